@@ -12,5 +12,6 @@ set(EXAMPLES_SOURCES ${EXAMPLES_SOURCES}
     ${PROJECT_SOURCE_DIR}/examples/policer.c
     ${PROJECT_SOURCE_DIR}/examples/firewall.c
     ${PROJECT_SOURCE_DIR}/examples/nat.c
+    ${PROJECT_SOURCE_DIR}/examples/nat_port_partition.c
     ${PROJECT_SOURCE_DIR}/examples/no_constraints.c
 )
@@ -0,0 +1,95 @@
+#include <r3s.h>
+
+/*
+ * Key for the WAN device of a shared-nothing NAT (vigor/vignat built with
+ * VIGOR_MULTICORE): the hash of a reply packet must only depend on its
+ * destination port, i.e. the external port the NAT allocated, so that each
+ * core can pick external ports that RSS will bring back to it.
+ */
+
+Z3_ast mk_p_cnstrs(R3S_cfg_t cfg, R3S_packet_ast_t p1, R3S_packet_ast_t p2)
+{
+    R3S_status_t status;
+    R3S_pf_t     pf;
+    Z3_ast       p1_l4_dst;
+    Z3_ast       p2_l4_dst;
+
+    if (p1.loaded_opt.opt != p2.loaded_opt.opt)
+        return NULL;
+
+    if (p1.loaded_opt.opt == R3S_OPT_NON_FRAG_IPV4_TCP)
+        pf = R3S_PF_TCP_DST;
+    else if (p1.loaded_opt.opt == R3S_OPT_NON_FRAG_IPV4_UDP)
+        pf = R3S_PF_UDP_DST;
+    else
+        return NULL;
+
+    status = R3S_packet_extract_pf(cfg, p1, pf, &p1_l4_dst);
+    if (status != R3S_STATUS_SUCCESS) return NULL;
+
+    status = R3S_packet_extract_pf(cfg, p2, pf, &p2_l4_dst);
+    if (status != R3S_STATUS_SUCCESS) return NULL;
+
+    return Z3_mk_eq(cfg->ctx, p1_l4_dst, p2_l4_dst);
+}
+
+int validate(R3S_cfg_t cfg, R3S_key_t k)
+{
+    R3S_packet_t       p1, p2;
+    R3S_key_hash_out_t o1, o2;
+
+    for (int i = 0; i < 25; i++)
+    {
+        R3S_packet_rand(cfg, &p1);
+        R3S_packet_rand(cfg, &p2);
+
+        // Same protocol and destination port, everything else random
+        p2.cfg = p1.cfg;
+        p2.tcp.dst[0] = p1.tcp.dst[0];
+        p2.tcp.dst[1] = p1.tcp.dst[1];
+
+        R3S_key_hash(cfg, k, p1, &o1);
+        R3S_key_hash(cfg, k, p2, &o2);
+
+        if (o1 != o2)
+        {
+            printf("%s\n", R3S_packet_to_string(p1));
+            printf("%s\n", R3S_packet_to_string(p2));
+            printf("Failed! %u != %u. Exiting.\n", o1, o2);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main () {
+    R3S_cfg_t       cfg;
+    R3S_key_t       k;
+    R3S_status_t    status;
+
+    R3S_cfg_init(&cfg);
+    R3S_cfg_set_number_of_keys(cfg, 1);
+    R3S_cfg_set_skew_analysis(cfg, true);
+    R3S_cfg_load_opt(cfg, R3S_OPT_NON_FRAG_IPV4_TCP);
+    R3S_cfg_load_opt(cfg, R3S_OPT_NON_FRAG_IPV4_UDP);
+
+    printf("\nConfiguration:\n%s\n", R3S_cfg_to_string(cfg));
+
+    status = R3S_keys_fit_cnstrs(cfg, &mk_p_cnstrs, &k);
+
+    if (status != R3S_STATUS_SUCCESS) {
+        printf("Status: %s\n", R3S_status_to_string(status));
+        R3S_cfg_delete(cfg);
+        return 1;
+    }
+
+    printf("WAN key:\n%s\n", R3S_key_to_string(k));
+
+    if (!validate(cfg, k)) {
+        R3S_cfg_delete(cfg);
+        return 1;
+    }
+
+    R3S_cfg_delete(cfg);
+}
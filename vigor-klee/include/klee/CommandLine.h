@@ -19,6 +19,19 @@ extern llvm::cl::opt<bool> UseCexCache;
 
 extern llvm::cl::opt<bool> UseCache;
 
+extern llvm::cl::opt<std::string> PersistentQueryCache;
+
+extern llvm::cl::opt<unsigned> PersistentQueryCacheSize;
+
+extern llvm::cl::opt<std::string> SolverProfile;
+
+enum SolverProfileFormat {
+  SOLVER_PROFILE_JSON,  ///< One JSON record per stack of sites and layers
+  SOLVER_PROFILE_FOLDED ///< Folded stacks, for flamegraph.pl
+};
+
+extern llvm::cl::opt<SolverProfileFormat> SolverProfileFormatToUse;
+
 extern llvm::cl::opt<bool> UseIndependentSolver; 
 
 extern llvm::cl::opt<bool> DebugValidateSolver;
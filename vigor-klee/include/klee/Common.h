@@ -27,6 +27,16 @@ namespace klee {
                                  std::string baseSolverQuerySMT2LogPath,
                                  std::string queryKQueryLogPath,
                                  std::string baseSolverQueryKQueryLogPath);
+
+    /// The chain the tools going through call paths share: the core solver
+    /// behind the counterexample cache, the persistent cache if enabled, the
+    /// validity cache and the independent solver.
+    Solver *constructToolSolverChain(CoreSolverType coreSolverType);
+
+    /// Wrap a layer of a solver chain in a profiling solver named after it
+    /// when -solver-profile is given, writing the profile at exit. Returns the
+    /// solver itself otherwise.
+    Solver *profileSolverLayer(Solver *solver, const std::string &layer);
 }
 
 
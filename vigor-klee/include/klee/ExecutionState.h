@@ -14,6 +14,7 @@
 #include "klee/Expr.h"
 #include "klee/Internal/ADT/TreeStream.h"
 #include "klee/MergeHandler.h"
+#include "klee/Internal/ADT/ImmutableMap.h"
 #include "klee/Internal/ADT/ImmutableSet.h"
 #include "klee/util/GetExprSymbols.h"
 #include "klee/LoopAnalysis.h"
@@ -26,6 +27,7 @@
 #include <llvm/Analysis/LoopInfo.h>
 
 #include <map>
+#include <memory>
 #include <regex>
 #include <set>
 #include <vector>
@@ -149,13 +151,57 @@ struct CallInfo {
   SymbolSet computeRetSymbolSet() const;
 };
 
+/// @brief The calls made by a state. Forked states share the calls made
+/// before the fork, only the last one can still be updated, and it is
+/// copied the first time a state updates it after a fork.
+class CallPath {
+  std::vector<std::shared_ptr<CallInfo> > calls;
+
+public:
+  class const_iterator {
+    std::vector<std::shared_ptr<CallInfo> >::const_iterator it;
+
+  public:
+    const_iterator(std::vector<std::shared_ptr<CallInfo> >::const_iterator _it)
+      : it(_it) {}
+
+    const CallInfo &operator*() const { return **it; }
+    const CallInfo *operator->() const { return it->get(); }
+    const_iterator &operator++() { ++it; return *this; }
+    bool operator==(const const_iterator &b) const { return it == b.it; }
+    bool operator!=(const const_iterator &b) const { return it != b.it; }
+  };
+
+  const_iterator begin() const { return calls.begin(); }
+  const_iterator end() const { return calls.end(); }
+  bool empty() const { return calls.empty(); }
+  size_t size() const { return calls.size(); }
+
+  void push_back(const CallInfo &call) {
+    calls.push_back(std::make_shared<CallInfo>(call));
+  }
+
+  const CallInfo &back() const { return *calls.back(); }
+  CallInfo &back() {
+    if (calls.back().use_count() > 1)
+      calls.back() = std::make_shared<CallInfo>(*calls.back());
+    return *calls.back();
+  }
+};
+
 struct HavocInfo {
+  MemoryObjectHolder object;
   std::string name;
   bool havoced;
   BitArray mask;
   const Array* value;
 };
 
+struct NoHavocInfo {
+  MemoryObjectHolder object;
+  std::string name;
+};
+
 class ExecutionState;
 
 /// @brief LoopInProcess keeps all the necessary information for
@@ -259,6 +305,12 @@ public:
   /// @brief Exploration depth, i.e., number of times KLEE branched for this state
   unsigned depth;
 
+  /// @brief Which side of each fork led to this state, outside of loop
+  /// invariant search, including forks skipped by picking one side.
+  /// Replaying them reaches this state again. Only recorded by parallel
+  /// workers, which may donate the state.
+  std::vector<unsigned> forkDecisions;
+
   /// @brief History of complete path: represents branches taken to
   /// reach/create this state (both concrete and symbolic)
   TreeOStream pathOS;
@@ -290,23 +342,24 @@ public:
 
   /// @brief The list of possibly havoced memory locations with their names
   ///  and values placed at the last havoc event.
-  std::map<const MemoryObject *, HavocInfo> havocs;
+  ///  Persistent, so forked states share it until one of them changes it.
+  ImmutableMap<const MemoryObject *, HavocInfo> havocs;
 
   /// @brief The list of never havoced memory locations with their names.
-  std::map<const MemoryObject *, std::string> noHavocs;
+  ImmutableMap<const MemoryObject *, NoHavocInfo> noHavocs;
 
   /// @brief The list of registered havoc mem location names, used to guarantee
   ///  uniqueness of each name.
-  std::set<std::string> havocNames;
+  ImmutableSet<std::string> havocNames;
 
   /// @brief The list of registered never-havoc mem location names, used to guarantee
   ///  uniqueness of each name.
-  std::set<std::string> noHavocNames;
+  ImmutableSet<std::string> noHavocNames;
 
   /// @brief Set of used array names for this state.  Used to avoid collisions.
   std::set<std::string> arrayNames;
 
-  std::vector<CallInfo> callPath;
+  CallPath callPath;
   SymbolSet relevantSymbols;
 
   /// @brief: a flag indicating that the state is genuine and not
@@ -47,6 +47,14 @@ public:
                                const char *err, 
                                const char *suffix) = 0;
   virtual void processCallPath(const ExecutionState &state) = 0;
+
+  // parallel exploration: whether another worker would take a pending
+  // state, and hands it one given the fork decisions leading to it. the
+  // state is dropped here only if the worker took it.
+  virtual bool wantsState() { return false; }
+  virtual bool donateState(const std::vector<unsigned> &forkDecisions) {
+    return false;
+  }
 };
 
 struct HavocedLocation {
@@ -137,6 +145,11 @@ public:
   // a user specified path. use null to reset.
   virtual void setReplayPath(const std::vector<bool> *path) = 0;
 
+  // supply the fork decisions of a state donated by another worker, see
+  // InterpreterHandler::donateState. they drive the interpretation down to
+  // that state, which is then explored as usual. use null to reset.
+  virtual void setReplayForkDecisions(const std::vector<unsigned> *decisions) = 0;
+
   // supply a set of symbolic bindings that will be used as "seeds"
   // for the search. use null to reset.
   virtual void useSeeds(const std::vector<struct KTest *> *seeds) = 0;
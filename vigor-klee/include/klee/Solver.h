@@ -226,6 +226,27 @@ namespace klee {
   /// \param s - The underlying solver to use.
   Solver *createCachingSolver(Solver *s);
 
+  /// createPersistentCachingSolver - Create a solver which will cache the
+  /// queries in a file mapped to memory, shared by every process using it and
+  /// kept across runs. The least recently used queries are evicted to keep
+  /// the file under the given size.
+  ///
+  /// \param s - The underlying solver to use.
+  /// \param path - The file holding the cache, created if missing.
+  /// \param maxSize - The size in bytes of a newly created cache.
+  Solver *createPersistentCachingSolver(Solver *s, const std::string &path,
+                                        uint64_t maxSize);
+
+  /// createProfilingSolver - Create a solver which will forward all queries
+  /// after recording their kind, size and latency under the active
+  /// SolverProfileSite stack and the given layer name (see SolverProfile.h).
+  /// Stacking profiling solvers around the layers of a chain also records how
+  /// many queries each layer answered without reaching the next one.
+  ///
+  /// \param s - The underlying solver to use.
+  /// \param layer - Name of the underlying solver in the profile.
+  Solver *createProfilingSolver(Solver *s, const std::string &layer);
+
   /// createCexCachingSolver - Create a counterexample caching solver. This is a
   /// more sophisticated cache which records counterexamples for a constraint
   /// set and uses subset/superset relations among constraints to try and
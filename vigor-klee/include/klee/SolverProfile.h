@@ -0,0 +1,47 @@
+//===-- SolverProfile.h -----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_SOLVERPROFILE_H
+#define KLEE_SOLVERPROFILE_H
+
+namespace llvm {
+  class raw_ostream;
+}
+
+namespace klee {
+
+  /// SolverProfileSite - Names the code asking the queries that reach the
+  /// profiling solvers (see createProfilingSolver) for as long as it is
+  /// alive. Sites nest, so a query is attributed to the whole stack of
+  /// sites, followed by the profiled solver layers it went through.
+  ///
+  /// The name is not copied, it must outlive the profile (a string literal,
+  /// __func__ or the like).
+  class SolverProfileSite {
+    // DO NOT IMPLEMENT.
+    SolverProfileSite(const SolverProfileSite&);
+    void operator=(const SolverProfileSite&);
+
+  public:
+    explicit SolverProfileSite(const char *name);
+    ~SolverProfileSite();
+  };
+
+  /// writeSolverProfileJSON - Write one record per stack of sites and
+  /// profiled layers: query counts, how many were forwarded to the next
+  /// profiled layer (cache misses), latencies and query sizes.
+  void writeSolverProfileJSON(llvm::raw_ostream &os);
+
+  /// writeSolverProfileFolded - Write the time spent in each profiled layer,
+  /// excluding the layers below it, as folded stacks ("site;layer usecs")
+  /// for flamegraph.pl and compatible viewers.
+  void writeSolverProfileFolded(llvm::raw_ostream &os);
+}
+
+#endif
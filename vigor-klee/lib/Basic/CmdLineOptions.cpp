@@ -38,6 +38,41 @@ UseCache("use-cache",
          cl::init(true),
          cl::desc("Use validity caching (default=on)"));
 
+cl::opt<std::string>
+PersistentQueryCache("persistent-query-cache",
+                     cl::init(""),
+                     cl::value_desc("file"),
+                     cl::desc("Cache validity results in the given file, "
+                              "shared between processes and kept across runs "
+                              "(default=off)"));
+
+cl::opt<unsigned>
+PersistentQueryCacheSize("persistent-query-cache-size",
+                         cl::init(256),
+                         cl::value_desc("MiB"),
+                         cl::desc("Size of a newly created persistent query "
+                                  "cache, the least recently used queries are "
+                                  "evicted past it (default=256)"));
+
+cl::opt<std::string>
+SolverProfile("solver-profile",
+              cl::init(""),
+              cl::value_desc("file"),
+              cl::desc("Write where solver time goes at exit, per solver "
+                       "layer and per call site (default=off)"));
+
+cl::opt<SolverProfileFormat>
+SolverProfileFormatToUse("solver-profile-format",
+                         cl::desc("Format of the solver profile"),
+                         cl::values(clEnumValN(SOLVER_PROFILE_JSON, "json",
+                                               "Statistics per stack of call "
+                                               "sites and layers (default)"),
+                                    clEnumValN(SOLVER_PROFILE_FOLDED, "folded",
+                                               "Folded stacks for "
+                                               "flamegraph.pl")
+                                    KLEE_LLVM_CL_VAL_END),
+                         cl::init(SOLVER_PROFILE_JSON));
+
 cl::opt<bool>
 UseIndependentSolver("use-independent-solver",
                      cl::init(true),
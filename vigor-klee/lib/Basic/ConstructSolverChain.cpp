@@ -12,16 +12,52 @@
  */
 #include "klee/Common.h"
 #include "klee/CommandLine.h"
+#include "klee/SolverProfile.h"
 #include "klee/Internal/Support/ErrorHandling.h"
+#include "klee/Internal/Support/FileHandling.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <cstdlib>
+
 namespace klee {
+static void writeSolverProfile() {
+  std::string path = SolverProfile;
+  std::string error;
+  llvm::raw_fd_ostream *os = klee_open_output_file(path, error);
+  if (!os) {
+    klee_warning("Unable to write the solver profile to %s: %s", path.c_str(),
+                 error.c_str());
+    return;
+  }
+
+  if (SolverProfileFormatToUse == SOLVER_PROFILE_FOLDED)
+    writeSolverProfileFolded(*os);
+  else
+    writeSolverProfileJSON(*os);
+
+  delete os;
+}
+
+Solver *profileSolverLayer(Solver *solver, const std::string &layer) {
+  static bool writeAtExit = false;
+
+  if (SolverProfile.empty())
+    return solver;
+
+  if (!writeAtExit) {
+    std::atexit(writeSolverProfile);
+    writeAtExit = true;
+  }
+
+  return createProfilingSolver(solver, layer);
+}
+
 Solver *constructSolverChain(Solver *coreSolver,
                              std::string querySMT2LogPath,
                              std::string baseSolverQuerySMT2LogPath,
                              std::string queryKQueryLogPath,
                              std::string baseSolverQueryKQueryLogPath) {
-  Solver *solver = coreSolver;
+  Solver *solver = profileSolverLayer(coreSolver, "core");
 
   if (queryLoggingOptions.isSet(SOLVER_KQUERY)) {
     solver = createKQueryLoggingSolver(solver, baseSolverQueryKQueryLogPath,
@@ -44,13 +80,19 @@ Solver *constructSolverChain(Solver *coreSolver,
     solver = createFastCexSolver(solver);
 
   if (UseCexCache)
-    solver = createCexCachingSolver(solver);
+    solver = profileSolverLayer(createCexCachingSolver(solver), "cex-cache");
+
+  if (!PersistentQueryCache.empty())
+    solver = profileSolverLayer(
+        createPersistentCachingSolver(solver, PersistentQueryCache,
+                                      (uint64_t)PersistentQueryCacheSize << 20),
+        "persistent-cache");
 
   if (UseCache)
-    solver = createCachingSolver(solver);
+    solver = profileSolverLayer(createCachingSolver(solver), "cache");
 
   if (UseIndependentSolver)
-    solver = createIndependentSolver(solver);
+    solver = profileSolverLayer(createIndependentSolver(solver), "independent");
 
   if (DebugValidateSolver)
     solver = createValidatingSolver(solver, coreSolver);
@@ -75,4 +117,24 @@ Solver *constructSolverChain(Solver *coreSolver,
 
   return solver;
 }
+
+Solver *constructToolSolverChain(CoreSolverType coreSolverType) {
+  Solver *solver = createCoreSolver(coreSolverType);
+  if (!solver)
+    klee_error("Unable to create the core solver");
+
+  solver = profileSolverLayer(solver, "core");
+  solver = profileSolverLayer(createCexCachingSolver(solver), "cex-cache");
+
+  if (!PersistentQueryCache.empty())
+    solver = profileSolverLayer(
+        createPersistentCachingSolver(solver, PersistentQueryCache,
+                                      (uint64_t)PersistentQueryCacheSize << 20),
+        "persistent-cache");
+
+  solver = profileSolverLayer(createCachingSolver(solver), "cache");
+  solver = profileSolverLayer(createIndependentSolver(solver), "independent");
+
+  return solver;
+}
 }
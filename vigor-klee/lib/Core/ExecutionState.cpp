@@ -113,20 +113,6 @@ ExecutionState::~ExecutionState() {
       delete mo;
   }
 
-  for(auto it = havocs.begin(); it != havocs.end(); ++it) {
-    const MemoryObject *mo = it->first;
-    assert(mo->refCount > 0);
-    mo->refCount--;
-    if (mo->refCount == 0)
-      delete mo;
-  }
-  for(auto it = noHavocs.begin(); it != noHavocs.end(); ++it) {
-    const MemoryObject *mo = it->first;
-    assert(mo->refCount > 0);
-    mo->refCount--;
-    if (mo->refCount == 0)
-      delete mo;
-  }
   delete executionStateForLoopInProcess;
 
   for (auto cur_mergehandler: openMergeStack){
@@ -156,6 +142,7 @@ ExecutionState::ExecutionState(const ExecutionState& state):
     queryCost(state.queryCost),
     weight(state.weight),
     depth(state.depth),
+    forkDecisions(state.forkDecisions),
 
     pathOS(state.pathOS),
     symPathOS(state.symPathOS),
@@ -183,12 +170,6 @@ ExecutionState::ExecutionState(const ExecutionState& state):
 
   for (auto cur_mergehandler: openMergeStack)
     cur_mergehandler->addOpenState(this);
-  for(auto it = havocs.begin(); it != havocs.end(); ++it) {
-    it->first->refCount++;
-  }
-  for(auto it = noHavocs.begin(); it != noHavocs.end(); ++it) {
-    it->first->refCount++;
-  }
   LOG_LA("Cloning ES " << (void*)this << " from " << (void*)&state);
 }
 
@@ -198,16 +179,20 @@ void ExecutionState::addHavocInfo(const MemoryObject *mo,
     klee_error("You must call klee_possibly_havoc(%s) outside of a "
                "loop subject to invariant analysis.", name.c_str());
   }
-  havocs[mo].name = name;
-  havocs[mo].havoced = false;
-  havocs[mo].mask = BitArray();
-  mo->refCount++;
+  HavocInfo info;
+  info.object = mo;
+  info.name = name;
+  info.havoced = false;
+  info.value = 0;
+  havocs = havocs.replace(std::make_pair(mo, info));
 }
 
 void ExecutionState::addNoHavocInfo(const MemoryObject *mo,
                                     const std::string &name) {
-  noHavocs[mo] = name;
-  mo->refCount++;
+  NoHavocInfo info;
+  info.object = mo;
+  info.name = name;
+  noHavocs = noHavocs.replace(std::make_pair(mo, info));
 }
 
 ExecutionState *ExecutionState::branch() {
@@ -1707,19 +1692,21 @@ ExecutionState *LoopInProcess::makeRestartState() {
     }
 
     //printf("looking for %p\n", mo);
-    auto havoc_info = newState->havocs.find(mo);
-    if (havoc_info == newState->havocs.end() &&
+    auto havoc_info = newState->havocs.lookup(mo);
+    if (!havoc_info &&
         !restartState->condoneUndeclaredHavocs) {
       printf("Unexpected memory location being havoced.\n");
       assert(0 && "Possible havoc location must have been predelcared");
     }
 
-    if (havoc_info != newState->havocs.end()) {
+    if (havoc_info) {
       // Remember the generated value for later reporting in the ktest file.
-      havoc_info->second.value = array;
-      havoc_info->second.havoced = true;
-      havoc_info->second.mask = BitArray(*bytes, bytes->size());
-      LOG_LA("Adding havoc here: " << havoc_info->second.name << " in: " << (void*)newState);
+      HavocInfo info = havoc_info->second;
+      info.value = array;
+      info.havoced = true;
+      info.mask = BitArray(*bytes, bytes->size());
+      LOG_LA("Adding havoc here: " << info.name << " in: " << (void*)newState);
+      newState->havocs = newState->havocs.replace(std::make_pair(mo, info));
     }
 
     // Do not record this symbol, as it was not generated with klee_make_symbolic.
@@ -1905,7 +1892,7 @@ bool klee::updateDiffMask(StateByteMask* mask,
                        "  local: %s\n  global: %s\n"
                        "  fixed: %s\n  size: %u\n"
                        "  address: 0x%lx\n  metadata: %s",
-                       (*state.noHavocs.find(obj)).second.c_str(),
+                       state.noHavocs.lookup(obj)->second.name.c_str(),
                        obj->name.c_str(),
                        obj->allocSite->getName().str().c_str(),
                        obj->isLocal ? "true" : "false",
@@ -295,7 +295,8 @@ namespace {
   
   cl::opt<unsigned>
   MaxForks("max-forks",
-           cl::desc("Only fork this many times (default=-1 (off))"),
+           cl::desc("Only fork this many times, per worker with "
+                    "-parallel-workers (default=-1 (off))"),
            cl::init(~0u));
   
   cl::opt<unsigned>
@@ -341,7 +342,8 @@ Executor::Executor(LLVMContext &ctx, const InterpreterOptions &opts,
     : Interpreter(opts), kmodule(0), interpreterHandler(ih), searcher(0),
       externalDispatcher(new ExternalDispatcher(ctx)), statsTracker(0),
       pathWriter(0), symPathWriter(0), specialFunctionHandler(0),
-      processTree(0), replayKTest(0), replayPath(0), usingSeeds(0),
+      processTree(0), replayKTest(0), replayPath(0), replayForkDecisions(0),
+      replayForkPosition(0), instructionsSinceDonation(0), usingSeeds(0),
       atMemoryLimit(false), inhibitForking(false), haltExecution(false),
       ivcEnabled(false),
       coreSolverTimeout(MaxCoreSolverTime != 0 && MaxInstructionTime != 0
@@ -686,8 +688,21 @@ void Executor::branch(ExecutionState &state,
   unsigned N = conditions.size();
   assert(N);
 
-  if (MaxForks!=~0u && stats::forks >= MaxForks) {
+  if (isReplayingForks(state)) {
+    unsigned next = (*replayForkDecisions)[replayForkPosition++];
+    assert(next < N && "hit invalid branch in fork decisions replay");
+    state.forkDecisions.push_back(next);
+    for (unsigned i=0; i<N; ++i) {
+      if (i == next) {
+        result.push_back(&state);
+      } else {
+        result.push_back(NULL);
+      }
+    }
+  } else if (MaxForks!=~0u && stats::forks >= MaxForks) {
     unsigned next = theRNG.getInt32() % N;
+    if (isRecordingForks(state))
+      state.forkDecisions.push_back(next);
     for (unsigned i=0; i<N; ++i) {
       if (i == next) {
         result.push_back(&state);
@@ -711,6 +726,11 @@ void Executor::branch(ExecutionState &state,
       ns->ptreeNode = res.first;
       es->ptreeNode = res.second;
     }
+
+    if (isRecordingForks(state)) {
+      for (unsigned i=0; i<N; ++i)
+        result[i]->forkDecisions.push_back(i);
+    }
   }
 
   // If necessary redistribute seeds to match conditions, killing
@@ -812,7 +832,19 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
   }
 
   if (!isSeeding) {
-    if (replayPath && !isInternal) {
+    if (res==Solver::Unknown && isReplayingForks(current)) {
+      unsigned branch = (*replayForkDecisions)[replayForkPosition++];
+      assert(branch <= 1 && "hit invalid branch in fork decisions replay");
+      current.forkDecisions.push_back(branch);
+
+      if (branch) {
+        res = Solver::True;
+        addConstraint(current, condition);
+      } else {
+        res = Solver::False;
+        addConstraint(current, Expr::createIsZero(condition));
+      }
+    } else if (replayPath && !isInternal) {
       assert(replayPosition<replayPath->size() &&
              "ran out of branches in replay path mode");
       bool branch = (*replayPath)[replayPosition++];
@@ -856,6 +888,9 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
           addConstraint(current, Expr::createIsZero(condition));
           res = Solver::False;
         }
+        // The side picked has to be replayed like a fork
+        if (isRecordingForks(current))
+          current.forkDecisions.push_back(res == Solver::True);
       }
     }
   }
@@ -923,6 +958,11 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
     falseState = trueState->branch();
     addedStates.push_back(falseState);
 
+    if (isRecordingForks(*trueState)) {
+      trueState->forkDecisions.push_back(1);
+      falseState->forkDecisions.push_back(0);
+    }
+
     if (it != seedMap.end()) {
       std::vector<SeedInfo> seeds = it->second;
       it->second.clear();
@@ -994,6 +1034,39 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
   }
 }
 
+bool Executor::isReplayingForks(const ExecutionState &state) const {
+  return replayForkDecisions &&
+         replayForkPosition < replayForkDecisions->size() &&
+         state.loopInProcess.isNull();
+}
+
+bool Executor::isRecordingForks(const ExecutionState &state) const {
+  return replayForkDecisions && state.loopInProcess.isNull();
+}
+
+void Executor::donateState() {
+  if (states.size() < 2)
+    return;
+
+  ExecutionState *donated = 0;
+  for (std::set<ExecutionState*>::iterator it = states.begin(),
+         ie = states.end(); it != ie; ++it) {
+    ExecutionState *es = *it;
+    if (!es->loopInProcess.isNull() || !es->doTrace ||
+        !es->openMergeStack.empty())
+      continue;
+    if (!donated || es->forkDecisions.size() < donated->forkDecisions.size())
+      donated = es;
+  }
+
+  if (!donated || !interpreterHandler->donateState(donated->forkDecisions))
+    return;
+
+  // Explored elsewhere, so nothing is output for it here.
+  removedStates.push_back(donated);
+  updateStates(0);
+}
+
 void Executor::addConstraint(ExecutionState &state, ref<Expr> condition) {
   if (ConstantExpr *CE = dyn_cast<ConstantExpr>(condition)) {
     if (!CE->isTrue())
@@ -2956,6 +3029,14 @@ void Executor::run(ExecutionState &initialState) {
     checkMemoryUsage();
 
     updateStates(&state);
+
+    // Looking for a state to donate scans them all, so only do it now and
+    // then, and only in a worker.
+    if (replayForkDecisions && ++instructionsSinceDonation >= 1024) {
+      instructionsSinceDonation = 0;
+      if (interpreterHandler->wantsState())
+        donateState();
+    }
   }
 
   delete searcher;
@@ -3851,9 +3932,10 @@ void Executor::executePossiblyHavoc(ExecutionState &state,
 
   unsigned id = 0;
   std::string uniqueName = name;
-  while (!state.havocNames.insert(uniqueName).second) {
+  while (state.havocNames.count(uniqueName)) {
     uniqueName = name + "_" + llvm::utostr(++id);
   }
+  state.havocNames = state.havocNames.insert(uniqueName);
 
   state.addHavocInfo(mo, uniqueName);
 }
@@ -3870,9 +3952,10 @@ void Executor::executeNeverHavoc(ExecutionState &state,
 
   unsigned id = 0;
   std::string uniqueName = name;
-  while (!state.noHavocNames.insert(uniqueName).second) {
+  while (state.noHavocNames.count(uniqueName)) {
     uniqueName = name + "_" + llvm::utostr(++id);
   }
+  state.noHavocNames = state.noHavocNames.insert(uniqueName);
 
   state.addNoHavocInfo(mo, uniqueName);
 }
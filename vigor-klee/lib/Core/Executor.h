@@ -192,6 +192,14 @@ private:
   /// object.
   unsigned replayPosition;
 
+  /// When non-null the fork decisions of a state donated by another
+  /// worker, taken until that state is reached.
+  const std::vector<unsigned> *replayForkDecisions;
+  /// The index into \ref replayForkDecisions.
+  unsigned replayForkPosition;
+  /// Instructions run since the last look for a state to donate.
+  unsigned instructionsSinceDonation;
+
   /// When non-null a list of "seed" inputs which will be used to
   /// drive execution.
   const std::vector<struct KTest *> *usingSeeds;  
@@ -347,6 +355,19 @@ private:
   // current state, and one of the states may be null.
   StatePair fork(ExecutionState &current, ref<Expr> condition, bool isInternal);
 
+  /// Whether the next fork of the state is taken from
+  /// \ref replayForkDecisions. States searching for loop invariants
+  /// neither record nor replay their forks, every worker runs the search.
+  bool isReplayingForks(const ExecutionState &state) const;
+
+  /// Whether the forks of the state are recorded, which is only needed to
+  /// donate it, so when running as a worker.
+  bool isRecordingForks(const ExecutionState &state) const;
+
+  /// Hand the pending state with the fewest fork decisions, the root of the
+  /// largest subtree as far as we know, to an idle worker.
+  void donateState();
+
   /// Add the given (boolean) condition as a constraint on state. This
   /// function is a wrapper around the state's addConstraint function
   /// which also manages propagation of implied values,
@@ -507,6 +528,13 @@ public:
     replayPosition = 0;
   }
 
+  virtual void setReplayForkDecisions(const std::vector<unsigned> *decisions) {
+    assert(!replayKTest && !replayPath &&
+           "cannot replay fork decisions along with a buffer or a path");
+    replayForkDecisions = decisions;
+    replayForkPosition = 0;
+  }
+
   virtual const llvm::Module *
   setModule(llvm::Module *module, const ModuleOptions &opts);
 
@@ -59,6 +59,25 @@ ObjectHolder &ObjectHolder::operator=(const ObjectHolder &b) {
   return *this;
 }
 
+MemoryObjectHolder::MemoryObjectHolder(const MemoryObject *_mo) : mo(_mo) {
+  if (mo) ++mo->refCount;
+}
+
+MemoryObjectHolder::MemoryObjectHolder(const MemoryObjectHolder &b) : mo(b.mo) {
+  if (mo) ++mo->refCount;
+}
+
+MemoryObjectHolder::~MemoryObjectHolder() {
+  if (mo && --mo->refCount == 0) delete mo;
+}
+
+MemoryObjectHolder &MemoryObjectHolder::operator=(const MemoryObjectHolder &b) {
+  if (b.mo) ++b.mo->refCount;
+  if (mo && --mo->refCount == 0) delete mo;
+  mo = b.mo;
+  return *this;
+}
+
 /***/
 
 int MemoryObject::counter = 0;
@@ -99,10 +118,10 @@ ObjectState::ObjectState(const MemoryObject *mo)
   : copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore(mo->size),
     concreteMask(0),
     flushMask(0),
-    knownSymbolics(0),
+    knownSymbolics(mo->size),
     updates(0, 0),
     size(mo->size),
     readOnly(false),
@@ -114,7 +133,6 @@ ObjectState::ObjectState(const MemoryObject *mo)
         getArrayCache()->CreateArray("tmp_arr" + llvm::utostr(++id), size);
     updates = UpdateList(array, 0);
   }
-  memset(concreteStore, 0, size);
 }
 
 
@@ -122,27 +140,26 @@ ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
   : copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore(mo->size),
     concreteMask(0),
     flushMask(0),
-    knownSymbolics(0),
+    knownSymbolics(mo->size),
     updates(array, 0),
     size(mo->size),
     readOnly(false),
     accessible(true) {
   mo->refCount++;
   makeSymbolic();
-  memset(concreteStore, 0, size);
 }
 
 ObjectState::ObjectState(const ObjectState &os) 
   : copyOnWriteOwner(0),
     refCount(0),
     object(os.object),
-    concreteStore(new uint8_t[os.size]),
+    concreteStore(os.concreteStore),
     concreteMask(os.concreteMask ? new BitArray(*os.concreteMask, os.size) : 0),
     flushMask(os.flushMask ? new BitArray(*os.flushMask, os.size) : 0),
-    knownSymbolics(0),
+    knownSymbolics(os.knownSymbolics),
     updates(os.updates),
     size(os.size),
     readOnly(false),
@@ -151,22 +168,12 @@ ObjectState::ObjectState(const ObjectState &os)
   assert(!os.readOnly && "no need to copy read only object?");
   if (object)
     object->refCount++;
-
-  if (os.knownSymbolics) {
-    knownSymbolics = new ref<Expr>[size];
-    for (unsigned i=0; i<size; i++)
-      knownSymbolics[i] = os.knownSymbolics[i];
-  }
-
-  memcpy(concreteStore, os.concreteStore, size*sizeof(*concreteStore));
 }
 
 ObjectState::~ObjectState() {
   assert(refCount == 0);
   if (concreteMask) delete concreteMask;
   if (flushMask) delete flushMask;
-  if (knownSymbolics) delete[] knownSymbolics;
-  delete[] concreteStore;
 
   if (object)
   {
@@ -248,7 +255,7 @@ void ObjectState::flushToConcreteStore(TimingSolver *solver,
                      "byte %p+%u will have random value",
                      (void *)object->address, i);
       else
-        ce->toMemory(concreteStore + i);
+        concreteStore.set(i, ce->getZExtValue(8));
     }
   }
 }
@@ -256,10 +263,9 @@ void ObjectState::flushToConcreteStore(TimingSolver *solver,
 void ObjectState::makeConcrete() {
   if (concreteMask) delete concreteMask;
   if (flushMask) delete flushMask;
-  if (knownSymbolics) delete[] knownSymbolics;
   concreteMask = 0;
   flushMask = 0;
-  knownSymbolics = 0;
+  knownSymbolics.clear();
 }
 
 void ObjectState::makeSymbolic() {
@@ -346,7 +352,7 @@ void ObjectState::forbidAccessWithLastMessage() {
 void ObjectState::initializeToZero() {
   assert(accessible);
   makeConcrete();
-  memset(concreteStore, 0, size);
+  concreteStore.clear();
 }
 
 void ObjectState::initializeToRandom() {  
@@ -354,7 +360,7 @@ void ObjectState::initializeToRandom() {
   makeConcrete();
   for (unsigned i=0; i<size; i++) {
     // randomly selected by 256 sided die
-    concreteStore[i] = 0xAB;
+    concreteStore.set(i, 0xAB);
   }
 }
 
@@ -432,7 +438,7 @@ bool ObjectState::isByteFlushed(unsigned offset) const {
 }
 
 bool ObjectState::isByteKnownSymbolic(unsigned offset) const {
-  return knownSymbolics && knownSymbolics[offset].get();
+  return knownSymbolics[offset].get();
 }
 
 void ObjectState::markByteConcrete(unsigned offset) {
@@ -461,14 +467,10 @@ void ObjectState::markByteFlushed(unsigned offset) {
 
 void ObjectState::setKnownSymbolic(unsigned offset, 
                                    Expr *value /* can be null */) {
-  if (knownSymbolics) {
-    knownSymbolics[offset] = value;
-  } else {
-    if (value) {
-      knownSymbolics = new ref<Expr>[size];
-      knownSymbolics[offset] = value;
-    }
-  }
+  // Clearing a byte of a page that was never written would copy it for
+  // nothing.
+  if (value || knownSymbolics.isMaterialized(offset))
+    knownSymbolics.set(offset, value);
 }
 
 /***/
@@ -508,7 +510,7 @@ ref<Expr> ObjectState::read8(ref<Expr> offset) const {
 void ObjectState::write8(unsigned offset, uint8_t value) {
   assert(accessible);
   //assert(read_only == false && "writing to read-only object!");
-  concreteStore[offset] = value;
+  concreteStore.set(offset, value);
   setKnownSymbolic(offset, 0);
 
   markByteConcrete(offset);
@@ -16,6 +16,7 @@
 
 #include "llvm/ADT/StringExtras.h"
 
+#include <algorithm>
 #include <vector>
 #include <string>
 
@@ -34,6 +35,7 @@ class MemoryObject {
   friend class STPBuilder;
   friend class ObjectState;
   friend class ExecutionState;
+  friend class MemoryObjectHolder;
 
 private:
   static int counter;
@@ -144,6 +146,128 @@ public:
   }
 };
 
+/// Fixed size array split in reference counted pages. Copies share every
+/// page until one of them writes to it, so forking a state only copies the
+/// pages of its objects that are written afterwards. Pages that were never
+/// written read as T(). The last page only holds the elements left, so
+/// arrays smaller than a page take no more than their size.
+template <typename T> class PagedArray {
+  static const unsigned PageSize = 4096;
+
+  struct Page {
+    unsigned refCount;
+    unsigned length;
+    T *data;
+
+    explicit Page(unsigned _length)
+      : refCount(1), length(_length), data(new T[_length]()) {}
+    Page(const Page &b) : refCount(1), length(b.length), data(new T[b.length]) {
+      for (unsigned i = 0; i < length; i++)
+        data[i] = b.data[i];
+    }
+    ~Page() { delete[] data; }
+
+  private:
+    // DO NOT IMPLEMENT
+    Page &operator=(const Page &b);
+  };
+
+  unsigned size;
+  std::vector<Page *> pages;
+
+  static const T &defaultValue() {
+    static const T value = T();
+    return value;
+  }
+
+  // Elements in the page starting at the given index.
+  unsigned getPageLength(unsigned start) const {
+    return size - start < PageSize ? size - start : PageSize;
+  }
+
+  static void release(Page *page) {
+    if (page && --page->refCount == 0)
+      delete page;
+  }
+
+  Page *getWritablePage(unsigned index) {
+    Page *&page = pages[index / PageSize];
+    if (!page) {
+      unsigned start = index / PageSize * PageSize;
+      page = new Page(getPageLength(start));
+    } else if (page->refCount > 1) {
+      --page->refCount;
+      page = new Page(*page);
+    }
+    return page;
+  }
+
+  // DO NOT IMPLEMENT
+  PagedArray &operator=(const PagedArray &b);
+
+public:
+  explicit PagedArray(unsigned _size)
+    : size(_size), pages((_size + PageSize - 1) / PageSize, 0) {}
+
+  PagedArray(const PagedArray &b) : size(b.size), pages(b.pages) {
+    for (unsigned i = 0; i < pages.size(); i++)
+      if (pages[i])
+        ++pages[i]->refCount;
+  }
+
+  ~PagedArray() { clear(); }
+
+  /// Drop every page, all the elements read as T() again.
+  void clear() {
+    for (unsigned i = 0; i < pages.size(); i++) {
+      release(pages[i]);
+      pages[i] = 0;
+    }
+  }
+
+  const T &operator[](unsigned index) const {
+    assert(index < size && "out of bounds paged array access");
+    const Page *page = pages[index / PageSize];
+    return page ? page->data[index % PageSize] : defaultValue();
+  }
+
+  void set(unsigned index, const T &value) {
+    assert(index < size && "out of bounds paged array access");
+    getWritablePage(index)->data[index % PageSize] = value;
+  }
+
+  /// Whether the page holding the element was ever written, if not there is
+  /// no need to write T() to it.
+  bool isMaterialized(unsigned index) const {
+    return pages[index / PageSize] != 0;
+  }
+
+  void copyTo(T *dst) const {
+    for (unsigned i = 0; i < size; i += PageSize) {
+      unsigned n = getPageLength(i);
+      const Page *page = pages[i / PageSize];
+      for (unsigned j = 0; j < n; j++)
+        dst[i + j] = page ? page->data[j] : defaultValue();
+    }
+  }
+
+  void copyFrom(const T *src) {
+    for (unsigned i = 0; i < size; i += PageSize) {
+      unsigned n = getPageLength(i);
+      Page *page = getWritablePage(i);
+      for (unsigned j = 0; j < n; j++)
+        page->data[j] = src[i + j];
+    }
+  }
+
+  bool equals(const T *src) const {
+    for (unsigned i = 0; i < size; i++)
+      if (!((*this)[i] == src[i]))
+        return false;
+    return true;
+  }
+};
+
 class ObjectState {
 private:
   friend class AddressSpace;
@@ -154,7 +278,8 @@ private:
 
   const MemoryObject *object;
 
-  uint8_t *concreteStore;
+  // mutable because flushing symbolic bytes to it is done on const objects
+  mutable PagedArray<uint8_t> concreteStore;
 
   // XXX cleanup name of flushMask (its backwards or something)
   BitArray *concreteMask;
@@ -162,7 +287,7 @@ private:
   // mutable because may need flushed during read of const
   mutable BitArray *flushMask;
 
-  ref<Expr> *knownSymbolics;
+  PagedArray<ref<Expr> > knownSymbolics;
 
   // mutable because we may need flush during read of const
   mutable UpdateList updates;
@@ -11,6 +11,7 @@
 #define KLEE_OBJECTHOLDER_H
 
 namespace klee {
+  class MemoryObject;
   class ObjectState;
 
   class ObjectHolder {
@@ -27,6 +28,22 @@ namespace klee {
     operator class ObjectState *() { return os; }
     operator class ObjectState *() const { return (ObjectState*) os; }
   };
+
+  /// Keeps a memory object alive, for bookkeeping shared between states
+  /// that may outlive the address spaces referring to it.
+  class MemoryObjectHolder {
+    const MemoryObject *mo;
+
+  public:
+    MemoryObjectHolder() : mo(0) {}
+    MemoryObjectHolder(const MemoryObject *_mo);
+    MemoryObjectHolder(const MemoryObjectHolder &b);
+    ~MemoryObjectHolder();
+
+    MemoryObjectHolder &operator=(const MemoryObjectHolder &b);
+
+    operator const MemoryObject *() const { return mo; }
+  };
 }
 
 #endif
@@ -0,0 +1,500 @@
+//===-- PersistentCachingSolver.cpp - On-disk validity cache --------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Caches validity results in a memory-mapped hash table, so they outlive the
+// process and are shared by every process mapping the same file: klee runs
+// over an NF and the tools that go through its call paths afterwards.
+//
+// Queries are keyed by a 128 bit hash of their KQuery text, which only
+// depends on the structure of the expressions and on the names and contents
+// of the arrays they read, never on addresses. Each slot is guarded by a
+// sequence number: it is odd while a writer fills the slot, and readers retry
+// a slot that changed under them. Writers take a slot by compare-and-swap
+// instead of a lock, so this also holds between processes that forked after
+// the table was mapped. Once the table is full, an insertion evicts the
+// least recently used slot among the ones its key may live in.
+//
+// A writer killed while filling a slot leaves it odd. Every process holds a
+// shared lock on the file while it maps it, so the first one to open the file
+// once nobody else does takes it exclusively and frees such slots.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/IncompleteSolver.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
+#include "klee/Internal/Support/ErrorHandling.h"
+#include "klee/util/ExprPPrinter.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+
+const char CacheMagic[8] = { 'K', 'L', 'E', 'E', 'Q', 'C', 'H', 'E' };
+const uint32_t CacheVersion = 1;
+
+// Slots a key may live in, starting from the one its hash points to.
+const uint64_t ProbeLength = 8;
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t entrySize;
+  uint64_t capacity;
+  uint64_t clock;
+};
+
+struct CacheEntry {
+  uint64_t seq;
+  uint64_t key[2];
+  uint64_t lastUse;
+  int64_t result;
+};
+
+struct CacheKey {
+  uint64_t key[2];
+};
+
+// FNV-1a, once over the text and once over it backwards with another basis.
+CacheKey hashQueryText(const std::string &text) {
+  const uint64_t prime = 1099511628211ULL;
+  CacheKey k;
+
+  k.key[0] = 14695981039346656037ULL;
+  for (std::string::const_iterator it = text.begin(), ie = text.end();
+       it != ie; ++it)
+    k.key[0] = (k.key[0] ^ (unsigned char)*it) * prime;
+
+  k.key[1] = 0x84222325cbf29ce4ULL ^ text.size();
+  for (std::string::const_reverse_iterator it = text.rbegin(),
+                                           ie = text.rend();
+       it != ie; ++it)
+    k.key[1] = (k.key[1] ^ (unsigned char)*it) * prime;
+
+  // An all zero key marks an empty slot.
+  k.key[0] |= 1;
+  return k;
+}
+
+class PersistentCachingSolver : public SolverImpl {
+private:
+  Solver *solver;
+  std::string path;
+
+  int fd;
+  CacheHeader *header;
+  CacheEntry *entries;
+  size_t mappedSize;
+
+  uint64_t hits;
+  uint64_t misses;
+
+  bool openCache(uint64_t maxSize);
+  void reclaimStaleSlots();
+
+  ref<Expr> canonicalizeQuery(ref<Expr> originalQuery, bool &negationUsed);
+  CacheKey getKey(const Query &query, bool &negationUsed);
+
+  bool cacheLookup(const Query &query,
+                   IncompleteSolver::PartialValidity &result);
+  void cacheInsert(const Query &query,
+                   IncompleteSolver::PartialValidity result);
+
+public:
+  PersistentCachingSolver(Solver *s, const std::string &_path,
+                          uint64_t maxSize)
+      : solver(s), path(_path), fd(-1), header(0), entries(0), mappedSize(0),
+        hits(0), misses(0) {
+    if (!openCache(maxSize))
+      klee_warning("Not using the persistent query cache at %s",
+                   path.c_str());
+  }
+  ~PersistentCachingSolver();
+
+  bool computeValidity(const Query &, Solver::Validity &result);
+  bool computeTruth(const Query &, bool &isValid);
+  bool computeValue(const Query &query, ref<Expr> &result) {
+    return solver->impl->computeValue(query, result);
+  }
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array *> &objects,
+                            std::vector<std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    return solver->impl->computeInitialValues(query, objects, values,
+                                              hasSolution);
+  }
+  SolverRunStatus getOperationStatusCode();
+  char *getConstraintLog(const Query &);
+  void setCoreSolverTimeout(double timeout);
+};
+
+bool PersistentCachingSolver::openCache(uint64_t maxSize) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    klee_warning("Unable to open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // Exclusive when nobody else has the table mapped, in which case it may be
+  // created or cleaned up, else shared until the table is unmapped.
+  bool exclusive = flock(fd, LOCK_EX | LOCK_NB) == 0;
+  if (!exclusive)
+    flock(fd, LOCK_SH);
+
+  uint64_t capacity = maxSize / sizeof(CacheEntry);
+  if (capacity < ProbeLength)
+    capacity = ProbeLength;
+
+  struct stat st;
+  fstat(fd, &st);
+
+  if (st.st_size == 0 && exclusive) {
+    CacheHeader fresh;
+    memcpy(fresh.magic, CacheMagic, sizeof(CacheMagic));
+    fresh.version = CacheVersion;
+    fresh.entrySize = sizeof(CacheEntry);
+    fresh.capacity = capacity;
+    fresh.clock = 0;
+
+    off_t size = sizeof(CacheHeader) + fresh.capacity * sizeof(CacheEntry);
+    if (ftruncate(fd, size) < 0 ||
+        pwrite(fd, &fresh, sizeof(fresh), 0) != sizeof(fresh)) {
+      klee_warning("Unable to create %s: %s", path.c_str(), strerror(errno));
+      close(fd);
+      fd = -1;
+      return false;
+    }
+
+    st.st_size = size;
+  }
+
+  CacheHeader existing;
+  if (pread(fd, &existing, sizeof(existing), 0) != sizeof(existing) ||
+      memcmp(existing.magic, CacheMagic, sizeof(CacheMagic)) ||
+      existing.version != CacheVersion ||
+      existing.entrySize != sizeof(CacheEntry) ||
+      (uint64_t)st.st_size !=
+          sizeof(CacheHeader) + existing.capacity * sizeof(CacheEntry)) {
+    klee_warning("%s is not a query cache", path.c_str());
+    close(fd);
+    fd = -1;
+    return false;
+  }
+
+  if (existing.capacity != capacity)
+    klee_message("Persistent query cache %s keeps its size of %llu entries",
+                 path.c_str(), (unsigned long long)existing.capacity);
+
+  void *mapped =
+      mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (mapped == MAP_FAILED) {
+    klee_warning("Unable to map %s: %s", path.c_str(), strerror(errno));
+    close(fd);
+    fd = -1;
+    return false;
+  }
+
+  mappedSize = st.st_size;
+  header = static_cast<CacheHeader *>(mapped);
+  entries = reinterpret_cast<CacheEntry *>(header + 1);
+
+  if (exclusive) {
+    reclaimStaleSlots();
+    flock(fd, LOCK_SH);
+  }
+
+  return true;
+}
+
+// Only called with the file locked exclusively, so no writer is running.
+void PersistentCachingSolver::reclaimStaleSlots() {
+  uint64_t reclaimed = 0;
+
+  for (uint64_t i = 0; i < header->capacity; i++) {
+    CacheEntry *entry = &entries[i];
+    if (!(entry->seq & 1))
+      continue;
+
+    entry->key[0] = 0;
+    entry->key[1] = 0;
+    entry->lastUse = 0;
+    entry->result = 0;
+    entry->seq++;
+    reclaimed++;
+  }
+
+  if (reclaimed)
+    klee_message("Persistent query cache %s: freed %llu slots left half "
+                 "written",
+                 path.c_str(), (unsigned long long)reclaimed);
+}
+
+PersistentCachingSolver::~PersistentCachingSolver() {
+  if (header) {
+    klee_message("Persistent query cache: %llu hits, %llu misses",
+                 (unsigned long long)hits, (unsigned long long)misses);
+    munmap(header, mappedSize);
+  }
+  if (fd >= 0)
+    close(fd);
+  delete solver;
+}
+
+/** @returns the canonical version of the given query, as picked by
+    CachingSolver. */
+ref<Expr> PersistentCachingSolver::canonicalizeQuery(ref<Expr> originalQuery,
+                                                     bool &negationUsed) {
+  ref<Expr> negatedQuery = Expr::createIsZero(originalQuery);
+
+  if (originalQuery.compare(negatedQuery) < 0) {
+    negationUsed = false;
+    return originalQuery;
+  } else {
+    negationUsed = true;
+    return negatedQuery;
+  }
+}
+
+CacheKey PersistentCachingSolver::getKey(const Query &query,
+                                         bool &negationUsed) {
+  ref<Expr> canonicalQuery = canonicalizeQuery(query.expr, negationUsed);
+
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  ExprPPrinter::printQuery(os, query.constraints, canonicalQuery);
+  os.flush();
+
+  return hashQueryText(text);
+}
+
+/** @returns true on a cache hit, false of a cache miss.  Reference
+    value result only valid on a cache hit. */
+bool PersistentCachingSolver::cacheLookup(
+    const Query &query, IncompleteSolver::PartialValidity &result) {
+  if (!header)
+    return false;
+
+  bool negationUsed;
+  CacheKey k = getKey(query, negationUsed);
+  uint64_t start = k.key[0] % header->capacity;
+
+  for (uint64_t i = 0; i < ProbeLength; i++) {
+    CacheEntry *entry = &entries[(start + i) % header->capacity];
+
+    uint64_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+
+    uint64_t key0 = __atomic_load_n(&entry->key[0], __ATOMIC_RELAXED);
+    uint64_t key1 = __atomic_load_n(&entry->key[1], __ATOMIC_RELAXED);
+    int64_t cached = __atomic_load_n(&entry->result, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+
+    if (key0 != k.key[0] || key1 != k.key[1])
+      continue;
+
+    __atomic_store_n(&entry->lastUse,
+                     __atomic_add_fetch(&header->clock, 1, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+
+    result = (IncompleteSolver::PartialValidity)cached;
+    if (negationUsed)
+      result = IncompleteSolver::negatePartialValidity(result);
+
+    ++hits;
+    return true;
+  }
+
+  ++misses;
+  return false;
+}
+
+/// Inserts the given query, result pair into the cache.
+void PersistentCachingSolver::cacheInsert(
+    const Query &query, IncompleteSolver::PartialValidity result) {
+  if (!header)
+    return;
+
+  bool negationUsed;
+  CacheKey k = getKey(query, negationUsed);
+  uint64_t start = k.key[0] % header->capacity;
+
+  if (negationUsed)
+    result = IncompleteSolver::negatePartialValidity(result);
+
+  // The slot already holding the key, else an empty one, else the least
+  // recently used.
+  CacheEntry *victim = 0;
+  for (uint64_t i = 0; i < ProbeLength; i++) {
+    CacheEntry *entry = &entries[(start + i) % header->capacity];
+
+    uint64_t key0 = __atomic_load_n(&entry->key[0], __ATOMIC_RELAXED);
+    uint64_t key1 = __atomic_load_n(&entry->key[1], __ATOMIC_RELAXED);
+
+    if ((key0 == k.key[0] && key1 == k.key[1]) || (!key0 && !key1)) {
+      victim = entry;
+      break;
+    }
+
+    if (!victim || __atomic_load_n(&entry->lastUse, __ATOMIC_RELAXED) <
+                       __atomic_load_n(&victim->lastUse, __ATOMIC_RELAXED))
+      victim = entry;
+  }
+
+  uint64_t seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+
+  // Someone else is writing the slot, this result is not worth waiting for.
+  if ((seq & 1) ||
+      !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+
+  __atomic_store_n(&victim->key[0], k.key[0], __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->key[1], k.key[1], __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->result, (int64_t)result, __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->lastUse,
+                   __atomic_add_fetch(&header->clock, 1, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+
+  __atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+bool PersistentCachingSolver::computeValidity(const Query &query,
+                                              Solver::Validity &result) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool tmp, cacheHit = cacheLookup(query, cachedResult);
+
+  if (cacheHit) {
+    switch (cachedResult) {
+    case IncompleteSolver::MustBeTrue:
+      result = Solver::True;
+      return true;
+    case IncompleteSolver::MustBeFalse:
+      result = Solver::False;
+      return true;
+    case IncompleteSolver::TrueOrFalse:
+      result = Solver::Unknown;
+      return true;
+    case IncompleteSolver::MayBeTrue: {
+      if (!solver->impl->computeTruth(query, tmp))
+        return false;
+      if (tmp) {
+        cacheInsert(query, IncompleteSolver::MustBeTrue);
+        result = Solver::True;
+        return true;
+      } else {
+        cacheInsert(query, IncompleteSolver::TrueOrFalse);
+        result = Solver::Unknown;
+        return true;
+      }
+    }
+    case IncompleteSolver::MayBeFalse: {
+      if (!solver->impl->computeTruth(query.negateExpr(), tmp))
+        return false;
+      if (tmp) {
+        cacheInsert(query, IncompleteSolver::MustBeFalse);
+        result = Solver::False;
+        return true;
+      } else {
+        cacheInsert(query, IncompleteSolver::TrueOrFalse);
+        result = Solver::Unknown;
+        return true;
+      }
+    }
+    default:
+      // Only a corrupted slot gets here, ask the solver again.
+      break;
+    }
+  }
+
+  if (!solver->impl->computeValidity(query, result))
+    return false;
+
+  switch (result) {
+  case Solver::True:
+    cachedResult = IncompleteSolver::MustBeTrue; break;
+  case Solver::False:
+    cachedResult = IncompleteSolver::MustBeFalse; break;
+  default:
+    cachedResult = IncompleteSolver::TrueOrFalse; break;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+bool PersistentCachingSolver::computeTruth(const Query &query,
+                                           bool &isValid) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool cacheHit = cacheLookup(query, cachedResult);
+
+  if (cacheHit && (cachedResult == IncompleteSolver::MustBeTrue ||
+                   cachedResult == IncompleteSolver::MustBeFalse ||
+                   cachedResult == IncompleteSolver::MayBeFalse ||
+                   cachedResult == IncompleteSolver::TrueOrFalse)) {
+    isValid = (cachedResult == IncompleteSolver::MustBeTrue);
+    return true;
+  }
+
+  if (!solver->impl->computeTruth(query, isValid))
+    return false;
+
+  if (isValid) {
+    cachedResult = IncompleteSolver::MustBeTrue;
+  } else if (cacheHit && cachedResult == IncompleteSolver::MayBeTrue) {
+    // We know a true assignment exists, and query isn't valid, so
+    // must be TrueOrFalse.
+    cachedResult = IncompleteSolver::TrueOrFalse;
+  } else {
+    cachedResult = IncompleteSolver::MayBeFalse;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+SolverImpl::SolverRunStatus PersistentCachingSolver::getOperationStatusCode() {
+  return solver->impl->getOperationStatusCode();
+}
+
+char *PersistentCachingSolver::getConstraintLog(const Query &query) {
+  return solver->impl->getConstraintLog(query);
+}
+
+void PersistentCachingSolver::setCoreSolverTimeout(double timeout) {
+  solver->impl->setCoreSolverTimeout(timeout);
+}
+
+} // namespace
+
+///
+
+Solver *klee::createPersistentCachingSolver(Solver *_solver,
+                                            const std::string &path,
+                                            uint64_t maxSize) {
+  return new Solver(new PersistentCachingSolver(_solver, path, maxSize));
+}
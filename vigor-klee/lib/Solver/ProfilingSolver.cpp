@@ -0,0 +1,357 @@
+//===-- ProfilingSolver.cpp - Per call site solver statistics -------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Records the queries going through a layer of the solver chain, keyed by
+// the stack of SolverProfileSites active when they were asked and by the
+// profiled layers they went through, outermost first. A query a profiled
+// layer answers without reaching the next profiled layer is a hit of the
+// layers in between, usually a cache.
+//
+// Time spent measuring the size of queries is left out of the latencies.
+// The profile is global and not thread safe, like the rest of the solver
+// chain.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+#include "klee/SolverProfile.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/SolverImpl.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+// Bucket i holds the queries that took less than 2^i microseconds, and more
+// than what the previous one holds.
+const unsigned LatencyBuckets = 32;
+
+enum QueryKind {
+  ValidityQuery,
+  TruthQuery,
+  ValueQuery,
+  InitialValuesQuery,
+  QueryKinds
+};
+
+const char *QueryKindNames[QueryKinds] = { "validity", "truth", "value",
+                                           "initial_values" };
+
+struct ProfileRecord {
+  uint64_t queries[QueryKinds];
+  uint64_t failures;
+  uint64_t forwarded;
+  uint64_t nanoseconds;
+  uint64_t childNanoseconds;
+  uint64_t constraints;
+  uint64_t nodes;
+  uint64_t maxNodes;
+  uint64_t latencies[LatencyBuckets];
+
+  ProfileRecord()
+      : failures(0), forwarded(0), nanoseconds(0), childNanoseconds(0),
+        constraints(0), nodes(0), maxNodes(0) {
+    for (unsigned i = 0; i < QueryKinds; i++)
+      queries[i] = 0;
+    for (unsigned i = 0; i < LatencyBuckets; i++)
+      latencies[i] = 0;
+  }
+
+  uint64_t totalQueries() const {
+    uint64_t total = 0;
+    for (unsigned i = 0; i < QueryKinds; i++)
+      total += queries[i];
+    return total;
+  }
+};
+
+// A query going through a profiled layer.
+struct Activation {
+  bool forwarded;
+  uint64_t childNanoseconds;
+  uint64_t start;
+  // Spent measuring the queries below this one.
+  uint64_t excludedNanoseconds;
+  // Spent measuring this one, before it started.
+  uint64_t measureNanoseconds;
+};
+
+struct Profile {
+  // Sites and layers, outermost first.
+  std::vector<const char *> frames;
+  std::vector<Activation> activations;
+  std::map<std::string, ProfileRecord> records;
+
+  std::string getStack() const {
+    std::string stack;
+    for (std::vector<const char *>::const_iterator it = frames.begin(),
+                                                   ie = frames.end();
+         it != ie; ++it) {
+      if (!stack.empty())
+        stack += ';';
+      stack += *it;
+    }
+    return stack;
+  }
+};
+
+// Never destroyed, as it is written by an atexit handler, which may run after
+// function-local statics built later than it was registered are gone.
+Profile &getProfile() {
+  static Profile *profile = new Profile();
+  return *profile;
+}
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t countNodes(const Query &query) {
+  std::unordered_set<const Expr *> visited;
+  std::vector<const Expr *> pending;
+
+  for (ConstraintManager::const_iterator it = query.constraints.begin(),
+                                         ie = query.constraints.end();
+       it != ie; ++it)
+    pending.push_back(it->get());
+  pending.push_back(query.expr.get());
+
+  while (!pending.empty()) {
+    const Expr *e = pending.back();
+    pending.pop_back();
+
+    if (!visited.insert(e).second)
+      continue;
+
+    for (unsigned i = 0, n = e->getNumKids(); i < n; i++)
+      pending.push_back(e->getKid(i).get());
+  }
+
+  return visited.size();
+}
+
+void writeJSONString(llvm::raw_ostream &os, const std::string &s) {
+  os << '"';
+  for (std::string::const_iterator it = s.begin(), ie = s.end(); it != ie;
+       ++it) {
+    if (*it == '"' || *it == '\\')
+      os << '\\';
+    os << *it;
+  }
+  os << '"';
+}
+
+class ProfilingSolver : public SolverImpl {
+private:
+  Solver *solver;
+  std::string layer;
+
+  // Pushes the layer and starts timing the query.
+  void enter(const Query &query);
+  // Stops timing the query and records it.
+  void leave(QueryKind kind, bool success);
+
+public:
+  ProfilingSolver(Solver *s, const std::string &_layer)
+      : solver(s), layer(_layer) {}
+  ~ProfilingSolver() { delete solver; }
+
+  bool computeValidity(const Query &query, Solver::Validity &result) {
+    enter(query);
+    bool success = solver->impl->computeValidity(query, result);
+    leave(ValidityQuery, success);
+    return success;
+  }
+
+  bool computeTruth(const Query &query, bool &isValid) {
+    enter(query);
+    bool success = solver->impl->computeTruth(query, isValid);
+    leave(TruthQuery, success);
+    return success;
+  }
+
+  bool computeValue(const Query &query, ref<Expr> &result) {
+    enter(query);
+    bool success = solver->impl->computeValue(query, result);
+    leave(ValueQuery, success);
+    return success;
+  }
+
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array *> &objects,
+                            std::vector<std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    enter(query);
+    bool success = solver->impl->computeInitialValues(query, objects, values,
+                                                      hasSolution);
+    leave(InitialValuesQuery, success);
+    return success;
+  }
+
+  SolverRunStatus getOperationStatusCode() {
+    return solver->impl->getOperationStatusCode();
+  }
+
+  char *getConstraintLog(const Query &query) {
+    return solver->impl->getConstraintLog(query);
+  }
+
+  void setCoreSolverTimeout(double timeout) {
+    solver->impl->setCoreSolverTimeout(timeout);
+  }
+};
+
+void ProfilingSolver::enter(const Query &query) {
+  Profile &profile = getProfile();
+  uint64_t start = now();
+
+  if (!profile.activations.empty())
+    profile.activations.back().forwarded = true;
+
+  profile.frames.push_back(layer.c_str());
+
+  ProfileRecord &record = profile.records[profile.getStack()];
+  uint64_t nodes = countNodes(query);
+  record.constraints += query.constraints.size();
+  record.nodes += nodes;
+  if (nodes > record.maxNodes)
+    record.maxNodes = nodes;
+
+  Activation activation;
+  activation.forwarded = false;
+  activation.childNanoseconds = 0;
+  activation.excludedNanoseconds = 0;
+  activation.start = now();
+  activation.measureNanoseconds = activation.start - start;
+  profile.activations.push_back(activation);
+}
+
+void ProfilingSolver::leave(QueryKind kind, bool success) {
+  Profile &profile = getProfile();
+  Activation activation = profile.activations.back();
+  uint64_t elapsed =
+      now() - activation.start - activation.excludedNanoseconds;
+
+  profile.activations.pop_back();
+
+  ProfileRecord &record = profile.records[profile.getStack()];
+  profile.frames.pop_back();
+
+  record.queries[kind]++;
+  if (!success)
+    record.failures++;
+  if (activation.forwarded)
+    record.forwarded++;
+  record.nanoseconds += elapsed;
+  record.childNanoseconds += activation.childNanoseconds;
+
+  unsigned bucket = 0;
+  for (uint64_t us = elapsed / 1000; us && bucket < LatencyBuckets - 1;
+       us >>= 1)
+    bucket++;
+  record.latencies[bucket]++;
+
+  if (!profile.activations.empty()) {
+    Activation &parent = profile.activations.back();
+    parent.childNanoseconds += elapsed;
+    parent.excludedNanoseconds +=
+        activation.excludedNanoseconds + activation.measureNanoseconds;
+  }
+}
+
+} // namespace
+
+SolverProfileSite::SolverProfileSite(const char *name) {
+  getProfile().frames.push_back(name);
+}
+
+SolverProfileSite::~SolverProfileSite() {
+  getProfile().frames.pop_back();
+}
+
+void klee::writeSolverProfileJSON(llvm::raw_ostream &os) {
+  const Profile &profile = getProfile();
+
+  os << "{\n  \"records\": [";
+
+  bool first = true;
+  for (std::map<std::string, ProfileRecord>::const_iterator
+           it = profile.records.begin(),
+           ie = profile.records.end();
+       it != ie; ++it) {
+    const ProfileRecord &record = it->second;
+    uint64_t queries = record.totalQueries();
+
+    if (!queries)
+      continue;
+
+    os << (first ? "\n" : ",\n") << "    {\n      \"stack\": ";
+    writeJSONString(os, it->first);
+    first = false;
+
+    os << ",\n      \"queries\": " << queries;
+    for (unsigned i = 0; i < QueryKinds; i++)
+      os << ",\n      \"" << QueryKindNames[i]
+         << "_queries\": " << record.queries[i];
+    os << ",\n      \"failures\": " << record.failures;
+    os << ",\n      \"forwarded\": " << record.forwarded;
+    os << ",\n      \"hit_rate\": "
+       << (double)(queries - record.forwarded) / queries;
+    os << ",\n      \"seconds\": " << record.nanoseconds / 1e9;
+    os << ",\n      \"self_seconds\": "
+       << (record.nanoseconds - record.childNanoseconds) / 1e9;
+    os << ",\n      \"mean_constraints\": "
+       << (double)record.constraints / queries;
+    os << ",\n      \"mean_nodes\": " << (double)record.nodes / queries;
+    os << ",\n      \"max_nodes\": " << record.maxNodes;
+
+    // Up to the slowest bucket with queries in it.
+    unsigned buckets = LatencyBuckets;
+    while (buckets > 1 && !record.latencies[buckets - 1])
+      buckets--;
+
+    os << ",\n      \"latency_us_log2_histogram\": [";
+    for (unsigned i = 0; i < buckets; i++)
+      os << (i ? ", " : "") << record.latencies[i];
+    os << "]\n    }";
+  }
+
+  os << "\n  ]\n}\n";
+}
+
+void klee::writeSolverProfileFolded(llvm::raw_ostream &os) {
+  const Profile &profile = getProfile();
+
+  for (std::map<std::string, ProfileRecord>::const_iterator
+           it = profile.records.begin(),
+           ie = profile.records.end();
+       it != ie; ++it) {
+    const ProfileRecord &record = it->second;
+    uint64_t self = record.nanoseconds - record.childNanoseconds;
+
+    if (record.totalQueries())
+      os << it->first << " " << self / 1000 << "\n";
+  }
+}
+
+Solver *klee::createProfilingSolver(Solver *s, const std::string &layer) {
+  return new Solver(new ProfilingSolver(s, layer));
+}
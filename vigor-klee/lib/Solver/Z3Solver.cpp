@@ -17,6 +17,7 @@
 #include "klee/SolverImpl.h"
 #include "klee/util/Assignment.h"
 #include "klee/util/ExprUtil.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -38,6 +39,16 @@ llvm::cl::opt<bool> Z3ValidateModels(
 llvm::cl::opt<unsigned>
     Z3VerbosityLevel("debug-z3-verbosity", llvm::cl::init(0),
                      llvm::cl::desc("Z3 verbosity level (default=0)"));
+
+llvm::cl::opt<bool> Z3Incremental(
+    "z3-incremental", llvm::cl::init(false),
+    llvm::cl::desc("Keep the constraints shared with the previous query "
+                   "asserted in a single Z3 solver, asserting only the ones "
+                   "that differ, and check the query as an assumption. Falls "
+                   "back to a fresh solver on timeouts. Constraints are only "
+                   "shared if they reach the solver in the same order, which "
+                   "the independent solver rarely preserves "
+                   "(default=false)"));
 }
 
 #include "llvm/Support/ErrorHandling.h"
@@ -54,10 +65,31 @@ private:
   // Parameter symbols
   ::Z3_symbol timeoutParamStrSymbol;
 
+  // Incremental mode. The solver keeps one scope per asserted constraint, so
+  // moving to the constraints of another query pops back to the prefix they
+  // share and pushes the rest.
+  ::Z3_solver incrementalSolver;
+  std::vector<ref<Expr> > assertedConstraints;
+  // Guards the negated query, asserted in a scope of its own, so the same
+  // literal serves every query.
+  Z3ASTHandle queryGuard;
+
   bool internalRunSolver(const Query &,
                          const std::vector<const Array *> *objects,
                          std::vector<std::vector<unsigned char> > *values,
                          bool &hasSolution);
+  SolverRunStatus
+  runFreshSolver(const Query &, const std::vector<const Array *> *objects,
+                 std::vector<std::vector<unsigned char> > *values,
+                 bool &hasSolution);
+  SolverRunStatus
+  runIncrementalSolver(const Query &,
+                       const std::vector<const Array *> *objects,
+                       std::vector<std::vector<unsigned char> > *values,
+                       bool &hasSolution);
+  void assertConstantArrays(::Z3_solver theSolver,
+                            const ConstantArrayFinder &constant_arrays);
+  void resetIncrementalSolver();
 bool validateZ3Model(::Z3_solver &theSolver, ::Z3_model &theModel);
 
 public:
@@ -74,6 +106,8 @@ public:
       timeoutInMilliSeconds = UINT_MAX;
     Z3_params_set_uint(builder->ctx, solverParameters, timeoutParamStrSymbol,
                        timeoutInMilliSeconds);
+    if (incrementalSolver)
+      Z3_solver_set_params(builder->ctx, incrementalSolver, solverParameters);
   }
 
   bool computeTruth(const Query &, bool &isValid);
@@ -97,7 +131,7 @@ Z3SolverImpl::Z3SolverImpl()
               ? Z3LogInteractionFile.c_str()
               : NULL)),
       timeout(0.0), runStatusCode(SOLVER_RUN_STATUS_FAILURE),
-      dumpedQueriesFile(0) {
+      dumpedQueriesFile(0), incrementalSolver(NULL) {
   assert(builder && "unable to create Z3Builder");
   solverParameters = Z3_mk_params(builder->ctx);
   Z3_params_inc_ref(builder->ctx, solverParameters);
@@ -125,6 +159,10 @@ Z3SolverImpl::Z3SolverImpl()
 }
 
 Z3SolverImpl::~Z3SolverImpl() {
+  assertedConstraints.clear();
+  queryGuard = Z3ASTHandle();
+  if (incrementalSolver)
+    Z3_solver_dec_ref(builder->ctx, incrementalSolver);
   Z3_params_dec_ref(builder->ctx, solverParameters);
   delete builder;
 
@@ -247,9 +285,65 @@ bool Z3SolverImpl::internalRunSolver(
     std::vector<std::vector<unsigned char> > *values, bool &hasSolution) {
 
   TimerStatIncrementer t(stats::queryTime);
+  ++stats::queries;
+  if (objects)
+    ++stats::queryCounterexamples;
+
+  if (Z3Incremental) {
+    runStatusCode =
+        runIncrementalSolver(query, objects, values, hasSolution);
+
+    // Z3 gives up on some queries in incremental mode that it solves from
+    // scratch, so those are retried on their own.
+    if (runStatusCode != SolverImpl::SOLVER_RUN_STATUS_SUCCESS_SOLVABLE &&
+        runStatusCode != SolverImpl::SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE) {
+      resetIncrementalSolver();
+      runStatusCode = runFreshSolver(query, objects, values, hasSolution);
+    }
+  } else {
+    runStatusCode = runFreshSolver(query, objects, values, hasSolution);
+  }
+
+  // Clear the builder's cache to prevent memory usage exploding.
+  // By using ``autoClearConstructCache=false`` and clearning now
+  // we allow Z3_ast expressions to be shared from an entire
+  // ``Query`` rather than only sharing within a single call to
+  // ``builder->construct()``.
+  builder->clearConstructCache();
+
+  if (runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_SOLVABLE ||
+      runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE) {
+    if (hasSolution) {
+      ++stats::queriesInvalid;
+    } else {
+      ++stats::queriesValid;
+    }
+    return true; // success
+  }
+  return false; // failed
+}
+
+void Z3SolverImpl::assertConstantArrays(
+    ::Z3_solver theSolver, const ConstantArrayFinder &constant_arrays) {
+  for (auto const &constant_array : constant_arrays.results) {
+    assert(builder->constant_array_assertions.count(constant_array) == 1 &&
+           "Constant array found in query, but not handled by Z3Builder");
+    for (auto const &arrayIndexValueExpr :
+         builder->constant_array_assertions[constant_array]) {
+      Z3_solver_assert(builder->ctx, theSolver, arrayIndexValueExpr);
+    }
+  }
+}
+
+SolverImpl::SolverRunStatus Z3SolverImpl::runFreshSolver(
+    const Query &query, const std::vector<const Array *> *objects,
+    std::vector<std::vector<unsigned char> > *values, bool &hasSolution) {
   // NOTE: Z3 will switch to using a slower solver internally if push/pop are
   // used so for now it is likely that creating a new solver each time is the
-  // right way to go until Z3 changes its behaviour.
+  // right way to go until Z3 changes its behaviour. -z3-incremental trades
+  // that for not asserting the constraints shared with the previous query
+  // again, which only pays off when queries share long prefixes, e.g.
+  // without the independent solver, and is not the default for that reason.
   //
   // TODO: Investigate using a custom tactic as described in
   // https://github.com/klee/klee/issues/653
@@ -257,29 +351,17 @@ bool Z3SolverImpl::internalRunSolver(
   Z3_solver_inc_ref(builder->ctx, theSolver);
   Z3_solver_set_params(builder->ctx, theSolver, solverParameters);
 
-  runStatusCode = SOLVER_RUN_STATUS_FAILURE;
-
   ConstantArrayFinder constant_arrays_in_query;
   for (auto const &constraint : query.constraints) {
     Z3_solver_assert(builder->ctx, theSolver, builder->construct(constraint));
     constant_arrays_in_query.visit(constraint);
   }
-  ++stats::queries;
-  if (objects)
-    ++stats::queryCounterexamples;
 
   Z3ASTHandle z3QueryExpr =
       Z3ASTHandle(builder->construct(query.expr), builder->ctx);
   constant_arrays_in_query.visit(query.expr);
 
-  for (auto const &constant_array : constant_arrays_in_query.results) {
-    assert(builder->constant_array_assertions.count(constant_array) == 1 &&
-           "Constant array found in query, but not handled by Z3Builder");
-    for (auto const &arrayIndexValueExpr :
-         builder->constant_array_assertions[constant_array]) {
-      Z3_solver_assert(builder->ctx, theSolver, arrayIndexValueExpr);
-    }
-  }
+  assertConstantArrays(theSolver, constant_arrays_in_query);
 
   // KLEE Queries are validity queries i.e.
   // ∀ X Constraints(X) → query(X)
@@ -300,27 +382,101 @@ bool Z3SolverImpl::internalRunSolver(
   }
 
   ::Z3_lbool satisfiable = Z3_solver_check(builder->ctx, theSolver);
-  runStatusCode = handleSolverResponse(theSolver, satisfiable, objects, values,
-                                       hasSolution);
+  SolverRunStatus status = handleSolverResponse(theSolver, satisfiable,
+                                                objects, values, hasSolution);
 
   Z3_solver_dec_ref(builder->ctx, theSolver);
-  // Clear the builder's cache to prevent memory usage exploding.
-  // By using ``autoClearConstructCache=false`` and clearning now
-  // we allow Z3_ast expressions to be shared from an entire
-  // ``Query`` rather than only sharing within a single call to
-  // ``builder->construct()``.
-  builder->clearConstructCache();
+  return status;
+}
 
-  if (runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_SOLVABLE ||
-      runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE) {
-    if (hasSolution) {
-      ++stats::queriesInvalid;
-    } else {
-      ++stats::queriesValid;
-    }
-    return true; // success
+SolverImpl::SolverRunStatus Z3SolverImpl::runIncrementalSolver(
+    const Query &query, const std::vector<const Array *> *objects,
+    std::vector<std::vector<unsigned char> > *values, bool &hasSolution) {
+  if (!incrementalSolver) {
+    incrementalSolver = Z3_mk_solver(builder->ctx);
+    Z3_solver_inc_ref(builder->ctx, incrementalSolver);
+    Z3_solver_set_params(builder->ctx, incrementalSolver, solverParameters);
   }
-  return false; // failed
+
+  // Queries of the same state, and of the states forked from it, share the
+  // constraints collected before the last branch. Those are compared by
+  // pointer, constraints are not copied when states fork.
+  size_t shared = 0;
+  auto constraint_it = query.constraints.begin();
+  auto constraint_ie = query.constraints.end();
+  while (shared < assertedConstraints.size() &&
+         constraint_it != constraint_ie &&
+         assertedConstraints[shared].get() == constraint_it->get()) {
+    ++shared;
+    ++constraint_it;
+  }
+
+  if (shared < assertedConstraints.size()) {
+    Z3_solver_pop(builder->ctx, incrementalSolver,
+                  assertedConstraints.size() - shared);
+    assertedConstraints.resize(shared);
+  }
+
+  for (; constraint_it != constraint_ie; ++constraint_it) {
+    ConstantArrayFinder constant_arrays_in_constraint;
+    constant_arrays_in_constraint.visit(*constraint_it);
+
+    Z3_solver_push(builder->ctx, incrementalSolver);
+    Z3_solver_assert(builder->ctx, incrementalSolver,
+                     builder->construct(*constraint_it));
+    assertConstantArrays(incrementalSolver, constant_arrays_in_constraint);
+    assertedConstraints.push_back(*constraint_it);
+  }
+
+  // Z3 4.5 only takes literals as assumptions, so the negated query is
+  // guarded by one in a scope of its own, dropped after the check.
+  ConstantArrayFinder constant_arrays_in_query;
+  constant_arrays_in_query.visit(query.expr);
+
+  if (!queryGuard)
+    queryGuard = Z3ASTHandle(
+        Z3_mk_const(builder->ctx,
+                    Z3_mk_string_symbol(builder->ctx, "query_guard"),
+                    Z3_mk_bool_sort(builder->ctx)),
+        builder->ctx);
+  Z3ASTHandle z3QueryExpr =
+      Z3ASTHandle(builder->construct(query.expr), builder->ctx);
+
+  Z3_solver_push(builder->ctx, incrementalSolver);
+  assertConstantArrays(incrementalSolver, constant_arrays_in_query);
+  Z3_solver_assert(
+      builder->ctx, incrementalSolver,
+      Z3ASTHandle(
+          Z3_mk_implies(
+              builder->ctx, queryGuard,
+              Z3ASTHandle(Z3_mk_not(builder->ctx, z3QueryExpr), builder->ctx)),
+          builder->ctx));
+
+  if (dumpedQueriesFile) {
+    *dumpedQueriesFile << "; start Z3 query\n";
+    *dumpedQueriesFile << Z3_solver_to_string(builder->ctx, incrementalSolver);
+    *dumpedQueriesFile << "(check-sat query_guard)\n";
+    *dumpedQueriesFile << "; end Z3 query\n\n";
+    dumpedQueriesFile->flush();
+  }
+
+  ::Z3_ast assumption = queryGuard;
+  ::Z3_lbool satisfiable =
+      Z3_solver_check_assumptions(builder->ctx, incrementalSolver, 1,
+                                  &assumption);
+  SolverRunStatus status = handleSolverResponse(
+      incrementalSolver, satisfiable, objects, values, hasSolution);
+
+  Z3_solver_pop(builder->ctx, incrementalSolver, 1);
+  return status;
+}
+
+void Z3SolverImpl::resetIncrementalSolver() {
+  if (!incrementalSolver)
+    return;
+
+  Z3_solver_reset(builder->ctx, incrementalSolver);
+  assertedConstraints.clear();
 }
 
 SolverImpl::SolverRunStatus Z3SolverImpl::handleSolverResponse(
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Measures how long call-paths-to-bdd takes to build the BDD of each NF, and
+# its peak RSS, printing nf,binary,call paths,seconds,peak RSS (KiB) lines.
+#
+# Usage: bench-bdd.sh [-b baseline-call-paths-to-bdd] [-j jobs] [nf-dir...]
+#
+# NFs default to the ones under vigor/ that have call paths in klee-last, so
+# run "make symbex" in an NF's directory first. Given a baseline binary, for
+# example one built from an older commit, every NF is measured with both.
+
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+VIGOR_DIR="$SCRIPT_DIR/../../vigor"
+
+BDD_BIN="$SCRIPT_DIR/../build/bin/call-paths-to-bdd"
+BASELINE_BIN=""
+JOBS=1
+
+while getopts "b:j:" OPT; do
+  case $OPT in
+    b) BASELINE_BIN="$OPTARG" ;;
+    j) JOBS="$OPTARG" ;;
+    *) echo "Usage: $0 [-b baseline-call-paths-to-bdd] [-j jobs] [nf-dir...]"
+       exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+  set -- "$VIGOR_DIR"/vig*
+fi
+
+if [ ! -x /usr/bin/time ]; then
+  echo "GNU time (/usr/bin/time) is needed to measure the peak RSS" >&2
+  exit 1
+fi
+
+function measure {
+  local NF=$1
+  local BIN=$2
+  local CALL_PATHS=("$NF"/klee-last/*.call_path)
+  local STATS
+
+  STATS=$(mktemp)
+
+  /usr/bin/time -f "%e,%M" -o "$STATS" \
+      "$BIN" -jobs "$JOBS" "${CALL_PATHS[@]}" > /dev/null 2>&1
+
+  echo "$(basename "$NF"),$BIN,${#CALL_PATHS[@]},$(cat "$STATS")"
+  rm -f "$STATS"
+}
+
+echo "nf,binary,call paths,seconds,peak rss (KiB)"
+
+for NF in "$@"; do
+  if ! compgen -G "$NF/klee-last/*.call_path" > /dev/null; then
+    echo "Skipping $NF: no call paths in klee-last" >&2
+    continue
+  fi
+
+  if [ "$BASELINE_BIN" ]; then
+    measure "$NF" "$BASELINE_BIN"
+  fi
+
+  measure "$NF" "$BDD_BIN"
+done
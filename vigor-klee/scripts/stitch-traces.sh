@@ -17,21 +17,41 @@ function stitch_traces {
     done
 
     USER_VAR_STR="$(echo "$USER_VAR_STR" | sed -e 's/^,//')"
-
-    parallel "$SCRIPT_DIR/../build/bin/stitch-perf-contract \
-                  -contract $SCRIPT_DIR/../../vnds/perf-contracts/perf-contracts.so \
-                  --user-vars \"$USER_VAR_STR\" \
-                  {} 2>/dev/null \
-                | awk \"{ print \\\"\$(basename {} .call_path),\\\" \\\$0; }\"" \
-                ::: $TRACES_DIR/*.call_path > $TRACES_DIR/stateful-perf.txt
   else
-    parallel "$SCRIPT_DIR/../build/bin/stitch-perf-contract \
-                  -contract $SCRIPT_DIR/../../vnds/perf-contracts/perf-contracts.so \
-                  {} 2>/dev/null \
-                | awk \"{ print \\\"\$(basename {} .call_path),\\\" \\\$0; }\"" \
-                ::: $TRACES_DIR/*.call_path > $TRACES_DIR/stateful-perf.txt
+    USER_VAR_STR=""
   fi
 
+  # One process stitches every call path, with one job per core, and prints a
+  # table that is turned back into name,metric,value lines.
+  "$SCRIPT_DIR/../build/bin/stitch-perf-contract" \
+      -contract "$SCRIPT_DIR/../../vnds/perf-contracts/perf-contracts.so" \
+      ${USER_VAR_STR:+--user-vars "$USER_VAR_STR"} \
+      -jobs "$(nproc)" -table \
+      $TRACES_DIR/*.call_path 2>/dev/null \
+    | awk -F, '
+      NR == 1 {
+        for (i = 2; i <= NF; i++) {
+          metric[i] = $i;
+        }
+        next;
+      }
+
+      $0 == "" {
+        exit;
+      }
+
+      {
+        name = $1;
+        sub(/.*\//, "", name);
+        sub(/\.call_path$/, "", name);
+
+        for (i = 2; i <= NF; i++) {
+          if ($i != "") {
+            print name "," metric[i] "," $i;
+          }
+        }
+      }' > $TRACES_DIR/stateful-perf.txt
+
   join -t, -j1 \
       <(sort klee-last/stateful-perf.txt | awk -F, '{print $1 "_" $2 "," $3}') \
       <(sort klee-last/stateless-perf.txt | awk -F, '{print $1 "_" $2 "," $3}') \
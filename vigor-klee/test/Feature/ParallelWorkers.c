@@ -0,0 +1,33 @@
+// RUN: %llvmgcc %s -emit-llvm -g -O0 -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out %t.bc
+// RUN: grep "KLEE: done: explored paths = 64" %t.klee-out/info
+// RUN: grep "KLEE: done: generated tests = 64" %t.klee-out/info
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --parallel-workers=2 %t.bc
+// RUN: grep "KLEE: done: explored paths = 64" %t.klee-out/info
+// RUN: grep "KLEE: done: generated tests = 64" %t.klee-out/info
+// RUN: test `ls %t.klee-out/*.ktest | wc -l` -eq 64
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --parallel-workers=4 %t.bc
+// RUN: grep "KLEE: done: explored paths = 64" %t.klee-out/info
+// RUN: grep "KLEE: done: generated tests = 64" %t.klee-out/info
+// RUN: test `ls %t.klee-out/*.ktest | wc -l` -eq 64
+
+#include "klee/klee.h"
+
+int main() {
+  unsigned char bits = klee_int("bits");
+  unsigned sum = 0;
+
+  // Six independent forks, with enough work on each path for the workers to
+  // look for states to hand over.
+  for (int i = 0; i < 6; i++) {
+    if (bits & (1 << i))
+      sum += i;
+    for (int j = 0; j < 500; j++)
+      sum = sum * 31 + j;
+  }
+
+  return sum & 1;
+}
@@ -9,6 +9,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "klee/Common.h"
 #include "klee/ExprBuilder.h"
 #include "klee/perf-contracts.h"
 #include "klee/util/ArrayCache.h"
@@ -19,6 +20,8 @@
 #include <klee/Solver.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <dlfcn.h>
 #include <expr/Parser.h>
 #include <fstream>
@@ -26,9 +29,13 @@
 #include <iostream>
 #include <memory>
 #include <regex>
+#include <sstream>
 #include <stack>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
+#include "../load-call-paths/binary-io.h"
 #include "../load-call-paths/load-call-paths.h"
 #include "../printer/printer.h"
 
@@ -36,6 +43,17 @@ namespace {
 llvm::cl::list<std::string> InputCallPathFiles(llvm::cl::desc("<call paths>"),
                                                llvm::cl::Positional,
                                                llvm::cl::OneOrMore);
+
+llvm::cl::opt<std::string> CacheDir(
+    "cache-dir",
+    llvm::cl::desc("Directory keeping the analysis of every call path, keyed "
+                   "by the hash of its content. Only call paths not found "
+                   "there are analysed again."));
+
+llvm::cl::opt<std::string> BinaryLVA(
+    "binary-lva",
+    llvm::cl::desc("Also write the report to this file in the binary LVA "
+                   "format, which rss-config-from-lvas loads directly."));
 }
 
 // term colors
@@ -62,6 +80,63 @@ llvm::cl::list<std::string> InputCallPathFiles(llvm::cl::desc("<call paths>"),
 
 #define UINT_16_SWAP_ENDIANNESS(p) ((((p)&0xff) << 8) | ((p) >> 8 & 0xff))
 
+// Analysis of a single call path, as kept in the cache directory. Bump the
+// version whenever the analysis changes, so that stale entries are ignored.
+constexpr char BINARY_ANALYSIS_MAGIC[] = "VIGORLVC";
+constexpr unsigned ANALYSIS_CACHE_VERSION = 1;
+
+void put_optional(BinaryWriter &writer,
+                  const std::pair<bool, unsigned int> &value) {
+  writer.put(value.first);
+  writer.put(value.second);
+}
+
+std::pair<bool, unsigned int> get_optional(BinaryReader &reader) {
+  bool is_set = reader.get();
+  unsigned int value = reader.get();
+  return std::make_pair(is_set, value);
+}
+
+// Binary LVA report.
+//
+// Holds the same records as the textual report, as 32 bit words, so that
+// rss-config-from-lvas can load it without parsing any text. Strings are
+// stored as their length followed by their characters, padded to a word.
+// Expressions keep the SMT-LIB text of the textual report, and operations and
+// types their token. The Parser of rss-config-from-lvas reads this layout
+// back, so both must be kept in sync.
+constexpr char LVA_MAGIC[] = "VIGORLVA";
+constexpr uint32_t LVA_VERSION = 1;
+
+enum lva_record_t { LVA_ACCESS, LVA_CALL_PATHS_CONSTRAINT };
+
+class LvaWriter {
+private:
+  std::vector<uint32_t> words;
+
+public:
+  void put(uint32_t word) { words.push_back(word); }
+
+  void put_string(const std::string &str) {
+    put(str.size());
+
+    auto offset = words.size();
+    words.resize(offset + (str.size() + 3) / 4, 0);
+    memcpy(words.data() + offset, str.data(), str.size());
+  }
+
+  void write(const std::string &file_path) const {
+    std::ofstream out(file_path, std::ios::binary);
+    assert(out.is_open() && "Unable to open binary LVA file.");
+
+    out.write(LVA_MAGIC, 8);
+    out.write(reinterpret_cast<const char *>(&LVA_VERSION),
+              sizeof(LVA_VERSION));
+    out.write(reinterpret_cast<const char *>(words.data()),
+              words.size() * sizeof(uint32_t));
+  }
+};
+
 class KleeInterface {
 private:
   std::map<std::string, klee::ConstraintManager> call_path_constraints;
@@ -76,12 +151,7 @@ private:
 
 public:
   KleeInterface() {
-    solver = klee::createCoreSolver(klee::Z3_SOLVER);
-    assert(solver);
-
-    solver = createCexCachingSolver(solver);
-    solver = createCachingSolver(solver);
-    solver = createIndependentSolver(solver);
+    solver = klee::constructToolSolverChain(klee::Z3_SOLVER);
   }
 
   KleeInterface(const KleeInterface &interface) : KleeInterface() {
@@ -555,6 +625,30 @@ struct packet_chunk_t {
     call_path_filename = _call_path_filename;
   }
 
+  packet_chunk_t(BinaryReader &reader,
+                 std::shared_ptr<KleeInterface> _klee_interface,
+                 const std::string &_call_path_filename) {
+    auto num_fragments = reader.get();
+    for (unsigned int i = 0; i < num_fragments; i++) {
+      auto offset = reader.get();
+      auto length = reader.get_expr();
+      auto expr = reader.get_expr();
+      fragments.emplace_back(offset, length, expr);
+    }
+
+    layer = reader.get();
+    protocol.code = reader.get();
+    protocol.state = static_cast<protocol_t::state_t>(reader.get());
+
+    auto num_dependencies = reader.get();
+    for (unsigned int i = 0; i < num_dependencies; i++) {
+      packet_fields_dependencies.push_back(reader.get());
+    }
+
+    klee_interface = _klee_interface;
+    call_path_filename = _call_path_filename;
+  }
+
   packet_chunk_t(const packet_chunk_t &chunk)
       : fragments(chunk.fragments), layer(chunk.layer),
         protocol(chunk.protocol),
@@ -746,6 +840,39 @@ struct packet_chunk_t {
     }
   }
 
+  void save(BinaryWriter &writer) const {
+    writer.put(fragments.size());
+    for (const auto &fragment : fragments) {
+      writer.put(fragment.offset);
+      writer.put_expr(fragment.length);
+      writer.put_expr(fragment.expr);
+    }
+
+    writer.put(layer);
+    writer.put(protocol.state == protocol_t::state_t::NO_INFO ? 0
+                                                               : protocol.code);
+    writer.put(protocol.state);
+
+    writer.put(packet_fields_dependencies.size());
+    for (const auto &dependency : packet_fields_dependencies) {
+      writer.put(dependency);
+    }
+  }
+
+  void report(LvaWriter &writer) const {
+    assert(protocol.state != protocol_t::state_t::INCOMPLETE);
+
+    writer.put(layer);
+    writer.put(protocol.state == protocol_t::state_t::COMPLETE);
+    writer.put(protocol.state == protocol_t::state_t::COMPLETE ? protocol.code
+                                                                : 0);
+
+    writer.put(packet_fields_dependencies.size());
+    for (const auto &dependency : packet_fields_dependencies) {
+      writer.put(dependency);
+    }
+  }
+
   void report() const {
     assert(protocol.state != protocol_t::state_t::INCOMPLETE);
     if (packet_fields_dependencies.size() == 0)
@@ -931,6 +1058,30 @@ public:
     call_handler_map["packet_get_unread_length"] = &PacketManager::nop;
   }
 
+  PacketManager(BinaryReader &reader,
+                std::shared_ptr<KleeInterface> _klee_interface,
+                const std::string &_call_path_filename)
+      : PacketManager(_klee_interface, _call_path_filename) {
+    src_device = get_optional(reader);
+    dst_device = get_optional(reader);
+
+    auto num_chunks = reader.get();
+    for (unsigned int i = 0; i < num_chunks; i++) {
+      borrowed_chunks_processed.emplace_back(reader, klee_interface,
+                                             call_path_filename);
+    }
+
+    auto num_translations = reader.get();
+    for (unsigned int i = 0; i < num_translations; i++) {
+      translation_unit_t translation;
+      translation.layer = reader.get();
+      translation.offset = reader.get();
+      translation.received = reader.get_expr();
+      translation.translated = reader.get_expr();
+      translations.push_back(translation);
+    }
+  }
+
   PacketManager(const PacketManager &pm)
       : src_device(pm.src_device), dst_device(pm.dst_device),
         borrowed_chunk_layer_pairs(pm.borrowed_chunk_layer_pairs),
@@ -1035,6 +1186,42 @@ public:
     }
   }
 
+  // Only what's left once every packet call was processed, which is all
+  // the accesses and the constraints between call paths look at.
+  void save(BinaryWriter &writer) const {
+    put_optional(writer, src_device);
+    put_optional(writer, dst_device);
+
+    writer.put(borrowed_chunks_processed.size());
+    for (const auto &chunk : borrowed_chunks_processed) {
+      chunk.save(writer);
+    }
+
+    writer.put(translations.size());
+    for (const auto &translation : translations) {
+      writer.put(translation.layer);
+      writer.put(translation.offset);
+      writer.put_expr(translation.received);
+      writer.put_expr(translation.translated);
+    }
+  }
+
+  void report(LvaWriter &writer) const {
+    unsigned int num_chunks = 0;
+    for (const auto &chunk : borrowed_chunks_processed) {
+      if (chunk.has_dependencies()) {
+        num_chunks++;
+      }
+    }
+
+    writer.put(num_chunks);
+    for (const auto &chunk : borrowed_chunks_processed) {
+      if (chunk.has_dependencies()) {
+        chunk.report(writer);
+      }
+    }
+  }
+
   void report() const {
     if (!has_dependencies())
       return;
@@ -1148,38 +1335,80 @@ public:
     packet_dependencies.update_devices(pm);
   }
 
-  void report(const unsigned int &id) const {
+  // The name comes with the access, only what the analysis found is saved.
+  void save(BinaryWriter &writer) const {
     if (!name.first)
       return;
-    assert(expr.first);
-    const auto &klee_interface = packet_dependencies.get_klee_interface();
 
-    std::cout << "BEGIN ARGUMENT"
-              << "\n";
+    writer.put(expr.first);
+    if (!expr.first)
+      return;
 
-    std::cout << "type ";
+    writer.put_expr(expr.second);
+    packet_dependencies.save(writer);
+  }
+
+  void load(BinaryReader &reader,
+            std::shared_ptr<KleeInterface> klee_interface,
+            const std::string &call_path_filename) {
+    if (!name.first)
+      return;
+
+    if (!reader.get())
+      return;
+
+    set_expr(reader.get_expr());
+    packet_dependencies =
+        PacketManager(reader, klee_interface, call_path_filename);
+  }
+
+  std::string get_type_token() const {
     switch (type) {
     case READ:
-      std::cout << "read";
-      break;
+      return "read";
     case WRITE:
-      std::cout << "write";
-      break;
+      return "write";
     case RESULT:
-      std::cout << "result";
-      break;
+      return "result";
     default:
       assert(false);
     }
-    std::cout << "\n";
 
-    std::cout << "BEGIN EXPRESSION"
-              << "\n";
+    return "";
+  }
+
+  std::string get_expr_smt(const unsigned int &id) const {
+    const auto &klee_interface = packet_dependencies.get_klee_interface();
 
     RenameChunks renamed(id);
     auto renamed_expr = renamed.visit(expr.second);
 
-    std::cout << klee_interface->expr_to_smt(renamed_expr) << "\n";
+    return klee_interface->expr_to_smt(renamed_expr);
+  }
+
+  void report(LvaWriter &writer, const unsigned int &id) const {
+    if (!name.first)
+      return;
+    assert(expr.first);
+
+    writer.put_string(get_type_token());
+    writer.put_string(get_expr_smt(id) + "\n");
+    packet_dependencies.report(writer);
+  }
+
+  void report(const unsigned int &id) const {
+    if (!name.first)
+      return;
+    assert(expr.first);
+
+    std::cout << "BEGIN ARGUMENT"
+              << "\n";
+
+    std::cout << "type " << get_type_token() << "\n";
+
+    std::cout << "BEGIN EXPRESSION"
+              << "\n";
+    std::cout << get_expr_smt(id) << "\n";
     std::cout << "END EXPRESSION"
               << "\n";
 
@@ -1523,6 +1752,83 @@ public:
               << "\n";
   }
 
+  // The access has to come from the lookup table, which holds everything
+  // not found by the analysis.
+  void save(BinaryWriter &writer) const {
+    writer.put_string(interface);
+    writer.put(obj.second);
+    writer.put(success.first);
+    writer.put_u64(success.second);
+    put_optional(writer, src_device);
+    put_optional(writer, dst_device);
+
+    read_arg.save(writer);
+    write_arg.save(writer);
+    result_arg.save(writer);
+  }
+
+  void load(BinaryReader &reader) {
+    obj.second = reader.get();
+    success.first = reader.get();
+    success.second = reader.get_u64();
+    src_device = get_optional(reader);
+    dst_device = get_optional(reader);
+
+    read_arg.load(reader, klee_interface, call_path_filename);
+    write_arg.load(reader, klee_interface, call_path_filename);
+    result_arg.load(reader, klee_interface, call_path_filename);
+  }
+
+  std::string get_operation_token() const {
+    switch (op) {
+    case NOP:
+      return "NOP";
+    case INIT:
+      return "INIT";
+    case CREATE:
+      return "CREATE";
+    case VERIFY:
+      return "VERIFY";
+    case UPDATE:
+      return "UPDATE";
+    case DESTROY:
+      return "DESTROY";
+    case READ:
+      return "READ";
+    case WRITE:
+      return "WRITE";
+    default:
+      assert(false && "Unknown operation");
+    }
+
+    return "";
+  }
+
+  void report(LvaWriter &writer) const {
+    if (op == NOP || (!src_device.first && op == INIT))
+      return;
+    assert(src_device.first && "Unset source device");
+
+    writer.put(LVA_ACCESS);
+    writer.put(get_id());
+    writer.put(src_device.second);
+    writer.put(dst_device.first);
+    writer.put(dst_device.second);
+    writer.put(success.first);
+    writer.put(success.first && success.second);
+    writer.put_string(get_operation_token());
+    writer.put(obj.second);
+
+    writer.put(read_arg.is_name_set() + write_arg.is_name_set() +
+               result_arg.is_name_set());
+    read_arg.report(writer, id.second);
+    write_arg.report(writer, id.second);
+    result_arg.report(writer, id.second);
+
+    writer.put_string(interface);
+    writer.put_string(call_path_filename);
+  }
+
   void report() const {
     if (op == NOP || (!src_device.first && op == INIT))
       return;
@@ -1546,37 +1852,7 @@ public:
       std::cout << "\n";
     }
 
-    std::cout << "operation ";
-    switch (op) {
-    case NOP:
-      std::cout << "NOP";
-      break;
-    case INIT:
-      std::cout << "INIT";
-      break;
-    case CREATE:
-      std::cout << "CREATE";
-      break;
-    case VERIFY:
-      std::cout << "VERIFY";
-      break;
-    case UPDATE:
-      std::cout << "UPDATE";
-      break;
-    case DESTROY:
-      std::cout << "DESTROY";
-      break;
-    case READ:
-      std::cout << "READ";
-      break;
-    case WRITE:
-      std::cout << "WRITE";
-      break;
-    default:
-      assert(false && "Unknown operation");
-    }
-    std::cout << "\n";
-
+    std::cout << "operation " << get_operation_token() << "\n";
     std::cout << "object " << obj.second << "\n";
 
     read_arg.report(id.second);
@@ -1684,6 +1960,44 @@ private:
     add_access_lookup_table(LibvigAccess("LoadBalancedFlow_hash"));
   }
 
+  void add_call_path_analysis(
+      const std::string &call_path_filename, const PacketManager &pm,
+      const std::vector<LibvigAccess> &call_path_accesses) {
+    accesses.insert(accesses.begin(), call_path_accesses.begin(),
+                    call_path_accesses.end());
+    packet_manager_per_call_path.emplace(
+        std::make_pair(call_path_filename, pm));
+  }
+
+  void save_call_path_analysis(
+      const std::string &cache_file, const call_path_t *call_path,
+      const PacketManager &pm,
+      const std::vector<LibvigAccess> &call_path_accesses) const {
+    BinaryWriter writer;
+
+    writer.put(call_path->constraints.size());
+    for (auto constraint : call_path->constraints) {
+      writer.put_expr(constraint);
+    }
+
+    pm.save(writer);
+
+    writer.put(call_path_accesses.size());
+    for (const auto &access : call_path_accesses) {
+      access.save(writer);
+    }
+
+    // Never leave a partially written entry behind.
+    auto tmp_file = cache_file + ".tmp." + std::to_string(getpid());
+    writer.write(tmp_file, BINARY_ANALYSIS_MAGIC);
+
+    if (rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+      std::cerr << "Unable to cache the analysis of " << call_path->file_name
+                << std::endl;
+      unlink(tmp_file.c_str());
+    }
+  }
+
 public:
   LibvigAccessesManager() {
     fill_access_lookup_table();
@@ -1694,8 +2008,60 @@ public:
     accesses = _accesses;
   }
 
+  // Restores the analysis cached by analyse_call_path. Only the constraints
+  // of the call path are returned, as its calls were already analysed.
+  call_path_t *load_call_path_analysis(const std::string &call_path_filename,
+                                       const std::string &cache_file) {
+    // Arrays must outlive the expressions read, just like the ones of a call
+    // path.
+    auto array_cache = new klee::ArrayCache();
+    BinaryReader reader(cache_file, BINARY_ANALYSIS_MAGIC, *array_cache);
+
+    call_path_t *call_path = new call_path_t;
+    call_path->file_name = call_path_filename;
+
+    std::vector<klee::ref<klee::Expr>> constraints;
+    auto num_constraints = reader.get();
+    for (unsigned int i = 0; i < num_constraints; i++) {
+      constraints.push_back(reader.get_expr());
+    }
+    call_path->constraints = klee::ConstraintManager(constraints);
+
+    klee_interface->add_constraints(call_path_filename, call_path->constraints);
+
+    PacketManager pm(reader, klee_interface, call_path_filename);
+    std::vector<LibvigAccess> call_path_accesses;
+
+    auto num_accesses = reader.get();
+    for (unsigned int i = 0; i < num_accesses; i++) {
+      auto interface = reader.get_string();
+      auto found_access_it = access_lookup_table.find(interface);
+
+      reader.check(found_access_it != access_lookup_table.end(),
+                   "Unexpected function call in cached analysis.");
+
+      auto access = found_access_it->second;
+
+      access.set_klee_interface(klee_interface);
+      access.set_call_path_filename(call_path_filename);
+      access.set_id(accesses.size() + call_path_accesses.size());
+
+      access.load(reader);
+
+      call_path_accesses.emplace_back(access);
+    }
+
+    reader.check(reader.done(), "Invalid cached analysis.");
+
+    add_call_path_analysis(call_path_filename, pm, call_path_accesses);
+
+    return call_path;
+  }
+
+  // Also saves the analysis to the given cache file, if any.
   void analyse_call_path(const std::string &call_path_filename,
-                         const call_path_t *call_path) {
+                         const call_path_t *call_path,
+                         const std::string &cache_file = "") {
     klee_interface->add_constraints(call_path_filename, call_path->constraints);
 
     PacketManager pm(klee_interface, call_path_filename);
@@ -1735,10 +2101,11 @@ public:
       access.update_devices(pm);
     }
 
-    accesses.insert(accesses.begin(), call_path_accesses.begin(),
-                    call_path_accesses.end());
-    packet_manager_per_call_path.emplace(
-        std::make_pair(call_path_filename, pm));
+    if (!cache_file.empty()) {
+      save_call_path_analysis(cache_file, call_path, pm, call_path_accesses);
+    }
+
+    add_call_path_analysis(call_path_filename, pm, call_path_accesses);
   }
 
   void print() const {
@@ -1746,6 +2113,11 @@ public:
       access.print();
   }
 
+  void report(LvaWriter &writer) const {
+    for (const auto &access : accesses)
+      access.report(writer);
+  }
+
   void report() const {
     for (const auto &access : accesses)
       access.report();
@@ -1856,6 +2228,24 @@ struct ConstraintBetweenCallPaths {
     std::cerr << RESET;
   }
 
+  void report(LvaWriter &writer) const {
+    const auto &klee_interface =
+        source_call_path_packet_manager.get_klee_interface();
+
+    writer.put(LVA_CALL_PATHS_CONSTRAINT);
+    writer.put_string(klee_interface->expr_to_smt(expression));
+
+    writer.put_string(source_call_path_filename);
+    writer.put_string("source");
+    writer.put(source_chunk_id);
+    source_call_path_packet_manager.report(writer);
+
+    writer.put_string(pair_call_path_filename);
+    writer.put_string("pair");
+    writer.put(pair_chunk_id);
+    pair_call_path_packet_manager.report(writer);
+  }
+
   void report() const {
     const auto &klee_interface =
         source_call_path_packet_manager.get_klee_interface();
@@ -2102,6 +2492,11 @@ public:
       generated->print();
   }
 
+  void report(LvaWriter &writer) const {
+    for (const auto &generated : generated_constraints_between_call_paths)
+      generated->report(writer);
+  }
+
   void report() const {
     for (const auto &generated : generated_constraints_between_call_paths)
       generated->report();
@@ -2279,6 +2674,31 @@ private:
   }
 };
 
+// The analysis of a call path only depends on its content, so its cache
+// entry is named after an FNV-1a hash of the file.
+std::string get_cache_file(const std::string &call_path_filename) {
+  std::ifstream call_path_file(call_path_filename, std::ios::binary);
+  assert(call_path_file.is_open() && "Unable to open call path file.");
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  char buffer[1 << 16];
+
+  while (call_path_file.read(buffer, sizeof(buffer)) ||
+         call_path_file.gcount()) {
+    for (std::streamsize i = 0; i < call_path_file.gcount(); i++) {
+      hash ^= static_cast<unsigned char>(buffer[i]);
+      hash *= 0x100000001b3ull;
+    }
+  }
+
+  std::stringstream cache_file;
+  cache_file << CacheDir << "/" << std::hex << std::setw(16)
+             << std::setfill('0') << hash << ".v" << std::dec
+             << ANALYSIS_CACHE_VERSION << ".analysis";
+
+  return cache_file.str();
+}
+
 int main(int argc, char **argv) {
   llvm::cl::ParseCommandLineOptions(argc, argv);
 
@@ -2286,15 +2706,33 @@ int main(int argc, char **argv) {
   ConstraintsAnalyser constraints_analyser;
   AccessesStitcher accesses_stitcher;
 
+  if (!CacheDir.empty()) {
+    mkdir(CacheDir.c_str(), 0755);
+  }
+
   for (auto file : InputCallPathFiles) {
-    std::cerr << "Loading: " << file << std::endl;
+    std::string cache_file;
+    call_path_t *call_path;
+
+    if (!CacheDir.empty()) {
+      cache_file = get_cache_file(file);
+    }
 
-    std::vector<std::string> expressions_str;
-    std::deque<klee::ref<klee::Expr>> expressions;
+    if (!cache_file.empty() &&
+        BinaryReader::is_binary(cache_file, BINARY_ANALYSIS_MAGIC)) {
+      std::cerr << "Cached: " << file << std::endl;
 
-    call_path_t *call_path = load_call_path(file, expressions_str, expressions);
+      call_path = libvig_manager.load_call_path_analysis(file, cache_file);
+    } else {
+      std::cerr << "Loading: " << file << std::endl;
+
+      std::vector<std::string> expressions_str;
+      std::deque<klee::ref<klee::Expr>> expressions;
+
+      call_path = load_call_path(file, expressions_str, expressions);
+      libvig_manager.analyse_call_path(file, call_path, cache_file);
+    }
 
-    libvig_manager.analyse_call_path(file, call_path);
     constraints_analyser.store_libvig_packet_constraints(file, call_path);
   }
 
@@ -2310,5 +2748,14 @@ int main(int argc, char **argv) {
   libvig_manager.report();
   constraints_analyser.report();
 
+  if (!BinaryLVA.empty()) {
+    LvaWriter writer;
+
+    libvig_manager.report(writer);
+    constraints_analyser.report(writer);
+
+    writer.write(BinaryLVA);
+  }
+
   return 0;
 }
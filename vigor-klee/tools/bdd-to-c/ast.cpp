@@ -5,6 +5,10 @@ constexpr char AST::CHUNK_LAYER_2[];
 constexpr char AST::CHUNK_LAYER_3[];
 constexpr char AST::CHUNK_LAYER_4[];
 
+const std::vector<std::string> AST::LIBVIG_OBJECT_ARGS{
+  "map", "vector", "chain", "sketch", "cht", "active_backends"
+};
+
 std::string get_symbol_label(const std::string &wanted,
                              const BDD::symbols_t &symbols) {
   for (auto symbol : symbols) {
@@ -389,6 +393,11 @@ Variable_ptr AST::get_from_local_by_addr(const std::string &symbol,
 Variable_ptr AST::get_from_state(unsigned int addr) {
   assert(addr != 0);
 
+  auto host_it = fused_vector_hosts.find(addr);
+  if (host_it != fused_vector_hosts.end()) {
+    addr = host_it->second;
+  }
+
   auto addr_finder = [&](Variable_ptr v) -> bool {
     return v->get_addr() == addr;
   };
@@ -506,6 +515,118 @@ void AST::push_to_local(Variable_ptr var, klee::ref<klee::Expr> expr) {
   local_variables.back().push_back(std::make_pair(var, expr));
 }
 
+// Every lcore gets its share of the capacity, see sn_capacity in the
+// shared-nothing boilerplate.
+Expr_ptr AST::partition_capacity(Expr_ptr capacity, TargetOption target) const {
+  if (target != TargetOption::SHARED_NOTHING ||
+      capacity->get_kind() != Node::NodeKind::CONSTANT) {
+    return capacity;
+  }
+
+  auto value = static_cast<Constant *>(capacity.get())->get_value();
+
+  if (!partitioned_capacities.count(value)) {
+    return capacity;
+  }
+
+  auto u32 = PrimitiveType::build(PrimitiveType::PrimitiveKind::UINT32_T);
+  std::vector<ExpressionType_ptr> args{ capacity };
+
+  return FunctionCall::build("sn_capacity", args, u32);
+}
+
+const AST::fused_vectors_t *AST::get_fused_vectors(unsigned int addr) const {
+  for (const auto &fused : fused_vectors) {
+    if (std::find(fused.members.begin(), fused.members.end(), addr) !=
+        fused.members.end()) {
+      return &fused;
+    }
+  }
+
+  return nullptr;
+}
+
+uint64_t AST::get_fused_vector_offset(unsigned int addr) const {
+  auto fused = get_fused_vectors(addr);
+
+  if (!fused) {
+    return 0;
+  }
+
+  auto it = std::find(fused->members.begin(), fused->members.end(), addr);
+  return fused->offsets[it - fused->members.begin()];
+}
+
+// Initializes each member's value in the element of the fused vector.
+Node_ptr AST::build_fused_vectors_init(const fused_vectors_t &fused,
+                                       const std::string &name) const {
+  auto void_type = PrimitiveType::build(PrimitiveType::PrimitiveKind::VOID);
+  auto u8_ptr = Pointer::build(
+      PrimitiveType::build(PrimitiveType::PrimitiveKind::UINT8_T));
+  auto obj = Variable::build("obj", Pointer::build(void_type));
+
+  std::vector<Node_ptr> nodes;
+
+  for (unsigned i = 0; i < fused.members.size(); i++) {
+    Expr_ptr member_obj = obj;
+
+    if (fused.offsets[i]) {
+      auto offset = Constant::build(PrimitiveType::PrimitiveKind::UINT32_T,
+                                    fused.offsets[i]);
+      member_obj = Add::build(Cast::build(obj, u8_ptr), offset);
+    }
+
+    std::vector<ExpressionType_ptr> args{ member_obj };
+    auto init_elem = FunctionCall::build(fused.init_elems[i], args, void_type);
+    init_elem->set_terminate_line(true);
+
+    nodes.push_back(init_elem);
+  }
+
+  std::vector<FunctionArgDecl_ptr> init_args{
+    FunctionArgDecl::build("obj", Pointer::build(void_type)),
+  };
+
+  return Function::build(name, init_args, Block::build(nodes), void_type);
+}
+
+// Hybrid NFs use the shared-nothing flavour of the objects RSS partitions, and
+// the lock based one of every other object.
+TargetOption AST::get_object_target(uint64_t addr, TargetOption target) const {
+  if (target != TargetOption::HYBRID) {
+    return target;
+  }
+
+  if (partitioned_objects.count(addr)) {
+    return TargetOption::SHARED_NOTHING;
+  }
+
+  return TargetOption::LOCKS;
+}
+
+TargetOption AST::get_call_target(call_t call, TargetOption target) const {
+  if (target != TargetOption::HYBRID) {
+    return target;
+  }
+
+  for (const auto &arg : LIBVIG_OBJECT_ARGS) {
+    if (!call.args.count(arg)) {
+      continue;
+    }
+
+    auto obj = call.args[arg].expr;
+
+    if (obj.isNull() || obj->getKind() != klee::Expr::Kind::Constant) {
+      continue;
+    }
+
+    auto addr = static_cast<klee::ConstantExpr *>(obj.get())->getZExtValue();
+    return get_object_target(addr, target);
+  }
+
+  return target;
+}
+
 Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
                                         TargetOption target) {
   auto call = bdd_call->get_call();
@@ -517,11 +638,14 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
   PrimitiveType_ptr ret_type;
   std::string ret_symbol;
 
+  auto object_target = target;
+
   if (fname == "map_allocate") {
     Expr_ptr map_out_expr = transpile(this, call.args["map_out"].out);
     assert(map_out_expr->get_kind() == Node::NodeKind::CONSTANT);
     uint64_t map_addr =
         (static_cast<Constant *>(map_out_expr.get()))->get_value();
+    object_target = get_object_target(map_addr, target);
 
     assert(call.args["keq"].fn_ptr_name.first);
     assert(call.args["khash"].fn_ptr_name.first);
@@ -559,15 +683,16 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
 
     Expr_ptr capacity = transpile(this, call.args["capacity"].expr);
     assert(capacity);
+    capacity = partition_capacity(capacity, object_target);
 
-    Type_ptr map_type = Struct::build(translate_struct("Map", target));
+    Type_ptr map_type = Struct::build(translate_struct("Map", object_target));
     Variable_ptr new_map = generate_new_symbol("map", map_type, 1, 0);
     new_map->set_addr(map_addr);
 
     push_to_state(new_map);
 
     // hack
-    if (target == TargetOption::SHARED_NOTHING) {
+    if (object_target == TargetOption::SHARED_NOTHING) {
       new_map = generate_new_symbol("(*" + new_map->get_symbol() + "_ptr)",
                                     map_type, 1, 0);
     }
@@ -584,15 +709,37 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
     assert(vector_out_expr->get_kind() == Node::NodeKind::CONSTANT);
     uint64_t vector_addr =
         (static_cast<Constant *>(vector_out_expr.get()))->get_value();
+    object_target = get_object_target(vector_addr, target);
 
     assert(call.args["init_elem"].fn_ptr_name.first);
     Type_ptr void_type =
         PrimitiveType::build(PrimitiveType::PrimitiveKind::VOID);
 
+    auto fused = get_fused_vectors(vector_addr);
+
+    // Allocated along with the first of the vectors it is fused with, whose
+    // allocation nf_init already checked.
+    if (fused && fused_vector_hosts.count(vector_addr)) {
+      ret_type = PrimitiveType::build(PrimitiveType::PrimitiveKind::INT);
+      ret_symbol = get_symbol_label("vector_alloc_success", symbols);
+
+      Variable_ptr ret_var = generate_new_symbol(ret_symbol, ret_type);
+      ret_var->set_wrap(false);
+      push_to_local(ret_var);
+
+      auto one = Constant::build(PrimitiveType::PrimitiveKind::INT, 1);
+      Assignment_ptr assignment =
+          Assignment::build(VariableDecl::build(ret_var), one);
+      assignment->set_terminate_line(true);
+
+      return assignment;
+    }
+
     Expr_ptr elem_size = transpile(this, call.args["elem_size"].expr);
     assert(elem_size);
     Expr_ptr capacity = transpile(this, call.args["capacity"].expr);
     assert(capacity);
+    capacity = partition_capacity(capacity, object_target);
 
     Expr_ptr init_elem =
         Variable::build(call.args["init_elem"].fn_ptr_name.second, void_type);
@@ -609,14 +756,44 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
     init_elem_decl->set_terminate_line(true);
     push_global_code(init_elem_decl);
 
-    Type_ptr vector_type = Struct::build(translate_struct("Vector", target));
+    if (fused) {
+      std::set<std::string> declared{
+        call.args["init_elem"].fn_ptr_name.second
+      };
+
+      for (const auto &member_init_elem : fused->init_elems) {
+        if (!declared.insert(member_init_elem).second) {
+          continue;
+        }
+
+        auto member_init_elem_decl = Function::build(
+            member_init_elem, init_elem_args, init_elem_ret_type);
+        member_init_elem_decl->set_terminate_line(true);
+        push_global_code(member_init_elem_decl);
+      }
+
+      auto fused_init_elem = "fused_vector_init_elem_" +
+                             std::to_string(fused - fused_vectors.data());
+      push_global_code(build_fused_vectors_init(*fused, fused_init_elem));
+
+      elem_size = Constant::build(PrimitiveType::PrimitiveKind::INT,
+                                  fused->elem_size);
+      init_elem = Variable::build(fused_init_elem, void_type);
+
+      for (auto member : fused->members) {
+        fused_vector_hosts[member] = vector_addr;
+      }
+    }
+
+    Type_ptr vector_type =
+        Struct::build(translate_struct("Vector", object_target));
     Variable_ptr new_vector = generate_new_symbol("vector", vector_type, 1, 0);
     new_vector->set_addr(vector_addr);
 
     push_to_state(new_vector);
 
     // hack
-    if (target == TargetOption::SHARED_NOTHING) {
+    if (object_target == TargetOption::SHARED_NOTHING) {
       new_vector = generate_new_symbol(
           "(*" + new_vector->get_symbol() + "_ptr)", vector_type, 1, 0);
     }
@@ -633,19 +810,21 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
     assert(chain_out_expr->get_kind() == Node::NodeKind::CONSTANT);
     uint64_t dchain_addr =
         (static_cast<Constant *>(chain_out_expr.get()))->get_value();
+    object_target = get_object_target(dchain_addr, target);
 
     Expr_ptr index_range = transpile(this, call.args["index_range"].expr);
     assert(index_range);
+    index_range = partition_capacity(index_range, object_target);
 
     Type_ptr dchain_type =
-        Struct::build(translate_struct("DoubleChain", target));
+        Struct::build(translate_struct("DoubleChain", object_target));
     Variable_ptr new_dchain = generate_new_symbol("dchain", dchain_type, 1, 0);
     new_dchain->set_addr(dchain_addr);
 
     push_to_state(new_dchain);
 
     // hack
-    if (target == TargetOption::SHARED_NOTHING) {
+    if (object_target == TargetOption::SHARED_NOTHING) {
       new_dchain = generate_new_symbol(
           "(*" + new_dchain->get_symbol() + "_ptr)", dchain_type, 1, 0);
     }
@@ -685,15 +864,17 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
     assert(sketch_out_expr->get_kind() == Node::NodeKind::CONSTANT);
     uint64_t sketch_addr =
         (static_cast<Constant *>(sketch_out_expr.get()))->get_value();
+    object_target = get_object_target(sketch_addr, target);
 
-    Type_ptr sketch_type = Struct::build(translate_struct("Sketch", target));
+    Type_ptr sketch_type =
+        Struct::build(translate_struct("Sketch", object_target));
     Variable_ptr new_sketch = generate_new_symbol("sketch", sketch_type, 1, 0);
     new_sketch->set_addr(sketch_addr);
 
     push_to_state(new_sketch);
 
     // hack
-    if (target == TargetOption::SHARED_NOTHING) {
+    if (object_target == TargetOption::SHARED_NOTHING) {
       new_sketch = generate_new_symbol(
           "(*" + new_sketch->get_symbol() + "_ptr)", sketch_type, 1, 0);
     }
@@ -710,6 +891,7 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
     assert(vector_expr->get_kind() == Node::NodeKind::CONSTANT);
     uint64_t vector_addr =
         (static_cast<Constant *>(vector_expr.get()))->get_value();
+    object_target = get_object_target(vector_addr, target);
 
     Expr_ptr vector = get_from_state(vector_addr);
     Expr_ptr cht_height = transpile(this, call.args["cht_height"].expr);
@@ -749,10 +931,25 @@ Node_ptr AST::init_state_node_from_call(const BDD::Call *bdd_call,
     assert(false && "Not implemented");
   }
 
-  fname = translate_fname(fname, target);
+  fname = translate_fname(fname, object_target);
   assert(args.size() == call.args.size());
 
-  FunctionCall_ptr fcall = FunctionCall::build(fname, args, ret_type);
+  Expr_ptr fcall = FunctionCall::build(fname, args, ret_type);
+
+  // Every lcore runs nf_init, but shared objects are only set up once.
+  if (target == TargetOption::HYBRID && object_target == TargetOption::LOCKS) {
+    auto ret = PrimitiveType::build(PrimitiveType::PrimitiveKind::INT);
+    std::vector<ExpressionType_ptr> no_args;
+
+    auto rte_get_master_lcore =
+        FunctionCall::build("rte_get_master_lcore", no_args, ret);
+    auto rte_lcore_id = FunctionCall::build("rte_lcore_id", no_args, ret);
+    auto is_master = Equals::build(rte_get_master_lcore, rte_lcore_id);
+
+    auto one = Constant::build(PrimitiveType::PrimitiveKind::INT, 1);
+
+    fcall = Select::build(is_master, fcall, one);
+  }
 
   if (ret_type->get_primitive_kind() != PrimitiveType::PrimitiveKind::VOID) {
     assert(ret_symbol.size());
@@ -864,6 +1061,88 @@ const BDD::Call *find_vector_return_with_value(const BDD::Node *root,
   return nullptr;
 }
 
+// Calls that give up and ask for the write lock when working on a lock based
+// object in read mode.
+const std::set<std::string> write_attempting_calls{
+  "map_put",
+  "map_erase",
+  "dchain_allocate_new_index",
+  "dchain_free_index",
+  "sketch_touch_buckets",
+  "sketch_expire",
+  "expire_items_single_map",
+  "expire_items_single_map_offseted",
+  "expire_items_single_map_iteratively",
+};
+
+// Writes that can be done twice, as there is nothing left to expire the
+// second time around.
+const std::set<std::string> repeatable_writes{
+  "sketch_expire",
+  "expire_items_single_map",
+  "expire_items_single_map_offseted",
+  "expire_items_single_map_iteratively",
+};
+
+// Whether a packet going through this node may still need the write lock of
+// the lock based objects, having to be processed all over again.
+bool AST::may_attempt_shared_write(const BDD::Node *root) const {
+  std::vector<const BDD::Node *> nodes{ root };
+
+  while (nodes.size()) {
+    auto node = nodes.back();
+    nodes.pop_back();
+
+    if (!node) {
+      continue;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::BRANCH) {
+      auto node_branch = static_cast<const BDD::Branch *>(node);
+
+      nodes.push_back(node_branch->get_on_true().get());
+      nodes.push_back(node_branch->get_on_false().get());
+
+      continue;
+    }
+
+    if (node->get_type() != BDD::Node::NodeType::CALL) {
+      continue;
+    }
+
+    nodes.push_back(node->get_next().get());
+
+    auto node_call = static_cast<const BDD::Call *>(node);
+    auto call = node_call->get_call();
+
+    if (get_call_target(call, TargetOption::HYBRID) != TargetOption::LOCKS) {
+      continue;
+    }
+
+    if (write_attempting_calls.count(call.function_name)) {
+      return true;
+    }
+
+    if (call.function_name != "vector_borrow") {
+      continue;
+    }
+
+    auto vector_return =
+        find_vector_return_with_obj(node_call, call.args["vector"].expr);
+    assert(vector_return && "vector_return not found after vector_borrow");
+
+    auto before_value = call.extra_vars["borrowed_cell"].second;
+    auto after_value = vector_return->get_call().args["value"].in;
+
+    if (!BDD::solver_toolbox.are_exprs_always_equal(before_value,
+                                                    after_value)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 Node_ptr AST::process_state_node_from_call(const BDD::Call *bdd_call,
                                            TargetOption target) {
   auto call = bdd_call->get_call();
@@ -886,6 +1165,8 @@ Node_ptr AST::process_state_node_from_call(const BDD::Call *bdd_call,
   bool check_write_attempt = false;
   bool write_attempt = false;
 
+  auto object_target = get_call_target(call, target);
+
   if (fname == "current_time") {
     associate_expr_to_local("now", call.ret);
     ignore = true;
@@ -1327,6 +1608,16 @@ Node_ptr AST::process_state_node_from_call(const BDD::Call *bdd_call,
     auto before_value = call.extra_vars["borrowed_cell"].second;
     auto after_value = vector_return_call.args["value"].in;
 
+    auto offset = get_fused_vector_offset(vector_addr);
+
+    // Point at this vector's value in the element of the fused vector.
+    if (offset) {
+      Expr_ptr offset_expr =
+          Constant::build(PrimitiveType::PrimitiveKind::UINT32_T, offset);
+      after_call_exprs.push_back(
+          Assignment::build(val_out, Add::build(val_out, offset_expr)));
+    }
+
     auto changes = apply_changes(this, val_out, before_value, after_value);
 
     write_attempt = changes.size();
@@ -1381,6 +1672,15 @@ Node_ptr AST::process_state_node_from_call(const BDD::Call *bdd_call,
     Expr_ptr value = get_from_local_by_addr("val_out", value_addr);
     assert(value);
 
+    auto offset = get_fused_vector_offset(vector_addr);
+
+    // Vectors take back the whole element they lent.
+    if (offset) {
+      Expr_ptr offset_expr =
+          Constant::build(PrimitiveType::PrimitiveKind::UINT32_T, offset);
+      value = Sub::build(value, offset_expr);
+    }
+
     Expr_ptr index_arg = index;
 
     if (index->get_type()->get_type_kind() == Type::TypeKind::POINTER) {
@@ -1662,7 +1962,7 @@ Node_ptr AST::process_state_node_from_call(const BDD::Call *bdd_call,
     assert(false && "Not implemented");
   }
 
-  fname = translate_fname(fname, target);
+  fname = translate_fname(fname, object_target);
 
   if (!ignore) {
     assert(call.function_name != fname || args.size() == call.args.size());
@@ -1726,13 +2026,25 @@ Node_ptr AST::process_state_node_from_call(const BDD::Call *bdd_call,
 
   std::vector<Node_ptr> nodes;
 
-  if (target == LOCKS && write_attempt) {
+  // Writes on partitioned objects are not undone if the packet is processed
+  // again with the write lock, so they wait for it if it may be needed.
+  auto unrepeatable_write =
+      write_attempt || (write_attempting_calls.count(call.function_name) &&
+                        !repeatable_writes.count(call.function_name));
+
+  if (target == HYBRID && object_target == SHARED_NOTHING &&
+      unrepeatable_write &&
+      may_attempt_shared_write(bdd_call->get_next().get())) {
+    nodes.push_back(AST::write_attempt());
+  }
+
+  if (object_target == LOCKS && write_attempt) {
     nodes.push_back(AST::write_attempt());
   }
 
   nodes.insert(nodes.end(), exprs.begin(), exprs.end());
 
-  if (target == LOCKS && check_write_attempt) {
+  if (object_target == LOCKS && check_write_attempt) {
     nodes.push_back(AST::check_write_attempt());
   }
 
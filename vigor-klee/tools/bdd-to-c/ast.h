@@ -8,6 +8,7 @@
 #include <iostream>
 #include <memory>
 #include <regex>
+#include <set>
 #include <stack>
 #include <vector>
 
@@ -17,6 +18,16 @@
 #include "nodes.h"
 
 class AST {
+public:
+  // Vectors always borrowed together and with the same index, allocated as a
+  // single one holding each member's value at its offset in the element.
+  struct fused_vectors_t {
+    std::vector<unsigned int> members;
+    std::vector<std::string> init_elems;
+    std::vector<uint64_t> offsets;
+    uint64_t elem_size;
+  };
+
 private:
   enum Context {
     INIT,
@@ -43,6 +54,18 @@ private:
   std::vector<Variable_ptr> state;
   stack_t local_variables;
 
+  // Shared-nothing state with these capacities is split between the lcores.
+  std::set<uint64_t> partitioned_capacities;
+
+  // Hybrid NFs keep these objects per lcore, like shared-nothing ones, and
+  // every other one shared, like lock based ones.
+  std::set<unsigned int> partitioned_objects;
+
+  // Vectors allocated as part of another one, by address, and the vector that
+  // allocated them, once it did.
+  std::vector<fused_vectors_t> fused_vectors;
+  std::map<unsigned int, unsigned int> fused_vector_hosts;
+
   std::vector<Node_ptr> global_code;
   Node_ptr nf_init;
   Node_ptr nf_process;
@@ -52,6 +75,10 @@ public:
   static constexpr char CHUNK_LAYER_3[] = "ipv4_header";
   static constexpr char CHUNK_LAYER_4[] = "tcpudp_header";
 
+  // Arguments holding the object a libvig call works on. Objects used together
+  // by a single call always get the same flavour.
+  static const std::vector<std::string> LIBVIG_OBJECT_ARGS;
+
   struct chunk_t {
     Variable_ptr var;
     unsigned int start_index;
@@ -82,6 +109,17 @@ private:
                                    unsigned int counter_begins);
   Variable_ptr generate_new_symbol(const std::string &symbol, Type_ptr type);
 
+  Expr_ptr partition_capacity(Expr_ptr capacity, TargetOption target) const;
+
+  const fused_vectors_t *get_fused_vectors(unsigned int addr) const;
+  uint64_t get_fused_vector_offset(unsigned int addr) const;
+  Node_ptr build_fused_vectors_init(const fused_vectors_t &fused,
+                                    const std::string &name) const;
+
+  TargetOption get_object_target(uint64_t addr, TargetOption target) const;
+  TargetOption get_call_target(call_t call, TargetOption target) const;
+  bool may_attempt_shared_write(const BDD::Node *root) const;
+
   Node_ptr init_state_node_from_call(const BDD::Call *bdd_call,
                                      TargetOption target);
   Node_ptr process_state_node_from_call(const BDD::Call *bdd_call,
@@ -240,6 +278,22 @@ public:
   void push();
   void pop();
 
+  void set_partitioned_capacities(const std::set<uint64_t> &capacities) {
+    partitioned_capacities = capacities;
+  }
+
+  void set_partitioned_objects(const std::set<unsigned int> &objects) {
+    partitioned_objects = objects;
+  }
+
+  bool is_partitioned(unsigned int addr) const {
+    return partitioned_objects.count(addr);
+  }
+
+  void set_fused_vectors(const std::vector<fused_vectors_t> &vectors) {
+    fused_vectors = vectors;
+  }
+
   void push_to_state(Variable_ptr var);
   void push_to_local(Variable_ptr var);
   void push_to_local(Variable_ptr var, klee::ref<klee::Expr> expr);
@@ -14,12 +14,13 @@
 #include <iomanip>
 #include <iostream>
 #include <memory>
-#include <regex>
+#include <set>
 #include <stack>
 #include <utility>
 #include <vector>
 
 #include "ast.h"
+#include "bdd-profile.h"
 #include "call-paths-to-bdd.h"
 #include "load-call-paths.h"
 #include "nodes.h"
@@ -54,8 +55,35 @@ llvm::cl::opt<TargetOption> Target(
                      clEnumValN(LOCKS, "locks", "Lock based"),
                      clEnumValN(TM, "tm", "Transactional memory"),
                      clEnumValN(CALL_PATH_HITTER, "cph", "Call path hitter"),
+                     clEnumValN(HYBRID, "hybrid",
+                                "Shared-nothing or lock based, per object"),
                      clEnumValEnd),
     llvm::cl::Required);
+
+llvm::cl::opt<std::string> Objects(
+    "objects",
+    llvm::cl::desc("Objects file of rss-config-from-lvas, telling the hybrid "
+                   "target which objects RSS partitions."),
+    llvm::cl::cat(SynthesizerCat));
+
+llvm::cl::opt<std::string> ProfileReport(
+    "profile",
+    llvm::cl::desc("Call path hitter report of a replay, used to lay out hot "
+                   "branches first and move cold ones out of the way."),
+    llvm::cl::cat(SynthesizerCat));
+
+llvm::cl::opt<double> ColdRatio(
+    "cold-ratio",
+    llvm::cl::desc("Fraction of the profiled packets under which a path is "
+                   "considered cold."),
+    llvm::cl::init(0.01), llvm::cl::cat(SynthesizerCat));
+
+llvm::cl::opt<bool> FuseVectors(
+    "fuse-vectors",
+    llvm::cl::desc("Allocate the vectors always borrowed together, with the "
+                   "same index, as a single one, so that the values of a flow "
+                   "share cache lines."),
+    llvm::cl::init(false), llvm::cl::cat(SynthesizerCat));
 } // namespace
 
 Node_ptr
@@ -71,14 +99,8 @@ preppend_call_path_hitter(AST &ast,
     return node;
   }
 
-  auto call_path = call_path_filenames[0];
-
-  std::regex call_path_match("test(\\d+)");
-  std::smatch matches;
-
-  auto match = std::regex_search(call_path, matches, call_path_match);
-  assert(match);
-  auto call_path_i = std::stoi(matches[1].str()) - 1;
+  auto call_path_i = BDD::Profile::get_call_path_index(call_path_filenames[0]);
+  assert(call_path_i >= 0);
 
   auto byte = PrimitiveType::build(PrimitiveType::PrimitiveKind::UINT8_T);
   auto idx = Constant::build(PrimitiveType::PrimitiveKind::INT, call_path_i);
@@ -99,7 +121,62 @@ preppend_call_path_hitter(AST &ast,
   return Block::build(nodes);
 }
 
-Node_ptr build_ast(AST &ast, const BDD::Node *root, TargetOption target) {
+Node_ptr preppend_cold_label(const BDD::Node *bdd_node, Node_ptr node) {
+  auto label = Label::build("cold_path_" + std::to_string(bdd_node->get_id()),
+                            true);
+
+  if (node->get_kind() == Node::NodeKind::BLOCK) {
+    auto block = static_cast<Block *>(node.get());
+    block->set_enclose(false);
+  }
+
+  std::vector<Node_ptr> nodes = {label, node};
+  return Block::build(nodes);
+}
+
+// Lays out the hottest side of the branch first, hints the condition if the
+// branch is biased and marks cold sides, so that the compiler moves them out
+// of the hot text of the function.
+Node_ptr build_profiled_branch(const BDD::Profile &profile,
+                               const BDD::Branch *branch_node, Expr_ptr cond,
+                               Node_ptr then_node, Node_ptr else_node,
+                               std::vector<std::string> on_true_filenames,
+                               std::vector<std::string> on_false_filenames) {
+  auto on_true_bdd = branch_node->get_on_true().get();
+  auto on_false_bdd = branch_node->get_on_false().get();
+
+  if (profile.is_cold(on_true_bdd)) {
+    then_node = preppend_cold_label(on_true_bdd, then_node);
+  }
+
+  if (profile.is_cold(on_false_bdd)) {
+    else_node = preppend_cold_label(on_false_bdd, else_node);
+  }
+
+  if (profile.get_hits(on_false_bdd) > profile.get_hits(on_true_bdd)) {
+    if (cond->get_kind() == Node::NodeKind::NOT) {
+      cond = static_cast<Not *>(cond.get())->get_expr();
+    } else {
+      cond = Not::build(cond);
+    }
+
+    std::swap(then_node, else_node);
+    std::swap(on_true_filenames, on_false_filenames);
+  }
+
+  auto branch = Branch::build(cond, then_node, else_node, on_true_filenames,
+                              on_false_filenames);
+
+  // The hot side is the first one now.
+  if (profile.get_bias(branch_node) != BDD::Profile::NO_BIAS) {
+    branch->set_expected(true);
+  }
+
+  return branch;
+}
+
+Node_ptr build_ast(AST &ast, const BDD::Node *root, TargetOption target,
+                   const BDD::Profile *profile) {
   std::vector<Node_ptr> nodes;
 
   while (root != nullptr) {
@@ -116,11 +193,11 @@ Node_ptr build_ast(AST &ast, const BDD::Node *root, TargetOption target) {
       auto cond = branch_node->get_condition();
 
       ast.push();
-      auto then_node = build_ast(ast, on_true_bdd.get(), target);
+      auto then_node = build_ast(ast, on_true_bdd.get(), target, profile);
       ast.pop();
 
       ast.push();
-      auto else_node = build_ast(ast, on_false_bdd.get(), target);
+      auto else_node = build_ast(ast, on_false_bdd.get(), target, profile);
       ast.pop();
 
       auto cond_node = transpile(&ast, cond);
@@ -139,8 +216,17 @@ Node_ptr build_ast(AST &ast, const BDD::Node *root, TargetOption target) {
             preppend_call_path_hitter(ast, on_false_filenames, else_node);
       }
 
-      Node_ptr branch = Branch::build(cond_node, then_node, else_node,
-                                      on_true_filenames, on_false_filenames);
+      Node_ptr branch;
+
+      if (profile) {
+        branch = build_profiled_branch(*profile, branch_node, cond_node,
+                                       then_node, else_node, on_true_filenames,
+                                       on_false_filenames);
+      } else {
+        branch = Branch::build(cond_node, then_node, else_node,
+                               on_true_filenames, on_false_filenames);
+      }
+
       nodes.push_back(branch);
 
       root = nullptr;
@@ -220,8 +306,414 @@ Node_ptr build_ast(AST &ast, const BDD::Node *root, TargetOption target) {
   return Block::build(nodes);
 }
 
-void build_ast(AST &ast, const BDD::BDD &bdd, TargetOption target) {
-  auto init_root = build_ast(ast, bdd.get_init().get(), target);
+uint64_t get_constant_arg(const call_t &call, const std::string &arg) {
+  auto expr = call.args.at(arg).expr;
+  assert(expr->getKind() == klee::Expr::Kind::Constant);
+  return static_cast<klee::ConstantExpr *>(expr.get())->getZExtValue();
+}
+
+// Capacities of the maps and double chains, and of the vectors sized like
+// them, hold per flow state, and RSS spreads flows over the lcores. Backend
+// capacities given to cht_fill_cht are left alone, as every lcore balances
+// over all the backends.
+std::set<uint64_t> get_partitioned_capacities(const BDD::BDD &bdd) {
+  std::set<uint64_t> capacities;
+  std::set<uint64_t> shared;
+
+  std::vector<const BDD::Node *> nodes{ bdd.get_init().get() };
+
+  while (nodes.size()) {
+    auto node = nodes.back();
+    nodes.pop_back();
+
+    if (!node) {
+      continue;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::BRANCH) {
+      auto branch_node = static_cast<const BDD::Branch *>(node);
+
+      nodes.push_back(branch_node->get_on_true().get());
+      nodes.push_back(branch_node->get_on_false().get());
+      continue;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::CALL) {
+      auto call = static_cast<const BDD::Call *>(node)->get_call();
+
+      if (call.function_name == "map_allocate") {
+        capacities.insert(get_constant_arg(call, "capacity"));
+      } else if (call.function_name == "dchain_allocate") {
+        capacities.insert(get_constant_arg(call, "index_range"));
+      } else if (call.function_name == "cht_fill_cht") {
+        shared.insert(get_constant_arg(call, "cht_height"));
+        shared.insert(get_constant_arg(call, "backend_capacity"));
+      }
+    }
+
+    nodes.push_back(node->get_next().get());
+  }
+
+  for (auto capacity : shared) {
+    capacities.erase(capacity);
+  }
+
+  return capacities;
+}
+
+// Objects the objects file says RSS partitions, one "<object> partitioned" or
+// "<object> shared" per line. Objects used by the same libvig call as a shared
+// one are shared too, as calls take objects of a single flavour.
+std::set<unsigned int> get_partitioned_objects(const BDD::BDD &bdd,
+                                               const std::string &filename) {
+  std::set<unsigned int> partitioned;
+
+  std::ifstream objects_file(filename);
+  assert(objects_file.is_open() && "Unable to open the objects file");
+
+  unsigned int object;
+  std::string kind;
+
+  while (objects_file >> object >> kind) {
+    assert((kind == "partitioned" || kind == "shared") &&
+           "Malformed objects file");
+
+    if (kind == "partitioned") {
+      partitioned.insert(object);
+    }
+  }
+
+  assert(objects_file.eof() && "Malformed objects file");
+
+  std::vector<std::vector<unsigned int>> used_together;
+  std::vector<const BDD::Node *> nodes{ bdd.get_process().get() };
+
+  while (nodes.size()) {
+    auto node = nodes.back();
+    nodes.pop_back();
+
+    if (!node) {
+      continue;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::BRANCH) {
+      auto branch_node = static_cast<const BDD::Branch *>(node);
+
+      nodes.push_back(branch_node->get_on_true().get());
+      nodes.push_back(branch_node->get_on_false().get());
+      continue;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::CALL) {
+      auto call = static_cast<const BDD::Call *>(node)->get_call();
+      std::vector<unsigned int> call_objects;
+
+      for (const auto &arg : AST::LIBVIG_OBJECT_ARGS) {
+        if (call.args.count(arg)) {
+          call_objects.push_back(get_constant_arg(call, arg));
+        }
+      }
+
+      if (call_objects.size() > 1) {
+        used_together.push_back(call_objects);
+      }
+    }
+
+    nodes.push_back(node->get_next().get());
+  }
+
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for (const auto &call_objects : used_together) {
+      auto is_shared = [&](unsigned int obj) {
+        return !partitioned.count(obj);
+      };
+
+      if (std::none_of(call_objects.begin(), call_objects.end(), is_shared) ||
+          std::all_of(call_objects.begin(), call_objects.end(), is_shared)) {
+        continue;
+      }
+
+      for (auto obj : call_objects) {
+        partitioned.erase(obj);
+      }
+
+      changed = true;
+    }
+  }
+
+  return partitioned;
+}
+
+struct vector_info_t {
+  uint64_t elem_size;
+  uint64_t capacity;
+  std::string init_elem;
+
+  // Expired by a libvig expirator, which hands its values to a map as keys.
+  bool expired;
+  bool borrowed;
+
+  // Only borrowed, returned and expired, with a constant element size and
+  // capacity.
+  bool fusable;
+};
+
+typedef std::map<unsigned int, std::vector<klee::ref<klee::Expr>>>
+    vector_borrows_t;
+
+bool get_constant_value(klee::ref<klee::Expr> expr, uint64_t &value) {
+  if (expr.isNull() || expr->getKind() != klee::Expr::Kind::Constant) {
+    return false;
+  }
+
+  value = static_cast<klee::ConstantExpr *>(expr.get())->getZExtValue();
+  return true;
+}
+
+bool are_indexes_always_equal(const std::vector<klee::ref<klee::Expr>> &lhs,
+                              const std::vector<klee::ref<klee::Expr>> &rhs) {
+  auto has_equal = [](const std::vector<klee::ref<klee::Expr>> &indexes,
+                      klee::ref<klee::Expr> index) {
+    return std::any_of(indexes.begin(), indexes.end(),
+                       [&](klee::ref<klee::Expr> other) {
+      return BDD::solver_toolbox.are_exprs_always_equal(index, other);
+    });
+  };
+
+  for (auto index : lhs) {
+    if (!has_equal(rhs, index)) {
+      return false;
+    }
+  }
+
+  for (auto index : rhs) {
+    if (!has_equal(lhs, index)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Pairs of vectors some path borrows without the other, or with other
+// indexes.
+void find_vectors_apart(
+    const BDD::Node *node, std::map<unsigned int, vector_info_t> &vectors,
+    vector_borrows_t borrows,
+    std::set<std::pair<unsigned int, unsigned int>> &apart) {
+  std::vector<std::string> expirators{ "expire_items_single_map",
+                                       "expire_items_single_map_offseted",
+                                       "expire_items_single_map_iteratively" };
+
+  while (node) {
+    if (node->get_type() == BDD::Node::NodeType::BRANCH) {
+      auto branch_node = static_cast<const BDD::Branch *>(node);
+
+      find_vectors_apart(branch_node->get_on_true().get(), vectors, borrows,
+                         apart);
+      find_vectors_apart(branch_node->get_on_false().get(), vectors, borrows,
+                         apart);
+      return;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::CALL) {
+      auto call = static_cast<const BDD::Call *>(node)->get_call();
+
+      for (const auto &arg : call.args) {
+        uint64_t addr;
+
+        if (!get_constant_value(arg.second.expr, addr) ||
+            !vectors.count(addr)) {
+          continue;
+        }
+
+        if (call.function_name == "vector_borrow" && arg.first == "vector") {
+          borrows[addr].push_back(call.args.at("index").expr);
+          vectors[addr].borrowed = true;
+        } else if (std::find(expirators.begin(), expirators.end(),
+                             call.function_name) != expirators.end() &&
+                   arg.first == "vector") {
+          vectors[addr].expired = true;
+        } else if (call.function_name != "vector_return") {
+          vectors[addr].fusable = false;
+        }
+      }
+    }
+
+    node = node->get_next().get();
+  }
+
+  for (auto lhs = vectors.begin(); lhs != vectors.end(); lhs++) {
+    for (auto rhs = std::next(lhs); rhs != vectors.end(); rhs++) {
+      auto lhs_borrows = borrows.find(lhs->first);
+      auto rhs_borrows = borrows.find(rhs->first);
+
+      if (lhs_borrows == borrows.end() && rhs_borrows == borrows.end()) {
+        continue;
+      }
+
+      if (lhs_borrows == borrows.end() || rhs_borrows == borrows.end() ||
+          !are_indexes_always_equal(lhs_borrows->second,
+                                    rhs_borrows->second)) {
+        apart.emplace(lhs->first, rhs->first);
+      }
+    }
+  }
+}
+
+// Groups the vectors every path borrows together, with the same indexes (the
+// flow's index in its double chain, usually), to be allocated as one. Members
+// must be in the same flavour of object and have the same capacity. At most
+// one is expired, and it goes first, as expirators hand the address of the
+// element they borrow to map_erase as the key.
+std::vector<AST::fused_vectors_t> get_fused_vectors(const BDD::BDD &bdd,
+                                                    const AST &ast) {
+  std::map<unsigned int, vector_info_t> vectors;
+  std::vector<const BDD::Node *> nodes{ bdd.get_init().get() };
+
+  while (nodes.size()) {
+    auto node = nodes.back();
+    nodes.pop_back();
+
+    if (!node) {
+      continue;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::BRANCH) {
+      auto branch_node = static_cast<const BDD::Branch *>(node);
+
+      nodes.push_back(branch_node->get_on_true().get());
+      nodes.push_back(branch_node->get_on_false().get());
+      continue;
+    }
+
+    if (node->get_type() == BDD::Node::NodeType::CALL) {
+      auto call = static_cast<const BDD::Call *>(node)->get_call();
+      uint64_t addr;
+
+      if (call.function_name == "vector_allocate" &&
+          get_constant_value(call.args.at("vector_out").out, addr) &&
+          !vectors.count(addr)) {
+        vector_info_t info;
+
+        info.init_elem = call.args.at("init_elem").fn_ptr_name.second;
+        info.expired = false;
+        info.borrowed = false;
+        auto elem_size = call.args.at("elem_size").expr;
+        auto capacity = call.args.at("capacity").expr;
+
+        info.fusable = get_constant_value(elem_size, info.elem_size) &&
+                       get_constant_value(capacity, info.capacity);
+
+        vectors[addr] = info;
+      }
+    }
+
+    nodes.push_back(node->get_next().get());
+  }
+
+  std::set<std::pair<unsigned int, unsigned int>> apart;
+  find_vectors_apart(bdd.get_process().get(), vectors, vector_borrows_t(),
+                     apart);
+
+  std::vector<std::vector<unsigned int>> groups;
+
+  for (const auto &vector : vectors) {
+    if (!vector.second.fusable || !vector.second.borrowed) {
+      continue;
+    }
+
+    auto fits = [&](const std::vector<unsigned int> &group) {
+      for (auto member : group) {
+        const auto &info = vectors[member];
+
+        if (apart.count(std::make_pair(member, vector.first)) ||
+            info.capacity != vector.second.capacity ||
+            (info.expired && vector.second.expired) ||
+            ast.is_partitioned(member) != ast.is_partitioned(vector.first)) {
+          return false;
+        }
+      }
+
+      return true;
+    };
+
+    auto group = std::find_if(groups.begin(), groups.end(), fits);
+
+    if (group != groups.end()) {
+      group->push_back(vector.first);
+    } else {
+      groups.push_back(std::vector<unsigned int>{ vector.first });
+    }
+  }
+
+  std::vector<AST::fused_vectors_t> fused_vectors;
+
+  for (auto &group : groups) {
+    if (group.size() < 2) {
+      continue;
+    }
+
+    std::stable_partition(group.begin(), group.end(), [&](unsigned int addr) {
+      return vectors[addr].expired;
+    });
+
+    AST::fused_vectors_t fused;
+    uint64_t max_align = 1;
+
+    fused.elem_size = 0;
+
+    for (auto member : group) {
+      const auto &info = vectors[member];
+
+      // Values are aligned as their size suggests, up to a word.
+      uint64_t align = std::min<uint64_t>(info.elem_size & -info.elem_size, 8);
+      max_align = std::max(max_align, align);
+
+      fused.elem_size = (fused.elem_size + align - 1) / align * align;
+
+      fused.members.push_back(member);
+      fused.init_elems.push_back(info.init_elem);
+      fused.offsets.push_back(fused.elem_size);
+
+      fused.elem_size += info.elem_size;
+    }
+
+    fused.elem_size = (fused.elem_size + max_align - 1) / max_align * max_align;
+
+    std::cerr << "Fusing vectors";
+    for (auto member : fused.members) {
+      std::cerr << " " << member;
+    }
+    std::cerr << " into elements of " << fused.elem_size << " bytes\n";
+
+    fused_vectors.push_back(fused);
+  }
+
+  return fused_vectors;
+}
+
+void build_ast(AST &ast, const BDD::BDD &bdd, TargetOption target,
+               const BDD::Profile *profile) {
+  if (target == SHARED_NOTHING || target == HYBRID) {
+    ast.set_partitioned_capacities(get_partitioned_capacities(bdd));
+  }
+
+  if (target == HYBRID) {
+    assert(Objects.size() && "The hybrid target needs an objects file");
+    ast.set_partitioned_objects(get_partitioned_objects(bdd, Objects));
+  }
+
+  if (FuseVectors) {
+    ast.set_fused_vectors(get_fused_vectors(bdd, ast));
+  }
+
+  // Profiles count processed packets, nf_init runs once.
+  auto init_root = build_ast(ast, bdd.get_init().get(), target, nullptr);
   std::vector<Node_ptr> intro_nodes;
 
   switch (target) {
@@ -246,9 +738,17 @@ void build_ast(AST &ast, const BDD::BDD &bdd, TargetOption target) {
 
     break;
   }
-  case SHARED_NOTHING: {
+  case SHARED_NOTHING:
+  case HYBRID: {
     auto state = ast.get_state();
     for (auto &var : state) {
+      if (target == HYBRID && !ast.is_partitioned(var->get_addr())) {
+        VariableDecl_ptr decl = VariableDecl::build(var);
+        decl->set_terminate_line(true);
+        ast.push_global_code(decl);
+        continue;
+      }
+
       // global
       std::string name = var->get_symbol();
 
@@ -365,12 +865,13 @@ void build_ast(AST &ast, const BDD::BDD &bdd, TargetOption target) {
   init_root = Block::build(intro_nodes_init);
   ast.commit(init_root);
 
-  auto process_root = build_ast(ast, bdd.get_process().get(), target);
+  auto process_root =
+      build_ast(ast, bdd.get_process().get(), target, profile);
 
   assert(process_root->get_kind() == Node::NodeKind::BLOCK);
   std::vector<Node_ptr> intro_nodes_process = intro_nodes;
 
-  if (target == LOCKS) {
+  if (target == LOCKS || target == HYBRID) {
     intro_nodes_process.push_back(AST::grab_locks());
   }
 
@@ -408,9 +909,16 @@ int main(int argc, char **argv) {
 
   auto bdd = build_bdd();
 
+  std::unique_ptr<BDD::Profile> profile;
+
+  if (ProfileReport.size()) {
+    profile = std::unique_ptr<BDD::Profile>(
+        new BDD::Profile(ProfileReport, ColdRatio));
+  }
+
   AST ast;
 
-  build_ast(ast, bdd, Target);
+  build_ast(ast, bdd, Target, profile.get());
 
   if (Out.size()) {
     auto file = std::ofstream(Out);
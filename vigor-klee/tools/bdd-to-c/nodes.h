@@ -13,7 +13,8 @@ enum TargetOption {
   SHARED_NOTHING,
   LOCKS,
   TM,
-  CALL_PATH_HITTER
+  CALL_PATH_HITTER,
+  HYBRID
 };
 
 class AST;
@@ -22,6 +23,7 @@ class Node {
 public:
   enum NodeKind {
     COMMENT,
+    LABEL,
     SIGNED_EXPRESSION,
     TYPE,
     EXPRESSION_TYPE,
@@ -157,6 +159,46 @@ public:
 
 typedef std::shared_ptr<Comment> Comment_ptr;
 
+class Label : public Node {
+private:
+  std::string name;
+  bool cold;
+
+  Label(const std::string &_name, bool _cold)
+      : Node(LABEL), name(_name), cold(_cold) {}
+
+public:
+  void synthesize(std::ostream &ofs, unsigned int lvl = 0) const override {
+    indent(ofs, lvl);
+    ofs << name << ":";
+
+    // GCC moves what follows a cold label out of the hot text of the function.
+    if (cold) {
+      ofs << " __attribute__((cold, unused))";
+    } else {
+      ofs << " __attribute__((unused))";
+    }
+
+    ofs << ";";
+  }
+
+  void debug(std::ostream &ofs, unsigned int lvl = 0) const override {
+    indent(ofs, lvl);
+    ofs << "<label";
+    ofs << " name=" << name;
+    ofs << " cold=" << cold;
+    ofs << " />"
+        << "\n";
+  }
+
+  static std::shared_ptr<Label> build(const std::string &_name, bool _cold) {
+    Label *label = new Label(_name, _cold);
+    return std::shared_ptr<Label>(label);
+  }
+};
+
+typedef std::shared_ptr<Label> Label_ptr;
+
 class Expression : public Node, public ExpressionType {
 protected:
   bool terminate_line;
@@ -1097,9 +1139,13 @@ private:
 
   Comment_ptr on_false_comment;
 
+  // Whether the condition is hinted with __builtin_expect, and as what.
+  bool expect;
+  bool expected;
+
   Branch(Expr_ptr _condition, Node_ptr _on_true, Node_ptr _on_false)
       : Node(BRANCH), condition(_condition), on_true(_on_true),
-        on_false(_on_false) {
+        on_false(_on_false), expect(false), expected(false) {
     condition->set_terminate_line(false);
     condition->set_wrap(false);
 
@@ -1112,7 +1158,8 @@ private:
   }
 
   Branch(Expr_ptr _condition, Node_ptr _on_true)
-      : Node(BRANCH), condition(_condition), on_true(_on_true) {
+      : Node(BRANCH), condition(_condition), on_true(_on_true), expect(false),
+        expected(false) {
     condition->set_terminate_line(false);
     condition->set_wrap(false);
   }
@@ -1132,6 +1179,11 @@ private:
   }
 
 public:
+  void set_expected(bool _expected) {
+    expect = true;
+    expected = _expected;
+  }
+
   void synthesize(std::ostream &ofs, unsigned int lvl = 0) const override {
     for (auto c : on_true_cps) {
       ofs << "\n";
@@ -1144,7 +1196,16 @@ public:
     indent(ofs, lvl);
 
     ofs << "if (";
-    condition->synthesize(ofs);
+
+    if (expect) {
+      // The condition is not necessarily 0 or 1, so normalize it
+      ofs << "__builtin_expect(!!(";
+      condition->synthesize(ofs);
+      ofs << "), " << expected << ")";
+    } else {
+      condition->synthesize(ofs);
+    }
+
     ofs << ") ";
 
     if (on_true->get_kind() == Node::NodeKind::BLOCK) {
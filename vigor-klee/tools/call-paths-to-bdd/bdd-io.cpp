@@ -1,4 +1,5 @@
 #include "bdd.h"
+#include "binary-io.h"
 
 #include "llvm/Support/MemoryBuffer.h"
 
@@ -887,6 +888,10 @@ void process_edge(std::string serialized_edge,
 }
 
 BDD BDD::deserialize(std::string file_path) {
+  if (BinaryReader::is_binary(file_path, BINARY_BDD_MAGIC)) {
+    return deserialize_binary(file_path);
+  }
+
   BDD bdd;
 
   std::ifstream bdd_file(file_path);
@@ -1010,4 +1015,216 @@ BDD BDD::deserialize(std::string file_path) {
   return bdd;
 }
 
-} // namespace BDD
\ No newline at end of file
+void BDD::serialize_binary(const BDD &bdd, std::string file_path) {
+  BinaryWriter writer;
+
+  std::vector<const Node *> all_nodes;
+  std::vector<const Node *> nodes{ bdd.nf_init.get(), bdd.nf_process.get() };
+
+  while (nodes.size()) {
+    auto node = nodes[0];
+    nodes.erase(nodes.begin());
+
+    all_nodes.push_back(node);
+
+    if (node->get_type() == Node::NodeType::BRANCH) {
+      auto branch_node = static_cast<const Branch *>(node);
+
+      nodes.push_back(branch_node->get_on_true().get());
+      nodes.push_back(branch_node->get_on_false().get());
+    } else if (node->get_next()) {
+      nodes.push_back(node->get_next().get());
+    }
+  }
+
+  writer.put_u64(bdd.nf_init->get_id());
+  writer.put_u64(bdd.nf_process->get_id());
+
+  writer.put(all_nodes.size());
+
+  for (auto node : all_nodes) {
+    writer.put_u64(node->get_id());
+    writer.put(node->get_type());
+
+    const auto &filenames = node->get_call_paths_filenames();
+    const auto &managers = node->get_constraints();
+
+    assert(filenames.size() == managers.size());
+    writer.put(filenames.size());
+
+    for (auto i = 0u; i < filenames.size(); i++) {
+      writer.put_string(filenames[i]);
+      writer.put(managers[i].size());
+
+      for (auto constraint : managers[i]) {
+        writer.put_expr(constraint);
+      }
+    }
+
+    switch (node->get_type()) {
+    case Node::NodeType::CALL: {
+      auto call_node = static_cast<const Call *>(node);
+
+      assert(node->get_next());
+
+      writer.put_call(call_node->get_call());
+      writer.put_u64(node->get_next()->get_id());
+      break;
+    }
+    case Node::NodeType::BRANCH: {
+      auto branch_node = static_cast<const Branch *>(node);
+
+      assert(!branch_node->get_condition().isNull());
+      assert(branch_node->get_on_true());
+      assert(branch_node->get_on_false());
+
+      writer.put_expr(branch_node->get_condition());
+      writer.put_u64(branch_node->get_on_true()->get_id());
+      writer.put_u64(branch_node->get_on_false()->get_id());
+      break;
+    }
+    case Node::NodeType::RETURN_INIT: {
+      auto return_init_node = static_cast<const ReturnInit *>(node);
+      writer.put(return_init_node->get_return_value());
+      break;
+    }
+    case Node::NodeType::RETURN_PROCESS: {
+      auto return_process_node = static_cast<const ReturnProcess *>(node);
+      writer.put(return_process_node->get_return_operation());
+      writer.put(return_process_node->get_return_value());
+      break;
+    }
+    case Node::NodeType::RETURN_RAW: {
+      assert(false);
+    }
+    }
+  }
+
+  writer.write(file_path, BINARY_BDD_MAGIC);
+}
+
+BDD BDD::deserialize_binary(std::string file_path) {
+  BDD bdd;
+
+  // Arrays must outlive the BDD, just like the ones created by the kQuery
+  // parser.
+  auto array_cache = new klee::ArrayCache();
+  BinaryReader reader(file_path, BINARY_BDD_MAGIC, *array_cache);
+
+  auto init_id = reader.get_u64();
+  auto process_id = reader.get_u64();
+
+  std::map<uint64_t, BDDNode_ptr> nodes;
+  std::vector<std::pair<uint64_t, std::vector<uint64_t>>> edges;
+
+  auto num_nodes = reader.get();
+
+  for (auto i = 0u; i < num_nodes; i++) {
+    auto id = reader.get_u64();
+    auto type = static_cast<Node::NodeType>(reader.get());
+
+    std::vector<std::string> call_paths_filenames;
+    std::vector<klee::ConstraintManager> constraint_managers;
+
+    auto num_call_paths = reader.get();
+
+    for (auto j = 0u; j < num_call_paths; j++) {
+      call_paths_filenames.push_back(reader.get_string());
+
+      std::vector<klee::ref<klee::Expr>> constraints;
+      auto num_constraints = reader.get();
+
+      for (auto k = 0u; k < num_constraints; k++) {
+        constraints.push_back(reader.get_expr());
+      }
+
+      constraint_managers.emplace_back(constraints);
+    }
+
+    BDDNode_ptr node;
+
+    switch (type) {
+    case Node::NodeType::CALL: {
+      auto call = reader.get_call();
+      auto next_id = reader.get_u64();
+
+      node = std::make_shared<Call>(id, call, nullptr, nullptr,
+                                    call_paths_filenames, constraint_managers);
+      edges.emplace_back(id, std::vector<uint64_t>{ next_id });
+      break;
+    }
+    case Node::NodeType::BRANCH: {
+      auto condition = reader.get_expr();
+      auto on_true_id = reader.get_u64();
+      auto on_false_id = reader.get_u64();
+
+      node = std::make_shared<Branch>(id, condition, nullptr, nullptr, nullptr,
+                                      call_paths_filenames,
+                                      constraint_managers);
+      edges.emplace_back(id, std::vector<uint64_t>{ on_true_id, on_false_id });
+      break;
+    }
+    case Node::NodeType::RETURN_INIT: {
+      auto value = static_cast<ReturnInit::ReturnType>(reader.get());
+
+      node = std::make_shared<ReturnInit>(id, nullptr, value,
+                                          call_paths_filenames,
+                                          constraint_managers);
+      break;
+    }
+    case Node::NodeType::RETURN_PROCESS: {
+      auto operation = static_cast<ReturnProcess::Operation>(reader.get());
+      auto value = static_cast<int>(reader.get());
+
+      node = std::make_shared<ReturnProcess>(id, nullptr, value, operation,
+                                             call_paths_filenames,
+                                             constraint_managers);
+      break;
+    }
+    default:
+      reader.check(false, "Invalid binary BDD file.");
+    }
+
+    reader.check(nodes.find(id) == nodes.end(), "Invalid binary BDD file.");
+
+    bdd.id = std::max(bdd.id, id) + 1;
+    nodes[id] = node;
+  }
+
+  reader.check(reader.done(), "Invalid binary BDD file.");
+
+  auto node_at = [&](uint64_t id) {
+    auto found_it = nodes.find(id);
+    reader.check(found_it != nodes.end(), "Invalid binary BDD file.");
+    return found_it->second;
+  };
+
+  for (const auto &edge : edges) {
+    auto prev = node_at(edge.first);
+
+    if (prev->get_type() == Node::NodeType::BRANCH) {
+      auto branch_node = static_cast<Branch *>(prev.get());
+
+      auto on_true = node_at(edge.second[0]);
+      auto on_false = node_at(edge.second[1]);
+
+      branch_node->replace_on_true(on_true);
+      branch_node->replace_on_false(on_false);
+
+      on_true->replace_prev(prev);
+      on_false->replace_prev(prev);
+    } else {
+      auto next = node_at(edge.second[0]);
+
+      prev->replace_next(next);
+      next->replace_prev(prev);
+    }
+  }
+
+  bdd.nf_init = node_at(init_id);
+  bdd.nf_process = node_at(process_id);
+
+  return bdd;
+}
+
+} // namespace BDD
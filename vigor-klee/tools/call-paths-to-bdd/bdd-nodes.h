@@ -53,40 +53,55 @@ struct symbol_t_hash {
 };
 
 typedef std::unordered_set<symbol_t, symbol_t_hash> symbols_t;
-typedef std::pair<call_path_t *, calls_t> call_path_pair_t;
+// A call path and the index of its next call to be consumed.
+typedef std::pair<call_path_t *, size_t> call_path_pair_t;
 
+// Call paths being turned into a BDD. Their calls are never modified: each
+// one has a cursor to its next call instead, so consuming a call takes
+// constant time and branches share the same call arrays.
 struct call_paths_t {
   std::vector<call_path_t *> cp;
-  std::vector<calls_t> backup;
+  std::vector<size_t> next_call;
 
   static std::vector<std::string> skip_functions;
 
   call_paths_t() {}
 
   call_paths_t(const std::vector<call_path_t *> &_call_paths)
-      : cp(_call_paths) {
-    for (const auto &_cp : cp) {
-      backup.emplace_back(_cp->calls);
-    }
-
-    assert(cp.size() == backup.size());
-  }
+      : cp(_call_paths), next_call(_call_paths.size(), 0) {}
 
   size_t size() const { return cp.size(); }
 
-  call_path_pair_t get(unsigned int i) {
+  call_path_pair_t get(unsigned int i) const {
     assert(i < size());
-    return call_path_pair_t(cp[i], backup[i]);
+    return call_path_pair_t(cp[i], next_call[i]);
+  }
+
+  bool has_calls(unsigned int i) const {
+    assert(i < size());
+    return next_call[i] < cp[i]->calls.size();
+  }
+
+  const call_t &get_call(unsigned int i) const {
+    assert(has_calls(i));
+    return cp[i]->calls[next_call[i]];
+  }
+
+  void consume_call() {
+    for (unsigned int i = 0; i < size(); i++) {
+      assert(has_calls(i));
+      next_call[i]++;
+    }
   }
 
   void clear() {
     cp.clear();
-    backup.clear();
+    next_call.clear();
   }
 
   void push_back(call_path_pair_t pair) {
     cp.push_back(pair.first);
-    backup.push_back(pair.second);
+    next_call.push_back(pair.second);
   }
 
   static bool is_skip_function(const std::string &fname);
@@ -116,7 +131,7 @@ private:
                                 klee::ref<klee::Expr> constraint) const;
   bool satisfies_not_constraint(call_path_t *call_path,
                                 klee::ref<klee::Expr> constraint) const;
-  bool are_calls_equal(call_t c1, call_t c2);
+  bool are_calls_equal(const call_t &c1, const call_t &c2);
   call_t pop_call();
 
 public:
@@ -137,8 +152,11 @@ class Node;
 
 typedef std::shared_ptr<Node> BDDNode_ptr;
 
+class BDD;
+
 class Node {
   friend class SymbolFactory;
+  friend class BDD;
 
 public:
   enum NodeType {
@@ -471,9 +489,13 @@ private:
   std::vector<calls_t> calls_list;
 
 public:
-  ReturnRaw(uint64_t _id, call_paths_t call_paths)
-      : Node(_id, Node::NodeType::RETURN_RAW, nullptr, nullptr, call_paths.cp),
-        calls_list(call_paths.backup) {}
+  // Keeps every call of the call paths, not just the ones left.
+  ReturnRaw(uint64_t _id, const call_paths_t &call_paths)
+      : Node(_id, Node::NodeType::RETURN_RAW, nullptr, nullptr, call_paths.cp) {
+    for (auto cp : call_paths.cp) {
+      calls_list.push_back(cp->calls);
+    }
+  }
 
   ReturnRaw(uint64_t _id, const BDDNode_ptr &_prev,
             std::vector<calls_t> _calls_list,
@@ -491,7 +513,7 @@ public:
 
   virtual void recursive_update_ids(uint64_t &new_id) override;
 
-  std::vector<calls_t> get_calls() const { return calls_list; }
+  const std::vector<calls_t> &get_calls() const { return calls_list; }
 
   void visit(BDDVisitor &visitor) const override { visitor.visit(this); }
 
@@ -513,10 +535,10 @@ public:
 private:
   ReturnType value;
 
-  void fill_return_value(calls_t calls) {
+  void fill_return_value(const calls_t &calls) {
     assert(calls.size());
 
-    auto start_time_finder = [](call_t call)->bool {
+    auto start_time_finder = [](const call_t &call)->bool {
       return call.function_name == "start_time";
     };
 
@@ -534,7 +556,7 @@ public:
   ReturnInit(uint64_t _id, const ReturnRaw *raw)
       : Node(_id, Node::NodeType::RETURN_INIT, nullptr, nullptr,
              raw->call_paths_filenames, raw->constraints) {
-    auto calls_list = raw->get_calls();
+    const auto &calls_list = raw->get_calls();
     assert(calls_list.size());
     fill_return_value(calls_list[0]);
   }
@@ -593,7 +615,8 @@ private:
   int value;
   Operation operation;
 
-  std::pair<unsigned, unsigned> analyse_packet_sends(calls_t calls) const {
+  std::pair<unsigned, unsigned>
+  analyse_packet_sends(const calls_t &calls) const {
     unsigned counter = 0;
     unsigned dst_device = 0;
 
@@ -616,7 +639,7 @@ private:
     return std::pair<unsigned, unsigned>(counter, dst_device);
   }
 
-  void fill_return_value(calls_t calls) {
+  void fill_return_value(const calls_t &calls) {
     auto counter_dst_device_pair = analyse_packet_sends(calls);
 
     if (counter_dst_device_pair.first == 1) {
@@ -631,7 +654,7 @@ private:
       return;
     }
 
-    auto packet_receive_finder = [](call_t call)->bool {
+    auto packet_receive_finder = [](const call_t &call)->bool {
       return call.function_name == "packet_receive";
     };
 
@@ -661,7 +684,7 @@ public:
   ReturnProcess(uint64_t _id, const ReturnRaw *raw)
       : Node(_id, Node::NodeType::RETURN_PROCESS, nullptr, nullptr,
              raw->call_paths_filenames, raw->constraints) {
-    auto calls_list = raw->get_calls();
+    const auto &calls_list = raw->get_calls();
     assert(calls_list.size());
     fill_return_value(calls_list[0]);
   }
@@ -0,0 +1,447 @@
+#include "bdd.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <unordered_map>
+
+// Parallel BDD construction.
+//
+// The on_false side of a branch is populated by a forked process while the
+// current one populates the on_true side. Processes are used instead of
+// threads because KLEE expressions can't be shared between threads: klee::ref
+// reference counts are not atomic and Expr::compare uses a static cache.
+//
+// A child inherits the call paths and the solver, so it sends its subtree back
+// as indexes into the call paths, their calls and their constraints, which are
+// the same in every process as calls are never consumed from the call paths
+// themselves. Ids are reassigned once the BDD is built, so the result is the
+// same as the one built by a single process.
+
+namespace BDD {
+
+namespace {
+
+// Subtrees with fewer call paths are not worth a fork.
+constexpr size_t PARALLEL_MIN_CALL_PATHS = 4;
+
+enum populated_record_t {
+  RECORD_CALL,
+  RECORD_BRANCH,
+  RECORD_RETURN_RAW
+};
+
+bool write_all(int fd, const char *data, size_t size) {
+  while (size) {
+    auto written = write(fd, data, size);
+
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (written <= 0) {
+      return false;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+bool read_all(int fd, std::vector<char> &data) {
+  char buffer[1 << 16];
+
+  while (true) {
+    auto n = read(fd, buffer, sizeof(buffer));
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n < 0) {
+      return false;
+    }
+
+    if (n == 0) {
+      return true;
+    }
+
+    data.insert(data.end(), buffer, buffer + n);
+  }
+}
+
+} // namespace
+
+struct BDD::parallel_build_t {
+  struct origin_t {
+    std::vector<unsigned> call_paths;
+
+    // Call path the call or the discriminating constraint comes from, and its
+    // index in the calls or in the constraints of that call path.
+    unsigned source;
+    unsigned index;
+  };
+
+  // Shared by all the processes building the BDD.
+  int *free_jobs;
+
+  bool child;
+  std::unordered_map<const call_path_t *, unsigned> call_path_index;
+  std::unordered_map<const Node *, origin_t> origins;
+
+  parallel_build_t() : free_jobs(nullptr), child(false) {}
+
+  ~parallel_build_t() {
+    if (free_jobs) {
+      munmap(free_jobs, sizeof(*free_jobs));
+    }
+  }
+
+  bool acquire_job() {
+    int free = __atomic_load_n(free_jobs, __ATOMIC_RELAXED);
+
+    do {
+      if (free == 0) {
+        return false;
+      }
+    } while (!__atomic_compare_exchange_n(free_jobs, &free, free - 1, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    return true;
+  }
+
+  void release_job() { __atomic_add_fetch(free_jobs, 1, __ATOMIC_ACQ_REL); }
+};
+
+void BDD::parallel_build_start(unsigned jobs) {
+  auto build = std::make_shared<parallel_build_t>();
+
+  void *shared = mmap(nullptr, sizeof(*build->free_jobs),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (shared == MAP_FAILED) {
+    std::cerr << "Unable to share the job count, building the BDD with a "
+                 "single process" << std::endl;
+    return;
+  }
+
+  build->free_jobs = static_cast<int *>(shared);
+  *build->free_jobs = jobs - 1;
+
+  for (unsigned i = 0; i < call_paths.size(); i++) {
+    build->call_path_index[call_paths[i]] = i;
+  }
+
+  parallel = build;
+}
+
+void BDD::parallel_build_finish(const BDDNode_ptr &root) {
+  uint64_t new_id = 0;
+  renumber_populated(root, new_id);
+  id = new_id;
+
+  parallel.reset();
+}
+
+void BDD::parallel_record(const Node *node,
+                          const std::vector<call_path_t *> &call_paths,
+                          const call_path_t *source, size_t call_index) {
+  // Only subtrees built by a child are sent anywhere.
+  if (!parallel->child) {
+    return;
+  }
+
+  parallel_build_t::origin_t origin;
+  origin.source = 0;
+  origin.index = 0;
+
+  for (auto cp : call_paths) {
+    origin.call_paths.push_back(parallel->call_path_index.at(cp));
+  }
+
+  if (node->get_type() == Node::NodeType::CALL) {
+    origin.source = parallel->call_path_index.at(source);
+    origin.index = call_index;
+  } else if (node->get_type() == Node::NodeType::BRANCH) {
+    auto condition = static_cast<const Branch *>(node)->get_condition();
+
+    origin.source = parallel->call_path_index.at(source);
+
+    auto found_it =
+        std::find_if(source->constraints.begin(), source->constraints.end(),
+                     [&](const klee::ref<klee::Expr> &constraint) {
+          return constraint.get() == condition.get();
+        });
+
+    assert(found_it != source->constraints.end());
+    origin.index = found_it - source->constraints.begin();
+  }
+
+  parallel->origins[node] = origin;
+}
+
+bool BDD::spawn_populate(const call_paths_t &call_paths, populate_job_t &job) {
+  if (call_paths.size() < PARALLEL_MIN_CALL_PATHS) {
+    return false;
+  }
+
+  if (!parallel->acquire_job()) {
+    return false;
+  }
+
+  int fds[2];
+
+  if (pipe(fds) < 0) {
+    parallel->release_job();
+    return false;
+  }
+
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    parallel->release_job();
+    return false;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+
+    parallel->child = true;
+    parallel->origins.clear();
+
+    auto root = populate(call_paths);
+
+    std::vector<uint64_t> records;
+    serialize_populated(root, records);
+
+    parallel->release_job();
+
+    bool sent =
+        write_all(fds[1], reinterpret_cast<const char *>(records.data()),
+                  records.size() * sizeof(records[0]));
+
+    // Skip destructors and atexit handlers, they belong to the parent.
+    _exit(sent ? 0 : 1);
+  }
+
+  close(fds[1]);
+
+  job.pid = pid;
+  job.fd = fds[0];
+
+  return true;
+}
+
+BDDNode_ptr BDD::join_populate(const populate_job_t &job,
+                               const call_paths_t &call_paths) {
+  std::vector<char> data;
+  bool received = read_all(job.fd, data);
+  close(job.fd);
+
+  int status;
+  while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR)
+    ;
+
+  bool ok = received && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+            data.size() && data.size() % sizeof(uint64_t) == 0;
+
+  if (!ok) {
+    // The call paths given to the child are untouched here.
+    std::cerr << "BDD construction job " << job.pid
+              << " failed, populating its subtree locally" << std::endl;
+    return populate(call_paths);
+  }
+
+  std::vector<uint64_t> records(data.size() / sizeof(uint64_t));
+  memcpy(records.data(), data.data(), data.size());
+
+  size_t pos = 0;
+  auto root = deserialize_populated(records, pos);
+
+  assert(pos == records.size());
+
+  return root;
+}
+
+void BDD::serialize_populated(const BDDNode_ptr &root,
+                              std::vector<uint64_t> &records) const {
+  auto node = root;
+
+  while (node) {
+    const auto &origin = parallel->origins.at(node.get());
+
+    switch (node->get_type()) {
+    case Node::NodeType::CALL: {
+      records.push_back(RECORD_CALL);
+      records.push_back(origin.source);
+      records.push_back(origin.index);
+      break;
+    }
+    case Node::NodeType::BRANCH: {
+      records.push_back(RECORD_BRANCH);
+      records.push_back(origin.source);
+      records.push_back(origin.index);
+      break;
+    }
+    case Node::NodeType::RETURN_RAW: {
+      records.push_back(RECORD_RETURN_RAW);
+      break;
+    }
+    default:
+      assert(false && "Unexpected node while populating the BDD");
+    }
+
+    records.push_back(origin.call_paths.size());
+    records.insert(records.end(), origin.call_paths.begin(),
+                   origin.call_paths.end());
+
+    if (node->get_type() == Node::NodeType::BRANCH) {
+      auto branch_node = static_cast<const Branch *>(node.get());
+
+      serialize_populated(branch_node->get_on_true(), records);
+      serialize_populated(branch_node->get_on_false(), records);
+
+      return;
+    }
+
+    node = node->get_next();
+  }
+}
+
+BDDNode_ptr BDD::deserialize_populated(const std::vector<uint64_t> &records,
+                                       size_t &pos) {
+  BDDNode_ptr local_root;
+  BDDNode_ptr local_leaf;
+
+  while (true) {
+    assert(pos + 1 < records.size());
+
+    parallel_build_t::origin_t origin;
+    origin.source = 0;
+    origin.index = 0;
+
+    auto type = records[pos++];
+
+    if (type == RECORD_CALL || type == RECORD_BRANCH) {
+      origin.source = records[pos++];
+      origin.index = records[pos++];
+    }
+
+    auto size = records[pos++];
+    assert(pos + size <= records.size());
+
+    std::vector<call_path_t *> node_call_paths;
+    for (unsigned i = 0; i < size; i++) {
+      origin.call_paths.push_back(records[pos]);
+      node_call_paths.push_back(call_paths[records[pos]]);
+      pos++;
+    }
+
+    BDDNode_ptr node;
+
+    switch (type) {
+    case RECORD_CALL: {
+      const auto &calls = call_paths[origin.source]->calls;
+      assert(origin.index < calls.size());
+
+      auto call = calls[origin.index];
+      node = std::make_shared<Call>(get_and_inc_id(), call, node_call_paths);
+      break;
+    }
+    case RECORD_BRANCH: {
+      const auto &constraints = call_paths[origin.source]->constraints;
+      assert(origin.index < constraints.size());
+
+      auto condition = *(constraints.begin() + origin.index);
+      node = std::make_shared<Branch>(get_and_inc_id(), condition,
+                                      node_call_paths);
+      break;
+    }
+    case RECORD_RETURN_RAW: {
+      call_paths_t return_call_paths;
+
+      for (auto i : origin.call_paths) {
+        return_call_paths.push_back(call_path_pair_t(call_paths[i], 0));
+      }
+
+      node = std::make_shared<ReturnRaw>(get_and_inc_id(), return_call_paths);
+      break;
+    }
+    default:
+      assert(false && "Corrupted BDD construction records");
+    }
+
+    // A nested child sends this subtree further up.
+    if (parallel->child) {
+      parallel->origins[node.get()] = origin;
+    }
+
+    if (local_root == nullptr) {
+      local_root = node;
+    } else {
+      local_leaf->add_next(node);
+      node->add_prev(local_leaf);
+    }
+
+    local_leaf = node;
+
+    if (type == RECORD_BRANCH) {
+      auto on_true_root = deserialize_populated(records, pos);
+      auto on_false_root = deserialize_populated(records, pos);
+
+      auto branch_node = static_cast<Branch *>(node.get());
+
+      branch_node->add_on_true(on_true_root);
+      branch_node->add_on_false(on_false_root);
+
+      on_true_root->replace_prev(node);
+      on_false_root->replace_prev(node);
+
+      return local_root;
+    }
+
+    if (type == RECORD_RETURN_RAW) {
+      return local_root;
+    }
+  }
+}
+
+void BDD::renumber_populated(const BDDNode_ptr &root, uint64_t &new_id) {
+  // Same order BDD::populate takes ids in: every invocation takes one for its
+  // ReturnRaw first, even if it ends up in a branch instead.
+  auto return_raw_id = new_id++;
+  auto node = root;
+
+  while (node) {
+    switch (node->get_type()) {
+    case Node::NodeType::CALL: {
+      node->id = new_id++;
+      node = node->get_next();
+      break;
+    }
+    case Node::NodeType::BRANCH: {
+      auto branch_node = static_cast<Branch *>(node.get());
+
+      node->id = new_id++;
+      renumber_populated(branch_node->get_on_true(), new_id);
+      renumber_populated(branch_node->get_on_false(), new_id);
+      return;
+    }
+    case Node::NodeType::RETURN_RAW: {
+      node->id = return_raw_id;
+      return;
+    }
+    default:
+      assert(false && "Unexpected node while populating the BDD");
+    }
+  }
+}
+
+} // namespace BDD
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <assert.h>
+#include <fstream>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "./bdd-nodes.h"
+
+namespace BDD {
+
+// Per node packet frequencies, from the hit counters reported by the call
+// path hitter target of bdd-to-c after replaying a trace.
+//
+// The report has one counter per call path, indexed by the number in its
+// filename (testN.call_path has the N-1th), so the frequency of a node is the
+// sum of the counters of the call paths going through it. Nodes keep their
+// call paths when the BDD is reordered or deserialized, so the same profile
+// applies to any BDD built from those call paths.
+class Profile {
+public:
+  enum Bias {
+    NO_BIAS,
+    ON_TRUE,
+    ON_FALSE
+  };
+
+private:
+  std::vector<uint64_t> counters;
+  uint64_t total;
+  double cold_ratio;
+
+  // Fraction of the hits of a branch one of its sides needs to be hinted as
+  // the likely one.
+  static constexpr double BIAS_RATIO = 0.9;
+
+public:
+  Profile(const std::string &report_file, double _cold_ratio)
+      : total(0), cold_ratio(_cold_ratio) {
+    std::ifstream report(report_file);
+    assert(report.is_open() && "Unable to open the call path hitter report");
+
+    uint64_t counter;
+    while (report >> counter) {
+      counters.push_back(counter);
+      total += counter;
+    }
+
+    assert(report.eof() && "Malformed call path hitter report");
+  }
+
+  // Index of the call path's counter, or -1 if its filename has none.
+  static int get_call_path_index(const std::string &filename) {
+    std::regex call_path_match("test(\\d+)");
+    std::smatch matches;
+
+    if (!std::regex_search(filename, matches, call_path_match)) {
+      return -1;
+    }
+
+    return std::stoi(matches[1].str()) - 1;
+  }
+
+  uint64_t get_total_hits() const { return total; }
+
+  uint64_t get_hits(const Node *node) const {
+    uint64_t hits = 0;
+
+    if (!node) {
+      return hits;
+    }
+
+    for (const auto &filename : node->get_call_paths_filenames()) {
+      auto i = get_call_path_index(filename);
+
+      if (i >= 0 && i < static_cast<int>(counters.size())) {
+        hits += counters[i];
+      }
+    }
+
+    return hits;
+  }
+
+  // Taken by at most the cold ratio of all the packets replayed. Nothing is
+  // cold in an empty profile, there is no telling.
+  bool is_cold(const Node *node) const {
+    return total && get_hits(node) <= cold_ratio * total;
+  }
+
+  Bias get_bias(const Branch *node) const {
+    auto on_true_hits = get_hits(node->get_on_true().get());
+    auto on_false_hits = get_hits(node->get_on_false().get());
+    auto hits = on_true_hits + on_false_hits;
+
+    if (!hits) {
+      return NO_BIAS;
+    }
+
+    if (on_true_hits >= BIAS_RATIO * hits) {
+      return ON_TRUE;
+    }
+
+    if (on_false_hits >= BIAS_RATIO * hits) {
+      return ON_FALSE;
+    }
+
+    return NO_BIAS;
+  }
+};
+
+} // namespace BDD
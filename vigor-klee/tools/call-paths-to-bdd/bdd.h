@@ -1,5 +1,7 @@
 #pragma once
 
+#include <sys/types.h>
+
 #include "./bdd-nodes.h"
 #include "symbol-factory.h"
 
@@ -24,10 +26,35 @@ private:
   // For deserialization
   BDD() : id(0) { solver_toolbox.build(); }
 
+  // Parallel construction (see bdd-parallel.cpp)
+  struct parallel_build_t;
+
+  struct populate_job_t {
+    pid_t pid;
+    int fd;
+  };
+
+  std::shared_ptr<parallel_build_t> parallel;
+
 private:
-  call_t get_successful_call(std::vector<call_path_t *> call_paths) const;
+  call_t get_successful_call(const call_paths_t &call_paths,
+                             unsigned &source) const;
   BDDNode_ptr populate(call_paths_t call_paths);
 
+  void parallel_build_start(unsigned jobs);
+  void parallel_build_finish(const BDDNode_ptr &root);
+  void parallel_record(const Node *node,
+                       const std::vector<call_path_t *> &call_paths,
+                       const call_path_t *source, size_t call_index = 0);
+  bool spawn_populate(const call_paths_t &call_paths, populate_job_t &job);
+  BDDNode_ptr join_populate(const populate_job_t &job,
+                            const call_paths_t &call_paths);
+  void serialize_populated(const BDDNode_ptr &root,
+                           std::vector<uint64_t> &records) const;
+  BDDNode_ptr deserialize_populated(const std::vector<uint64_t> &records,
+                                    size_t &pos);
+  static void renumber_populated(const BDDNode_ptr &root, uint64_t &new_id);
+
   static std::string get_fname(const Node *node);
   static bool is_skip_function(const Node *node);
   static bool is_skip_condition(const Node *node);
@@ -63,12 +90,21 @@ private:
   }
 
 public:
-  BDD(std::vector<call_path_t *> _call_paths) : id(0), call_paths(_call_paths) {
+  BDD(std::vector<call_path_t *> _call_paths, unsigned jobs = 1)
+      : id(0), call_paths(_call_paths) {
     solver_toolbox.build();
 
+    if (jobs > 1) {
+      parallel_build_start(jobs);
+    }
+
     call_paths_t cp(call_paths);
     auto root = populate(cp);
 
+    if (parallel) {
+      parallel_build_finish(root);
+    }
+
     nf_init = populate_init(root);
     nf_process = populate_process(root);
 
@@ -163,9 +199,14 @@ public:
   }
 
   static void serialize(const BDD &bdd, std::string file_path);
+  static void serialize_binary(const BDD &bdd, std::string file_path);
+
+  // Reads either format.
   static BDD deserialize(std::string file_path);
 
 private:
+  static BDD deserialize_binary(std::string file_path);
+
   void rename_symbols(BDDNode_ptr node, SymbolFactory &factory) {
     assert(node);
 
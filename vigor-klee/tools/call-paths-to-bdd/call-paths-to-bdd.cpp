@@ -67,6 +67,7 @@ bool solver_toolbox_t::is_expr_always_true(klee::ref<klee::Expr> expr) const {
 
 bool solver_toolbox_t::is_expr_always_true(klee::ConstraintManager constraints,
                                            klee::ref<klee::Expr> expr) const {
+  klee::SolverProfileSite profile_site(__func__);
   klee::Query sat_query(constraints, expr);
 
   bool result;
@@ -76,9 +77,167 @@ bool solver_toolbox_t::is_expr_always_true(klee::ConstraintManager constraints,
   return result;
 }
 
+unsigned solver_toolbox_t::get_constraint_set_id(
+    const klee::ConstraintManager &constraints) const {
+  if (constraints.empty()) {
+    return 0;
+  }
+
+  constraint_set_t constraint_set(constraints.begin(), constraints.end());
+
+  auto found_it = constraint_set_ids.find(constraint_set);
+  if (found_it != constraint_set_ids.end()) {
+    return found_it->second;
+  }
+
+  unsigned id = constraint_set_ids.size() + 1;
+  constraint_set_ids[constraint_set] = id;
+
+  return id;
+}
+
+// Strips the Extract/Concat/ZExt wrappers that only rearrange bytes, so that
+// e.g. an Extract of the low bytes of a Concat compares equal to those bytes.
+klee::ref<klee::Expr>
+solver_toolbox_t::canonicalize(klee::ref<klee::Expr> expr) const {
+  switch (expr->getKind()) {
+  case klee::Expr::Kind::Extract: {
+    auto extract = static_cast<klee::ExtractExpr *>(expr.get());
+    auto inner = canonicalize(extract->expr);
+
+    if (extract->offset == 0 && extract->width == inner->getWidth()) {
+      return inner;
+    }
+
+    if (inner->getKind() == klee::Expr::Kind::Concat) {
+      auto lhs = inner->getKid(0);
+      auto rhs = inner->getKid(1);
+      auto rhs_width = rhs->getWidth();
+
+      if (extract->offset + extract->width <= rhs_width) {
+        return canonicalize(
+            exprBuilder->Extract(rhs, extract->offset, extract->width));
+      }
+
+      if (extract->offset >= rhs_width) {
+        return canonicalize(exprBuilder->Extract(
+            lhs, extract->offset - rhs_width, extract->width));
+      }
+    }
+
+    if (inner.get() == extract->expr.get()) {
+      return expr;
+    }
+
+    return exprBuilder->Extract(inner, extract->offset, extract->width);
+  }
+
+  case klee::Expr::Kind::Concat: {
+    auto lhs = canonicalize(expr->getKid(0));
+    auto rhs = canonicalize(expr->getKid(1));
+
+    if (lhs.get() == expr->getKid(0).get() &&
+        rhs.get() == expr->getKid(1).get()) {
+      return expr;
+    }
+
+    return exprBuilder->Concat(lhs, rhs);
+  }
+
+  case klee::Expr::Kind::ZExt: {
+    auto inner = canonicalize(expr->getKid(0));
+
+    if (inner->getWidth() == expr->getWidth()) {
+      return inner;
+    }
+
+    if (inner.get() == expr->getKid(0).get()) {
+      return expr;
+    }
+
+    return exprBuilder->ZExt(inner, expr->getWidth());
+  }
+
+  default:
+    return expr;
+  }
+}
+
+// Without constraints, structurally different constants are never equal.
+// With constraints, only equality can be decided syntactically, since
+// anything holds under unsatisfiable ones.
+solver_toolbox_t::syntactic_result_t
+solver_toolbox_t::compare_syntactically(klee::ref<klee::Expr> e1,
+                                        klee::ref<klee::Expr> e2,
+                                        bool constrained) const {
+  if (e1.get() == e2.get()) {
+    return SYNTACTIC_EQUAL;
+  }
+
+  if (e1->getWidth() != e2->getWidth()) {
+    return SYNTACTIC_UNKNOWN;
+  }
+
+  auto canonical1 = canonicalize(e1);
+  auto canonical2 = canonicalize(e2);
+
+  if (canonical1.compare(canonical2) == 0) {
+    return SYNTACTIC_EQUAL;
+  }
+
+  if (!constrained && isa<klee::ConstantExpr>(canonical1) &&
+      isa<klee::ConstantExpr>(canonical2)) {
+    return SYNTACTIC_NOT_EQUAL;
+  }
+
+  return SYNTACTIC_UNKNOWN;
+}
+
+bool solver_toolbox_t::lookup_equality(const equality_query_t &query,
+                                       bool &result) const {
+  auto found_it = equality_cache.find(query);
+
+  if (found_it == equality_cache.end()) {
+    equality_stats.cache_misses++;
+    return false;
+  }
+
+  equality_stats.cache_hits++;
+  result = found_it->second;
+
+  return true;
+}
+
+void solver_toolbox_t::store_equality(const equality_query_t &query,
+                                      bool result) const {
+  equality_cache[query] = result;
+}
+
+void solver_toolbox_t::dump_equality_stats(std::ostream &os) const {
+  os << "Equality queries:";
+  os << " syntactic " << equality_stats.syntactic;
+  os << " cache hits " << equality_stats.cache_hits;
+  os << " cache misses " << equality_stats.cache_misses;
+  os << "\n";
+}
+
 bool solver_toolbox_t::are_exprs_always_equal(
     klee::ref<klee::Expr> e1, klee::ref<klee::Expr> e2,
     klee::ConstraintManager c1, klee::ConstraintManager c2) const {
+  klee::SolverProfileSite profile_site(__func__);
+  if (compare_syntactically(e1, e2, true) == SYNTACTIC_EQUAL) {
+    equality_stats.syntactic++;
+    return true;
+  }
+
+  equality_query_t query{ ALWAYS_EQUAL, e1, e2, get_constraint_set_id(c1),
+                          get_constraint_set_id(c2) };
+
+  bool cached;
+  if (lookup_equality(query, cached)) {
+    return cached;
+  }
+
   RetrieveSymbols symbol_retriever1;
   RetrieveSymbols symbol_retriever2;
 
@@ -108,12 +267,24 @@ bool solver_toolbox_t::are_exprs_always_equal(
   assert(eq_in_e1_ctx_success);
   assert(eq_in_e2_ctx_success);
 
-  return eq_in_e1_ctx && eq_in_e2_ctx;
+  auto result = eq_in_e1_ctx && eq_in_e2_ctx;
+  store_equality(query, result);
+
+  return result;
 }
 
 bool solver_toolbox_t::are_exprs_always_not_equal(
     klee::ref<klee::Expr> e1, klee::ref<klee::Expr> e2,
     klee::ConstraintManager c1, klee::ConstraintManager c2) const {
+  klee::SolverProfileSite profile_site(__func__);
+  equality_query_t query{ ALWAYS_NOT_EQUAL, e1, e2, get_constraint_set_id(c1),
+                          get_constraint_set_id(c2) };
+
+  bool cached;
+  if (lookup_equality(query, cached)) {
+    return cached;
+  }
+
   RetrieveSymbols symbol_retriever1;
   RetrieveSymbols symbol_retriever2;
 
@@ -143,7 +314,10 @@ bool solver_toolbox_t::are_exprs_always_not_equal(
   assert(not_eq_in_e1_ctx_success);
   assert(not_eq_in_e2_ctx_success);
 
-  return not_eq_in_e1_ctx && not_eq_in_e2_ctx;
+  auto result = not_eq_in_e1_ctx && not_eq_in_e2_ctx;
+  store_equality(query, result);
+
+  return result;
 }
 
 bool solver_toolbox_t::is_expr_always_true(
@@ -165,6 +339,7 @@ bool solver_toolbox_t::is_expr_always_false(klee::ref<klee::Expr> expr) const {
 
 bool solver_toolbox_t::is_expr_always_false(klee::ConstraintManager constraints,
                                             klee::ref<klee::Expr> expr) const {
+  klee::SolverProfileSite profile_site(__func__);
   klee::Query sat_query(constraints, expr);
 
   bool result;
@@ -188,6 +363,7 @@ bool solver_toolbox_t::is_expr_always_false(
 
 bool solver_toolbox_t::are_exprs_always_equal(
     klee::ref<klee::Expr> expr1, klee::ref<klee::Expr> expr2) const {
+  klee::SolverProfileSite profile_site(__func__);
   if (expr1.isNull() != expr2.isNull()) {
     return false;
   }
@@ -200,6 +376,24 @@ bool solver_toolbox_t::are_exprs_always_equal(
     return false;
   }
 
+  switch (compare_syntactically(expr1, expr2, false)) {
+  case SYNTACTIC_EQUAL:
+    equality_stats.syntactic++;
+    return true;
+  case SYNTACTIC_NOT_EQUAL:
+    equality_stats.syntactic++;
+    return false;
+  case SYNTACTIC_UNKNOWN:
+    break;
+  }
+
+  equality_query_t query{ ALWAYS_EQUAL, expr1, expr2, 0, 0 };
+
+  bool cached;
+  if (lookup_equality(query, cached)) {
+    return cached;
+  }
+
   RetrieveSymbols symbol_retriever;
   symbol_retriever.visit(expr1);
   std::vector<klee::ref<klee::ReadExpr>> symbols =
@@ -212,10 +406,15 @@ bool solver_toolbox_t::are_exprs_always_equal(
   assert(!replaced.isNull());
 
   auto eq = exprBuilder->Eq(expr1, replaced);
-  return is_expr_always_true(eq);
+  auto result = is_expr_always_true(eq);
+
+  store_equality(query, result);
+
+  return result;
 }
 
 uint64_t solver_toolbox_t::value_from_expr(klee::ref<klee::Expr> expr) const {
+  klee::SolverProfileSite profile_site(__func__);
   klee::ConstraintManager no_constraints;
   klee::Query sat_query(no_constraints, expr);
 
@@ -229,6 +428,7 @@ uint64_t solver_toolbox_t::value_from_expr(klee::ref<klee::Expr> expr) const {
 uint64_t
 solver_toolbox_t::value_from_expr(klee::ref<klee::Expr> expr,
                                   klee::ConstraintManager constraints) const {
+  klee::SolverProfileSite profile_site(__func__);
   klee::Query sat_query(constraints, expr);
 
   klee::ref<klee::ConstantExpr> value_expr;
@@ -375,23 +575,24 @@ void Node::update_id(uint64_t new_id) {
 }
 
 void CallPathsGroup::group_call_paths() {
+  klee::SolverProfileSite profile_site(__func__);
   assert(call_paths.size());
 
-  for (const auto &cp : call_paths.cp) {
+  for (unsigned int i = 0; i < call_paths.size(); i++) {
     on_true.clear();
     on_false.clear();
 
-    if (cp->calls.size() == 0) {
+    if (!call_paths.has_calls(i)) {
       continue;
     }
 
-    call_t call = cp->calls[0];
+    const call_t &call = call_paths.get_call(i);
 
     for (unsigned int icp = 0; icp < call_paths.size(); icp++) {
       auto pair = call_paths.get(icp);
 
-      if (pair.first->calls.size() &&
-          are_calls_equal(pair.first->calls[0], call)) {
+      if (call_paths.has_calls(icp) &&
+          are_calls_equal(call_paths.get_call(icp), call)) {
         on_true.push_back(pair);
         continue;
       }
@@ -442,21 +643,24 @@ void CallPathsGroup::group_call_paths() {
   assert(false && "Could not group call paths");
 }
 
-bool CallPathsGroup::are_calls_equal(call_t c1, call_t c2) {
+bool CallPathsGroup::are_calls_equal(const call_t &c1, const call_t &c2) {
   if (c1.function_name != c2.function_name) {
     return false;
   }
 
-  for (auto arg_name_value_pair : c1.args) {
-    auto arg_name = arg_name_value_pair.first;
+  for (const auto &arg_name_value_pair : c1.args) {
+    const auto &arg_name = arg_name_value_pair.first;
 
     // exception: we don't care about 'p' differences
     if (arg_name == "p" || arg_name == "src_devices") {
       continue;
     }
 
-    auto c1_arg = c1.args[arg_name];
-    auto c2_arg = c2.args[arg_name];
+    const auto &c1_arg = arg_name_value_pair.second;
+
+    // An argument missing from c2 compares as an empty one.
+    auto c2_arg_it = c2.args.find(arg_name);
+    arg_t c2_arg = c2_arg_it != c2.args.end() ? c2_arg_it->second : arg_t();
 
     if (!c1_arg.out.isNull() &&
         !solver_toolbox.are_exprs_always_equal(c1_arg.in, c1_arg.out)) {
@@ -479,6 +683,7 @@ bool CallPathsGroup::are_calls_equal(call_t c1, call_t c2) {
 }
 
 klee::ref<klee::Expr> CallPathsGroup::find_discriminating_constraint() {
+  klee::SolverProfileSite profile_site(__func__);
   assert(on_true.size());
 
   auto possible_discriminating_constraints =
@@ -625,12 +830,13 @@ bool BDD::is_skip_condition(const Node *node) {
   return false;
 }
 
-call_t BDD::get_successful_call(std::vector<call_path_t *> call_paths) const {
+call_t BDD::get_successful_call(const call_paths_t &call_paths,
+                                unsigned &source) const {
   assert(call_paths.size());
 
-  for (const auto &cp : call_paths) {
-    assert(cp->calls.size());
-    call_t call = cp->calls[0];
+  for (unsigned i = 0; i < call_paths.size(); i++) {
+    const call_t &call = call_paths.get_call(i);
+    source = i;
 
     if (call.ret.isNull()) {
       return call;
@@ -646,14 +852,17 @@ call_t BDD::get_successful_call(std::vector<call_path_t *> call_paths) const {
   }
 
   // no function with successful return
-  return call_paths[0]->calls[0];
+  source = 0;
+  return call_paths.get_call(0);
 }
 
 BDDNode_ptr BDD::populate(call_paths_t call_paths) {
   BDDNode_ptr local_root = nullptr;
   BDDNode_ptr local_leaf = nullptr;
 
-  auto return_raw = std::make_shared<ReturnRaw>(get_and_inc_id(), call_paths);
+  // The ReturnRaw copies every call of the call paths, so it is only built
+  // if this invocation ends up needing it. Its id is still taken first.
+  auto return_raw_id = get_and_inc_id();
 
   while (call_paths.cp.size()) {
     CallPathsGroup group(call_paths);
@@ -664,13 +873,19 @@ BDDNode_ptr BDD::populate(call_paths_t call_paths) {
     if (on_true.cp.size() == call_paths.cp.size()) {
       assert(on_false.cp.size() == 0);
 
-      if (on_true.cp[0]->calls.size() == 0) {
+      if (!on_true.has_calls(0)) {
         break;
       }
 
-      auto call = get_successful_call(on_true.cp);
+      unsigned source;
+      auto call = get_successful_call(on_true, source);
       auto node = std::make_shared<Call>(get_and_inc_id(), call, on_true.cp);
 
+      if (parallel) {
+        parallel_record(node.get(), on_true.cp, on_true.cp[source],
+                        on_true.next_call[source]);
+      }
+
       // root node
       if (local_root == nullptr) {
         local_root = node;
@@ -685,18 +900,24 @@ BDDNode_ptr BDD::populate(call_paths_t call_paths) {
         local_leaf = node;
       }
 
-      for (auto &cp : call_paths.cp) {
-        assert(cp->calls.size());
-        cp->calls.erase(cp->calls.begin());
-      }
+      call_paths.consume_call();
     } else {
       auto discriminating_constraint = group.get_discriminating_constraint();
 
       auto node = std::make_shared<Branch>(
           get_and_inc_id(), discriminating_constraint, call_paths.cp);
 
+      populate_job_t job;
+      bool spawned = false;
+
+      if (parallel) {
+        parallel_record(node.get(), call_paths.cp, on_true.cp[0]);
+        spawned = spawn_populate(on_false, job);
+      }
+
       auto on_true_root = populate(on_true);
-      auto on_false_root = populate(on_false);
+      auto on_false_root =
+          spawned ? join_populate(job, on_false) : populate(on_false);
 
       node->add_on_true(on_true_root);
       node->add_on_false(on_false_root);
@@ -724,6 +945,12 @@ BDDNode_ptr BDD::populate(call_paths_t call_paths) {
     }
   }
 
+  auto return_raw = std::make_shared<ReturnRaw>(return_raw_id, call_paths);
+
+  if (parallel) {
+    parallel_record(return_raw.get(), call_paths.cp, nullptr);
+  }
+
   if (local_root == nullptr) {
     local_root = return_raw;
   } else {
@@ -20,6 +20,16 @@ llvm::cl::opt<std::string>
 llvm::cl::opt<std::string>
     OutputBDDFile("out", llvm::cl::desc("Output file for BDD serialization."),
                   llvm::cl::cat(BDDGeneratorCat));
+
+llvm::cl::opt<bool>
+    Binary("binary",
+           llvm::cl::desc("Serialize the BDD in the binary format."),
+           llvm::cl::cat(BDDGeneratorCat));
+
+llvm::cl::opt<unsigned>
+    Jobs("jobs",
+         llvm::cl::desc("Number of processes used to build the BDD."),
+         llvm::cl::init(1), llvm::cl::cat(BDDGeneratorCat));
 } // namespace
 
 int main(int argc, char **argv) {
@@ -56,7 +66,8 @@ int main(int argc, char **argv) {
     call_paths.push_back(call_path);
   }
 
-  BDD::BDD bdd(call_paths);
+  BDD::BDD bdd(call_paths, Jobs);
+  BDD::solver_toolbox.dump_equality_stats(std::cerr);
 
   BDD::PrinterDebug printer;
   bdd.visit(printer);
@@ -70,7 +81,11 @@ int main(int argc, char **argv) {
   }
 
   if (OutputBDDFile.size()) {
-    BDD::BDD::serialize(bdd, OutputBDDFile);
+    if (Binary) {
+      BDD::BDD::serialize_binary(bdd, OutputBDDFile);
+    } else {
+      BDD::BDD::serialize(bdd, OutputBDDFile);
+    }
   }
 
   for (auto call_path : call_paths) {
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <unordered_map>
+
+#include "klee/Common.h"
+#include "klee/SolverProfile.h"
+
 #include "load-call-paths.h"
 
 namespace BDD {
@@ -74,6 +79,19 @@ struct solver_toolbox_t {
   klee::ExprBuilder *exprBuilder;
   klee::ArrayCache arr_cache;
 
+  // Equality queries are asked over and over on the same expressions when
+  // grouping call paths. They are answered syntactically when possible, and
+  // their results are memoized otherwise.
+  struct equality_stats_t {
+    uint64_t syntactic;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+
+    equality_stats_t() : syntactic(0), cache_hits(0), cache_misses(0) {}
+  };
+
+  mutable equality_stats_t equality_stats;
+
   solver_toolbox_t() : solver(nullptr) {}
 
   void build() {
@@ -81,12 +99,7 @@ struct solver_toolbox_t {
       return;
     }
 
-    solver = klee::createCoreSolver(klee::Z3_SOLVER);
-    assert(solver);
-
-    solver = createCexCachingSolver(solver);
-    solver = createCachingSolver(solver);
-    solver = createIndependentSolver(solver);
+    solver = klee::constructToolSolverChain(klee::Z3_SOLVER);
 
     exprBuilder = klee::createDefaultExprBuilder();
   }
@@ -125,6 +138,92 @@ struct solver_toolbox_t {
                            klee::ConstraintManager constraints) const;
 
   bool are_calls_equal(call_t c1, call_t c2) const;
+
+  void dump_equality_stats(std::ostream &os) const;
+
+private:
+  enum equality_query_kind_t {
+    ALWAYS_EQUAL,
+    ALWAYS_NOT_EQUAL
+  };
+
+  enum syntactic_result_t {
+    SYNTACTIC_EQUAL,
+    SYNTACTIC_NOT_EQUAL,
+    SYNTACTIC_UNKNOWN
+  };
+
+  struct equality_query_t {
+    equality_query_kind_t kind;
+    klee::ref<klee::Expr> e1;
+    klee::ref<klee::Expr> e2;
+
+    // Ids of the constraint sets, 0 meaning no constraints.
+    unsigned c1;
+    unsigned c2;
+  };
+
+  struct equality_query_hash_t {
+    std::size_t operator()(const equality_query_t &query) const {
+      std::size_t hash = query.kind;
+      hash = hash * 31 + query.e1->hash();
+      hash = hash * 31 + query.e2->hash();
+      hash = hash * 31 + query.c1;
+      hash = hash * 31 + query.c2;
+      return hash;
+    }
+  };
+
+  struct equality_query_equal_t {
+    bool operator()(const equality_query_t &q1,
+                    const equality_query_t &q2) const {
+      return q1.kind == q2.kind && q1.c1 == q2.c1 && q1.c2 == q2.c2 &&
+             q1.e1.compare(q2.e1) == 0 && q1.e2.compare(q2.e2) == 0;
+    }
+  };
+
+  typedef std::vector<klee::ref<klee::Expr>> constraint_set_t;
+
+  struct constraint_set_hash_t {
+    std::size_t operator()(const constraint_set_t &constraints) const {
+      std::size_t hash = constraints.size();
+      for (const auto &constraint : constraints) {
+        hash = hash * 31 + constraint->hash();
+      }
+      return hash;
+    }
+  };
+
+  struct constraint_set_equal_t {
+    bool operator()(const constraint_set_t &cs1,
+                    const constraint_set_t &cs2) const {
+      if (cs1.size() != cs2.size()) {
+        return false;
+      }
+
+      for (auto i = 0u; i < cs1.size(); i++) {
+        if (cs1[i].compare(cs2[i]) != 0) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  };
+
+  mutable std::unordered_map<equality_query_t, bool, equality_query_hash_t,
+                             equality_query_equal_t> equality_cache;
+  mutable std::unordered_map<constraint_set_t, unsigned, constraint_set_hash_t,
+                             constraint_set_equal_t> constraint_set_ids;
+
+  unsigned get_constraint_set_id(const klee::ConstraintManager &constraints)
+      const;
+  klee::ref<klee::Expr> canonicalize(klee::ref<klee::Expr> expr) const;
+  syntactic_result_t compare_syntactically(klee::ref<klee::Expr> e1,
+                                           klee::ref<klee::Expr> e2,
+                                           bool constrained) const;
+  bool lookup_equality(const equality_query_t &query, bool &result) const;
+  void store_equality(const equality_query_t &query, bool result) const;
 };
 
 extern solver_toolbox_t solver_toolbox;
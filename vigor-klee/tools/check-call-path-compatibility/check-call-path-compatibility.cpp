@@ -9,6 +9,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "klee/Common.h"
 #include "klee/ExprBuilder.h"
 #include "klee/perf-contracts.h"
 #include "llvm/Support/CommandLine.h"
@@ -197,11 +198,7 @@ int main(int argc, char **argv, char **envp) {
   call_path_t *sender_call_path = load_call_path(SenderCallPathFile);
   call_path_t *receiver_call_path = load_call_path(ReceiverCallPathFile);
 
-  klee::Solver *solver = klee::createCoreSolver(klee::Z3_SOLVER);
-  assert(solver);
-  solver = createCexCachingSolver(solver);
-  solver = createCachingSolver(solver);
-  solver = createIndependentSolver(solver);
+  klee::Solver *solver = klee::constructToolSolverChain(klee::Z3_SOLVER);
 
   klee::ExprBuilder *exprBuilder = klee::createDefaultExprBuilder();
 
@@ -53,6 +53,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sched.h>
 
 #include <cerrno>
 #include <fstream>
@@ -231,6 +233,68 @@ namespace {
   Watchdog("watchdog",
            cl::desc("Use a watchdog process to enforce --max-time."),
            cl::init(0));
+
+  cl::opt<unsigned>
+  ParallelWorkers("parallel-workers",
+                  cl::desc("Explore with up to the given number of worker "
+                           "processes, handing pending states to the idle "
+                           "ones. Statistics other than the ones in info only "
+                           "cover the last worker (default=1)"),
+                  cl::init(1));
+}
+
+/***/
+
+// Parallel exploration.
+//
+// Once the module is set up, the main process forks a worker for each
+// pending state, up to --parallel-workers at a time, starting with the
+// initial one. A worker explores the whole subtree below its state, and
+// whenever a worker would be idle it hands one of its own pending states to
+// the pool instead. States are sent as the fork decisions leading to them:
+// the new worker replays them from the initial state, as workers share no
+// memory besides the pool. Test ids come from the pool, so every worker
+// writes into the same output directory.
+namespace {
+const unsigned ParallelMaxPending = 64;
+const unsigned ParallelMaxForkDecisions = 1 << 14;
+
+struct ParallelPool {
+  unsigned workers;
+
+  // Guards running, pending and the slots.
+  unsigned lock;
+  unsigned running;
+  unsigned pending;
+
+  unsigned jobs;
+  unsigned nextTestId;
+  unsigned nextCallPathId;
+  unsigned generatedTests;
+  unsigned pathsExplored;
+
+  // Added up by every worker as it exits, replayed prefixes included.
+  uint64_t queries;
+  uint64_t queriesValid;
+  uint64_t queriesInvalid;
+  uint64_t queriesCEX;
+  uint64_t queriesConstructs;
+  uint64_t instructions;
+
+  struct {
+    unsigned size;
+    unsigned forkDecisions[ParallelMaxForkDecisions];
+  } slots[ParallelMaxPending];
+
+  void acquire() {
+    while (__atomic_exchange_n(&lock, 1, __ATOMIC_ACQUIRE))
+      sched_yield();
+  }
+
+  void release() { __atomic_store_n(&lock, 0, __ATOMIC_RELEASE); }
+};
+
+ParallelPool *parallelPool = 0;
 }
 
 extern cl::opt<double> MaxTime;
@@ -248,8 +312,8 @@ class CallTree {
   std::vector<std::vector<CallPathTip*> > groupChildren();
 public:
   CallTree():children(), tip(){};
-  void addCallPath(std::vector<CallInfo>::const_iterator path_begin,
-                   std::vector<CallInfo>::const_iterator path_end,
+  void addCallPath(CallPath::const_iterator path_begin,
+                   CallPath::const_iterator path_end,
                    unsigned path_id);
   void dumpCallPrefixes(std::list<CallInfo> accumulated_prefix,
                         std::list<const std::vector<ref<Expr> >* >
@@ -289,9 +353,24 @@ public:
 
   llvm::raw_ostream &getInfoStream() const { return *m_infoFile; }
   /// Returns the number of test cases successfully generated so far
-  unsigned getNumTestCases() { return m_numGeneratedTests; }
-  unsigned getNumPathsExplored() { return m_pathsExplored; }
-  void incPathsExplored() { m_pathsExplored++; }
+  unsigned getNumTestCases() {
+    if (parallelPool)
+      return __atomic_load_n(&parallelPool->generatedTests, __ATOMIC_RELAXED);
+    return m_numGeneratedTests;
+  }
+  unsigned getNumPathsExplored() {
+    if (parallelPool)
+      return __atomic_load_n(&parallelPool->pathsExplored, __ATOMIC_RELAXED);
+    return m_pathsExplored;
+  }
+  void incPathsExplored() {
+    m_pathsExplored++;
+    if (parallelPool)
+      __atomic_add_fetch(&parallelPool->pathsExplored, 1, __ATOMIC_RELAXED);
+  }
+
+  bool wantsState();
+  bool donateState(const std::vector<unsigned> &forkDecisions);
 
   void setInterpreter(Interpreter *i);
 
@@ -464,6 +543,8 @@ void KleeHandler::processTestCase(const ExecutionState &state,
     double start_time = util::getWallTime();
 
     unsigned id = ++m_numTotalTests;
+    if (parallelPool)
+      id = __atomic_add_fetch(&parallelPool->nextTestId, 1, __ATOMIC_RELAXED);
 
     if (success) {
       KTest b;
@@ -530,6 +611,9 @@ void KleeHandler::processTestCase(const ExecutionState &state,
         klee_warning("unable to write output test case, losing it");
       } else {
         ++m_numGeneratedTests;
+        if (parallelPool)
+          __atomic_add_fetch(&parallelPool->generatedTests, 1,
+                             __ATOMIC_RELAXED);
       }
 
       if (DumpCallTraces && !errorMessage) {
@@ -616,7 +700,7 @@ void KleeHandler::processTestCase(const ExecutionState &state,
       delete f;
     }
 
-    if (m_numGeneratedTests == StopAfterNTests)
+    if (StopAfterNTests && getNumTestCases() >= StopAfterNTests)
       m_interpreter->setHaltExecution(true);
 
     if (WriteTestInfo) {
@@ -917,8 +1001,38 @@ bool dumpCallInfoSExpr(const CallInfo& ci, llvm::raw_ostream& file) {
   return true;
 }
 
+bool KleeHandler::wantsState() {
+  if (!parallelPool)
+    return false;
+
+  return __atomic_load_n(&parallelPool->running, __ATOMIC_RELAXED) +
+             __atomic_load_n(&parallelPool->pending, __ATOMIC_RELAXED) <
+         parallelPool->workers;
+}
+
+bool KleeHandler::donateState(const std::vector<unsigned> &forkDecisions) {
+  if (!parallelPool || forkDecisions.size() > ParallelMaxForkDecisions)
+    return false;
+
+  parallelPool->acquire();
+
+  bool donated = parallelPool->pending < ParallelMaxPending;
+  if (donated) {
+    unsigned slot = parallelPool->pending++;
+    parallelPool->slots[slot].size = forkDecisions.size();
+    std::copy(forkDecisions.begin(), forkDecisions.end(),
+              parallelPool->slots[slot].forkDecisions);
+  }
+
+  parallelPool->release();
+  return donated;
+}
+
 void KleeHandler::processCallPath(const ExecutionState &state) {
   unsigned id = m_callPathIndex;
+  if (parallelPool)
+    id = __atomic_add_fetch(&parallelPool->nextCallPathId, 1,
+                            __ATOMIC_RELAXED);
   if (DumpCallTracePrefixes)
     m_callTree.addCallPath(state.callPath.begin(),
                            state.callPath.end(),
@@ -931,7 +1045,7 @@ void KleeHandler::processCallPath(const ExecutionState &state) {
   std::stringstream filename;
   filename << "call-path" << std::setfill('0') << std::setw(6) << id << '.' << "txt";
   llvm::raw_ostream *file = openOutputFile(filename.str());
-  for (std::vector<CallInfo>::const_iterator iter = state.callPath.begin(),
+  for (CallPath::const_iterator iter = state.callPath.begin(),
          end = state.callPath.end(); iter != end; ++iter) {
     const CallInfo& ci = *iter;
     bool dumped = dumpCallInfo(ci, *file);
@@ -1004,7 +1118,7 @@ void KleeHandler::dumpCallPath(const ExecutionState &state, llvm::raw_ostream *f
   *file << kleaverROS.str();
 
   *file <<";;-- Calls --\n";
-  for (std::vector<CallInfo>::const_iterator iter = state.callPath.begin(),
+  for (CallPath::const_iterator iter = state.callPath.begin(),
          end = state.callPath.end(); iter != end; ++iter) {
     const CallInfo& ci = *iter;
     bool dumped = dumpCallInfo(ci, *file);
@@ -1098,14 +1212,14 @@ std::string KleeHandler::getRunTimeLibraryPath(const char *argv0) {
   return libDir.str();
 }
 
-void CallTree::addCallPath(std::vector<CallInfo>::const_iterator path_begin,
-                           std::vector<CallInfo>::const_iterator path_end,
+void CallTree::addCallPath(CallPath::const_iterator path_begin,
+                           CallPath::const_iterator path_end,
                            unsigned path_id) {
   //TODO: do we process constraints (what if they are different from the old ones?)
   //TODO: record assumptions for each item in the call-path, because, when
   // comparing two paths in the tree they may differ only by the assumptions.
   if (path_begin == path_end) return;
-  std::vector<CallInfo>::const_iterator next = path_begin;
+  CallPath::const_iterator next = path_begin;
   ++next;
   std::vector<CallTree*>::iterator i = children.begin(), ie = children.end();
   for (; i != ie; ++i) {
@@ -1904,6 +2018,104 @@ static llvm::Module *linkWithUclibc(llvm::Module *mainModule, StringRef libDir)
 }
 #endif
 
+static void runParallelWorkers(Interpreter *interpreter, KleeHandler *handler,
+                               Function *mainFn, int argc, char **argv,
+                               char **envp) {
+  void *shared = mmap(NULL, sizeof(ParallelPool), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED)
+    klee_error("unable to share the worker pool: %s", strerror(errno));
+
+  // Zeroed by mmap, the initial state has no fork decisions.
+  parallelPool = static_cast<ParallelPool *>(shared);
+  parallelPool->workers = ParallelWorkers;
+  parallelPool->pending = 1;
+
+  while (true) {
+    bool idle = true;
+
+    parallelPool->acquire();
+
+    if (!interrupted && parallelPool->pending &&
+        parallelPool->running < parallelPool->workers) {
+      // The oldest pending state is the closest to the root.
+      std::vector<unsigned> forkDecisions(
+          parallelPool->slots[0].forkDecisions,
+          parallelPool->slots[0].forkDecisions + parallelPool->slots[0].size);
+
+      unsigned last = --parallelPool->pending;
+      parallelPool->slots[0].size = parallelPool->slots[last].size;
+      std::copy(parallelPool->slots[last].forkDecisions,
+                parallelPool->slots[last].forkDecisions +
+                    parallelPool->slots[last].size,
+                parallelPool->slots[0].forkDecisions);
+
+      parallelPool->running++;
+      parallelPool->jobs++;
+      parallelPool->release();
+
+      int pid = fork();
+      if (pid < 0) {
+        klee_error("unable to fork worker: %s", strerror(errno));
+      } else if (pid == 0) {
+        interpreter->setReplayForkDecisions(&forkDecisions);
+        interpreter->runFunctionAsMain(mainFn, argc, argv, envp);
+
+        const char *const totals[] = { "Queries", "QueriesValid",
+                                       "QueriesInvalid", "QueriesCEX",
+                                       "QueriesConstructs", "Instructions" };
+        uint64_t *const pooled[] = {
+          &parallelPool->queries, &parallelPool->queriesValid,
+          &parallelPool->queriesInvalid, &parallelPool->queriesCEX,
+          &parallelPool->queriesConstructs, &parallelPool->instructions
+        };
+        for (unsigned i = 0; i < sizeof(totals) / sizeof(totals[0]); i++)
+          __atomic_add_fetch(
+              pooled[i], *theStatisticManager->getStatisticByName(totals[i]),
+              __ATOMIC_RELAXED);
+
+        handler->getInfoStream().flush();
+        fflush(klee_warning_file);
+        fflush(klee_message_file);
+        // Skip destructors and atexit handlers, they belong to the main
+        // process.
+        _exit(0);
+      }
+
+      idle = false;
+    } else {
+      parallelPool->release();
+    }
+
+    int status;
+    int pid = waitpid(-1, &status, WNOHANG);
+    if (pid > 0) {
+      if (!WIFEXITED(status) || WEXITSTATUS(status))
+        klee_warning("worker %d failed, losing the rest of its states", pid);
+
+      parallelPool->acquire();
+      parallelPool->running--;
+      parallelPool->release();
+
+      idle = false;
+    }
+
+    parallelPool->acquire();
+    bool done = !parallelPool->running &&
+                (interrupted || !parallelPool->pending);
+    parallelPool->release();
+
+    if (done)
+      break;
+
+    if (idle)
+      usleep(10000);
+  }
+
+  handler->getInfoStream()
+    << "KLEE: done: parallel jobs = " << parallelPool->jobs << "\n";
+}
+
 int main(int argc, char **argv, char **envp) {
   atexit(llvm_shutdown);  // Call llvm_shutdown() on exit.
 
@@ -2082,6 +2294,13 @@ int main(int argc, char **argv, char **envp) {
     pArgv[i] = pArg;
   }
 
+  if (ParallelWorkers > 1 &&
+      (!ReplayKTestDir.empty() || !ReplayKTestFile.empty() ||
+       ReplayPathFile != "" || !SeedOutFile.empty() || !SeedOutDir.empty() ||
+       DumpCallTracePrefixes))
+    klee_error("--parallel-workers does not support replaying, seeding or "
+               "dumping call trace prefixes");
+
   std::vector<bool> replayPath;
 
   if (ReplayPathFile != "") {
@@ -2204,7 +2423,10 @@ int main(int argc, char **argv, char **envp) {
                    sys::StrError(errno).c_str());
       }
     }
-    interpreter->runFunctionAsMain(mainFn, pArgc, pArgv, pEnvp);
+    if (ParallelWorkers > 1)
+      runParallelWorkers(interpreter, handler, mainFn, pArgc, pArgv, pEnvp);
+    else
+      interpreter->runFunctionAsMain(mainFn, pArgc, pArgv, pEnvp);
     handler->getInfoStream()
       << "KLEE: saving call prefixes \n";
 
@@ -2248,8 +2470,19 @@ int main(int argc, char **argv, char **envp) {
   uint64_t forks =
     *theStatisticManager->getStatisticByName("Forks");
 
+  // The main process does not execute anything in parallel mode.
+  if (parallelPool) {
+    queries = parallelPool->queries;
+    queriesValid = parallelPool->queriesValid;
+    queriesInvalid = parallelPool->queriesInvalid;
+    queryCounterexamples = parallelPool->queriesCEX;
+    queryConstructs = parallelPool->queriesConstructs;
+    instructions = parallelPool->instructions;
+  }
+
   handler->getInfoStream()
-    << "KLEE: done: explored paths = " << 1 + forks << "\n";
+    << "KLEE: done: explored paths = "
+    << (parallelPool ? handler->getNumPathsExplored() : 1 + forks) << "\n";
 
   // Write some extra information in the info file which users won't
   // necessarily care about or understand.
@@ -0,0 +1,619 @@
+#include "binary-io.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+// Update nodes share the expression stream, with a tag no Expr::Kind uses.
+constexpr uint32_t TAG_UPDATE_NODE = 0xff;
+
+struct binary_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_strings;
+  uint32_t strings_size; // bytes, padded to a multiple of 4
+  uint32_t num_arrays;
+  uint32_t arrays_size; // words
+  uint32_t exprs_size;  // words
+  uint32_t payload_size; // words
+  uint32_t reserved;
+};
+
+void put_constant(std::vector<uint32_t> &words, const llvm::APInt &value) {
+  words.push_back(value.getBitWidth());
+  words.push_back(value.getNumWords());
+
+  for (unsigned i = 0; i < value.getNumWords(); i++) {
+    words.push_back(value.getRawData()[i] & 0xffffffff);
+    words.push_back(value.getRawData()[i] >> 32);
+  }
+}
+
+} // namespace
+
+uint32_t BinaryWriter::intern_string(const std::string &str) {
+  auto found_it = string_ids.find(str);
+
+  if (found_it != string_ids.end()) {
+    return found_it->second;
+  }
+
+  uint32_t id = strings.size();
+  strings.push_back(str);
+  string_ids[str] = id;
+
+  return id;
+}
+
+uint32_t BinaryWriter::intern_array(const klee::Array *array) {
+  auto found_it = array_ids.find(array);
+
+  if (found_it != array_ids.end()) {
+    return found_it->second;
+  }
+
+  arrays.push_back(intern_string(array->name));
+  arrays.push_back(array->size);
+  arrays.push_back(array->domain);
+  arrays.push_back(array->range);
+  arrays.push_back(array->constantValues.size());
+
+  for (auto value : array->constantValues) {
+    put_constant(arrays, value->getAPValue());
+  }
+
+  uint32_t id = num_arrays++;
+  array_ids[array] = id;
+
+  return id;
+}
+
+uint32_t BinaryWriter::intern_updates(const klee::UpdateNode *head) {
+  if (!head) {
+    return BINARY_NONE;
+  }
+
+  // Update lists share their tails, only the new part of the chain is
+  // written, oldest update first.
+  std::vector<const klee::UpdateNode *> chain;
+
+  for (auto node = head; node && !update_ids.count(node); node = node->next) {
+    chain.push_back(node);
+  }
+
+  for (auto it = chain.rbegin(); it != chain.rend(); it++) {
+    auto node = *it;
+
+    auto next = node->next ? update_ids.at(node->next) : BINARY_NONE;
+    auto index = intern_expr(node->index);
+    auto value = intern_expr(node->value);
+
+    exprs.push_back(TAG_UPDATE_NODE);
+    exprs.push_back(next);
+    exprs.push_back(index);
+    exprs.push_back(value);
+
+    update_ids[node] = num_updates++;
+  }
+
+  return update_ids.at(head);
+}
+
+uint32_t BinaryWriter::intern_expr(const klee::ref<klee::Expr> &expr) {
+  assert(!expr.isNull());
+
+  auto found_it = expr_ids.find(expr.get());
+
+  if (found_it != expr_ids.end()) {
+    return found_it->second;
+  }
+
+  auto unique_it = unique_exprs.find(expr);
+
+  if (unique_it != unique_exprs.end()) {
+    expr_ids[expr.get()] = unique_it->second;
+    interned.push_back(expr);
+    return unique_it->second;
+  }
+
+  std::vector<uint32_t> record;
+  record.push_back(expr->getKind());
+
+  switch (expr->getKind()) {
+  case klee::Expr::Kind::Constant: {
+    auto constant = static_cast<klee::ConstantExpr *>(expr.get());
+    put_constant(record, constant->getAPValue());
+  } break;
+
+  case klee::Expr::Kind::Read: {
+    auto read = static_cast<klee::ReadExpr *>(expr.get());
+
+    record.push_back(intern_array(read->updates.root));
+    record.push_back(intern_updates(read->updates.head));
+    record.push_back(intern_expr(read->index));
+  } break;
+
+  case klee::Expr::Kind::Extract: {
+    auto extract = static_cast<klee::ExtractExpr *>(expr.get());
+
+    record.push_back(intern_expr(extract->expr));
+    record.push_back(extract->offset);
+    record.push_back(extract->width);
+  } break;
+
+  case klee::Expr::Kind::ZExt:
+  case klee::Expr::Kind::SExt: {
+    record.push_back(intern_expr(expr->getKid(0)));
+    record.push_back(expr->getWidth());
+  } break;
+
+  default: {
+    for (unsigned i = 0; i < expr->getNumKids(); i++) {
+      record.push_back(intern_expr(expr->getKid(i)));
+    }
+  } break;
+  }
+
+  exprs.insert(exprs.end(), record.begin(), record.end());
+
+  uint32_t id = num_exprs++;
+  expr_ids[expr.get()] = id;
+  unique_exprs[expr] = id;
+  interned.push_back(expr);
+
+  return id;
+}
+
+void BinaryWriter::put_call(const call_t &call) {
+  put_string(call.function_name);
+
+  put(call.args.size());
+  for (const auto &arg_pair : call.args) {
+    const auto &arg = arg_pair.second;
+
+    put_string(arg_pair.first);
+    put_expr(arg.expr);
+
+    if (arg.fn_ptr_name.first) {
+      put_string(arg.fn_ptr_name.second);
+    } else {
+      put(BINARY_NONE);
+    }
+
+    put_expr(arg.in);
+    put_expr(arg.out);
+  }
+
+  put(call.extra_vars.size());
+  for (const auto &extra_var_pair : call.extra_vars) {
+    put_string(extra_var_pair.first);
+    put_expr(extra_var_pair.second.first);
+    put_expr(extra_var_pair.second.second);
+  }
+
+  put_expr(call.ret);
+}
+
+void BinaryWriter::write(const std::string &file_path,
+                         const char *magic) const {
+  std::ofstream out(file_path, std::ios::binary);
+  assert(out.is_open() && "Unable to open binary output file.");
+
+  std::vector<uint32_t> string_offsets{ 0 };
+  std::string string_data;
+
+  for (const auto &str : strings) {
+    string_data += str;
+    string_offsets.push_back(string_data.size());
+  }
+
+  string_data.resize((string_data.size() + 3) & ~3ul, '\0');
+
+  binary_header_t header;
+  memset(&header, 0, sizeof(header));
+  strncpy(header.magic, magic, sizeof(header.magic));
+  header.version = BINARY_VERSION;
+  header.num_strings = strings.size();
+  header.strings_size = string_data.size();
+  header.num_arrays = num_arrays;
+  header.arrays_size = arrays.size();
+  header.exprs_size = exprs.size();
+  header.payload_size = payload.size();
+
+  auto write_words = [&](const std::vector<uint32_t> &words) {
+    out.write(reinterpret_cast<const char *>(words.data()),
+              words.size() * sizeof(uint32_t));
+  };
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  write_words(string_offsets);
+  out.write(string_data.data(), string_data.size());
+  write_words(arrays);
+  write_words(exprs);
+  write_words(payload);
+
+  assert(out.good() && "Unable to write binary output file.");
+}
+
+bool BinaryReader::is_binary(const std::string &file_path, const char *magic) {
+  std::ifstream in(file_path, std::ios::binary);
+
+  char file_magic[sizeof(binary_header_t::magic)];
+  if (!in.read(file_magic, sizeof(file_magic))) {
+    return false;
+  }
+
+  return strncmp(file_magic, magic, sizeof(file_magic)) == 0;
+}
+
+BinaryReader::BinaryReader(const std::string &file_path, const char *magic,
+                           klee::ArrayCache &cache)
+    : file_path(file_path), builder(klee::createDefaultExprBuilder()) {
+  int fd = open(file_path.c_str(), O_RDONLY);
+  check(fd >= 0, "Unable to open binary file.");
+
+  struct stat st;
+  fstat(fd, &st);
+  size = st.st_size;
+
+  check(size >= sizeof(binary_header_t), "Truncated binary file.");
+
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  check(map != MAP_FAILED, "Unable to map binary file.");
+  data = static_cast<const uint8_t *>(map);
+
+  auto header = reinterpret_cast<const binary_header_t *>(data);
+
+  check(strncmp(header->magic, magic, sizeof(header->magic)) == 0,
+        "Unexpected binary file type.");
+  check(header->version == BINARY_VERSION, "Unsupported binary file version.");
+
+  // In 64 bits, so that corrupted sizes cannot wrap around.
+  check(size == sizeof(binary_header_t) +
+                    sizeof(uint32_t) * ((uint64_t)header->num_strings + 1) +
+                    (uint64_t)header->strings_size +
+                    sizeof(uint32_t) * ((uint64_t)header->arrays_size +
+                                        header->exprs_size +
+                                        header->payload_size),
+        "Truncated binary file.");
+  check(header->strings_size % sizeof(uint32_t) == 0,
+        "Corrupted binary file.");
+
+  auto words = reinterpret_cast<const uint32_t *>(header + 1);
+
+  num_strings = header->num_strings;
+  strings_size = header->strings_size;
+  string_offsets = words;
+  words += num_strings + 1;
+
+  string_data = reinterpret_cast<const char *>(words);
+  words += header->strings_size / sizeof(uint32_t);
+
+  read_arrays(words, words + header->arrays_size, header->num_arrays, cache);
+  words += header->arrays_size;
+
+  read_exprs(words, words + header->exprs_size);
+  words += header->exprs_size;
+
+  payload = words;
+  payload_end = words + header->payload_size;
+}
+
+BinaryReader::~BinaryReader() {
+  munmap(const_cast<uint8_t *>(data), size);
+  delete builder;
+}
+
+void BinaryReader::check(bool ok, const char *message) const {
+  if (!ok) {
+    std::cerr << file_path << ": " << message << std::endl;
+    exit(1);
+  }
+}
+
+uint32_t BinaryReader::next_word(const uint32_t *&words,
+                                 const uint32_t *end) const {
+  check(words < end, "Truncated binary file.");
+  return *words++;
+}
+
+std::string BinaryReader::string_at(uint32_t id) const {
+  check(id < num_strings && string_offsets[id] <= string_offsets[id + 1] &&
+            string_offsets[id + 1] <= strings_size,
+        "Corrupted binary file.");
+
+  return std::string(string_data + string_offsets[id],
+                     string_offsets[id + 1] - string_offsets[id]);
+}
+
+llvm::APInt BinaryReader::read_constant(const uint32_t *&words,
+                                        const uint32_t *end) const {
+  auto width = next_word(words, end);
+  auto num_words = next_word(words, end);
+  check(width > 0 && num_words == (width + 63ull) / 64,
+        "Corrupted binary file.");
+
+  std::vector<uint64_t> raw;
+  for (unsigned i = 0; i < num_words; i++) {
+    uint64_t low = next_word(words, end);
+    uint64_t high = next_word(words, end);
+    raw.push_back(low | (high << 32));
+  }
+
+  return llvm::APInt(width, raw);
+}
+
+void BinaryReader::read_arrays(const uint32_t *words, const uint32_t *end,
+                               uint32_t num_arrays, klee::ArrayCache &cache) {
+  for (unsigned i = 0; i < num_arrays; i++) {
+    auto name = next_word(words, end);
+    auto array_size = next_word(words, end);
+    auto domain = next_word(words, end);
+    auto range = next_word(words, end);
+    auto num_values = next_word(words, end);
+
+    std::string array_name = string_at(name);
+
+    std::vector<klee::ref<klee::ConstantExpr>> values;
+    for (unsigned j = 0; j < num_values; j++) {
+      values.push_back(klee::ConstantExpr::alloc(read_constant(words, end)));
+    }
+
+    if (values.size()) {
+      arrays.push_back(cache.CreateArray(array_name, array_size,
+                                         &values[0], &values[0] + values.size(),
+                                         domain, range));
+    } else {
+      arrays.push_back(cache.CreateArray(array_name, array_size, nullptr,
+                                         nullptr, domain, range));
+    }
+  }
+
+  check(words == end, "Corrupted binary file.");
+}
+
+void BinaryReader::read_exprs(const uint32_t *words, const uint32_t *end) {
+  auto word = [&]() { return next_word(words, end); };
+
+  auto kid = [&]() -> klee::ref<klee::Expr> {
+    auto id = word();
+    check(id < exprs.size(), "Corrupted binary file.");
+    return exprs[id];
+  };
+
+  while (words < end) {
+    auto tag = word();
+
+    if (tag == TAG_UPDATE_NODE) {
+      auto next = word();
+      auto index = kid();
+      auto value = kid();
+
+      const klee::UpdateNode *next_node = nullptr;
+      if (next != BINARY_NONE) {
+        check(next < updates.size(), "Corrupted binary file.");
+        next_node = updates[next].head;
+      }
+
+      // The list holds a reference to the node, the root is irrelevant here.
+      updates.emplace_back(nullptr,
+                           new klee::UpdateNode(next_node, index, value));
+      continue;
+    }
+
+    klee::ref<klee::Expr> expr;
+
+    switch (tag) {
+    case klee::Expr::Kind::Constant: {
+      expr = builder->Constant(read_constant(words, end));
+    } break;
+
+    case klee::Expr::Kind::NotOptimized: {
+      expr = builder->NotOptimized(kid());
+    } break;
+
+    case klee::Expr::Kind::Read: {
+      auto array = word();
+      auto head = word();
+
+      check(array < arrays.size(), "Corrupted binary file.");
+      check(head == BINARY_NONE || head < updates.size(),
+            "Corrupted binary file.");
+
+      klee::UpdateList updates_list(
+          arrays[array], head == BINARY_NONE ? nullptr : updates[head].head);
+
+      expr = builder->Read(updates_list, kid());
+    } break;
+
+    case klee::Expr::Kind::Select: {
+      auto cond = kid();
+      auto lhs = kid();
+      auto rhs = kid();
+
+      expr = builder->Select(cond, lhs, rhs);
+    } break;
+
+    case klee::Expr::Kind::Concat: {
+      auto lhs = kid();
+      auto rhs = kid();
+
+      expr = builder->Concat(lhs, rhs);
+    } break;
+
+    case klee::Expr::Kind::Extract: {
+      auto lhs = kid();
+      auto offset = word();
+      auto width = word();
+
+      expr = builder->Extract(lhs, offset, width);
+    } break;
+
+    case klee::Expr::Kind::ZExt: {
+      auto lhs = kid();
+      expr = builder->ZExt(lhs, word());
+    } break;
+
+    case klee::Expr::Kind::SExt: {
+      auto lhs = kid();
+      expr = builder->SExt(lhs, word());
+    } break;
+
+    case klee::Expr::Kind::Not: {
+      expr = builder->Not(kid());
+    } break;
+
+    default: {
+      check(tag >= klee::Expr::Kind::BinaryKindFirst &&
+                tag <= klee::Expr::Kind::BinaryKindLast,
+            "Corrupted binary file.");
+
+      auto lhs = kid();
+      auto rhs = kid();
+
+      switch (tag) {
+      case klee::Expr::Kind::Add:
+        expr = builder->Add(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Sub:
+        expr = builder->Sub(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Mul:
+        expr = builder->Mul(lhs, rhs);
+        break;
+      case klee::Expr::Kind::UDiv:
+        expr = builder->UDiv(lhs, rhs);
+        break;
+      case klee::Expr::Kind::SDiv:
+        expr = builder->SDiv(lhs, rhs);
+        break;
+      case klee::Expr::Kind::URem:
+        expr = builder->URem(lhs, rhs);
+        break;
+      case klee::Expr::Kind::SRem:
+        expr = builder->SRem(lhs, rhs);
+        break;
+      case klee::Expr::Kind::And:
+        expr = builder->And(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Or:
+        expr = builder->Or(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Xor:
+        expr = builder->Xor(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Shl:
+        expr = builder->Shl(lhs, rhs);
+        break;
+      case klee::Expr::Kind::LShr:
+        expr = builder->LShr(lhs, rhs);
+        break;
+      case klee::Expr::Kind::AShr:
+        expr = builder->AShr(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Eq:
+        expr = builder->Eq(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Ne:
+        expr = builder->Ne(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Ult:
+        expr = builder->Ult(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Ule:
+        expr = builder->Ule(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Ugt:
+        expr = builder->Ugt(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Uge:
+        expr = builder->Uge(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Slt:
+        expr = builder->Slt(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Sle:
+        expr = builder->Sle(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Sgt:
+        expr = builder->Sgt(lhs, rhs);
+        break;
+      case klee::Expr::Kind::Sge:
+        expr = builder->Sge(lhs, rhs);
+        break;
+      default:
+        check(false, "Corrupted binary file.");
+      }
+    } break;
+    }
+
+    exprs.push_back(expr);
+  }
+}
+
+std::string BinaryReader::get_string() { return string_at(get()); }
+
+const klee::Array *BinaryReader::get_array() {
+  auto id = get();
+  check(id < arrays.size(), "Corrupted binary file.");
+
+  return arrays[id];
+}
+
+klee::ref<klee::Expr> BinaryReader::get_expr() {
+  auto id = get();
+
+  if (id == BINARY_NONE) {
+    return klee::ref<klee::Expr>();
+  }
+
+  check(id < exprs.size(), "Corrupted binary file.");
+  return exprs[id];
+}
+
+call_t BinaryReader::get_call() {
+  call_t call;
+
+  call.function_name = get_string();
+
+  auto num_args = get();
+  for (unsigned i = 0; i < num_args; i++) {
+    auto name = get_string();
+    auto &arg = call.args[name];
+
+    arg.expr = get_expr();
+
+    // Peek, since the function pointer name is a string id or BINARY_NONE.
+    check(payload < payload_end, "Truncated binary file.");
+    if (*payload == BINARY_NONE) {
+      get();
+    } else {
+      arg.fn_ptr_name = std::make_pair(true, get_string());
+    }
+
+    arg.in = get_expr();
+    arg.out = get_expr();
+  }
+
+  auto num_extra_vars = get();
+  for (unsigned i = 0; i < num_extra_vars; i++) {
+    auto name = get_string();
+    auto &extra_var = call.extra_vars[name];
+
+    extra_var.first = get_expr();
+    extra_var.second = get_expr();
+  }
+
+  call.ret = get_expr();
+
+  return call;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "klee/util/ArrayCache.h"
+
+#include "load-call-paths.h"
+
+// Compact binary format for call paths and BDDs.
+//
+// A file has a header, a string table, the arrays read by its expressions and
+// the expressions themselves, followed by a payload of 32 bit words whose
+// layout depends on the kind of file. Expressions are stored once per file
+// as a hash-consed DAG in topological order, interleaved with the update
+// nodes they read from, so loading is a single pass over the mapped file that
+// rebuilds them bottom-up, without parsing any kQuery.
+//
+// Expressions, arrays and strings are referred to in the payload by their
+// index in the corresponding table, BINARY_NONE standing for a null one.
+
+constexpr uint32_t BINARY_VERSION = 1;
+constexpr uint32_t BINARY_NONE = 0xffffffff;
+
+constexpr char BINARY_CALL_PATH_MAGIC[] = "VIGORCP";
+constexpr char BINARY_BDD_MAGIC[] = "VIGORBDD";
+
+class BinaryWriter {
+private:
+  struct expr_hash_t {
+    std::size_t operator()(const klee::ref<klee::Expr> &expr) const {
+      return expr->hash();
+    }
+  };
+
+  struct expr_equal_t {
+    bool operator()(const klee::ref<klee::Expr> &e1,
+                    const klee::ref<klee::Expr> &e2) const {
+      return e1.compare(e2) == 0;
+    }
+  };
+
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint32_t> string_ids;
+
+  uint32_t num_arrays;
+  std::vector<uint32_t> arrays;
+  std::unordered_map<const klee::Array *, uint32_t> array_ids;
+
+  uint32_t num_exprs;
+  uint32_t num_updates;
+  std::vector<uint32_t> exprs;
+  std::unordered_map<const klee::Expr *, uint32_t> expr_ids;
+  std::unordered_map<klee::ref<klee::Expr>, uint32_t, expr_hash_t,
+                     expr_equal_t> unique_exprs;
+  std::unordered_map<const klee::UpdateNode *, uint32_t> update_ids;
+
+  // Keeps every interned expression alive, so their addresses stay unique.
+  std::vector<klee::ref<klee::Expr>> interned;
+
+  std::vector<uint32_t> payload;
+
+  uint32_t intern_string(const std::string &str);
+  uint32_t intern_array(const klee::Array *array);
+  uint32_t intern_expr(const klee::ref<klee::Expr> &expr);
+  uint32_t intern_updates(const klee::UpdateNode *head);
+
+public:
+  BinaryWriter() : num_arrays(0), num_exprs(0), num_updates(0) {}
+
+  void put(uint32_t word) { payload.push_back(word); }
+
+  void put_u64(uint64_t value) {
+    put(value & 0xffffffff);
+    put(value >> 32);
+  }
+
+  void put_string(const std::string &str) { put(intern_string(str)); }
+  void put_array(const klee::Array *array) { put(intern_array(array)); }
+
+  void put_expr(const klee::ref<klee::Expr> &expr) {
+    put(expr.isNull() ? BINARY_NONE : intern_expr(expr));
+  }
+
+  void put_call(const call_t &call);
+
+  void write(const std::string &file_path, const char *magic) const;
+};
+
+class BinaryReader {
+private:
+  std::string file_path;
+
+  const uint8_t *data;
+  size_t size;
+
+  const uint32_t *string_offsets;
+  const char *string_data;
+  uint32_t num_strings;
+  uint32_t strings_size;
+
+  klee::ExprBuilder *builder;
+  std::vector<const klee::Array *> arrays;
+  std::vector<klee::ref<klee::Expr>> exprs;
+  std::vector<klee::UpdateList> updates;
+
+  const uint32_t *payload;
+  const uint32_t *payload_end;
+
+  uint32_t next_word(const uint32_t *&words, const uint32_t *end) const;
+  std::string string_at(uint32_t id) const;
+  llvm::APInt read_constant(const uint32_t *&words, const uint32_t *end) const;
+
+  void read_arrays(const uint32_t *words, const uint32_t *end,
+                   uint32_t num_arrays, klee::ArrayCache &cache);
+  void read_exprs(const uint32_t *words, const uint32_t *end);
+
+public:
+  // Maps and decodes the given file, which must have been written with the
+  // given magic. Arrays are created in the given cache, which must outlive
+  // the expressions read. A truncated or corrupted file is reported and
+  // ends the program, like every check below.
+  BinaryReader(const std::string &file_path, const char *magic,
+               klee::ArrayCache &cache);
+  ~BinaryReader();
+
+  static bool is_binary(const std::string &file_path, const char *magic);
+
+  bool done() const { return payload == payload_end; }
+
+  // Reports the given message along with the file name and exits, unless ok.
+  void check(bool ok, const char *message) const;
+
+  uint32_t get() {
+    check(payload < payload_end, "Truncated binary file.");
+    return *payload++;
+  }
+
+  uint64_t get_u64() {
+    uint64_t low = get();
+    uint64_t high = get();
+    return low | (high << 32);
+  }
+
+  std::string get_string();
+  const klee::Array *get_array();
+  klee::ref<klee::Expr> get_expr();
+  call_t get_call();
+};
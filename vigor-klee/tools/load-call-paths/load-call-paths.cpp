@@ -22,12 +22,73 @@
 #include <vector>
 
 #include "load-call-paths.h"
+#include "binary-io.h"
 
 #define DEBUG
 
+call_path_t *load_binary_call_path(std::string file_name) {
+  // Arrays must outlive the call path, just like the ones created by the
+  // kQuery parser.
+  auto array_cache = new klee::ArrayCache();
+  BinaryReader reader(file_name, BINARY_CALL_PATH_MAGIC, *array_cache);
+
+  call_path_t *call_path = new call_path_t;
+  call_path->file_name = file_name;
+
+  auto num_arrays = reader.get();
+  for (unsigned i = 0; i < num_arrays; i++) {
+    auto array = reader.get_array();
+    call_path->arrays[array->name] = array;
+  }
+
+  std::vector<klee::ref<klee::Expr>> constraints;
+  auto num_constraints = reader.get();
+  for (unsigned i = 0; i < num_constraints; i++) {
+    constraints.push_back(reader.get_expr());
+  }
+  call_path->constraints = klee::ConstraintManager(constraints);
+
+  auto num_calls = reader.get();
+  for (unsigned i = 0; i < num_calls; i++) {
+    call_path->calls.push_back(reader.get_call());
+  }
+
+  reader.check(reader.done(), "Invalid binary call path file.");
+
+  return call_path;
+}
+
+void save_binary_call_path(const call_path_t *call_path,
+                           std::string file_name) {
+  BinaryWriter writer;
+
+  writer.put(call_path->arrays.size());
+  for (const auto &array_pair : call_path->arrays) {
+    writer.put_array(array_pair.second);
+  }
+
+  writer.put(call_path->constraints.size());
+  for (auto constraint : call_path->constraints) {
+    writer.put_expr(constraint);
+  }
+
+  writer.put(call_path->calls.size());
+  for (const auto &call : call_path->calls) {
+    writer.put_call(call);
+  }
+
+  writer.write(file_name, BINARY_CALL_PATH_MAGIC);
+}
+
 call_path_t *load_call_path(std::string file_name,
                             std::vector<std::string> expressions_str,
                             std::deque<klee::ref<klee::Expr>> &expressions) {
+  if (BinaryReader::is_binary(file_name, BINARY_CALL_PATH_MAGIC)) {
+    assert(expressions_str.empty() &&
+           "Extra expressions require a kQuery call path.");
+    return load_binary_call_path(file_name);
+  }
+
   std::ifstream call_path_file(file_name);
   assert(call_path_file.is_open() && "Unable to open call path file.");
 
@@ -34,6 +34,11 @@ call_path_t *load_call_path(std::string file_name,
                             std::vector<std::string> expressions_str,
                             std::deque<klee::ref<klee::Expr>> &expressions);
 
+// Call paths in the binary format (see binary-io.h) are loaded by
+// load_call_path as well, as long as no extra expressions are requested.
+call_path_t *load_binary_call_path(std::string file_name);
+void save_binary_call_path(const call_path_t *call_path, std::string file_name);
+
 inline std::ostream &operator<<(std::ostream &os, const arg_t &arg) {
   if (arg.fn_ptr_name.first) {
     os << arg.fn_ptr_name.second;
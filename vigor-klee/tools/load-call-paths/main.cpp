@@ -20,6 +20,11 @@ namespace {
 llvm::cl::list<std::string> InputCallPathFiles(llvm::cl::desc("<call paths>"),
                                                llvm::cl::Positional,
                                                llvm::cl::OneOrMore);
+
+llvm::cl::opt<std::string> BinaryOutDir(
+    "binary-out",
+    llvm::cl::desc("Directory where to save the call paths in the binary "
+                   "format, with the same names and a .bin extension."));
 }
 
 
@@ -36,6 +41,13 @@ int main(int argc, char **argv, char **envp) {
     std::vector<std::string> expressions_str;
     std::deque<klee::ref<klee::Expr> > expressions;
     call_paths.push_back(load_call_path(file, expressions_str, expressions));
+
+    if (BinaryOutDir.size()) {
+      auto name = file.substr(file.find_last_of('/') + 1);
+      name = name.substr(0, name.find_last_of('.')) + ".bin";
+
+      save_binary_call_path(call_paths.back(), BinaryOutDir + "/" + name);
+    }
   }
 
   for (unsigned i = 0; i < call_paths.size(); i++) {
@@ -9,16 +9,23 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "klee/Common.h"
 #include "klee/ExprBuilder.h"
+#include "klee/SolverProfile.h"
 #include "klee/perf-contracts.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include <dlfcn.h>
+#include <errno.h>
 #include <expr/Parser.h>
 #include <fstream>
 #include <iostream>
 #include <klee/Constraints.h>
 #include <klee/Solver.h>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #define DEBUG
@@ -34,9 +41,21 @@ llvm::cl::opt<std::string> UserVariables(
     "user-vars",
     llvm::cl::desc("Sets the value of user variables (var1=val1,var2=val2)."));
 
-llvm::cl::opt<std::string> InputCallPathFile(llvm::cl::desc("<call path>"),
-                                             llvm::cl::Positional,
-                                             llvm::cl::Required);
+llvm::cl::list<std::string> InputCallPathFiles(llvm::cl::desc("<call paths>"),
+                                               llvm::cl::Positional,
+                                               llvm::cl::OneOrMore);
+
+llvm::cl::opt<unsigned>
+    Jobs("jobs",
+         llvm::cl::desc("Number of processes stitching call paths in "
+                        "parallel, when given more than one."),
+         llvm::cl::init(1));
+
+llvm::cl::opt<bool>
+    Table("table",
+          llvm::cl::desc("Print the table of call paths and their "
+                         "performance even for a single call path."),
+          llvm::cl::init(false));
 }
 
 typedef struct {
@@ -55,6 +74,178 @@ typedef struct {
 std::map<std::pair<std::string, int>, klee::ref<klee::Expr>>
     subcontract_constraints;
 
+// Every call path is parsed on its own, so the same symbol is a different
+// array in each of them. Arrays are compared by name here, which is enough for
+// satisfiability, so that queries repeated across call paths are recognized.
+bool equal_modulo_arrays(const klee::ref<klee::Expr> &e1,
+                         const klee::ref<klee::Expr> &e2);
+
+bool equal_modulo_arrays(const klee::UpdateList &u1,
+                         const klee::UpdateList &u2) {
+  if (u1.root != u2.root &&
+      (u1.root->name != u2.root->name || u1.root->size != u2.root->size ||
+       u1.root->constantValues.size() != u2.root->constantValues.size())) {
+    return false;
+  }
+
+  if (u1.root != u2.root) {
+    for (unsigned i = 0; i < u1.root->constantValues.size(); i++) {
+      if (u1.root->constantValues[i]->compare(*u2.root->constantValues[i])) {
+        return false;
+      }
+    }
+  }
+
+  if (u1.getSize() != u2.getSize()) {
+    return false;
+  }
+
+  const klee::UpdateNode *n1 = u1.head, *n2 = u2.head;
+  for (; n1 && n2 && n1 != n2; n1 = n1->next, n2 = n2->next) {
+    if (!equal_modulo_arrays(n1->index, n2->index) ||
+        !equal_modulo_arrays(n1->value, n2->value)) {
+      return false;
+    }
+  }
+
+  return n1 == n2;
+}
+
+bool equal_modulo_arrays(const klee::ref<klee::Expr> &e1,
+                         const klee::ref<klee::Expr> &e2) {
+  if (e1.get() == e2.get()) {
+    return true;
+  }
+
+  // Expression hashes only depend on array names.
+  if (e1->hash() != e2->hash() || e1->getKind() != e2->getKind() ||
+      e1->getWidth() != e2->getWidth() ||
+      e1->getNumKids() != e2->getNumKids()) {
+    return false;
+  }
+
+  switch (e1->getKind()) {
+  case klee::Expr::Constant:
+    return e1->compare(*e2) == 0;
+  case klee::Expr::Read:
+    if (!equal_modulo_arrays(cast<klee::ReadExpr>(e1)->updates,
+                             cast<klee::ReadExpr>(e2)->updates)) {
+      return false;
+    }
+    break;
+  case klee::Expr::Extract:
+    if (cast<klee::ExtractExpr>(e1)->offset !=
+        cast<klee::ExtractExpr>(e2)->offset) {
+      return false;
+    }
+    break;
+  default:
+    break;
+  }
+
+  for (unsigned i = 0; i < e1->getNumKids(); i++) {
+    if (!equal_modulo_arrays(e1->getKid(i), e2->getKid(i))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Sub-contract feasibility, memoized by function, sub-contract and the
+// constraints of the call.
+class SubcontractCache {
+private:
+  struct key_t {
+    std::string function_name;
+    int sub_contract_idx;
+    std::vector<klee::ref<klee::Expr>> constraints;
+    size_t hash;
+  };
+
+  struct key_hash_t {
+    size_t operator()(const key_t &key) const { return key.hash; }
+  };
+
+  struct key_equal_t {
+    bool operator()(const key_t &k1, const key_t &k2) const {
+      if (k1.hash != k2.hash || k1.sub_contract_idx != k2.sub_contract_idx ||
+          k1.function_name != k2.function_name ||
+          k1.constraints.size() != k2.constraints.size()) {
+        return false;
+      }
+
+      for (unsigned i = 0; i < k1.constraints.size(); i++) {
+        if (!equal_modulo_arrays(k1.constraints[i], k2.constraints[i])) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  };
+
+  std::unordered_map<key_t, bool, key_hash_t, key_equal_t> results;
+
+  static key_t make_key(const std::string &function_name,
+                        int sub_contract_idx,
+                        const klee::ConstraintManager &constraints) {
+    key_t key;
+    key.function_name = function_name;
+    key.sub_contract_idx = sub_contract_idx;
+    key.constraints.assign(constraints.begin(), constraints.end());
+
+    key.hash = std::hash<std::string>()(function_name) ^ sub_contract_idx;
+    for (auto constraint : key.constraints) {
+      key.hash = key.hash * klee::Expr::MAGIC_HASH_CONSTANT + constraint->hash();
+    }
+
+    return key;
+  }
+
+public:
+  unsigned hits;
+  unsigned misses;
+
+  SubcontractCache() : hits(0), misses(0) {}
+
+  bool may_be_true(klee::Solver *solver, const std::string &function_name,
+                   int sub_contract_idx,
+                   const klee::ConstraintManager &constraints) {
+    auto key = make_key(function_name, sub_contract_idx, constraints);
+    auto found_it = results.find(key);
+
+    if (found_it != results.end()) {
+      hits++;
+      return found_it->second;
+    }
+
+    misses++;
+
+    klee::SolverProfileSite profile_site("subcontract_may_be_true");
+    klee::Query sat_query(constraints,
+                          subcontract_constraints[std::make_pair(
+                              function_name, sub_contract_idx)]);
+    bool result = false;
+    bool success = solver->mayBeTrue(sat_query, result);
+    assert(success);
+
+    results[key] = result;
+    return result;
+  }
+} subcontract_cache;
+
+// Solvers keep their caches across candidates and call paths.
+klee::Solver *get_solver() {
+  static klee::Solver *solver = nullptr;
+
+  if (!solver) {
+    solver = klee::constructToolSolverChain(klee::Z3_SOLVER);
+  }
+
+  return solver;
+}
+
 call_path_t *load_call_path(std::string file_name,
                             std::set<std::string> symbols,
                             std::vector<std::string> expressions_str,
@@ -228,6 +419,8 @@ call_path_t *load_call_path(std::string file_name,
 std::map<std::string, long>
 process_candidate(call_path_t *call_path, void *contract,
                   std::map<std::string, klee::ref<klee::Expr>> vars) {
+  klee::SolverProfileSite profile_site(__func__);
+
   LOAD_SYMBOL(contract, contract_get_metrics);
   LOAD_SYMBOL(contract, contract_has_contract);
   LOAD_SYMBOL(contract, contract_num_sub_contracts);
@@ -245,11 +438,7 @@ process_candidate(call_path_t *call_path, void *contract,
   }
 #endif
 
-  klee::Solver *solver = klee::createCoreSolver(klee::Z3_SOLVER);
-  assert(solver);
-  solver = createCexCachingSolver(solver);
-  solver = createCachingSolver(solver);
-  solver = createIndependentSolver(solver);
+  klee::Solver *solver = get_solver();
 
   klee::ConstraintManager constraints = call_path->constraints;
 
@@ -348,12 +537,8 @@ process_candidate(call_path_t *call_path, void *contract,
     for (int sub_contract_idx = 0;
          sub_contract_idx < contract_num_sub_contracts(cit.function_name);
          sub_contract_idx++) {
-      klee::Query sat_query(call_constraints,
-                            subcontract_constraints[std::make_pair(
-                                cit.function_name, sub_contract_idx)]);
-      bool result = false;
-      bool success = solver->mayBeTrue(sat_query, result);
-      assert(success);
+      bool result = subcontract_cache.may_be_true(
+          solver, cit.function_name, sub_contract_idx, call_constraints);
 
       if (result) {
         assert(!found_subcontract && "Multiple subcontracts match.");
@@ -363,7 +548,7 @@ process_candidate(call_path_t *call_path, void *contract,
         for (auto extra_var : cit.extra_vars) {
           klee::Query expr_query(constraints, extra_var.second.first);
           klee::ref<klee::ConstantExpr> result;
-          success = solver->getValue(expr_query, result);
+          bool success = solver->getValue(expr_query, result);
           assert(success);
 
           variables[extra_var.first] = result->getLimitedValue();
@@ -412,6 +597,259 @@ process_candidate(call_path_t *call_path, void *contract,
   return total_performance;
 }
 
+// Everything taken from the contract, which every call path is stitched
+// against.
+struct stitch_context_t {
+  std::set<std::string> symbols;
+  std::map<std::string, std::string> user_variables_str;
+  std::set<std::string> overriden_user_variables;
+  std::map<std::string, std::set<std::string>> optimization_variables_str;
+  std::map<std::pair<std::string, int>, std::string>
+      subcontract_constraints_str;
+  std::vector<std::string> expressions_str;
+};
+
+// Worst performance of a call path over every candidate, empty if none is SAT.
+std::map<std::string, long> stitch_call_path(const std::string &file_name,
+                                             void *contract,
+                                             const stitch_context_t &context) {
+  const auto &user_variables_str = context.user_variables_str;
+  const auto &overriden_user_variables = context.overriden_user_variables;
+  const auto &optimization_variables_str = context.optimization_variables_str;
+  const auto &subcontract_constraints_str = context.subcontract_constraints_str;
+
+  std::deque<klee::ref<klee::Expr>> expressions;
+  call_path_t *call_path = load_call_path(file_name, context.symbols,
+                                          context.expressions_str, expressions);
+
+  std::map<std::string, klee::ref<klee::Expr>> user_variables;
+  for (auto vit : user_variables_str) {
+    assert(!expressions.empty());
+    user_variables[vit.first] = expressions.front();
+    expressions.pop_front();
+  }
+  std::map<std::string, std::set<klee::ref<klee::Expr>>> optimization_variables;
+  for (auto vit : optimization_variables_str) {
+    for (auto cit : vit.second) {
+      assert(!expressions.empty());
+      optimization_variables[vit.first].insert(expressions.front());
+      expressions.pop_front();
+    }
+  }
+  for (auto cit : subcontract_constraints_str) {
+    assert(!expressions.empty());
+    subcontract_constraints[cit.first] = expressions.front();
+    expressions.pop_front();
+  }
+  assert(expressions.empty());
+
+  std::map<std::string, std::set<klee::ref<klee::Expr>>::iterator>
+      candidate_iterators;
+  for (auto &it : optimization_variables) {
+    if (!overriden_user_variables.count(it.first)) {
+      candidate_iterators[it.first] = it.second.begin();
+    }
+  }
+
+#ifdef DEBUG
+  std::cerr << "Debug: Binding user variables to:" << std::endl;
+  for (auto vit : user_variables) {
+    std::cerr << "Debug:   " << vit.first << " = " << std::flush;
+    vit.second->print(llvm::errs());
+    llvm::errs().flush();
+    std::cerr << std::endl;
+  }
+#endif
+
+  std::map<std::string, long> max_performance;
+  std::map<std::string, std::set<klee::ref<klee::Expr>>::iterator>::iterator
+      pos;
+  do {
+    std::map<std::string, klee::ref<klee::Expr>> vars = user_variables;
+
+    for (auto it : candidate_iterators) {
+      vars[it.first] = *it.second;
+    }
+
+    std::map<std::string, long> performance =
+        process_candidate(call_path, contract, vars);
+    for (auto metric : performance) {
+      assert(metric.second >= 0);
+      if (metric.second > max_performance[metric.first]) {
+        max_performance[metric.first] = metric.second;
+      }
+    }
+
+    pos = candidate_iterators.begin();
+    while (++(pos->second) == optimization_variables[pos->first].end()) {
+      if (++pos == candidate_iterators.end()) {
+        break;
+      }
+
+      for (auto reset_pos = candidate_iterators.begin(); reset_pos != pos;
+           reset_pos++) {
+        reset_pos->second = optimization_variables[reset_pos->first].begin();
+      }
+    }
+  } while (pos != candidate_iterators.end());
+
+  return max_performance;
+}
+
+bool write_all(int fd, const std::string &data) {
+  size_t written = 0;
+
+  while (written < data.size()) {
+    auto n = write(fd, data.data() + written, data.size() - written);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      return false;
+    }
+
+    written += n;
+  }
+
+  return true;
+}
+
+bool read_all(int fd, std::string &data) {
+  char buffer[1 << 12];
+
+  while (true) {
+    auto n = read(fd, buffer, sizeof(buffer));
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n < 0) {
+      return false;
+    }
+
+    if (n == 0) {
+      return true;
+    }
+
+    data.append(buffer, n);
+  }
+}
+
+// Stitches the call paths in parallel. KLEE expressions can't be shared
+// between threads, so every job is a forked process that stitches every
+// jobs-th call path and sends back its performance. The call paths of a job
+// that fails are stitched here.
+std::vector<std::map<std::string, long>>
+stitch_call_paths(const std::vector<std::string> &files, void *contract,
+                  const stitch_context_t &context, unsigned jobs) {
+  std::vector<std::map<std::string, long>> performances(files.size());
+  std::vector<bool> done(files.size(), false);
+
+  struct job_t {
+    pid_t pid;
+    int fd;
+  };
+
+  std::vector<job_t> running;
+
+  for (unsigned job = 1; job < jobs && job < files.size(); job++) {
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+      break;
+    }
+
+    std::cout.flush();
+    std::cerr.flush();
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      break;
+    }
+
+    if (pid == 0) {
+      close(fds[0]);
+
+      std::stringstream results;
+      for (unsigned i = job; i < files.size(); i += jobs) {
+        for (auto metric : stitch_call_path(files[i], contract, context)) {
+          results << i << "\t" << metric.first << "\t" << metric.second
+                  << "\n";
+        }
+        results << i << "\n";
+      }
+
+      bool sent = write_all(fds[1], results.str());
+
+      std::cout.flush();
+      std::cerr.flush();
+      _exit(sent ? 0 : 1);
+    }
+
+    close(fds[1]);
+    running.push_back(job_t{ pid, fds[0] });
+  }
+
+  // This process takes the first share, and the shares of jobs that could not
+  // be started.
+  for (unsigned i = 0; i < files.size(); i++) {
+    if (i % jobs == 0 || i % jobs > running.size()) {
+      performances[i] = stitch_call_path(files[i], contract, context);
+      done[i] = true;
+    }
+  }
+
+  for (auto job : running) {
+    std::string data;
+    bool received = read_all(job.fd, data);
+    close(job.fd);
+
+    int status;
+    while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR)
+      ;
+
+    if (!received || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cerr << "Warning: Stitching job " << job.pid
+                << " failed, stitching its call paths locally." << std::endl;
+      continue;
+    }
+
+    std::stringstream results(data);
+    std::string line;
+
+    while (std::getline(results, line)) {
+      std::stringstream fields(line);
+      std::string index, metric, value;
+
+      std::getline(fields, index, '\t');
+      unsigned i = std::stoul(index);
+      assert(i < files.size());
+
+      if (!std::getline(fields, metric, '\t')) {
+        done[i] = true;
+        continue;
+      }
+
+      std::getline(fields, value, '\t');
+      performances[i][metric] = std::stol(value);
+    }
+  }
+
+  for (unsigned i = 0; i < files.size(); i++) {
+    if (!done[i]) {
+      performances[i] = stitch_call_path(files[i], contract, context);
+    }
+  }
+
+  return performances;
+}
+
 int main(int argc, char **argv, char **envp) {
   llvm::cl::ParseCommandLineOptions(argc, argv);
 
@@ -438,9 +876,15 @@ int main(int argc, char **argv, char **envp) {
 
   contract_init();
 
-  std::map<std::string, std::string> user_variables_str =
-      contract_get_user_variables();
-  std::set<std::string> overriden_user_variables;
+  stitch_context_t context;
+  context.symbols = contract_get_symbols();
+
+  std::map<std::string, std::string> &user_variables_str =
+      context.user_variables_str;
+  std::set<std::string> &overriden_user_variables =
+      context.overriden_user_variables;
+
+  user_variables_str = contract_get_user_variables();
 
   std::string user_variables_param = UserVariables;
   while (!user_variables_param.empty()) {
@@ -470,11 +914,12 @@ int main(int argc, char **argv, char **envp) {
     overriden_user_variables.insert(user_var);
   }
 
-  std::map<std::string, std::set<std::string>> optimization_variables_str =
-      contract_get_optimization_variables();
+  std::map<std::string, std::set<std::string>> &optimization_variables_str =
+      context.optimization_variables_str;
+  optimization_variables_str = contract_get_optimization_variables();
 
-  std::map<std::pair<std::string, int>, std::string>
-      subcontract_constraints_str;
+  std::map<std::pair<std::string, int>, std::string> &
+      subcontract_constraints_str = context.subcontract_constraints_str;
   for (auto function_name : contract_get_contracts()) {
     for (int sub_contract_idx = 0;
          sub_contract_idx < contract_num_sub_contracts(function_name);
@@ -485,7 +930,7 @@ int main(int argc, char **argv, char **envp) {
     }
   }
 
-  std::vector<std::string> expressions_str;
+  std::vector<std::string> &expressions_str = context.expressions_str;
   for (auto vit : user_variables_str) {
     expressions_str.push_back(vit.second);
   }
@@ -498,87 +943,77 @@ int main(int argc, char **argv, char **envp) {
     expressions_str.push_back(cit.second);
   }
 
-  std::deque<klee::ref<klee::Expr>> expressions;
-  call_path_t *call_path = load_call_path(
-      InputCallPathFile, contract_get_symbols(), expressions_str, expressions);
+  std::vector<std::string> files(InputCallPathFiles.begin(),
+                                 InputCallPathFiles.end());
 
-  std::map<std::string, klee::ref<klee::Expr>> user_variables;
-  for (auto vit : user_variables_str) {
-    assert(!expressions.empty());
-    user_variables[vit.first] = expressions.front();
-    expressions.pop_front();
-  }
-  std::map<std::string, std::set<klee::ref<klee::Expr>>> optimization_variables;
-  for (auto vit : optimization_variables_str) {
-    for (auto cit : vit.second) {
-      assert(!expressions.empty());
-      optimization_variables[vit.first].insert(expressions.front());
-      expressions.pop_front();
+  assert(Jobs > 0 && "At least one job is required");
+  auto performances = stitch_call_paths(files, contract, context, Jobs);
+
+#ifdef DEBUG
+  std::cerr << "Debug: Sub-contract cache: " << subcontract_cache.hits
+            << " hits, " << subcontract_cache.misses << " misses"
+            << std::endl;
+#endif
+
+  if (files.size() == 1 && !Table) {
+    if (performances[0].empty()) {
+      std::cerr << "Warning: No candidate was SAT." << std::endl;
     }
-  }
-  for (auto cit : subcontract_constraints_str) {
-    assert(!expressions.empty());
-    subcontract_constraints[cit.first] = expressions.front();
-    expressions.pop_front();
-  }
-  assert(expressions.empty());
 
-  std::map<std::string, std::set<klee::ref<klee::Expr>>::iterator>
-      candidate_iterators;
-  for (auto &it : optimization_variables) {
-    if (!overriden_user_variables.count(it.first)) {
-      candidate_iterators[it.first] = it.second.begin();
+    for (auto metric : performances[0]) {
+      std::cout << metric.first << "," << metric.second << std::endl;
     }
+    return 0;
   }
 
-#ifdef DEBUG
-  std::cerr << "Debug: Binding user variables to:" << std::endl;
-  for (auto vit : user_variables) {
-    std::cerr << "Debug:   " << vit.first << " = " << std::flush;
-    vit.second->print(llvm::errs());
-    llvm::errs().flush();
-    std::cerr << std::endl;
+  // With several call paths, a table with the performance of each of them,
+  // followed by the worst-case call path for every metric.
+  std::set<std::string> metrics;
+  for (auto performance : performances) {
+    for (auto metric : performance) {
+      metrics.insert(metric.first);
+    }
   }
-#endif
 
-  std::map<std::string, long> max_performance;
-  std::map<std::string, std::set<klee::ref<klee::Expr>>::iterator>::iterator
-      pos;
-  do {
-    std::map<std::string, klee::ref<klee::Expr>> vars = user_variables;
+  std::cout << "call path";
+  for (auto metric : metrics) {
+    std::cout << "," << metric;
+  }
+  std::cout << std::endl;
 
-    for (auto it : candidate_iterators) {
-      vars[it.first] = *it.second;
+  std::map<std::string, unsigned> worst;
+  for (unsigned i = 0; i < files.size(); i++) {
+    if (performances[i].empty()) {
+      std::cerr << "Warning: No candidate was SAT for " << files[i] << "."
+                << std::endl;
     }
 
-    std::map<std::string, long> performance =
-        process_candidate(call_path, contract, vars);
-    for (auto metric : performance) {
-      assert(metric.second >= 0);
-      if (metric.second > max_performance[metric.first]) {
-        max_performance[metric.first] = metric.second;
-      }
-    }
+    std::cout << files[i];
+    for (auto metric : metrics) {
+      std::cout << ",";
 
-    pos = candidate_iterators.begin();
-    while (++(pos->second) == optimization_variables[pos->first].end()) {
-      if (++pos == candidate_iterators.end()) {
-        break;
+      auto found_it = performances[i].find(metric);
+      if (found_it == performances[i].end()) {
+        continue;
       }
 
-      for (auto reset_pos = candidate_iterators.begin(); reset_pos != pos;
-           reset_pos++) {
-        reset_pos->second = optimization_variables[reset_pos->first].begin();
+      std::cout << found_it->second;
+
+      if (!worst.count(metric) ||
+          found_it->second > performances[worst[metric]][metric]) {
+        worst[metric] = i;
       }
     }
-  } while (pos != candidate_iterators.end());
-
-  if (max_performance.empty()) {
-    std::cerr << "Warning: No candidate was SAT." << std::endl;
+    std::cout << std::endl;
   }
 
-  for (auto metric : max_performance) {
-    std::cout << metric.first << "," << metric.second << std::endl;
+  std::cout << std::endl;
+  std::cout << "metric,worst,call path" << std::endl;
+  for (auto metric : worst) {
+    std::cout << metric.first << ","
+              << performances[metric.second][metric.first] << ","
+              << files[metric.second] << std::endl;
   }
+
   return 0;
 }
@@ -93,6 +93,14 @@ public:
     target_helpers_loaded.push_back(found_it->second);
   }
 
+  void set_profile(const BDD::Profile *profile) {
+    for (auto &helper : target_helpers_bank) {
+      if (helper.second.generator) {
+        helper.second.generator->set_profile(profile);
+      }
+    }
+  }
+
   void generate(const ExecutionPlan &execution_plan) {
     for (auto helper : target_helpers_loaded) {
       auto &extractor = helper.extractor;
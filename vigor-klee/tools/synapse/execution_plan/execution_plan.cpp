@@ -7,6 +7,51 @@ namespace synapse {
 int ExecutionPlanNode::counter = 0;
 int ExecutionPlan::counter = 0;
 
+namespace {
+void hash_combine(uint64_t &seed, uint64_t value) {
+  seed ^= value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
+}
+} // namespace
+
+uint64_t ExecutionPlan::get_fingerprint() const {
+  uint64_t fingerprint = 0;
+
+  hash_combine(fingerprint, root != nullptr);
+  hash_combine(fingerprint, leaves.size());
+
+  for (const auto &leaf : leaves) {
+    hash_combine(fingerprint, leaf.current_platform.first);
+
+    if (leaf.current_platform.first) {
+      hash_combine(fingerprint, leaf.current_platform.second);
+    }
+
+    hash_combine(fingerprint, leaf.next ? leaf.next->get_id() + 1 : 0);
+  }
+
+  if (!root) {
+    return fingerprint;
+  }
+
+  // Same traversal as operator==. The BDD is left out, as plans with the
+  // same modules and leaves rarely differ only in it.
+  std::vector<ExecutionPlanNode_ptr> nodes{ root };
+
+  for (unsigned i = 0; i < nodes.size(); i++) {
+    auto module = nodes[i]->get_module();
+    assert(module);
+
+    const auto &next = nodes[i]->get_next();
+
+    hash_combine(fingerprint, module->get_type());
+    hash_combine(fingerprint, next.size());
+
+    nodes.insert(nodes.end(), next.begin(), next.end());
+  }
+
+  return fingerprint;
+}
+
 void ExecutionPlan::replace_node_in_bdd(BDD::BDDNode_ptr target) {
   assert(target);
 
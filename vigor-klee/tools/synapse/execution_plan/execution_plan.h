@@ -7,6 +7,7 @@
 #include "memory_bank.h"
 #include "visitors/visitor.h"
 
+#include <algorithm>
 #include <unordered_set>
 
 namespace synapse {
@@ -47,8 +48,20 @@ private:
 
   // Implementation details
 private:
+  // Ids of the processed BDD nodes, most recent first. The list is shared with
+  // the plans this one was cloned from.
+  struct processed_bdd_node_t {
+    uint64_t id;
+    std::shared_ptr<const processed_bdd_node_t> prev;
+
+    processed_bdd_node_t(uint64_t _id,
+                         std::shared_ptr<const processed_bdd_node_t> _prev)
+        : id(_id), prev(_prev) {}
+  };
+
   MemoryBank memory_bank;
-  std::unordered_set<uint64_t> processed_bdd_nodes;
+  std::shared_ptr<const processed_bdd_node_t> processed_bdd_nodes;
+  unsigned num_processed_bdd_nodes;
 
   // Metadata
 private:
@@ -62,7 +75,8 @@ private:
 
 public:
   ExecutionPlan(const BDD::BDD &_bdd)
-      : bdd(_bdd), depth(0), nodes(0), reordered_nodes(0), id(counter++) {
+      : bdd(_bdd), num_processed_bdd_nodes(0), depth(0), nodes(0),
+        reordered_nodes(0), id(counter++) {
     assert(bdd.get_process());
 
     leaf_t leaf(bdd.get_process());
@@ -72,13 +86,19 @@ public:
   ExecutionPlan(const ExecutionPlan &ep)
       : root(ep.root), leaves(ep.leaves), bdd(ep.bdd),
         memory_bank(ep.memory_bank),
-        processed_bdd_nodes(ep.processed_bdd_nodes), depth(ep.depth),
+        processed_bdd_nodes(ep.processed_bdd_nodes),
+        num_processed_bdd_nodes(ep.num_processed_bdd_nodes), depth(ep.depth),
         nodes(ep.nodes), nodes_per_target(ep.nodes_per_target),
         reordered_nodes(ep.reordered_nodes), id(ep.id) {}
 
+  ExecutionPlan(ExecutionPlan &&ep) = default;
+
+  ExecutionPlan &operator=(const ExecutionPlan &) = default;
+  ExecutionPlan &operator=(ExecutionPlan &&) = default;
+
   ExecutionPlan(const ExecutionPlan &ep, ExecutionPlanNode_ptr _root)
-      : root(_root), bdd(ep.bdd), depth(0), nodes(0), reordered_nodes(0),
-        id(counter++) {
+      : root(_root), bdd(ep.bdd), num_processed_bdd_nodes(0), depth(0),
+        nodes(0), reordered_nodes(0), id(counter++) {
     if (!_root) {
       return;
     }
@@ -124,9 +144,11 @@ private:
 
     // Different pointers!
     // We probably cloned the entire BDD in the past, we should update
-    // this node to point to our new BDD.
+    // this node to point to our new BDD. The module may be shared with other
+    // plans, so it is cloned first.
     auto found_bdd_node = ep.bdd.get_node_by_id(bdd_node->get_id());
     if (found_bdd_node && found_bdd_node != bdd_node) {
+      copy->replace_module(module->clone());
       copy->replace_node(found_bdd_node);
     }
 
@@ -153,6 +175,54 @@ private:
     return copy;
   }
 
+  // Plans share their nodes, so before modifying the tree a plan makes its
+  // own version of the nodes from the root to the active leaf, the only ones
+  // it ever modifies. Every other node stays shared with the plans it was
+  // cloned from. Versions keep the id of the node they replace, so prev
+  // pointers of shared nodes, which may lead to an older version, still give
+  // the right path.
+  void copy_active_path() {
+    if (!root || !leaves.size() || !leaves[0].leaf) {
+      return;
+    }
+
+    std::vector<int> path;
+
+    for (auto node = leaves[0].leaf; node; node = node->get_prev()) {
+      path.push_back(node->get_id());
+    }
+
+    std::reverse(path.begin(), path.end());
+    assert(path[0] == root->get_id());
+
+    auto old_leaf_id = leaves[0].leaf->get_id();
+
+    root = ExecutionPlanNode::build_version(root.get());
+    auto node = root;
+
+    for (unsigned i = 1; i < path.size(); i++) {
+      auto found_it = std::find_if(
+          node->next.begin(), node->next.end(),
+          [&](const ExecutionPlanNode_ptr &branch) {
+            return branch->get_id() == path[i];
+          });
+
+      assert(found_it != node->next.end() && "Broken execution plan path");
+
+      auto version = ExecutionPlanNode::build_version(found_it->get());
+      version->set_prev(node);
+
+      *found_it = version;
+      node = version;
+    }
+
+    for (auto &leaf : leaves) {
+      if (leaf.leaf && leaf.leaf->get_id() == old_leaf_id) {
+        leaf.leaf = node;
+      }
+    }
+  }
+
   void update_processed_nodes() {
     assert(leaves.size());
     auto processed_node = get_next_node();
@@ -162,10 +232,25 @@ private:
     }
 
     auto processed_node_id = processed_node->get_id();
-    auto search = processed_bdd_nodes.find(processed_node_id);
-    assert(search == processed_bdd_nodes.end());
+    assert(!is_processed_bdd_node(processed_node_id));
 
-    processed_bdd_nodes.insert(processed_node_id);
+    push_processed_bdd_node(processed_node_id);
+  }
+
+  bool is_processed_bdd_node(uint64_t id) const {
+    for (auto node = processed_bdd_nodes.get(); node; node = node->prev.get()) {
+      if (node->id == id) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void push_processed_bdd_node(uint64_t id) {
+    processed_bdd_nodes =
+        std::make_shared<processed_bdd_node_t>(id, processed_bdd_nodes);
+    num_processed_bdd_nodes++;
   }
 
   void replace_node_in_bdd(BDD::BDDNode_ptr target);
@@ -180,6 +265,10 @@ public:
 
   unsigned get_id() const { return id; }
 
+  // Hash of the structure compared by operator==, so equal plans have the
+  // same fingerprint.
+  uint64_t get_fingerprint() const;
+
   unsigned get_reordered_nodes() const { return reordered_nodes; }
   void inc_reordered_nodes() { reordered_nodes++; }
 
@@ -220,6 +309,7 @@ public:
                              const BDD::BDDNode_ptr &next,
                              bool process_bdd_node = true) const {
     auto new_ep = clone();
+    new_ep.copy_active_path();
 
     if (process_bdd_node) {
       new_ep.update_processed_nodes();
@@ -233,6 +323,7 @@ public:
     } else {
       auto prev = old_leaf.leaf->get_prev();
       prev->replace_next(old_leaf.leaf, new_leaf.leaf);
+      new_leaf.leaf->set_prev(prev);
     }
 
     assert(new_ep.leaves.size());
@@ -287,6 +378,7 @@ public:
                            bool is_terminal = false,
                            bool process_bdd_node = true) const {
     auto new_ep = clone();
+    new_ep.copy_active_path();
 
     if (process_bdd_node) {
       new_ep.update_processed_nodes();
@@ -343,24 +435,42 @@ public:
 
   BDD::BDD &get_bdd() { return bdd; }
 
-  const std::unordered_set<uint64_t> &get_processed_bdd_nodes() const {
-    return processed_bdd_nodes;
+  std::unordered_set<uint64_t> get_processed_bdd_nodes() const {
+    std::unordered_set<uint64_t> processed;
+
+    for (auto node = processed_bdd_nodes.get(); node; node = node->prev.get()) {
+      processed.insert(node->id);
+    }
+
+    return processed;
   }
 
   float get_percentage_of_processed_bdd_nodes() const {
     auto total_nodes = bdd.get_number_of_process_nodes();
-    return (float)processed_bdd_nodes.size() / (float)total_nodes;
+    return (float)num_processed_bdd_nodes / (float)total_nodes;
   }
 
   void remove_from_processed_bdd_nodes(uint64_t id) {
-    auto found_it = processed_bdd_nodes.find(id);
-    processed_bdd_nodes.erase(found_it);
+    assert(is_processed_bdd_node(id));
+
+    std::vector<uint64_t> newer;
+    auto node = processed_bdd_nodes.get();
+
+    for (; node->id != id; node = node->prev.get()) {
+      newer.push_back(node->id);
+    }
+
+    processed_bdd_nodes = node->prev;
+    num_processed_bdd_nodes -= newer.size() + 1;
+
+    for (auto it = newer.rbegin(); it != newer.rend(); it++) {
+      push_processed_bdd_node(*it);
+    }
   }
 
   void add_processed_bdd_node(uint64_t id) {
-    auto found_it = processed_bdd_nodes.find(id);
-    if (found_it == processed_bdd_nodes.end()) {
-      processed_bdd_nodes.insert(id);
+    if (!is_processed_bdd_node(id)) {
+      push_processed_bdd_node(id);
     }
 
     for (auto &leaf : leaves) {
@@ -399,18 +509,15 @@ public:
 
   void visit(ExecutionPlanVisitor &visitor) const { visitor.visit(*this); }
 
+  // A shallow clone shares its nodes until either plan modifies its active
+  // path (see copy_active_path), so it costs O(depth). A deep clone copies the
+  // BDD and the whole tree, which the caller may then modify freely.
   ExecutionPlan clone(bool deep = false) const {
     ExecutionPlan copy = *this;
 
     copy.id = counter++;
 
-    if (deep) {
-      copy.bdd = copy.bdd.clone();
-    }
-
-    if (root) {
-      copy.root = clone_nodes(copy, root.get());
-    } else {
+    if (!root) {
       for (auto leaf : copy.leaves) {
         assert(!leaf.leaf);
       }
@@ -420,6 +527,12 @@ public:
       return copy;
     }
 
+    copy.bdd = copy.bdd.clone();
+
+    if (root) {
+      copy.root = clone_nodes(copy, root.get());
+    }
+
     for (auto &leaf : copy.leaves) {
       assert(leaf.next);
       auto new_next = copy.bdd.get_node_by_id(leaf.next->get_id());
@@ -69,5 +69,18 @@ public:
     ExecutionPlanNode *epn = new ExecutionPlanNode(ep_node);
     return std::shared_ptr<ExecutionPlanNode>(epn);
   }
+
+private:
+  // New version of a node, for a plan that modifies it while sharing the rest
+  // of the tree. It keeps the id, branches and prev of the original.
+  static ExecutionPlanNode_ptr build_version(const ExecutionPlanNode *ep_node) {
+    auto epn = build(ep_node);
+
+    epn->id = ep_node->id;
+    epn->next = ep_node->next;
+    epn->prev = ep_node->prev;
+
+    return epn;
+  }
 };
 } // namespace synapse
\ No newline at end of file
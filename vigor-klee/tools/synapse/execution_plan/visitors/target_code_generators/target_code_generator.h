@@ -5,6 +5,7 @@
 #include <streambuf>
 #include <string>
 
+#include "bdd-profile.h"
 #include "visitor.h"
 
 #define GET_BOILERPLATE_PATH(fname)                                            \
@@ -75,12 +76,18 @@ protected:
   code_builder_t code_builder;
   const ExecutionPlan *original_ep;
 
+  // Branch frequencies of a replay, if any.
+  const BDD::Profile *profile;
+
 public:
   TargetCodeGenerator(const std::string &boilerplate_fpath)
-      : code_builder(boilerplate_fpath), original_ep(nullptr) {
+      : code_builder(boilerplate_fpath), original_ep(nullptr),
+        profile(nullptr) {
     os = std::unique_ptr<std::ostream>(new std::ostream(std::cerr.rdbuf()));
   }
 
+  void set_profile(const BDD::Profile *_profile) { profile = _profile; }
+
   void output_to_file(const std::string &_fpath) {
     fpath = _fpath;
     os = std::unique_ptr<std::ostream>(new std::ofstream(fpath));
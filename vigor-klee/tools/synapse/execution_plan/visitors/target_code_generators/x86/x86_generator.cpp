@@ -878,6 +878,17 @@ int x86_Generator::close_if_clauses() {
   return closed;
 }
 
+// GCC moves what follows a cold label out of the hot text of the function.
+void x86_Generator::mark_if_cold(const BDD::Node *node) {
+  if (!profile || !profile->is_cold(node)) {
+    return;
+  }
+
+  pad(nf_process_stream);
+  nf_process_stream << "cold_path_" << cold_paths++;
+  nf_process_stream << ": __attribute__((cold, unused));\n";
+}
+
 void x86_Generator::allocate_map(call_t call, std::ostream &global_state,
                                  std::ostream &buffer) {
   assert(call.args["keq"].fn_ptr_name.first);
@@ -1605,13 +1616,33 @@ void x86_Generator::visit(const targets::x86::PacketReturnChunk *node) {
 
 void x86_Generator::visit(const targets::x86::If *node) {
   auto condition = node->get_condition();
+  auto bdd_node = node->get_node();
+  auto bias = BDD::Profile::NO_BIAS;
+
+  assert(bdd_node->get_type() == BDD::Node::NodeType::BRANCH);
+  auto branch_node = static_cast<const BDD::Branch *>(bdd_node.get());
+
+  if (profile) {
+    bias = profile->get_bias(branch_node);
+  }
 
   pad(nf_process_stream);
   nf_process_stream << "if (";
-  nf_process_stream << transpile(condition, stack);
+
+  if (bias != BDD::Profile::NO_BIAS) {
+    // The condition is not necessarily 0 or 1, so normalize it
+    nf_process_stream << "__builtin_expect(!!(";
+    nf_process_stream << transpile(condition, stack);
+    nf_process_stream << "), " << (bias == BDD::Profile::ON_TRUE) << ")";
+  } else {
+    nf_process_stream << transpile(condition, stack);
+  }
+
   nf_process_stream << ") {\n";
   lvl++;
 
+  mark_if_cold(branch_node->get_on_true().get());
+
   stack.push();
   pending_ifs.push(true);
 }
@@ -1619,10 +1650,16 @@ void x86_Generator::visit(const targets::x86::If *node) {
 void x86_Generator::visit(const targets::x86::Then *node) {}
 
 void x86_Generator::visit(const targets::x86::Else *node) {
+  auto bdd_node = node->get_node();
+
   pad(nf_process_stream);
   nf_process_stream << "else {\n";
   lvl++;
 
+  assert(bdd_node->get_type() == BDD::Node::NodeType::BRANCH);
+  auto branch_node = static_cast<const BDD::Branch *>(bdd_node.get());
+  mark_if_cold(branch_node->get_on_false().get());
+
   stack.push();
 }
 
@@ -324,6 +324,7 @@ private:
   std::stringstream nf_process_stream;
 
   int lvl;
+  int cold_paths;
   std::stack<bool> pending_ifs;
   stack_t stack;
   std::vector<std::pair<klee::ref<klee::Expr>, uint64_t>> expiration_times;
@@ -334,6 +335,7 @@ private:
   void pad(std::ostream &_os) const { _os << std::string(lvl * 2, ' '); }
 
   int close_if_clauses();
+  void mark_if_cold(const BDD::Node *node);
 
   void fill_is_controller();
 
@@ -361,7 +363,7 @@ private:
 public:
   x86_Generator()
       : TargetCodeGenerator(GET_BOILERPLATE_PATH("boilerplate.c")), lvl(0),
-        stack() {}
+        cold_paths(0), stack() {}
 
   void visit(ExecutionPlan ep) override;
   void visit(const ExecutionPlanNode *ep_node) override;
@@ -3,17 +3,14 @@
 #include "../execution_plan/execution_plan.h"
 #include "score.h"
 
+#include <iterator>
 #include <set>
+#include <unordered_map>
 
 namespace synapse {
 
 struct HeuristicConfiguration {
   virtual Score get_score(const ExecutionPlan &e) const = 0;
-
-  virtual bool operator()(const ExecutionPlan &e1,
-                          const ExecutionPlan &e2) const {
-    return get_score(e1) > get_score(e2);
-  }
   virtual bool terminate_on_first_solution() const = 0;
 };
 
@@ -22,74 +19,210 @@ template <class T> class Heuristic {
                 "T must inherit from HeuristicConfiguration");
 
 protected:
-  std::multiset<ExecutionPlan, T> execution_plans;
+  // Scores are computed once, when a plan is added, and plans are ordered by
+  // them, best first.
+  struct entry_t {
+    // Only moved out right before the entry is erased.
+    mutable ExecutionPlan execution_plan;
+    std::vector<int> score;
+    uint64_t fingerprint;
+
+    entry_t(const ExecutionPlan &_execution_plan, std::vector<int> _score,
+            uint64_t _fingerprint)
+        : execution_plan(_execution_plan), score(std::move(_score)),
+          fingerprint(_fingerprint) {}
+  };
+
+  struct entry_comparator_t {
+    bool operator()(const entry_t &e1, const entry_t &e2) const {
+      return e1.score > e2.score;
+    }
+  };
+
+  typedef std::multiset<entry_t, entry_comparator_t> entries_t;
+
+  entries_t execution_plans;
+  std::unordered_multimap<uint64_t, typename entries_t::iterator> fingerprints;
   T configuration;
 
+  // Plans that still have BDD nodes to process.
+  unsigned pending;
+
 private:
-  typename std::set<ExecutionPlan, T>::iterator get_best_it() const {
+  typename entries_t::iterator get_best_it() const {
     assert(execution_plans.size());
     return execution_plans.begin();
   }
 
-  typename std::set<ExecutionPlan, T>::iterator get_next_it() const {
+  typename entries_t::iterator get_next_it() const {
     assert(execution_plans.size());
 
     auto conf = static_cast<const HeuristicConfiguration *>(&configuration);
     auto it = execution_plans.begin();
 
-    while (!conf->terminate_on_first_solution() && !it->get_next_node() &&
-           it != execution_plans.end()) {
+    while (!conf->terminate_on_first_solution() &&
+           it != execution_plans.end() &&
+           !it->execution_plan.get_next_node()) {
       ++it;
     }
 
-    if (!it->get_next_node()) {
+    if (it != execution_plans.end() && !it->execution_plan.get_next_node()) {
       it = execution_plans.end();
     }
 
     return it;
   }
 
+  bool contains(const ExecutionPlan &ep, uint64_t fingerprint) const {
+    auto range = fingerprints.equal_range(fingerprint);
+
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second->execution_plan == ep) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Whether the plan was pending is given by the caller, since the plan may
+  // already have been moved out of the entry.
+  void erase(typename entries_t::iterator entry_it, bool was_pending) {
+    auto range = fingerprints.equal_range(entry_it->fingerprint);
+
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == entry_it) {
+        fingerprints.erase(it);
+        break;
+      }
+    }
+
+    if (was_pending) {
+      pending--;
+    }
+
+    execution_plans.erase(entry_it);
+  }
+
+  bool pending_is_consistent() const {
+    unsigned counted = 0;
+
+    for (const auto &entry : execution_plans) {
+      if (entry.execution_plan.get_next_node()) {
+        counted++;
+      }
+    }
+
+    return counted == pending;
+  }
+
+  // Fingerprints point into the multiset, so copies need their own.
+  void index_fingerprints() {
+    fingerprints.clear();
+
+    for (auto it = execution_plans.begin(); it != execution_plans.end(); ++it) {
+      fingerprints.emplace(it->fingerprint, it);
+    }
+  }
+
 public:
-  bool finished() const { return get_next_it() == execution_plans.end(); }
+  Heuristic() : pending(0) {}
 
-  ExecutionPlan get() { return *get_best_it(); }
+  Heuristic(const Heuristic &other)
+      : execution_plans(other.execution_plans),
+        configuration(other.configuration), pending(other.pending) {
+    index_fingerprints();
+  }
+
+  Heuristic &operator=(const Heuristic &other) {
+    execution_plans = other.execution_plans;
+    configuration = other.configuration;
+    pending = other.pending;
+    index_fingerprints();
+    return *this;
+  }
+
+  // Nothing left to search, either because every plan is a solution or
+  // because there are no plans at all (a drained or pruned search).
+  bool finished() const {
+    return execution_plans.empty() ||
+           get_next_it() == execution_plans.end();
+  }
+
+  ExecutionPlan get() { return get_best_it()->execution_plan; }
 
   std::vector<ExecutionPlan> get_all() const {
     std::vector<ExecutionPlan> eps;
-    eps.assign(execution_plans.begin(), execution_plans.end());
+
+    for (const auto &entry : execution_plans) {
+      eps.push_back(entry.execution_plan);
+    }
+
     return eps;
   }
 
   ExecutionPlan pop() {
     auto it = get_next_it();
-    auto copy = *it;
+    assert(it != execution_plans.end());
 
-    execution_plans.erase(it);
-    return copy;
+    bool was_pending = (bool)it->execution_plan.get_next_node();
+    auto ep = std::move(it->execution_plan);
+    erase(it, was_pending);
+    assert(pending_is_consistent());
+
+    return ep;
   }
 
   void add(const std::vector<ExecutionPlan> &next_eps) {
     assert(next_eps.size());
 
-    for (auto ep : next_eps) {
-      auto found = false;
+    for (const auto &ep : next_eps) {
+      auto fingerprint = ep.get_fingerprint();
 
-      for (auto saved_ep : execution_plans) {
-        if (saved_ep == ep) {
-          found = true;
-          break;
-        }
+      if (contains(ep, fingerprint)) {
+        continue;
       }
 
-      if (found) {
+      auto it = execution_plans.emplace(ep, get_score(ep).get_values(),
+                                        fingerprint);
+      fingerprints.emplace(fingerprint, it);
+
+      if (ep.get_next_node()) {
+        pending++;
+      }
+    }
+
+    assert(pending_is_consistent());
+  }
+
+  // Drops the worst plans still being searched until at most beam_width of
+  // them are left, and returns their ids. Solutions are always kept.
+  std::vector<unsigned> trim(unsigned beam_width) {
+    std::vector<unsigned> dropped;
+
+    auto it = execution_plans.end();
+
+    while (pending > beam_width && it != execution_plans.begin()) {
+      --it;
+
+      if (!it->execution_plan.get_next_node()) {
         continue;
       }
 
-      execution_plans.insert(ep);
+      dropped.push_back(it->execution_plan.get_id());
+
+      auto next_it = std::next(it);
+      erase(it, true);
+      it = next_it;
     }
+
+    assert(pending_is_consistent());
+    return dropped;
   }
 
   int size() const { return execution_plans.size(); }
+  int get_num_pending() const { return pending; }
+  int get_num_solutions() const { return size() - pending; }
 
   const T *get_cfg() const { return &configuration; }
 
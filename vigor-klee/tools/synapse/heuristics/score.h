@@ -80,6 +80,24 @@ public:
     return (this->*computer)();
   }
 
+  // Values of every category, in order and negated when minimized, so that
+  // scores compare lexicographically.
+  std::vector<int> get_values() const {
+    std::vector<int> values;
+
+    for (auto category_objective : categories) {
+      auto value = get(category_objective.first);
+
+      if (category_objective.second == Objective::MINIMIZE) {
+        value *= -1;
+      }
+
+      values.push_back(value);
+    }
+
+    return values;
+  }
+
   inline bool operator<(const Score &other) {
     for (auto category_objective : categories) {
       auto category = category_objective.first;
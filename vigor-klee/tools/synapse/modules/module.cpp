@@ -950,6 +950,7 @@ bool can_process_platform(const ExecutionPlan &ep, Target target) {
 processing_result_t Module::process_node(const ExecutionPlan &ep,
                                          BDD::BDDNode_ptr node) {
   assert(node);
+  klee::SolverProfileSite profile_site(name);
   processing_result_t result;
 
   if (can_process_platform(ep, target)) {
@@ -0,0 +1,158 @@
+#include "search.h"
+
+#include "modules/modules.h"
+
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace synapse {
+
+namespace {
+
+bool write_all(int fd, const char *data, size_t size) {
+  while (size) {
+    auto written = write(fd, data, size);
+
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (written <= 0) {
+      return false;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+bool read_all(int fd, std::vector<char> &data) {
+  char buffer[1 << 12];
+
+  while (true) {
+    auto n = read(fd, buffer, sizeof(buffer));
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n < 0) {
+      return false;
+    }
+
+    if (n == 0) {
+      return true;
+    }
+
+    data.insert(data.end(), buffer, buffer + n);
+  }
+}
+
+} // namespace
+
+bool SearchEngine::spawn_search_job(search_job_t &job) {
+  int fds[2];
+
+  if (pipe(fds) < 0) {
+    return false;
+  }
+
+  // Buffered output would otherwise be flushed by both processes.
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    job.pid = 0;
+    job.fd = fds[1];
+    return true;
+  }
+
+  close(fds[1]);
+
+  job.pid = pid;
+  job.fd = fds[0];
+
+  return true;
+}
+
+void SearchEngine::finish_search_job(const search_job_t &job,
+                                     const std::vector<uint32_t> &result) {
+  bool sent = write_all(job.fd, reinterpret_cast<const char *>(result.data()),
+                        result.size() * sizeof(result[0]));
+
+  std::cout.flush();
+  std::cerr.flush();
+
+  // Skip destructors and atexit handlers, they belong to the parent.
+  _exit(sent ? 0 : 1);
+}
+
+bool SearchEngine::join_search_job(const search_job_t &job,
+                                   std::vector<uint32_t> &result) {
+  std::vector<char> data;
+  bool received = read_all(job.fd, data);
+  close(job.fd);
+
+  int status;
+  while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR)
+    ;
+
+  bool ok = received && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+            data.size() && data.size() % sizeof(uint32_t) == 0;
+
+  if (!ok) {
+    return false;
+  }
+
+  result.resize(data.size() / sizeof(uint32_t));
+  memcpy(result.data(), data.data(), data.size());
+
+  return true;
+}
+
+ExecutionPlan SearchEngine::replay(const ExecutionPlan &ep,
+                                   const trace_t &trace,
+                                   SearchSpace &search_space) const {
+  assert(trace.size() % 2 == 1 && "Corrupted search job trace");
+
+  auto current = ep;
+
+  for (unsigned i = 1; i < trace.size(); i += 2) {
+    assert(trace[i] < modules.size());
+
+    auto next_node = current.get_next_node();
+    assert(next_node);
+
+    auto module = modules[trace[i]];
+    auto result = module->process_node(current, next_node);
+
+    assert(trace[i + 1] < result.next_eps.size() &&
+           "Search job decisions don't replay");
+
+    auto next = result.next_eps[trace[i + 1]];
+
+    search_space.add_leaves(current, result.module,
+                            std::vector<ExecutionPlan>{ next });
+    search_space.submit_leaves();
+
+    current = next;
+  }
+
+  return current;
+}
+
+} // namespace synapse
@@ -6,17 +6,403 @@
 #include "log.h"
 #include "search_space.h"
 
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <unordered_map>
+
 namespace synapse {
 
 class SearchEngine {
 private:
+  // Decisions taken from a frontier plan: the index of the plan in the
+  // frontier, followed by a (module, resulting plan) pair of indexes per
+  // expansion.
+  typedef std::vector<uint32_t> trace_t;
+  typedef std::unordered_map<unsigned, trace_t> traces_t;
+
+  struct search_job_t {
+    pid_t pid;
+    int fd;
+    unsigned partition;
+  };
+
+  typedef std::chrono::steady_clock search_clock_t;
+  typedef std::function<void(const ExecutionPlan &)> improvement_callback_t;
+
+  struct search_progress_t {
+    search_clock_t::time_point start;
+    search_clock_t::time_point last_report;
+    unsigned expansions;
+    unsigned expansions_at_last_report;
+    bool warned_out_of_time;
+
+    // Best solution found so far, and its score.
+    std::shared_ptr<ExecutionPlan> best;
+    std::vector<int> best_score;
+
+    // Search jobs only report statistics, prefixed with their name.
+    bool is_job;
+    std::string name;
+
+    search_progress_t()
+        : expansions(0), expansions_at_last_report(0),
+          warned_out_of_time(false), is_job(false) {}
+  };
+
+  // The search is only split once the frontier has this many plans per job.
+  static constexpr unsigned PARALLEL_PLANS_PER_JOB = 4;
+
   std::vector<synapse::Module_ptr> modules;
   BDD::BDD bdd;
+  unsigned jobs;
+
+  // Limits, in plans and seconds. Zero means unlimited.
+  unsigned beam_width;
+  unsigned time_budget;
+  unsigned report_interval;
+  improvement_callback_t on_improvement;
+
+  search_progress_t progress;
 
 public:
-  SearchEngine(BDD::BDD _bdd) : bdd(_bdd) {}
-  SearchEngine(const SearchEngine &se) : SearchEngine(se.bdd) {
+  SearchEngine(BDD::BDD _bdd, unsigned _jobs = 1)
+      : bdd(_bdd), jobs(_jobs), beam_width(0), time_budget(0),
+        report_interval(0) {
+    assert(jobs > 0);
+  }
+
+  SearchEngine(const SearchEngine &se) : SearchEngine(se.bdd, se.jobs) {
     modules = se.modules;
+    beam_width = se.beam_width;
+    time_budget = se.time_budget;
+    report_interval = se.report_interval;
+    on_improvement = se.on_improvement;
+  }
+
+private:
+  static bool spawn_search_job(search_job_t &job);
+  static void finish_search_job(const search_job_t &job,
+                                const std::vector<uint32_t> &result);
+  static bool join_search_job(const search_job_t &job,
+                              std::vector<uint32_t> &result);
+
+  ExecutionPlan replay(const ExecutionPlan &ep, const trace_t &trace,
+                       SearchSpace &search_space) const;
+
+  double seconds_since(search_clock_t::time_point time_point) const {
+    return std::chrono::duration<double>(search_clock_t::now() - time_point).count();
+  }
+
+  // The time budget only stops a search that already has a solution.
+  bool out_of_time() {
+    if (!time_budget || seconds_since(progress.start) < time_budget) {
+      return false;
+    }
+
+    if (!progress.best) {
+      if (!progress.warned_out_of_time) {
+        Log::wrn() << progress.name << "Out of time without a solution,"
+                                       " searching until one is found.\n";
+        progress.warned_out_of_time = true;
+      }
+
+      return false;
+    }
+
+    return true;
+  }
+
+  template <class T>
+  void consider_solution(const Heuristic<T> &h, const ExecutionPlan &ep) {
+    auto score = h.get_score(ep).get_values();
+
+    if (progress.best && score <= progress.best_score) {
+      return;
+    }
+
+    progress.best = std::make_shared<ExecutionPlan>(ep);
+    progress.best_score = score;
+
+    if (progress.is_job) {
+      return;
+    }
+
+    std::cerr << "improved:  " << h.get_score(ep) << " after "
+              << progress.expansions << " expansions\n";
+
+    if (on_improvement) {
+      on_improvement(ep);
+    }
+  }
+
+  template <class T> void report_progress(const Heuristic<T> &h) {
+    if (!report_interval ||
+        seconds_since(progress.last_report) < report_interval) {
+      return;
+    }
+
+    auto now = search_clock_t::now();
+    auto elapsed = seconds_since(progress.start);
+    auto rate = (progress.expansions - progress.expansions_at_last_report) /
+                seconds_since(progress.last_report);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::cerr << progress.name << "search:    " << std::fixed
+              << std::setprecision(0) << elapsed << " s, "
+              << progress.expansions << " expansions (" << std::setprecision(1)
+              << rate << "/s), frontier " << h.get_num_pending()
+              << ", solutions " << h.get_num_solutions() << ", max rss "
+              << usage.ru_maxrss / 1024 << " MB\n";
+
+    progress.last_report = now;
+    progress.expansions_at_last_report = progress.expansions;
+  }
+
+  template <class T>
+  void run(Heuristic<T> &h, SearchSpace &search_space, traces_t *traces) {
+    while (!h.finished() && !out_of_time()) {
+      expand(h, search_space, traces);
+    }
+  }
+
+  template <class T>
+  void expand(Heuristic<T> &h, SearchSpace &search_space, traces_t *traces) {
+    auto available = h.size();
+    auto next_ep = h.pop();
+    auto next_node = next_ep.get_next_node();
+    assert(next_node);
+
+    // Graphviz::visualize(next_ep);
+
+    struct report_t {
+      std::vector<std::string> target_name;
+      std::vector<std::string> name;
+      std::vector<unsigned> generated_contexts;
+    };
+
+    report_t report;
+
+    for (unsigned i = 0; i < modules.size(); i++) {
+      auto module = modules[i];
+      auto result = module->process_node(next_ep, next_node);
+
+      if (result.next_eps.size()) {
+        report.target_name.push_back(module->get_target_name());
+        report.name.push_back(module->get_name());
+        report.generated_contexts.push_back(result.next_eps.size());
+
+        if (traces) {
+          const auto &trace = traces->at(next_ep.get_id());
+
+          for (unsigned j = 0; j < result.next_eps.size(); j++) {
+            auto &next_trace = (*traces)[result.next_eps[j].get_id()];
+            next_trace = trace;
+            next_trace.push_back(i);
+            next_trace.push_back(j);
+          }
+        }
+
+        h.add(result.next_eps);
+        search_space.add_leaves(next_ep, result.module, result.next_eps);
+
+        for (const auto &ep : result.next_eps) {
+          if (!ep.get_next_node()) {
+            consider_solution(h, ep);
+          }
+        }
+      }
+    }
+
+    if (traces) {
+      traces->erase(next_ep.get_id());
+    }
+
+    if (beam_width) {
+      for (auto dropped : h.trim(beam_width)) {
+        if (traces) {
+          traces->erase(dropped);
+        }
+      }
+    }
+
+    progress.expansions++;
+    report_progress(h);
+
+    if (report.target_name.size()) {
+      search_space.submit_leaves();
+
+      Log::dbg() << "\n";
+      Log::dbg() << "=======================================================\n";
+      Log::dbg() << "Available      " << available << "\n";
+      Log::dbg() << "BDD progress   " << std::fixed << std::setprecision(2)
+                 << 100 * next_ep.get_percentage_of_processed_bdd_nodes()
+                 << " %"
+                 << "\n";
+      Log::dbg() << "Node           " << next_node->dump(true) << "\n";
+
+      if (next_ep.get_current_platform().first) {
+        auto platform = next_ep.get_current_platform().second;
+        Log::dbg() << "Current target " << Module::target_to_string(platform)
+                   << "\n";
+      }
+
+      for (unsigned i = 0; i < report.target_name.size(); i++) {
+        Log::dbg() << "MATCH          " << report.target_name[i]
+                   << "::" << report.name[i] << " -> "
+                   << report.generated_contexts[i] << " exec plans"
+                   << "\n";
+      }
+
+      Log::dbg() << "=======================================================\n";
+    } else {
+      Log::dbg() << "\n";
+      Log::dbg() << "=======================================================\n";
+      Log::dbg() << "Available      " << available << "\n";
+      Log::dbg() << "Node           " << next_node->dump(true) << "\n";
+
+      if (next_ep.get_current_platform().first) {
+        auto platform = next_ep.get_current_platform().second;
+        Log::dbg() << "Current target " << Module::target_to_string(platform)
+                   << "\n";
+      }
+
+      Log::wrn() << "No module can handle this BDD node"
+                    " in the current context.\n";
+      Log::wrn() << "Deleting solution from search space.\n";
+
+      Log::dbg() << "=======================================================\n";
+    }
+  }
+
+  // Parallel search.
+  //
+  // Once the frontier is big enough, it is split round-robin into one
+  // partition per job, and every partition is searched on its own by a forked
+  // process, the first one by this process. Processes are used instead of
+  // threads because modules query the solver and build KLEE expressions,
+  // which can't be shared between threads.
+  //
+  // A job sends back its best plan as the decisions that led to it from its
+  // frontier, which are replayed here. Plans are only deduplicated within a
+  // partition, and the search space only records the path to the best plan
+  // of every job.
+  //
+  // Returns the number of solutions found by the jobs that were not merged
+  // into the given heuristic.
+  template <class T>
+  unsigned search_parallel(Heuristic<T> &h, SearchSpace &search_space) {
+    while (!h.finished() && !out_of_time() &&
+           static_cast<unsigned>(h.get_num_pending()) <
+               jobs * PARALLEL_PLANS_PER_JOB) {
+      expand(h, search_space, nullptr);
+    }
+
+    if (h.finished() || out_of_time()) {
+      return 0;
+    }
+
+    std::vector<ExecutionPlan> frontier;
+
+    // Solutions stay in the heuristic, only pending plans are split.
+    while (!h.finished()) {
+      frontier.push_back(h.pop());
+    }
+
+    auto add_partition = [&](Heuristic<T> &target, unsigned partition,
+                             traces_t *traces) {
+      for (unsigned i = partition; i < frontier.size(); i += jobs) {
+        target.add(std::vector<ExecutionPlan>{ frontier[i] });
+
+        if (traces) {
+          (*traces)[frontier[i].get_id()] = trace_t{ i };
+        }
+      }
+    };
+
+    std::vector<search_job_t> running;
+    std::vector<unsigned> local_partitions{ 0 };
+
+    for (unsigned partition = 1; partition < jobs; partition++) {
+      search_job_t job;
+      job.partition = partition;
+
+      if (!spawn_search_job(job)) {
+        local_partitions.push_back(partition);
+        continue;
+      }
+
+      if (job.pid != 0) {
+        running.push_back(job);
+        continue;
+      }
+
+      Heuristic<T> partition_h;
+      traces_t traces;
+
+      // Solutions found before the split are not in this partition.
+      progress.best.reset();
+      progress.best_score.clear();
+      progress.is_job = true;
+      progress.name = "job " + std::to_string(partition) + " ";
+
+      add_partition(partition_h, partition, &traces);
+      run(partition_h, search_space, &traces);
+
+      std::vector<uint32_t> result{ static_cast<uint32_t>(
+          partition_h.get_num_solutions()) };
+
+      if (progress.best) {
+        const auto &trace = traces.at(progress.best->get_id());
+        result.insert(result.end(), trace.begin(), trace.end());
+      }
+
+      finish_search_job(job, result);
+    }
+
+    for (auto partition : local_partitions) {
+      add_partition(h, partition, nullptr);
+    }
+
+    run(h, search_space, nullptr);
+
+    unsigned remote_solutions = 0;
+
+    for (const auto &job : running) {
+      std::vector<uint32_t> result;
+
+      if (!join_search_job(job, result)) {
+        Log::wrn() << "Search job " << job.pid
+                   << " failed, searching its partition locally\n";
+
+        add_partition(h, job.partition, nullptr);
+        run(h, search_space, nullptr);
+
+        continue;
+      }
+
+      auto solutions = result[0];
+
+      if (!solutions) {
+        continue;
+      }
+
+      trace_t trace(result.begin() + 1, result.end());
+      assert(trace.size() && trace[0] < frontier.size());
+
+      auto best = replay(frontier[trace[0]], trace, search_space);
+      h.add(std::vector<ExecutionPlan>{ best });
+      consider_solution(h, best);
+
+      remote_solutions += solutions - 1;
+    }
+
+    return remote_solutions;
   }
 
 public:
@@ -44,93 +430,51 @@ public:
     modules.insert(modules.begin(), _modules.begin(), _modules.end());
   }
 
-  template <class T> ExecutionPlan search(Heuristic<T> h) {
-    auto first_execution_plan = ExecutionPlan(bdd);
-    SearchSpace search_space(h.get_cfg(), first_execution_plan);
+  // Keeps at most this many plans being searched, dropping the worst ones.
+  void set_beam_width(unsigned _beam_width) { beam_width = _beam_width; }
 
-    h.add(std::vector<ExecutionPlan>{ first_execution_plan });
+  // Stops searching after this many seconds, once there is a solution.
+  void set_time_budget(unsigned seconds) { time_budget = seconds; }
 
-    while (!h.finished()) {
-      auto available = h.size();
-      auto next_ep = h.pop();
-      auto next_node = next_ep.get_next_node();
-      assert(next_node);
-
-      // Graphviz::visualize(next_ep);
-
-      struct report_t {
-        std::vector<std::string> target_name;
-        std::vector<std::string> name;
-        std::vector<unsigned> generated_contexts;
-      };
-
-      report_t report;
-
-      for (auto module : modules) {
-        auto result = module->process_node(next_ep, next_node);
+  void set_report_interval(unsigned seconds) { report_interval = seconds; }
 
-        if (result.next_eps.size()) {
-          report.target_name.push_back(module->get_target_name());
-          report.name.push_back(module->get_name());
-          report.generated_contexts.push_back(result.next_eps.size());
+  // Called with every solution better than the ones found before it.
+  void set_improvement_callback(improvement_callback_t callback) {
+    on_improvement = callback;
+  }
 
-          h.add(result.next_eps);
-          search_space.add_leaves(next_ep, result.module, result.next_eps);
-        }
-      }
+  template <class T> ExecutionPlan search(Heuristic<T> h) {
+    auto first_execution_plan = ExecutionPlan(bdd);
+    SearchSpace search_space(h.get_cfg(), first_execution_plan);
 
-      if (report.target_name.size()) {
-        search_space.submit_leaves();
+    h.add(std::vector<ExecutionPlan>{ first_execution_plan });
 
-        Log::dbg() << "\n";
-        Log::dbg()
-            << "=======================================================\n";
-        Log::dbg() << "Available      " << available << "\n";
-        Log::dbg() << "BDD progress   " << std::fixed << std::setprecision(2)
-                   << 100 * next_ep.get_percentage_of_processed_bdd_nodes()
-                   << " %"
-                   << "\n";
-        Log::dbg() << "Node           " << next_node->dump(true) << "\n";
+    progress = search_progress_t();
+    progress.start = search_clock_t::now();
+    progress.last_report = progress.start;
 
-        if (next_ep.get_current_platform().first) {
-          auto platform = next_ep.get_current_platform().second;
-          Log::dbg() << "Current target " << Module::target_to_string(platform)
-                     << "\n";
-        }
+    unsigned remote_solutions = 0;
 
-        for (unsigned i = 0; i < report.target_name.size(); i++) {
-          Log::dbg() << "MATCH          " << report.target_name[i]
-                     << "::" << report.name[i] << " -> "
-                     << report.generated_contexts[i] << " exec plans"
-                     << "\n";
-        }
+    if (jobs > 1) {
+      remote_solutions = search_parallel(h, search_space);
+    }
 
-        Log::dbg()
-            << "=======================================================\n";
-      } else {
-        Log::dbg() << "\n";
-        Log::dbg()
-            << "=======================================================\n";
-        Log::dbg() << "Available      " << available << "\n";
-        Log::dbg() << "Node           " << next_node->dump(true) << "\n";
-
-        if (next_ep.get_current_platform().first) {
-          auto platform = next_ep.get_current_platform().second;
-          Log::dbg() << "Current target " << Module::target_to_string(platform)
-                     << "\n";
-        }
+    run(h, search_space, nullptr);
 
-        Log::wrn() << "No module can handle this BDD node"
-                      " in the current context.\n";
-        Log::wrn() << "Deleting solution from search space.\n";
+    // Out of time, the best plan in the heuristic may be unfinished, and
+    // after a parallel search the heuristic may hold no plan at all, so the
+    // best solution seen wins, if any.
+    assert((progress.best || h.size()) && "No execution plan left");
+    auto winner = progress.best ? *progress.best : h.get();
 
-        Log::dbg()
-            << "=======================================================\n";
-      }
+    if (!h.finished()) {
+      std::cerr << "stopped:   out of time with " << h.get_num_pending()
+                << " plans left\n";
     }
 
-    std::cerr << "solutions: " << h.get_all().size() << "\n";
-    std::cerr << "winner:    " << h.get_score(h.get()) << "\n";
+    std::cerr << "solutions: " << h.get_num_solutions() + remote_solutions
+              << "\n";
+    std::cerr << "winner:    " << h.get_score(winner) << "\n";
 
     // Graphviz::visualize(h.get());
     // Graphviz::visualize(h.get_all().back());
@@ -140,7 +484,7 @@ public:
     // }
     // Graphviz::visualize(h.get(), search_space);
 
-    return h.get();
+    return winner;
   }
 };
 } // namespace synapse
@@ -57,6 +57,46 @@ llvm::cl::opt<std::string>
 llvm::cl::opt<std::string>
     Out("out", llvm::cl::desc("Output directory for every generated file."),
         llvm::cl::cat(SyNAPSE));
+
+llvm::cl::opt<unsigned>
+    Jobs("jobs", llvm::cl::desc("Number of processes searching in parallel."),
+         llvm::cl::init(1), llvm::cl::cat(SyNAPSE));
+
+llvm::cl::opt<unsigned> BeamWidth(
+    "beam-width",
+    llvm::cl::desc("Maximum number of plans being searched (0 for no limit)."),
+    llvm::cl::init(0), llvm::cl::cat(SyNAPSE));
+
+llvm::cl::opt<unsigned> TimeBudget(
+    "time-budget",
+    llvm::cl::desc("Seconds after which the search stops with the best "
+                   "solution found so far (0 for no limit)."),
+    llvm::cl::init(0), llvm::cl::cat(SyNAPSE));
+
+llvm::cl::opt<bool> Anytime(
+    "anytime",
+    llvm::cl::desc("Generate code for every better solution found while "
+                   "searching, in the output directory."),
+    llvm::cl::init(false), llvm::cl::cat(SyNAPSE));
+
+llvm::cl::opt<std::string> ProfileReport(
+    "profile",
+    llvm::cl::desc("Call path hitter report of a replay, used to hint biased "
+                   "branches and move cold ones out of the way."),
+    llvm::cl::cat(SyNAPSE));
+
+llvm::cl::opt<double> ColdRatio(
+    "cold-ratio",
+    llvm::cl::desc("Fraction of the profiled packets under which a path is "
+                   "considered cold."),
+    llvm::cl::init(0.01), llvm::cl::cat(SyNAPSE));
+
+llvm::cl::opt<unsigned> ReportInterval(
+    "report-interval",
+    llvm::cl::desc("Seconds between search statistics (0 to disable)."),
+    llvm::cl::init(10), llvm::cl::cat(SyNAPSE));
+
+std::unique_ptr<BDD::Profile> profile;
 } // namespace
 
 BDD::BDD build_bdd() {
@@ -82,18 +122,53 @@ BDD::BDD build_bdd() {
   return BDD::BDD(call_paths);
 }
 
+// Generators can only be used once, and open their files when targets are
+// added, so every generation gets its own.
+void generate_code(const synapse::ExecutionPlan &execution_plan) {
+  synapse::CodeGenerator code_generator(Out);
+  code_generator.set_profile(profile.get());
+
+  for (unsigned i = 0; i != TargetList.size(); ++i) {
+    code_generator.add_target(TargetList[i]);
+  }
+
+  code_generator.generate(execution_plan);
+}
+
 int main(int argc, char **argv) {
   llvm::cl::ParseCommandLineOptions(argc, argv);
 
+  if (Jobs == 0) {
+    std::cerr << argv[0] << ": -jobs must be at least 1" << std::endl;
+    return 1;
+  }
+
+  if (Anytime && Out.empty()) {
+    std::cerr << argv[0] << ": -anytime needs an output directory (-out)"
+              << std::endl;
+    return 1;
+  }
+
   synapse::Log::MINIMUM_LOG_LEVEL = synapse::Log::Level::DEBUG;
   BDD::BDD bdd = build_bdd();
 
-  synapse::SearchEngine search_engine(bdd);
-  synapse::CodeGenerator code_generator(Out);
+  if (ProfileReport.size()) {
+    profile = std::unique_ptr<BDD::Profile>(
+        new BDD::Profile(ProfileReport, ColdRatio));
+  }
+
+  synapse::SearchEngine search_engine(bdd, Jobs);
 
   for (unsigned i = 0; i != TargetList.size(); ++i) {
     search_engine.add_target(TargetList[i]);
-    code_generator.add_target(TargetList[i]);
+  }
+
+  search_engine.set_beam_width(BeamWidth);
+  search_engine.set_time_budget(TimeBudget);
+  search_engine.set_report_interval(ReportInterval);
+
+  if (Anytime) {
+    search_engine.set_improvement_callback(generate_code);
   }
 
   synapse::Biggest biggest;
@@ -108,7 +183,7 @@ int main(int argc, char **argv) {
   // auto winner = search_engine.search(most_compact);
   auto winner = search_engine.search(maximize_switch_nodes);
 
-  code_generator.generate(winner);
+  generate_code(winner);
 
   return 0;
 }
@@ -0,0 +1,184 @@
+// Compares how long it takes a restarted NF to get its flow table back, by
+// either reattaching to persistent state or rebuilding and rehashing it from
+// a snapshot of the flows.
+// Usage: persistent-state [file] (default /dev/shm/vigor-persistent-bench,
+// use a file on hugetlbfs to measure with hugepages)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libvig/unverified/persistent.h"
+#include "libvig/verified/double-chain.h"
+#include "libvig/verified/map.h"
+#include "libvig/verified/vector.h"
+
+struct Flow {
+  uint32_t src_ip;
+  uint32_t dst_ip;
+  uint16_t src_port;
+  uint16_t dst_port;
+  uint8_t protocol;
+};
+
+static bool flow_eq(void *a, void *b) {
+  struct Flow *fa = (struct Flow *)a;
+  struct Flow *fb = (struct Flow *)b;
+  return fa->src_ip == fb->src_ip && fa->dst_ip == fb->dst_ip &&
+         fa->src_port == fb->src_port && fa->dst_port == fb->dst_port &&
+         fa->protocol == fb->protocol;
+}
+
+static unsigned flow_hash(void *obj) {
+  struct Flow *flow = (struct Flow *)obj;
+  unsigned hash = 0;
+  hash = __builtin_ia32_crc32si(hash, flow->src_ip);
+  hash = __builtin_ia32_crc32si(hash, flow->dst_ip);
+  hash = __builtin_ia32_crc32si(hash, flow->src_port);
+  hash = __builtin_ia32_crc32si(hash, flow->dst_port);
+  hash = __builtin_ia32_crc32si(hash, flow->protocol);
+  return hash;
+}
+
+static void flow_init(void *obj) { memset(obj, 0, sizeof(struct Flow)); }
+
+static void flow_make(struct Flow *flow, unsigned n) {
+  flow->src_ip = 0x0a000000 | (n >> 8);
+  flow->dst_ip = 0xc0a80000 | (n * 2654435761u >> 16);
+  flow->src_port = 1024 + (n & 0xff) * 211;
+  flow->dst_port = 80;
+  flow->protocol = 6;
+}
+
+struct FlowTable {
+  struct Map *map;
+  struct Vector *keys;
+  struct DoubleChain *chain;
+};
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void insert_flow(struct FlowTable *table, struct Flow *flow) {
+  int index;
+  if (!dchain_allocate_new_index(table->chain, &index, 1)) {
+    fprintf(stderr, "Flow table full\n");
+    exit(1);
+  }
+  struct Flow *key;
+  vector_borrow(table->keys, index, (void **)&key);
+  *key = *flow;
+  map_put(table->map, key, index);
+  vector_return(table->keys, index, key);
+}
+
+static void lookup_all(struct FlowTable *table, unsigned flows) {
+  for (unsigned n = 0; n < flows; n++) {
+    struct Flow flow;
+    flow_make(&flow, n);
+    int index;
+    if (!map_get(table->map, &flow, &index)) {
+      fprintf(stderr, "Flow %u is missing\n", n);
+      exit(1);
+    }
+  }
+}
+
+static void persistent_table(struct PersistentArena *arena, unsigned capacity,
+                             struct FlowTable *table) {
+  if (!persistent_map_allocate(arena, "fm", flow_eq, flow_hash, capacity,
+                               &table->map) ||
+      !persistent_vector_allocate(arena, "fv", sizeof(struct Flow), capacity,
+                                  flow_init, &table->keys) ||
+      !persistent_dchain_allocate(arena, "heap", capacity, &table->chain)) {
+    fprintf(stderr, "Cannot allocate persistent state\n");
+    exit(1);
+  }
+}
+
+static void run(const char *path, unsigned flows) {
+  unsigned capacity = 1;
+  while (capacity < flows) {
+    capacity *= 2;
+  }
+  size_t size = (size_t)capacity * 128 + 4 * 1024 * 1024;
+
+  // Populate the persistent state, as a first run of the NF would
+  unlink(path);
+  struct PersistentArena *arena;
+  bool restored;
+  if (!persistent_arena_open(path, size, &arena, &restored)) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    exit(1);
+  }
+  struct FlowTable table;
+  persistent_table(arena, capacity, &table);
+  for (unsigned n = 0; n < flows; n++) {
+    struct Flow flow;
+    flow_make(&flow, n);
+    insert_flow(&table, &flow);
+  }
+  persistent_arena_close(arena);
+
+  // Restart by reattaching, and touch every flow as traffic would
+  double restore_start = now_ms();
+  if (!persistent_arena_open(path, size, &arena, &restored) || !restored) {
+    fprintf(stderr, "Cannot restore %s\n", path);
+    exit(1);
+  }
+  persistent_table(arena, capacity, &table);
+  double restore_end = now_ms();
+  lookup_all(&table, flows);
+  double restore_lookup_end = now_ms();
+
+  // Restart by rebuilding from a snapshot of the flows
+  struct Flow *snapshot = malloc(sizeof(struct Flow) * flows);
+  for (unsigned n = 0; n < flows; n++) {
+    struct Flow *flow;
+    vector_borrow(table.keys, n, (void **)&flow);
+    snapshot[n] = *flow;
+    vector_return(table.keys, n, flow);
+  }
+  persistent_arena_close(arena);
+
+  double rebuild_start = now_ms();
+  struct FlowTable fresh;
+  if (!map_allocate(flow_eq, flow_hash, capacity, &fresh.map) ||
+      !vector_allocate(sizeof(struct Flow), capacity, flow_init,
+                       &fresh.keys) ||
+      !dchain_allocate(capacity, &fresh.chain)) {
+    fprintf(stderr, "Cannot allocate state\n");
+    exit(1);
+  }
+  for (unsigned n = 0; n < flows; n++) {
+    insert_flow(&fresh, &snapshot[n]);
+  }
+  double rebuild_end = now_ms();
+  lookup_all(&fresh, flows);
+  double rebuild_lookup_end = now_ms();
+  free(snapshot);
+  unlink(path);
+
+  printf("%8u %12.3f %12.3f %12.3f %12.3f\n", flows,
+         restore_end - restore_start, restore_lookup_end - restore_start,
+         rebuild_end - rebuild_start, rebuild_lookup_end - rebuild_start);
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "/dev/shm/vigor-persistent-bench";
+
+  printf("# times in ms; '+lookups' includes looking up every flow once\n");
+  printf("%8s %12s %12s %12s %12s\n", "flows", "restore", "+lookups",
+         "rebuild", "+lookups");
+  unsigned flows[] = {1000, 10000, 100000, 1000000};
+  for (unsigned n = 0; n < sizeof(flows) / sizeof(flows[0]); n++) {
+    run(path, flows[n]);
+  }
+  return 0;
+}
@@ -627,8 +627,19 @@ let gen_allocation containers =
   let abort_on_null allocation =
     "  if (" ^ allocation ^ " == 0) return NULL;\n"
   in
+  let persistent_or persistent_allocation allocations =
+    "#ifdef VIGOR_PERSISTENT_STATE\n" ^
+    (abort_on_null persistent_allocation) ^
+    "#else//VIGOR_PERSISTENT_STATE\n" ^
+    (String.concat "" allocations) ^
+    "#endif//VIGOR_PERSISTENT_STATE\n"
+  in
   (gen_allocation_proto containers) ^ "\n{\n" ^
   "  if (allocated_nf_state != NULL) return allocated_nf_state;\n" ^
+  "#ifdef VIGOR_PERSISTENT_STATE\n" ^
+  "  struct PersistentArena* arena = persistent_state_arena();\n" ^
+  "  if (arena == NULL) return NULL;\n" ^
+  "#endif//VIGOR_PERSISTENT_STATE\n" ^
   "  struct State* ret = malloc(sizeof(struct State));\n" ^
   "  if (ret == NULL) return NULL;\n" ^
   (concat_flatten_map ""
@@ -636,9 +647,13 @@ let gen_allocation containers =
         match cnt with
         | Map (typ, cap, _) ->
           ["  ret->" ^ name ^ " = NULL;\n";
-           abort_on_null ("map_allocate(" ^ eq_fun_name typ ^
-                          ", " ^ hash_fun_name typ ^ ", " ^ cap ^
-                          ", &(ret->" ^ name ^ "))")]
+           persistent_or
+             ("persistent_map_allocate(arena, \"" ^ name ^ "\", " ^
+              eq_fun_name typ ^ ", " ^ hash_fun_name typ ^ ", " ^ cap ^
+              ", &(ret->" ^ name ^ "))")
+             [abort_on_null ("map_allocate(" ^ eq_fun_name typ ^
+                             ", " ^ hash_fun_name typ ^ ", " ^ cap ^
+                             ", &(ret->" ^ name ^ "))")]]
         | Vector (typ, cap, _) ->
           let typ_size =
             if String.equal typ "uint32_t" then
@@ -646,19 +661,29 @@ let gen_allocation containers =
               "sizeof(struct " ^ typ ^ ")"
           in
           ["  ret->" ^ name ^ " = NULL;\n";
-           abort_on_null ("vector_allocate(" ^ typ_size ^ ", " ^ cap ^
-                          ", " ^ alloc_fun_name typ ^ ", &(ret->" ^ name ^ "))")]
+           persistent_or
+             ("persistent_vector_allocate(arena, \"" ^ name ^ "\", " ^
+              typ_size ^ ", " ^ cap ^ ", " ^ alloc_fun_name typ ^
+              ", &(ret->" ^ name ^ "))")
+             [abort_on_null ("vector_allocate(" ^ typ_size ^ ", " ^ cap ^
+                             ", " ^ alloc_fun_name typ ^ ", &(ret->" ^ name ^ "))")]]
         | CHT (depth, height) ->
           ["  ret->" ^ name ^ " = NULL;\n";
-           abort_on_null ("vector_allocate(sizeof(uint32_t), " ^
-                          depth ^ "*" ^ height ^ ", null_init, &(ret->" ^
-                          name ^ "))");
-           "  " ^ abort_on_null ("cht_fill_cht(ret->" ^
-                                 name ^ ", " ^ height ^
-                                 ", " ^ depth ^ ")")]
+           persistent_or
+             ("persistent_cht_allocate(arena, \"" ^ name ^ "\", " ^
+              height ^ ", " ^ depth ^ ", &(ret->" ^ name ^ "))")
+             [abort_on_null ("vector_allocate(sizeof(uint32_t), " ^
+                             depth ^ "*" ^ height ^ ", null_init, &(ret->" ^
+                             name ^ "))");
+              "  " ^ abort_on_null ("cht_fill_cht(ret->" ^
+                                    name ^ ", " ^ height ^
+                                    ", " ^ depth ^ ")")]]
         | DChain cap -> ["  ret->" ^ name ^ " = NULL;\n";
-                         abort_on_null ("dchain_allocate(" ^
-                                        cap ^ ", &(ret->" ^ name ^ "))")]
+                         persistent_or
+                           ("persistent_dchain_allocate(arena, \"" ^ name ^
+                            "\", " ^ cap ^ ", &(ret->" ^ name ^ "))")
+                           [abort_on_null ("dchain_allocate(" ^
+                                           cap ^ ", &(ret->" ^ name ^ "))")]]
         | Int
         | UInt
         | UInt32 -> ["  ret->" ^ name ^ " = " ^ name ^ ";\n"]
@@ -836,7 +861,10 @@ let () =
   fprintf cout "#include \"libvig/models/verified/vector-control.h\"\n";
   fprintf cout "#include \"libvig/models/verified/lpm-dir-24-8-control.h\"\n";
   fprintf cout "#endif//KLEE_VERIFICATION\n";
-  fprintf cout "struct State* allocated_nf_state = NULL;\n";
+  fprintf cout "#ifdef VIGOR_PERSISTENT_STATE\n";
+  fprintf cout "#include \"libvig/unverified/persistent.h\"\n";
+  fprintf cout "#endif//VIGOR_PERSISTENT_STATE\n";
+  fprintf cout "VIGOR_PER_LCORE struct State* allocated_nf_state = NULL;\n";
   fprintf cout "%s\n" (gen_inv_c_functions constraints containers);
   fprintf cout "%s\n" (gen_allocation containers);
   fprintf cout "#ifdef KLEE_VERIFICATION\n";
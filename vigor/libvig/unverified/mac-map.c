@@ -0,0 +1,107 @@
+#include "mac-map.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Set in all used slots, so that the empty slot is 0 even for 00:00:00:00:00:00
+#define MACMAP_BUSY (1ull << 48)
+
+struct MacMap {
+  uint64_t *keys;
+  int *values;
+  uint64_t mask;
+  unsigned shift;
+  unsigned capacity;
+  unsigned size;
+};
+
+int macmap_allocate(unsigned capacity, struct MacMap **map_out) {
+  struct MacMap *map = (struct MacMap *)malloc(sizeof(struct MacMap));
+  if (map == NULL) {
+    return 0;
+  }
+
+  // Keep the load under 50% so that probe sequences stay short
+  unsigned bits = 1;
+  while ((1ull << bits) < 2ull * capacity) {
+    bits++;
+  }
+  map->keys = (uint64_t *)calloc(1ull << bits, sizeof(uint64_t));
+  map->values = (int *)calloc(1ull << bits, sizeof(int));
+  if (map->keys == NULL || map->values == NULL) {
+    free(map->keys);
+    free(map->values);
+    free(map);
+    return 0;
+  }
+  map->mask = (1ull << bits) - 1;
+  map->shift = 64 - bits;
+  map->capacity = capacity;
+  map->size = 0;
+
+  *map_out = map;
+  return 1;
+}
+
+static uint64_t macmap_key(const uint8_t *addr) {
+  uint64_t key = 0;
+  memcpy(&key, addr, 6);
+  return key | MACMAP_BUSY;
+}
+
+static uint64_t macmap_home(struct MacMap *map, uint64_t key) {
+  return (key * 0x9e3779b97f4a7c15ull) >> map->shift;
+}
+
+int macmap_get(struct MacMap *map, const uint8_t *addr, int *value_out) {
+  uint64_t key = macmap_key(addr);
+  for (uint64_t slot = macmap_home(map, key);; slot = (slot + 1) & map->mask) {
+    if (map->keys[slot] == key) {
+      *value_out = map->values[slot];
+      return 1;
+    }
+    if (map->keys[slot] == 0) {
+      return 0;
+    }
+  }
+}
+
+void macmap_put(struct MacMap *map, const uint8_t *addr, int value) {
+  assert(map->size < map->capacity);
+  uint64_t key = macmap_key(addr);
+  uint64_t slot = macmap_home(map, key);
+  while (map->keys[slot] != 0) {
+    slot = (slot + 1) & map->mask;
+  }
+  map->keys[slot] = key;
+  map->values[slot] = value;
+  map->size++;
+}
+
+void macmap_erase(struct MacMap *map, const uint8_t *addr) {
+  uint64_t key = macmap_key(addr);
+  uint64_t slot = macmap_home(map, key);
+  while (map->keys[slot] != key) {
+    assert(map->keys[slot] != 0);
+    slot = (slot + 1) & map->mask;
+  }
+
+  // Shift back the following entries that would no longer be reachable
+  uint64_t hole = slot;
+  for (uint64_t next = (hole + 1) & map->mask; map->keys[next] != 0;
+       next = (next + 1) & map->mask) {
+    uint64_t home = macmap_home(map, map->keys[next]);
+    // Can the entry at 'next' move to 'hole', i.e. is its home not in
+    // (hole, next], cyclically?
+    if (((next - home) & map->mask) >= ((next - hole) & map->mask)) {
+      map->keys[hole] = map->keys[next];
+      map->values[hole] = map->values[next];
+      hole = next;
+    }
+  }
+  map->keys[hole] = 0;
+  map->size--;
+}
+
+unsigned macmap_size(struct MacMap *map) { return map->size; }
@@ -0,0 +1,27 @@
+#ifndef _MAC_MAP_H_INCLUDED_
+#define _MAC_MAP_H_INCLUDED_
+
+#include <stdint.h>
+
+// Hash table from MAC addresses to integers, with the same semantics as the
+// libVig Map but keeping the 6-byte keys inline in 8-byte slots, so that a
+// lookup only touches one array instead of following pointers to the keys.
+// Uses linear probing, with deletion by backward shifting.
+
+struct MacMap;
+
+// Can hold up to 'capacity' entries.
+int macmap_allocate(unsigned capacity, struct MacMap **map_out);
+
+// 'addr' points to the 6 bytes of the MAC address.
+int macmap_get(struct MacMap *map, const uint8_t *addr, int *value_out);
+
+// The address must not be in the map, and the map must not be full.
+void macmap_put(struct MacMap *map, const uint8_t *addr, int value);
+
+// The address must be in the map.
+void macmap_erase(struct MacMap *map, const uint8_t *addr);
+
+unsigned macmap_size(struct MacMap *map);
+
+#endif //_MAC_MAP_H_INCLUDED_
@@ -0,0 +1,264 @@
+#include "perfect-hash.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Average number of keys per bucket, and maximum load of the slots; the
+// lower, the faster the build and the bigger the table
+#define PHASH_KEYS_PER_BUCKET 4
+#define PHASH_LOAD_PERCENT 80
+
+// Attempts before giving up
+#define PHASH_MAX_SEEDS 32
+#define PHASH_MAX_DISPLACEMENTS (1u << 22)
+
+struct displacement {
+  uint32_t d0;
+  uint32_t d1;
+};
+
+struct PerfectHash {
+  uint64_t seed;
+  uint32_t buckets_mask;
+  uint32_t slots_mask;
+  unsigned key_size;
+  unsigned entry_size;
+  struct displacement *displacements;
+  // Each entry is the key, padded to 4 bytes, then the value and whether the
+  // slot is used
+  char *entries;
+};
+
+static uint64_t fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+static uint64_t phash_hash(const void *key, unsigned key_size, uint64_t seed) {
+  const char *bytes = (const char *)key;
+  uint64_t hash = seed ^ (key_size * 0x9e3779b97f4a7c15ull);
+  while (key_size >= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(uint64_t));
+    hash = fmix64(hash ^ word);
+    bytes += sizeof(uint64_t);
+    key_size -= sizeof(uint64_t);
+  }
+  if (key_size != 0) {
+    uint64_t word = 0;
+    memcpy(&word, bytes, key_size);
+    hash = fmix64(hash ^ word);
+  }
+  return hash;
+}
+
+static uint32_t slot_of(struct PerfectHash *table, uint64_t hash,
+                        struct displacement d) {
+  uint32_t f1 = (uint32_t)(hash >> 32);
+  // Odd, so that all slots can be reached since there is a power of 2 of them
+  uint32_t f2 = (uint32_t)fmix64(hash) | 1;
+  return (f1 + d.d0 * f2 + d.d1) & table->slots_mask;
+}
+
+static char *entry_at(struct PerfectHash *table, uint32_t slot) {
+  return table->entries + (size_t)slot * table->entry_size;
+}
+
+static int *entry_value(struct PerfectHash *table, char *entry) {
+  return (int *)(entry + table->entry_size - 2 * sizeof(int));
+}
+
+static int *entry_used(struct PerfectHash *table, char *entry) {
+  return (int *)(entry + table->entry_size - sizeof(int));
+}
+
+static uint32_t power_of_2_at_least(uint64_t n) {
+  uint32_t result = 1;
+  while (result < n) {
+    result *= 2;
+  }
+  return result;
+}
+
+// Tries to place all keys with the current seed, returns false if some bucket
+// could not be placed
+static bool phash_place(struct PerfectHash *table, const char *keys,
+                        const int *values, unsigned count, uint64_t *hashes,
+                        unsigned *bucket_starts, unsigned *bucket_keys,
+                        unsigned *order, uint32_t *slots) {
+  uint32_t buckets = table->buckets_mask + 1;
+  uint32_t slots_count = table->slots_mask + 1;
+
+  for (unsigned k = 0; k < count; k++) {
+    hashes[k] = phash_hash(keys + (size_t)k * table->key_size, table->key_size,
+                           table->seed);
+  }
+
+  // Group keys by bucket, with a counting sort
+  memset(bucket_starts, 0, sizeof(unsigned) * (buckets + 1));
+  for (unsigned k = 0; k < count; k++) {
+    bucket_starts[(hashes[k] & table->buckets_mask) + 1]++;
+  }
+  for (uint32_t b = 0; b < buckets; b++) {
+    bucket_starts[b + 1] += bucket_starts[b];
+  }
+  for (unsigned k = 0; k < count; k++) {
+    uint32_t b = hashes[k] & table->buckets_mask;
+    bucket_keys[bucket_starts[b]++] = k;
+  }
+  for (uint32_t b = buckets; b > 0; b--) {
+    bucket_starts[b] = bucket_starts[b - 1];
+  }
+  bucket_starts[0] = 0;
+
+  // Place the biggest buckets first, they are the hardest
+  unsigned max_size = 0;
+  for (uint32_t b = 0; b < buckets; b++) {
+    unsigned size = bucket_starts[b + 1] - bucket_starts[b];
+    if (size > max_size) {
+      max_size = size;
+    }
+  }
+  unsigned ordered = 0;
+  for (unsigned size = max_size; size > 0; size--) {
+    for (uint32_t b = 0; b < buckets; b++) {
+      if (bucket_starts[b + 1] - bucket_starts[b] == size) {
+        order[ordered++] = b;
+      }
+    }
+  }
+
+  memset(table->entries, 0, (size_t)slots_count * table->entry_size);
+  memset(table->displacements, 0, sizeof(struct displacement) * buckets);
+
+  for (unsigned o = 0; o < ordered; o++) {
+    uint32_t b = order[o];
+    unsigned *members = &bucket_keys[bucket_starts[b]];
+    unsigned size = bucket_starts[b + 1] - bucket_starts[b];
+
+    // Drop duplicate keys, keeping the first one since members are sorted
+    unsigned unique = 0;
+    for (unsigned i = 0; i < size; i++) {
+      bool duplicate = false;
+      for (unsigned j = 0; j < unique && !duplicate; j++) {
+        duplicate = memcmp(keys + (size_t)members[i] * table->key_size,
+                           keys + (size_t)members[j] * table->key_size,
+                           table->key_size) == 0;
+      }
+      if (!duplicate) {
+        members[unique++] = members[i];
+      }
+    }
+
+    bool placed = false;
+    for (uint32_t attempt = 0; attempt < PHASH_MAX_DISPLACEMENTS && !placed;
+         attempt++) {
+      struct displacement d = { .d0 = attempt / slots_count,
+                                .d1 = attempt % slots_count };
+      placed = true;
+      for (unsigned i = 0; i < unique && placed; i++) {
+        slots[i] = slot_of(table, hashes[members[i]], d);
+        if (*entry_used(table, entry_at(table, slots[i]))) {
+          placed = false;
+        }
+        for (unsigned j = 0; j < i && placed; j++) {
+          if (slots[j] == slots[i]) {
+            placed = false;
+          }
+        }
+      }
+      if (placed) {
+        table->displacements[b] = d;
+      }
+    }
+    if (!placed) {
+      return false;
+    }
+
+    for (unsigned i = 0; i < unique; i++) {
+      char *entry = entry_at(table, slots[i]);
+      memcpy(entry, keys + (size_t)members[i] * table->key_size,
+             table->key_size);
+      *entry_value(table, entry) = values[members[i]];
+      *entry_used(table, entry) = 1;
+    }
+  }
+
+  return true;
+}
+
+int phash_build(const void *keys, const int *values, unsigned count,
+                unsigned key_size, struct PerfectHash **table_out) {
+  struct PerfectHash *table =
+      (struct PerfectHash *)malloc(sizeof(struct PerfectHash));
+  if (table == NULL) {
+    return 0;
+  }
+
+  uint32_t buckets =
+      power_of_2_at_least(count / PHASH_KEYS_PER_BUCKET + 1);
+  uint32_t slots =
+      power_of_2_at_least((uint64_t)count * 100 / PHASH_LOAD_PERCENT + 1);
+  table->buckets_mask = buckets - 1;
+  table->slots_mask = slots - 1;
+  table->key_size = key_size;
+  table->entry_size = (key_size + 3) / 4 * 4 + 2 * sizeof(int);
+  table->displacements =
+      (struct displacement *)malloc(sizeof(struct displacement) * buckets);
+  table->entries = (char *)malloc((size_t)slots * table->entry_size);
+
+  uint64_t *hashes = (uint64_t *)malloc(sizeof(uint64_t) * (count + 1));
+  unsigned *bucket_starts =
+      (unsigned *)malloc(sizeof(unsigned) * (buckets + 1));
+  unsigned *bucket_keys = (unsigned *)malloc(sizeof(unsigned) * (count + 1));
+  unsigned *order = (unsigned *)malloc(sizeof(unsigned) * buckets);
+  uint32_t *bucket_slots = (uint32_t *)malloc(sizeof(uint32_t) * (count + 1));
+
+  int result = 0;
+  if (table->displacements != NULL && table->entries != NULL &&
+      hashes != NULL && bucket_starts != NULL && bucket_keys != NULL &&
+      order != NULL && bucket_slots != NULL) {
+    for (uint64_t seed = 0; seed < PHASH_MAX_SEEDS && !result; seed++) {
+      table->seed = fmix64(seed + 1);
+      result = phash_place(table, (const char *)keys, values, count, hashes,
+                           bucket_starts, bucket_keys, order, bucket_slots);
+    }
+  }
+
+  free(hashes);
+  free(bucket_starts);
+  free(bucket_keys);
+  free(order);
+  free(bucket_slots);
+
+  if (!result) {
+    phash_free(table);
+    return 0;
+  }
+
+  *table_out = table;
+  return 1;
+}
+
+int phash_get(struct PerfectHash *table, const void *key, int *value_out) {
+  uint64_t hash = phash_hash(key, table->key_size, table->seed);
+  struct displacement d = table->displacements[hash & table->buckets_mask];
+  char *entry = entry_at(table, slot_of(table, hash, d));
+  if (!*entry_used(table, entry) ||
+      memcmp(entry, key, table->key_size) != 0) {
+    return 0;
+  }
+  *value_out = *entry_value(table, entry);
+  return 1;
+}
+
+void phash_free(struct PerfectHash *table) {
+  free(table->displacements);
+  free(table->entries);
+  free(table);
+}
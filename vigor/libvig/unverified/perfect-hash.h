@@ -0,0 +1,24 @@
+#ifndef _PERFECT_HASH_H_INCLUDED_
+#define _PERFECT_HASH_H_INCLUDED_
+
+#include <stdint.h>
+
+// Read-only hash table built once from a set of fixed-size keys, using
+// "hash, displace and compress" (CHD) perfect hashing: a lookup computes one
+// hash, reads one displacement and compares one slot, whatever the number of
+// keys, instead of following a probe chain.
+
+struct PerfectHash;
+
+// Builds a table mapping keys[i] (each of key_size bytes) to values[i].
+// Identical keys are only inserted once, with the value of the first one.
+// Returns 1 on success and 0 on failure.
+int phash_build(const void *keys, const int *values, unsigned count,
+                unsigned key_size, struct PerfectHash **table_out);
+
+// Returns 1 and sets *value_out if the key is in the table, 0 otherwise.
+int phash_get(struct PerfectHash *table, const void *key, int *value_out);
+
+void phash_free(struct PerfectHash *table);
+
+#endif //_PERFECT_HASH_H_INCLUDED_
@@ -0,0 +1,468 @@
+#include "persistent.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libvig/verified/boilerplate-util.h"
+#include "libvig/verified/cht.h"
+#include "libvig/verified/double-chain-impl.h"
+#include "libvig/verified/vigor-time.h"
+
+#ifdef CAPACITY_POW2
+#include "libvig/verified/map-impl-pow2.h"
+#else
+#include "libvig/verified/map-impl.h"
+#endif
+
+// Same layouts as in libvig/verified, so that the structures allocated here
+// can be used with the verified API
+struct Map {
+  int *busybits;
+  void **keyps;
+  unsigned *khs;
+  int *chns;
+  int *vals;
+  unsigned capacity;
+  unsigned size;
+  map_keys_equality *keys_eq;
+  map_key_hash *khash;
+};
+
+struct Vector {
+  char *data;
+  int elem_size;
+  unsigned capacity;
+};
+
+struct DoubleChain {
+  struct dchain_cell *cells;
+  vigor_time_t *timestamps;
+};
+
+#define PERSISTENT_MAGIC 0x5649474f52535454ull // "VIGORSTT"
+#define PERSISTENT_VERSION 1
+#define PERSISTENT_MAX_ENTRIES 64
+#define PERSISTENT_NAME_LENGTH 32
+#define PERSISTENT_ALIGNMENT 64
+// Rounding to the hugepage size keeps hugetlbfs happy
+#define PERSISTENT_SIZE_GRANULARITY (2ul * 1024 * 1024)
+
+enum persistent_kind {
+  PERSISTENT_MAP,
+  PERSISTENT_VECTOR,
+  PERSISTENT_DCHAIN,
+  PERSISTENT_CHT
+};
+
+struct persistent_entry {
+  char name[PERSISTENT_NAME_LENGTH];
+  uint32_t kind;
+  uint32_t params[2];
+  uint64_t offset;
+};
+
+// Lives at the start of the file
+struct persistent_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t clean;
+  uint64_t base;
+  uint64_t size;
+  uint64_t used;
+  uint32_t entries_count;
+  struct persistent_entry entries[PERSISTENT_MAX_ENTRIES];
+};
+
+struct PersistentArena {
+  int fd;
+  bool restored;
+  struct persistent_header *header;
+  // Entries reattached so far, so they can be discarded if a later one
+  // cannot be; vectors need their element initializer for that
+  uint32_t reattached[PERSISTENT_MAX_ENTRIES];
+  vector_init_elem *reattached_init[PERSISTENT_MAX_ENTRIES];
+  uint32_t reattached_count;
+};
+
+static void *arena_map_at(int fd, size_t size, void *address) {
+  int flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+  if (address != NULL) {
+    flags |= MAP_FIXED_NOREPLACE;
+  }
+#endif
+  void *result = mmap(address, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (result == MAP_FAILED) {
+    return NULL;
+  }
+  // Without MAP_FIXED_NOREPLACE the address is only a hint
+  if (address != NULL && result != address) {
+    munmap(result, size);
+    return NULL;
+  }
+  return result;
+}
+
+static bool arena_reattach(struct PersistentArena *arena) {
+  struct persistent_header header;
+  if (pread(arena->fd, &header, sizeof(header), 0) != sizeof(header)) {
+    return false;
+  }
+  if (header.magic != PERSISTENT_MAGIC ||
+      header.version != PERSISTENT_VERSION || !header.clean) {
+    return false;
+  }
+
+  arena->header = (struct persistent_header *)arena_map_at(
+      arena->fd, header.size, (void *)(uintptr_t)header.base);
+  return arena->header != NULL;
+}
+
+static bool arena_create(struct PersistentArena *arena, size_t size) {
+  size = (size + PERSISTENT_SIZE_GRANULARITY - 1) /
+         PERSISTENT_SIZE_GRANULARITY * PERSISTENT_SIZE_GRANULARITY;
+  if (ftruncate(arena->fd, 0) != 0 || ftruncate(arena->fd, size) != 0) {
+    return false;
+  }
+
+  arena->header =
+      (struct persistent_header *)arena_map_at(arena->fd, size, NULL);
+  if (arena->header == NULL) {
+    return false;
+  }
+
+  memset(arena->header, 0, sizeof(struct persistent_header));
+  arena->header->magic = PERSISTENT_MAGIC;
+  arena->header->version = PERSISTENT_VERSION;
+  arena->header->base = (uint64_t)(uintptr_t)arena->header;
+  arena->header->size = size;
+  arena->header->used =
+      (sizeof(struct persistent_header) + PERSISTENT_ALIGNMENT - 1) /
+      PERSISTENT_ALIGNMENT * PERSISTENT_ALIGNMENT;
+  return true;
+}
+
+int persistent_arena_open(const char *path, size_t size,
+                          struct PersistentArena **arena_out,
+                          bool *restored_out) {
+  struct PersistentArena *arena =
+      (struct PersistentArena *)malloc(sizeof(struct PersistentArena));
+  if (arena == NULL) {
+    return 0;
+  }
+
+  arena->fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (arena->fd < 0) {
+    free(arena);
+    return 0;
+  }
+
+  arena->reattached_count = 0;
+  arena->restored = arena_reattach(arena);
+  if (!arena->restored && !arena_create(arena, size)) {
+    close(arena->fd);
+    free(arena);
+    return 0;
+  }
+
+  // From now on the state may be modified at any time
+  arena->header->clean = 0;
+
+  *arena_out = arena;
+  *restored_out = arena->restored;
+  return 1;
+}
+
+void persistent_arena_close(struct PersistentArena *arena) {
+  arena->header->clean = 1;
+  msync(arena->header, arena->header->size, MS_SYNC);
+  munmap(arena->header, arena->header->size);
+  close(arena->fd);
+  free(arena);
+}
+
+static void *arena_base(struct PersistentArena *arena) {
+  return (void *)arena->header;
+}
+
+static void *arena_alloc(struct PersistentArena *arena, size_t size) {
+  uint64_t offset = arena->header->used;
+  size = (size + PERSISTENT_ALIGNMENT - 1) / PERSISTENT_ALIGNMENT *
+         PERSISTENT_ALIGNMENT;
+  if (size > arena->header->size - offset) {
+    return NULL;
+  }
+  arena->header->used += size;
+  return (char *)arena_base(arena) + offset;
+}
+
+// Reinitializes in place every structure reattached so far, since a restore
+// is all or nothing: the NF would otherwise run with a mix of old and new
+// state, and believe it has all of its old state.
+static void arena_discard(struct PersistentArena *arena) {
+  fprintf(stderr, "Discarding the persistent state\n");
+  for (uint32_t n = 0; n < arena->reattached_count; n++) {
+    struct persistent_entry *entry =
+        &arena->header->entries[arena->reattached[n]];
+    void *object = (char *)arena_base(arena) + entry->offset;
+    switch (entry->kind) {
+    case PERSISTENT_MAP: {
+      struct Map *map = (struct Map *)object;
+      map->size = 0;
+      map_impl_init(map->busybits, map->keys_eq, map->keyps, map->khs,
+                    map->chns, map->vals, map->capacity);
+      break;
+    }
+    case PERSISTENT_VECTOR: {
+      struct Vector *vector = (struct Vector *)object;
+      for (unsigned i = 0; i < vector->capacity; ++i) {
+        arena->reattached_init[n](vector->data +
+                                  (size_t)vector->elem_size * i);
+      }
+      break;
+    }
+    case PERSISTENT_DCHAIN: {
+      struct DoubleChain *chain = (struct DoubleChain *)object;
+      dchain_impl_init(chain->cells, entry->params[0]);
+      break;
+    }
+    case PERSISTENT_CHT:
+      // Only depends on its parameters, which matched
+      break;
+    }
+  }
+  arena->reattached_count = 0;
+  arena->restored = false;
+}
+
+static void *arena_find(struct PersistentArena *arena, const char *name,
+                        enum persistent_kind kind, uint32_t param0,
+                        uint32_t param1, vector_init_elem *init_elem) {
+  if (!arena->restored) {
+    return NULL;
+  }
+
+  for (uint32_t n = 0; n < arena->header->entries_count; n++) {
+    struct persistent_entry *entry = &arena->header->entries[n];
+    if (strncmp(entry->name, name, PERSISTENT_NAME_LENGTH) == 0) {
+      if (entry->kind != kind || entry->params[0] != param0 ||
+          entry->params[1] != param1) {
+        fprintf(stderr, "Persistent state '%s' changed shape, cannot reuse it\n",
+                name);
+        arena_discard(arena);
+        return NULL;
+      }
+      arena->reattached[arena->reattached_count] = n;
+      arena->reattached_init[arena->reattached_count] = init_elem;
+      arena->reattached_count++;
+      return (char *)arena_base(arena) + entry->offset;
+    }
+  }
+
+  fprintf(stderr, "Persistent state '%s' not found, cannot reuse the rest\n",
+          name);
+  arena_discard(arena);
+  return NULL;
+}
+
+// Replaces the entry with the same name, if any, so that a structure that
+// changed shape does not leave a stale entry behind to be found again.
+// The memory of the old structure is not reclaimed.
+static bool arena_register(struct PersistentArena *arena, const char *name,
+                           enum persistent_kind kind, uint32_t param0,
+                           uint32_t param1, void *object) {
+  if (strlen(name) >= PERSISTENT_NAME_LENGTH) {
+    return false;
+  }
+
+  uint32_t n = 0;
+  while (n < arena->header->entries_count &&
+         strncmp(arena->header->entries[n].name, name,
+                 PERSISTENT_NAME_LENGTH) != 0) {
+    n++;
+  }
+  if (n == PERSISTENT_MAX_ENTRIES) {
+    return false;
+  }
+
+  struct persistent_entry *entry = &arena->header->entries[n];
+  strncpy(entry->name, name, PERSISTENT_NAME_LENGTH);
+  entry->kind = kind;
+  entry->params[0] = param0;
+  entry->params[1] = param1;
+  entry->offset = (uint64_t)((char *)object - (char *)arena_base(arena));
+  if (n == arena->header->entries_count) {
+    arena->header->entries_count++;
+  }
+  return true;
+}
+
+int persistent_map_allocate(struct PersistentArena *arena, const char *name,
+                            map_keys_equality *keq, map_key_hash *khash,
+                            unsigned capacity, struct Map **map_out) {
+  struct Map *map =
+      (struct Map *)arena_find(arena, name, PERSISTENT_MAP, capacity, 0, NULL);
+  if (map == NULL) {
+#ifdef CAPACITY_POW2
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+      return 0;
+    }
+#endif
+    map = (struct Map *)arena_alloc(arena, sizeof(struct Map));
+    if (map == NULL) {
+      return 0;
+    }
+    map->busybits = (int *)arena_alloc(arena, sizeof(int) * capacity);
+    map->keyps = (void **)arena_alloc(arena, sizeof(void *) * capacity);
+    map->khs = (unsigned *)arena_alloc(arena, sizeof(unsigned) * capacity);
+    map->chns = (int *)arena_alloc(arena, sizeof(int) * capacity);
+    map->vals = (int *)arena_alloc(arena, sizeof(int) * capacity);
+    if (map->busybits == NULL || map->keyps == NULL || map->khs == NULL ||
+        map->chns == NULL || map->vals == NULL) {
+      return 0;
+    }
+    map->capacity = capacity;
+    map->size = 0;
+    map_impl_init(map->busybits, keq, map->keyps, map->khs, map->chns,
+                  map->vals, capacity);
+    if (!arena_register(arena, name, PERSISTENT_MAP, capacity, 0, map)) {
+      return 0;
+    }
+  }
+
+  map->keys_eq = keq;
+  map->khash = khash;
+  *map_out = map;
+  return 1;
+}
+
+static struct Vector *vector_allocate_in(struct PersistentArena *arena,
+                                         int elem_size, unsigned capacity,
+                                         vector_init_elem *init_elem) {
+  struct Vector *vector =
+      (struct Vector *)arena_alloc(arena, sizeof(struct Vector));
+  if (vector == NULL) {
+    return NULL;
+  }
+  vector->data = (char *)arena_alloc(arena, (size_t)elem_size * capacity);
+  if (vector->data == NULL) {
+    return NULL;
+  }
+  vector->elem_size = elem_size;
+  vector->capacity = capacity;
+  for (unsigned i = 0; i < capacity; ++i) {
+    init_elem(vector->data + (size_t)elem_size * i);
+  }
+  return vector;
+}
+
+int persistent_vector_allocate(struct PersistentArena *arena,
+                               const char *name, int elem_size,
+                               unsigned capacity, vector_init_elem *init_elem,
+                               struct Vector **vector_out) {
+  struct Vector *vector = (struct Vector *)arena_find(
+      arena, name, PERSISTENT_VECTOR, elem_size, capacity, init_elem);
+  if (vector == NULL) {
+    vector = vector_allocate_in(arena, elem_size, capacity, init_elem);
+    if (vector == NULL || !arena_register(arena, name, PERSISTENT_VECTOR,
+                                          elem_size, capacity, vector)) {
+      return 0;
+    }
+  }
+
+  *vector_out = vector;
+  return 1;
+}
+
+int persistent_dchain_allocate(struct PersistentArena *arena,
+                               const char *name, int index_range,
+                               struct DoubleChain **chain_out) {
+  struct DoubleChain *chain = (struct DoubleChain *)arena_find(
+      arena, name, PERSISTENT_DCHAIN, index_range, 0, NULL);
+  if (chain == NULL) {
+    chain = (struct DoubleChain *)arena_alloc(arena, sizeof(struct DoubleChain));
+    if (chain == NULL) {
+      return 0;
+    }
+    chain->cells = (struct dchain_cell *)arena_alloc(
+        arena, sizeof(struct dchain_cell) * (index_range + DCHAIN_RESERVED));
+    chain->timestamps = (vigor_time_t *)arena_alloc(
+        arena, sizeof(vigor_time_t) * index_range);
+    if (chain->cells == NULL || chain->timestamps == NULL) {
+      return 0;
+    }
+    dchain_impl_init(chain->cells, index_range);
+    if (!arena_register(arena, name, PERSISTENT_DCHAIN, index_range, 0,
+                        chain)) {
+      return 0;
+    }
+  }
+
+  *chain_out = chain;
+  return 1;
+}
+
+int persistent_cht_allocate(struct PersistentArena *arena, const char *name,
+                            uint32_t cht_height, uint32_t backend_capacity,
+                            struct Vector **cht_out) {
+  struct Vector *cht = (struct Vector *)arena_find(
+      arena, name, PERSISTENT_CHT, cht_height, backend_capacity, NULL);
+  if (cht == NULL) {
+    cht = vector_allocate_in(arena, sizeof(uint32_t),
+                             cht_height * backend_capacity, null_init);
+    if (cht == NULL || !cht_fill_cht(cht, cht_height, backend_capacity) ||
+        !arena_register(arena, name, PERSISTENT_CHT, cht_height,
+                        backend_capacity, cht)) {
+      return 0;
+    }
+  }
+
+  *cht_out = cht;
+  return 1;
+}
+
+#define PERSISTENT_STATE_DEFAULT_SIZE_MB 1024
+
+static struct PersistentArena *state_arena = NULL;
+
+struct PersistentArena *persistent_state_arena(void) {
+  if (state_arena != NULL) {
+    return state_arena;
+  }
+
+  const char *path = getenv("VIGOR_STATE_FILE");
+  if (path == NULL) {
+    fprintf(stderr, "VIGOR_STATE_FILE must be set to use persistent state\n");
+    return NULL;
+  }
+
+  size_t size_mb = PERSISTENT_STATE_DEFAULT_SIZE_MB;
+  const char *size_str = getenv("VIGOR_STATE_SIZE");
+  if (size_str != NULL) {
+    size_mb = strtoul(size_str, NULL, 10);
+  }
+
+  bool restored;
+  if (!persistent_arena_open(path, size_mb * 1024 * 1024, &state_arena,
+                             &restored)) {
+    fprintf(stderr, "Cannot open persistent state file %s\n", path);
+    state_arena = NULL;
+  }
+  return state_arena;
+}
+
+bool persistent_state_restored(void) {
+  return state_arena != NULL && state_arena->restored;
+}
+
+void persistent_state_close(void) {
+  if (state_arena != NULL) {
+    persistent_arena_close(state_arena);
+    state_arena = NULL;
+  }
+}
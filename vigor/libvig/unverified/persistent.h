@@ -0,0 +1,78 @@
+#ifndef _PERSISTENT_H_INCLUDED_
+#define _PERSISTENT_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libvig/verified/double-chain.h"
+#include "libvig/verified/map.h"
+#include "libvig/verified/vector.h"
+
+// Persistent libVig state: structures allocated in an arena backed by a file
+// (ideally on hugetlbfs, e.g. /dev/hugepages/nf-state) survive a restart of
+// the NF. The file is always mapped at the same address, so the internal
+// pointers of the structures stay valid and nothing needs to be rehashed when
+// reattaching to it.
+//
+// The structures returned are regular libVig structures, to be used with the
+// usual API. Keys given to map_put must live in the same arena, e.g. in a
+// persistent vector, which is what EMaps and all Vigor NFs do.
+//
+// State is only reattached if the arena was closed cleanly, since a crash
+// may have happened in the middle of an update. It is reattached as a whole:
+// if one structure is missing or changed shape, all of them start afresh.
+
+struct PersistentArena;
+
+// Opens the arena backed by the given file, creating it with the given size if
+// it does not exist or was not closed cleanly. On success, *restored_out tells
+// whether existing state can be reattached.
+int persistent_arena_open(const char *path, size_t size,
+                          struct PersistentArena **arena_out,
+                          bool *restored_out);
+
+// Marks the arena as cleanly closed and unmaps it; no structure allocated in
+// it may be used afterwards.
+void persistent_arena_close(struct PersistentArena *arena);
+
+// The following either reattach the structure with the given name, if the
+// arena was restored and contains one with the same parameters, or allocate
+// and initialize a new one like their non-persistent counterparts do. In the
+// latter case, the structures reattached before are reinitialized in place
+// and the arena no longer counts as restored.
+// Function pointers are always rebound, since the code may have moved.
+// They return 1 on success and 0 on failure, like the libVig allocators.
+
+int persistent_map_allocate(struct PersistentArena *arena, const char *name,
+                            map_keys_equality *keq, map_key_hash *khash,
+                            unsigned capacity, struct Map **map_out);
+
+int persistent_vector_allocate(struct PersistentArena *arena,
+                               const char *name, int elem_size,
+                               unsigned capacity, vector_init_elem *init_elem,
+                               struct Vector **vector_out);
+
+int persistent_dchain_allocate(struct PersistentArena *arena,
+                               const char *name, int index_range,
+                               struct DoubleChain **chain_out);
+
+int persistent_cht_allocate(struct PersistentArena *arena, const char *name,
+                            uint32_t cht_height, uint32_t backend_capacity,
+                            struct Vector **cht_out);
+
+// Process-wide arena used by the generated state allocation when built with
+// VIGOR_PERSISTENT_STATE, opened on first use from the file given by the
+// VIGOR_STATE_FILE environment variable, of VIGOR_STATE_SIZE MiB (default
+// 1024).
+struct PersistentArena *persistent_state_arena(void);
+
+// Whether the process-wide arena reattached all of the existing state, in
+// which case the NF must not initialize its state again (e.g. load static
+// rules). Only meaningful once all the state is allocated.
+bool persistent_state_restored(void);
+
+// Cleanly closes the process-wide arena, if it was opened.
+void persistent_state_close(void);
+
+#endif //_PERSISTENT_H_INCLUDED_
@@ -0,0 +1,80 @@
+#include "port-set.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PORT_SETS_ALIGNMENT 64
+
+struct port_set {
+  uint16_t count;
+  uint16_t ports[];
+};
+
+struct PortSets {
+  char *slab;
+  size_t stride;
+  unsigned max_ports;
+};
+
+int port_sets_allocate(unsigned capacity, unsigned max_ports,
+                       struct PortSets **sets_out) {
+  if (max_ports == 0 || max_ports > UINT16_MAX) {
+    return 0;
+  }
+
+  struct PortSets *sets = (struct PortSets *)malloc(sizeof(struct PortSets));
+  if (sets == NULL) {
+    return 0;
+  }
+
+  sets->max_ports = max_ports;
+  sets->stride = (sizeof(struct port_set) + sizeof(uint16_t) * max_ports +
+                  PORT_SETS_ALIGNMENT - 1) /
+                 PORT_SETS_ALIGNMENT * PORT_SETS_ALIGNMENT;
+  sets->slab = (char *)aligned_alloc(PORT_SETS_ALIGNMENT,
+                                     sets->stride * (size_t)capacity);
+  if (sets->slab == NULL) {
+    free(sets);
+    return 0;
+  }
+  memset(sets->slab, 0, sets->stride * (size_t)capacity);
+
+  *sets_out = sets;
+  return 1;
+}
+
+static struct port_set *port_set_at(struct PortSets *sets, int index) {
+  return (struct port_set *)(sets->slab + sets->stride * (size_t)index);
+}
+
+void port_sets_clear(struct PortSets *sets, int index) {
+  port_set_at(sets, index)->count = 0;
+}
+
+int port_sets_contains(struct PortSets *sets, int index, uint16_t port) {
+  struct port_set *set = port_set_at(sets, index);
+  // No early exit, so that the compiler can vectorize the loop
+  int found = 0;
+  for (unsigned n = 0; n < set->count; n++) {
+    found |= set->ports[n] == port;
+  }
+  return found;
+}
+
+int port_sets_add(struct PortSets *sets, int index, uint16_t port) {
+  if (port_sets_contains(sets, index, port)) {
+    return 1;
+  }
+
+  struct port_set *set = port_set_at(sets, index);
+  if (set->count == sets->max_ports) {
+    return 0;
+  }
+  set->ports[set->count] = port;
+  set->count++;
+  return 1;
+}
+
+unsigned port_sets_count(struct PortSets *sets, int index) {
+  return port_set_at(sets, index)->count;
+}
@@ -0,0 +1,29 @@
+#ifndef _PORT_SET_H_INCLUDED_
+#define _PORT_SET_H_INCLUDED_
+
+#include <stdint.h>
+
+// Fixed number of small sets of 16-bit ports, e.g. the ports touched by each
+// tracked source, indexed like the other libVig structures (e.g. by a
+// DoubleChain index). Each set holds up to 'max_ports' ports, inline in a
+// cache-aligned slot of a single slab, so that a membership check touches a
+// single slot instead of probing a map keyed by (index, port).
+// With max_ports < 32, a set fits in one cache line.
+
+struct PortSets;
+
+// Fails if max_ports is 0 or more than 65535.
+int port_sets_allocate(unsigned capacity, unsigned max_ports,
+                       struct PortSets **sets_out);
+
+void port_sets_clear(struct PortSets *sets, int index);
+
+int port_sets_contains(struct PortSets *sets, int index, uint16_t port);
+
+// Adds the port to the set if it is not full; returns 1 if the port is in the
+// set afterwards, 0 if it is not because the set is full.
+int port_sets_add(struct PortSets *sets, int index, uint16_t port);
+
+unsigned port_sets_count(struct PortSets *sets, int index);
+
+#endif //_PORT_SET_H_INCLUDED_
@@ -23,6 +23,14 @@ unsigned long long __builtin_ia32_crc32di(unsigned long long acc,
 #  define AND &&
 #endif // KLEE_VERIFICATION
 
+// Unverified shared-nothing multi-core support (see nf.c): globals holding
+// per-packet or per-NF-instance state become thread-local, one copy per lcore
+#ifdef VIGOR_MULTICORE
+#  define VIGOR_PER_LCORE __thread
+#else // VIGOR_MULTICORE
+#  define VIGOR_PER_LCORE
+#endif // VIGOR_MULTICORE
+
 #define DEFAULT_UINT32_T 0
 
 static void null_init(void *obj)
@@ -5,9 +5,10 @@
 #include <rte_memcpy.h>
 
 #include "packet-io.h"
+#include "boilerplate-util.h"
 
-size_t global_total_length;
-size_t global_read_length = 0;
+VIGOR_PER_LCORE size_t global_total_length;
+VIGOR_PER_LCORE size_t global_read_length = 0;
 
 /*@
   fixpoint bool missing_chunks(list<pair<int8_t*, int> > missing_chunks, int8_t*
@@ -16,8 +16,8 @@
 #  include <klee/klee.h>
 #endif
 
-void *chunks_borrowed[MAX_N_CHUNKS];
-size_t chunks_borrowed_num = 0;
+VIGOR_PER_LCORE void *chunks_borrowed[MAX_N_CHUNKS];
+VIGOR_PER_LCORE size_t chunks_borrowed_num = 0;
 
 void nf_log_pkt(struct rte_ether_hdr *rte_ether_header,
                 struct rte_ipv4_hdr *rte_ipv4_header,
@@ -11,6 +11,7 @@
 #include <rte_ethdev.h>
 #include <rte_ip.h>
 
+#include "libvig/verified/boilerplate-util.h"
 #include "libvig/verified/packet-io.h"
 #include "libvig/verified/tcpudp_hdr.h"
 
@@ -88,8 +89,8 @@ char *nf_mac_to_str(struct rte_ether_addr *addr);
 char *nf_rte_ipv4_to_str(uint32_t addr);
 
 #define MAX_N_CHUNKS 100
-extern void *chunks_borrowed[];
-extern size_t chunks_borrowed_num;
+extern VIGOR_PER_LCORE void *chunks_borrowed[];
+extern VIGOR_PER_LCORE size_t chunks_borrowed_num;
 
 static inline void *nf_borrow_next_chunk(uint8_t **p, size_t length) {
   assert(chunks_borrowed_num < MAX_N_CHUNKS);
@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <string.h>
 // DPDK uses these but doesn't include them. :|
 #include <linux/limits.h>
 #include <sys/types.h>
@@ -34,6 +35,30 @@
 #define VIGOR_BATCH_SIZE 1
 #endif
 
+// Unverified support for shared-nothing multi-core, see nf.h
+#if defined(VIGOR_MULTICORE) && defined(KLEE_VERIFICATION)
+#error "Multi-core support is not verified, build it without KLEE_VERIFICATION"
+#endif
+
+// Unverified support for state that survives restarts, see
+// libvig/unverified/persistent.h; the NF runs until SIGINT/SIGTERM, then
+// closes its state cleanly so the next run can reattach to it
+#ifdef VIGOR_PERSISTENT_STATE
+#if defined(KLEE_VERIFICATION) || defined(VIGOR_MULTICORE)
+#error "Persistent state is unverified and single-core only"
+#endif
+#include <signal.h>
+#include "libvig/unverified/persistent.h"
+static volatile sig_atomic_t nf_running = 1;
+static void nf_stop(int signal) {
+  (void)signal;
+  nf_running = 0;
+}
+#define NF_RUNNING nf_running
+#else // VIGOR_PERSISTENT_STATE
+#define NF_RUNNING 1
+#endif // VIGOR_PERSISTENT_STATE
+
 // More elaborate loop shape with annotations for verification
 #ifdef KLEE_VERIFICATION
 #define VIGOR_LOOP_BEGIN                                                       \
@@ -55,7 +80,7 @@
   }
 #else // KLEE_VERIFICATION
 #define VIGOR_LOOP_BEGIN                                                       \
-  while (1) {                                                                  \
+  while (NF_RUNNING) {                                                         \
     vigor_time_t VIGOR_NOW = current_time();                                   \
     unsigned VIGOR_DEVICES_COUNT = rte_eth_dev_count_avail();                  \
     for (uint16_t VIGOR_DEVICE = 0; VIGOR_DEVICE < VIGOR_DEVICES_COUNT;        \
@@ -81,14 +106,29 @@ static const uint16_t TX_QUEUE_SIZE = 128;
 // Buffer count for mempools
 static const unsigned MEMPOOL_BUFFER_COUNT = 256;
 
+#ifdef VIGOR_MULTICORE
+// Per-core cache size for the mempool, since all lcores share it
+static const unsigned MEMPOOL_CACHE_SIZE = 256;
+#endif // VIGOR_MULTICORE
+
+// Queue used by the current lcore on every device
+static uint16_t nf_lcore_queue(void) {
+#ifdef VIGOR_MULTICORE
+  return rte_lcore_index(rte_lcore_id());
+#else  // VIGOR_MULTICORE
+  return 0;
+#endif // VIGOR_MULTICORE
+}
+
 // Send the given packet to all devices except the packet's own
 void flood(struct rte_mbuf *packet, uint16_t nb_devices) {
   rte_mbuf_refcnt_set(packet, nb_devices - 1);
   int total_sent = 0;
   uint16_t skip_device = packet->port;
+  uint16_t queue = nf_lcore_queue();
   for (uint16_t device = 0; device < nb_devices; device++) {
     if (device != skip_device) {
-      total_sent += rte_eth_tx_burst(device, 0, &packet, 1);
+      total_sent += rte_eth_tx_burst(device, queue, &packet, 1);
     }
   }
   // should not happen, but in case we couldn't transmit, ensure the packet is
@@ -107,24 +147,47 @@ static int nf_init_device(uint16_t device, struct rte_mempool *mbuf_pool) {
   struct rte_eth_conf device_conf = { 0 };
   // device_conf.rxmode.hw_strip_crc = 1;
 
-  // Configure the device (1, 1 == number of RX/TX queues)
-  retval = rte_eth_dev_configure(device, 1, 1, &device_conf);
-  if (retval != 0) {
-    return retval;
+#ifdef VIGOR_MULTICORE
+  // One RX/TX queue pair per lcore, the NF decides how RSS spreads packets
+  uint16_t queues = rte_lcore_count();
+
+  struct rte_eth_dev_info dev_info;
+  rte_eth_dev_info_get(device, &dev_info);
+
+  uint16_t reta[ETH_RSS_RETA_SIZE_512];
+  uint16_t reta_size = RTE_MIN(dev_info.reta_size, ETH_RSS_RETA_SIZE_512);
+  for (uint16_t bucket = 0; bucket < reta_size; bucket++) {
+    reta[bucket] = bucket % queues;
   }
 
-  // Allocate and set up a TX queue (NULL == default config)
-  retval = rte_eth_tx_queue_setup(device, 0, TX_QUEUE_SIZE,
-                                  rte_eth_dev_socket_id(device), NULL);
+  device_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+  nf_rss_config(device, queues, &device_conf.rx_adv_conf.rss_conf, reta,
+                reta_size);
+#else  // VIGOR_MULTICORE
+  uint16_t queues = 1;
+#endif // VIGOR_MULTICORE
+
+  // Configure the device
+  retval = rte_eth_dev_configure(device, queues, queues, &device_conf);
   if (retval != 0) {
     return retval;
   }
 
-  // Allocate and set up RX queues (NULL == default config)
-  retval = rte_eth_rx_queue_setup(
-      device, 0, RX_QUEUE_SIZE, rte_eth_dev_socket_id(device), NULL, mbuf_pool);
-  if (retval != 0) {
-    return retval;
+  for (uint16_t queue = 0; queue < queues; queue++) {
+    // Allocate and set up a TX queue (NULL == default config)
+    retval = rte_eth_tx_queue_setup(device, queue, TX_QUEUE_SIZE,
+                                    rte_eth_dev_socket_id(device), NULL);
+    if (retval != 0) {
+      return retval;
+    }
+
+    // Allocate and set up RX queues (NULL == default config)
+    retval =
+        rte_eth_rx_queue_setup(device, queue, RX_QUEUE_SIZE,
+                               rte_eth_dev_socket_id(device), NULL, mbuf_pool);
+    if (retval != 0) {
+      return retval;
+    }
   }
 
   // Start the device
@@ -133,6 +196,25 @@ static int nf_init_device(uint16_t device, struct rte_mempool *mbuf_pool) {
     return retval;
   }
 
+#ifdef VIGOR_MULTICORE
+  // The redirection table can only be updated once the device is started
+  if (queues > 1) {
+    struct rte_eth_rss_reta_entry64
+        reta_conf[ETH_RSS_RETA_SIZE_512 / RTE_RETA_GROUP_SIZE];
+    memset(reta_conf, 0, sizeof(reta_conf));
+    for (uint16_t bucket = 0; bucket < reta_size; bucket++) {
+      reta_conf[bucket / RTE_RETA_GROUP_SIZE].mask = UINT64_MAX;
+      reta_conf[bucket / RTE_RETA_GROUP_SIZE].reta[bucket %
+                                                   RTE_RETA_GROUP_SIZE] =
+          reta[bucket];
+    }
+    retval = rte_eth_dev_rss_reta_update(device, reta_conf, reta_size);
+    if (retval != 0) {
+      return retval;
+    }
+  }
+#endif // VIGOR_MULTICORE
+
   // Enable RX in promiscuous mode, just in case
   rte_eth_promiscuous_enable(device);
   if (rte_eth_promiscuous_get(device) != 1) {
@@ -142,7 +224,7 @@ static int nf_init_device(uint16_t device, struct rte_mempool *mbuf_pool) {
   return 0;
 }
 
-// Main worker method (for now used on a single thread...)
+// Main worker method, run by every lcore in multi-core mode
 static void worker_main(void) {
   if (!nf_init()) {
     rte_exit(EXIT_FAILURE, "Error initializing NF");
@@ -150,10 +232,12 @@ static void worker_main(void) {
 
   NF_INFO("Core %u forwarding packets.", rte_lcore_id());
 
+  uint16_t queue = nf_lcore_queue();
+
 #if VIGOR_BATCH_SIZE == 1
   VIGOR_LOOP_BEGIN
   struct rte_mbuf *mbuf;
-  if (rte_eth_rx_burst(VIGOR_DEVICE, 0, &mbuf, 1) != 0) {
+  if (rte_eth_rx_burst(VIGOR_DEVICE, queue, &mbuf, 1) != 0) {
     uint8_t *data = rte_pktmbuf_mtod(mbuf, uint8_t *);
     packet_state_total_length(data, &(mbuf->pkt_len));
 
@@ -168,7 +252,7 @@ static void worker_main(void) {
     } else {
       // ensure we don't leak symbols into DPDK
       concretize_devices(&dst_device, rte_eth_dev_count_avail());
-      if (rte_eth_tx_burst(dst_device, 0, &mbuf, 1) != 1) {
+      if (rte_eth_tx_burst(dst_device, queue, &mbuf, 1) != 1) {
 #ifdef VIGOR_ALLOW_DROPS
         rte_pktmbuf_free(mbuf); // OK, we're debugging
 #else
@@ -190,13 +274,13 @@ static void worker_main(void) {
   }
   NF_INFO("Running with batches, this code is unverified!");
 
-  while (1) {
+  while (NF_RUNNING) {
     unsigned VIGOR_DEVICES_COUNT = rte_eth_dev_count_avail();
     for (uint16_t VIGOR_DEVICE = 0; VIGOR_DEVICE < VIGOR_DEVICES_COUNT;
          VIGOR_DEVICE++) {
       struct rte_mbuf *mbufs[VIGOR_BATCH_SIZE];
       uint16_t rx_count =
-          rte_eth_rx_burst(VIGOR_DEVICE, 0, mbufs, VIGOR_BATCH_SIZE);
+          rte_eth_rx_burst(VIGOR_DEVICE, queue, mbufs, VIGOR_BATCH_SIZE);
 
       struct rte_mbuf *mbufs_to_send[VIGOR_BATCH_SIZE];
       uint16_t tx_count = 0;
@@ -218,7 +302,7 @@ static void worker_main(void) {
       }
 
       uint16_t sent_count =
-          rte_eth_tx_burst(1 - VIGOR_DEVICE, 0, mbufs_to_send, tx_count);
+          rte_eth_tx_burst(1 - VIGOR_DEVICE, queue, mbufs_to_send, tx_count);
       for (uint16_t n = sent_count; n < tx_count; n++) {
         rte_pktmbuf_free(mbufs[n]); // should not happen, but we're in the
                                     // unverified case anyway
@@ -228,6 +312,14 @@ static void worker_main(void) {
 #endif
 }
 
+#ifdef VIGOR_MULTICORE
+static int worker_main_remote(void *unused) {
+  (void)unused;
+  worker_main();
+  return 0;
+}
+#endif // VIGOR_MULTICORE
+
 // Entry point
 int MAIN(int argc, char **argv) {
   // Initialize the DPDK Environment Abstraction Layer (EAL)
@@ -244,6 +336,17 @@ int MAIN(int argc, char **argv) {
 
   // Create a memory pool
   unsigned nb_devices = rte_eth_dev_count_avail();
+#ifdef VIGOR_MULTICORE
+  struct rte_mempool *mbuf_pool = rte_pktmbuf_pool_create(
+      "MEMPOOL", // name
+      (MEMPOOL_BUFFER_COUNT * nb_devices + MEMPOOL_CACHE_SIZE) *
+          rte_lcore_count(), // #elements
+      MEMPOOL_CACHE_SIZE,    // cache size (per-core)
+      0,                     // application private area size
+      RTE_MBUF_DEFAULT_BUF_SIZE, // data buffer size
+      rte_socket_id()            // socket ID
+      );
+#else  // VIGOR_MULTICORE
   struct rte_mempool *mbuf_pool = rte_pktmbuf_pool_create(
       "MEMPOOL",                         // name
       MEMPOOL_BUFFER_COUNT * nb_devices, // #elements
@@ -252,6 +355,7 @@ int MAIN(int argc, char **argv) {
       RTE_MBUF_DEFAULT_BUF_SIZE, // data buffer size
       rte_socket_id()            // socket ID
       );
+#endif // VIGOR_MULTICORE
   if (mbuf_pool == NULL) {
     rte_exit(EXIT_FAILURE, "Cannot create pool: %s\n", rte_strerror(rte_errno));
   }
@@ -267,7 +371,21 @@ int MAIN(int argc, char **argv) {
   }
 
   // Run!
+#ifdef VIGOR_MULTICORE
+  unsigned lcore_id;
+  RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+    rte_eal_remote_launch(worker_main_remote, NULL, lcore_id);
+  }
+#endif // VIGOR_MULTICORE
+#ifdef VIGOR_PERSISTENT_STATE
+  signal(SIGINT, nf_stop);
+  signal(SIGTERM, nf_stop);
+#endif // VIGOR_PERSISTENT_STATE
   worker_main();
+#ifdef VIGOR_PERSISTENT_STATE
+  persistent_state_close();
+  NF_INFO("State saved, exiting.");
+#endif // VIGOR_PERSISTENT_STATE
 
   return 0;
 }
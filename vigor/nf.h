@@ -18,6 +18,18 @@ void nf_config_init(int argc, char **argv);
 void nf_config_usage(void);
 void nf_config_print(void);
 
+#ifdef VIGOR_MULTICORE
+// Unverified shared-nothing multi-core support: the lcore with index i
+// (see rte_lcore_index) polls RX/TX queue i of every device, and calls nf_init
+// on its own before processing packets, so NF state must be per-lcore.
+// The NF chooses the RSS configuration of each device; the redirection table
+// comes pre-filled with a round-robin mapping of buckets to queues.
+struct rte_eth_rss_conf;
+void nf_rss_config(uint16_t device, uint16_t queues,
+                   struct rte_eth_rss_conf *rss_conf, uint16_t *reta,
+                   uint16_t reta_size);
+#endif // VIGOR_MULTICORE
+
 #ifdef KLEE_VERIFICATION
 void nf_loop_iteration_border(unsigned lcore_id, vigor_time_t time);
 #endif
@@ -0,0 +1,49 @@
+#include "synthesized/boilerplate/locks-common.h"
+#include "synthesized/boilerplate/sn-capacity.h"
+
+#include "libvig/verified/double-chain.h"
+#include "libvig/verified/vector.h"
+#include "libvig/verified/map.h"
+#include "libvig/verified/expirator.h"
+#include "libvig/verified/cht.h"
+
+#include "libvig/unverified/sketch.h"
+
+// Partitioned objects are allocated by every lcore, shared ones only by the
+// master, which is done with nf_init before the other lcores start.
+static void worker_init(void) {
+  nf_util_init();
+  packet_io_init();
+
+  if (!nf_init()) {
+    rte_exit(EXIT_FAILURE, "Error initializing NF");
+  }
+}
+
+static void worker_main(void) {
+  const unsigned lcore_id = rte_lcore_id();
+  const uint16_t queue_id = lcores_conf[lcore_id].queue_id;
+
+  if (lcore_id != rte_get_master_lcore()) {
+    worker_init();
+  }
+
+  nf_worker_loop(queue_id);
+}
+
+// Entry point
+int MAIN(int argc, char **argv) {
+  nf_init_devices(argc, argv);
+
+  nf_util_init_locks();
+  worker_init();
+
+  unsigned lcore_id;
+  RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+    rte_eal_remote_launch((lcore_function_t *)worker_main, NULL, lcore_id);
+  }
+
+  worker_main();
+
+  return 0;
+}
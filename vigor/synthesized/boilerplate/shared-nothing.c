@@ -38,6 +38,8 @@
 #include "libvig/unverified/sketch.h"
 #include "libvig/unverified/expirator.h"
 
+#include "synthesized/boilerplate/sn-capacity.h"
+
 /**********************************************
  *
  *                  PACKET-IO
@@ -0,0 +1,45 @@
+#ifndef _SN_CAPACITY_H_INCLUDED_
+#define _SN_CAPACITY_H_INCLUDED_
+
+#include <stdint.h>
+
+#include <rte_lcore.h>
+
+// Extra per flow capacity given to each lcore, in percent of its fair share,
+// as RSS never spreads flows perfectly evenly.
+#ifndef SN_CAPACITY_HEADROOM
+#define SN_CAPACITY_HEADROOM 25
+#endif
+
+// Each lcore only sees the flows RSS sends to its queue, so the per flow state
+// nf_init allocates on every lcore (all of it in shared-nothing, the
+// partitioned objects in hybrid) gets its share of the configured capacity
+// instead of all of it. nf_init runs on the lcore owning the state, which first
+// touches it, so its memory comes from that lcore's NUMA node.
+static uint32_t sn_capacity(uint32_t capacity) {
+  uint64_t lcores = rte_lcore_count();
+  uint64_t share = ((uint64_t)capacity * (100 + SN_CAPACITY_HEADROOM) +
+                    100 * lcores - 1) /
+                   (100 * lcores);
+
+  if (share > capacity) {
+    share = capacity;
+  }
+
+  if (share == 0) {
+    share = 1;
+  }
+
+#ifdef CAPACITY_POW2
+  // Still a power of 2, and never above the capacity, which already is one.
+  uint64_t pow2 = 1;
+  while (pow2 < share) {
+    pow2 <<= 1;
+  }
+  share = pow2;
+#endif // CAPACITY_POW2
+
+  return (uint32_t)share;
+}
+
+#endif // _SN_CAPACITY_H_INCLUDED_
@@ -24,6 +24,7 @@ subprocess.call([ "mkdir", "-p", SYNTHESIZED_BUNDLE ], stdout=subprocess.DEVNULL
 
 BOILERPLATE_CHOICE_BMV2 = "bmv2_ss_grpc_controller"
 BOILERPLATE_CHOICE_CALL_PATH_HITTER = "call_path_hitter"
+BOILERPLATE_CHOICE_HYBRID = "hybrid"
 BOILERPLATE_CHOICE_LOCKS = "locks"
 BOILERPLATE_CHOICE_SQ = "sequential"
 BOILERPLATE_CHOICE_SN = "shared-nothing"
@@ -97,6 +98,7 @@ if __name__ == "__main__":
     choices=[
       BOILERPLATE_CHOICE_BMV2,
       BOILERPLATE_CHOICE_CALL_PATH_HITTER,
+      BOILERPLATE_CHOICE_HYBRID,
       BOILERPLATE_CHOICE_LOCKS,
       BOILERPLATE_CHOICE_SQ,
       BOILERPLATE_CHOICE_SN,
@@ -38,6 +38,7 @@ CHOICE_SHARED_NOTHING = "sn"
 CHOICE_LOCKS          = "locks"
 CHOICE_TM             = "tm"
 CHOICE_CPH            = "cph"
+CHOICE_HYBRID         = "hybrid"
 
 CHOICE_TO_BOILERPLATE = {
   CHOICE_SEQUENTIAL: build.BOILERPLATE_CHOICE_SQ,
@@ -45,13 +46,17 @@ CHOICE_TO_BOILERPLATE = {
   CHOICE_LOCKS: build.BOILERPLATE_CHOICE_LOCKS,
   CHOICE_TM: build.BOILERPLATE_CHOICE_TM,
   CHOICE_CPH: build.BOILERPLATE_CHOICE_CALL_PATH_HITTER,
+  CHOICE_HYBRID: build.BOILERPLATE_CHOICE_HYBRID,
 }
 
 SYNTHESIZED       = f"{BUILD_SYNTHESIZED_DIR}/nf_process.gen.c"
 SYNTHESIZED_XML   = f"{BUILD_SYNTHESIZED_DIR}/nf_process.gen.xml"
 LVA               = f"{BUILD_DIR}/report.lva"
+LVA_BINARY        = f"{BUILD_DIR}/report.lva.bin"
+ANALYSIS_CACHE    = f"{BUILD_DIR}/analysis-cache"
 LVA_DEBUG         = f"{BUILD_DIR}/report.txt"
 RSS_CONF          = f"{BUILD_DIR}/rss_conf.txt"
+OBJECTS           = f"{BUILD_DIR}/objects.txt"
 RSS_KEY_LEN       = 52
 
 EXTRA_VAR_MAKEFILE = f"{os.getcwd()}/Makefile.foo"
@@ -80,7 +85,8 @@ def symbex(nf):
 
 def analyze_call_paths(nf, call_paths):
   analyze 		= f"{KLEE_DIR}/build/bin/analyse-libvig-call-paths"
-  analyze_args	= [ os.path.abspath(cp) for cp in call_paths ]
+  analyze_args	= [ f"-cache-dir={ANALYSIS_CACHE}", f"-binary-lva={LVA_BINARY}" ]
+  analyze_args += [ os.path.abspath(cp) for cp in call_paths ]
 
   lva = open(LVA, mode="w")
   code = subprocess.call([ analyze ] + analyze_args, stdout=lva)
@@ -88,12 +94,16 @@ def analyze_call_paths(nf, call_paths):
   if code != 0: error()
   lva.close()
 
-def rss_conf_from_lvas():
+def rss_conf_from_lvas(target):
   rss_conf_from_lva = f"{BUILD_DIR}/rss-config-from-lvas"
-  rss_conf_from_lva_arg = f"{BUILD_DIR}/report.lva"
+  rss_conf_from_lva_args = [ LVA_BINARY ]
+
+  # objects RSS can't partition are left to the locks
+  if target == CHOICE_HYBRID:
+    rss_conf_from_lva_args += [ "--objects", OBJECTS ]
 
   rss_conf = open(RSS_CONF, mode='w')
-  code = subprocess.call([ rss_conf_from_lva, rss_conf_from_lva_arg ], stdout=rss_conf)
+  code = subprocess.call([ rss_conf_from_lva ] + rss_conf_from_lva_args, stdout=rss_conf)
   rss_conf.close()
 
   return code == 0
@@ -163,11 +173,20 @@ def synthesize_rss_conf(target):
   code += f"\n}};"
   return (code, keys)
 
-def synthesize_nf(nf, call_paths, target):
+def synthesize_nf(nf, call_paths, target, profile):
   assert(call_paths)
 
   bdd_to_c      = f"{KLEE_DIR}/build/bin/bdd-to-c"
-  bdd_to_c_args	= f"-out={SYNTHESIZED} -xml={SYNTHESIZED_XML} -target={target} {' '.join(call_paths)}"
+  bdd_to_c_args	= f"-out={SYNTHESIZED} -xml={SYNTHESIZED_XML} -target={target}"
+
+  if target == CHOICE_HYBRID:
+    bdd_to_c_args += f" -objects={OBJECTS}"
+
+  # report.txt of a cph build replaying a pcap
+  if profile:
+    bdd_to_c_args += f" -profile={os.path.abspath(profile)}"
+
+  bdd_to_c_args += f" {' '.join(call_paths)}"
 
   code = subprocess.call([ bdd_to_c ] + bdd_to_c_args.split(' '))
   
@@ -249,10 +268,11 @@ if __name__ == "__main__":
   parser.add_argument('nf', type=str, help='path to the NF')
   parser.add_argument('--target', 													  \
     help='implementation model target', 											\
-    choices=[ CHOICE_SEQUENTIAL, CHOICE_SHARED_NOTHING, CHOICE_LOCKS, CHOICE_TM, CHOICE_CPH ],	\
+    choices=[ CHOICE_SEQUENTIAL, CHOICE_SHARED_NOTHING, CHOICE_LOCKS, CHOICE_TM, CHOICE_CPH, CHOICE_HYBRID ],	\
     default=CHOICE_SHARED_NOTHING)
   parser.add_argument('--randomize', type=str, help='randomize RSS keys')
   parser.add_argument('--balance', type=str, help='pcap used to balance LUT')
+  parser.add_argument('--profile', type=str, help='call path hitter report used to lay out hot paths first')
 
   args = parser.parse_args()
   args.nf = os.path.abspath(args.nf)
@@ -272,8 +292,13 @@ if __name__ == "__main__":
     t_analyze_call_paths = perf_counter()
 
     print("\n[*] Finding RSS configuration")
-    if not args.randomize and args.target == CHOICE_SHARED_NOTHING:
-      success = rss_conf_from_lvas()
+    if args.target == CHOICE_HYBRID:
+      success = rss_conf_from_lvas(args.target)
+      if not success:
+        print("Unable to synthesize a parallel implementation using a hybrid model.")
+        exit(1)
+    elif not args.randomize and args.target == CHOICE_SHARED_NOTHING:
+      success = rss_conf_from_lvas(args.target)
       if not success:
         print("Unable to synthesize a parallel implementation using a shared nothing model.")
         exit(1)
@@ -289,7 +314,7 @@ if __name__ == "__main__":
   rss_conf_code, keys = synthesize_rss_conf(args.target)
   synthesized_content.append(rss_conf_code)
 
-  synthesized_nf = synthesize_nf(args.nf, call_paths, args.target)
+  synthesized_nf = synthesize_nf(args.nf, call_paths, args.target, args.profile)
   synthesized_content.append(synthesized_nf)
 
   balance_lut_code = synthesize_balance_lut(keys, args.balance, args.target)
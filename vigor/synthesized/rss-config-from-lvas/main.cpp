@@ -1,3 +1,5 @@
+#include <fstream>
+
 #include "logger.h"
 #include "libvig_access.h"
 #include "constraint.h"
@@ -51,8 +53,40 @@ int main(int argc, char *argv[]) {
   } else {
     Parser parser(arg);
 
+    // "<LVA> --objects <file>" configures RSS for the objects it can
+    // partition, and tells which ones those are, one per line, for hybrid
+    // targets to synchronize the others.
+    std::string objects_file;
+
+    if (argc > 2) {
+      if (std::string(argv[2]) != "--objects" || argc < 4) {
+        Logger::error() << "[ERROR] Invalid arguments.";
+        Logger::error() << "Please provide an objects file location to go with the --objects flag.\n";
+        return 1;
+      }
+
+      objects_file = argv[3];
+    }
+
     RSSConfigBuilder rss_cfg_builder(parser.get_accesses(),
-                                    parser.get_call_paths_constraints());
+                                    parser.get_call_paths_constraints(),
+                                    objects_file.size());
+
+    if (objects_file.size()) {
+      std::ofstream objects(objects_file);
+
+      if (!objects.is_open()) {
+        Logger::error() << "[ERROR] Unable to open " << objects_file << "\n";
+        return 1;
+      }
+
+      for (auto object : rss_cfg_builder.get_objects()) {
+        objects << object << " ";
+        objects << (rss_cfg_builder.is_object_shared(object) ? "shared"
+                                                             : "partitioned");
+        objects << "\n";
+      }
+    }
 
 
     rss_cfg_builder.build_rss_config();
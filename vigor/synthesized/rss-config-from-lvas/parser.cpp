@@ -4,12 +4,104 @@
 #include <string>
 #include <algorithm>
 #include <numeric>
+#include <cstring>
+#include <cstdint>
 
 #include "logger.h"
 #include "parser.h"
 
 namespace ParallelSynthesizer {
 
+// Binary LVA files, as written by analyse-libvig-call-paths with -binary-lva:
+// a magic and a version, followed by records of 32 bit words. Strings are
+// stored as their length followed by their characters, padded to a word.
+// Both sides must be kept in sync.
+const char LVA_MAGIC[] = "VIGORLVA";
+const uint32_t LVA_VERSION = 1;
+
+enum LvaRecord {
+  LVA_ACCESS,
+  LVA_CALL_PATHS_CONSTRAINT
+};
+
+class LvaReader {
+private:
+  std::vector<char> data;
+  size_t pos;
+
+  void truncated() const {
+    Logger::error() << "Truncated binary LVA file"
+                    << "\n";
+    exit(1);
+  }
+
+public:
+  LvaReader(const std::string &filepath) : pos(0) {
+    std::ifstream file(filepath.c_str(), std::ios::in | std::ios::binary);
+
+    if (!file.is_open()) {
+      Logger::error() << "Failed to open file"
+                      << "\n";
+      exit(1);
+    }
+
+    data.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+
+    if (data.size() < sizeof(LVA_MAGIC) - 1 + sizeof(uint32_t) ||
+        memcmp(data.data(), LVA_MAGIC, sizeof(LVA_MAGIC) - 1) != 0) {
+      Logger::error() << "Not a binary LVA file"
+                      << "\n";
+      exit(1);
+    }
+
+    pos = sizeof(LVA_MAGIC) - 1;
+
+    if (get() != LVA_VERSION) {
+      Logger::error() << "Unsupported binary LVA version"
+                      << "\n";
+      exit(1);
+    }
+  }
+
+  bool done() const { return pos == data.size(); }
+
+  uint32_t get() {
+    uint32_t word;
+
+    if (pos + sizeof(word) > data.size())
+      truncated();
+
+    memcpy(&word, data.data() + pos, sizeof(word));
+    pos += sizeof(word);
+
+    return word;
+  }
+
+  std::string get_string() {
+    auto size = get();
+    auto padded_size = (size + 3) & ~3u;
+
+    if (pos + padded_size > data.size())
+      truncated();
+
+    std::string str(data.data() + pos, size);
+    pos += padded_size;
+
+    return str;
+  }
+};
+
+bool Parser::is_binary(const std::string &filepath) {
+  std::ifstream file(filepath.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(LVA_MAGIC) - 1];
+
+  if (!file.read(magic, sizeof(magic)))
+    return false;
+
+  return memcmp(magic, LVA_MAGIC, sizeof(magic)) == 0;
+}
+
 LibvigAccess &Parser::get_or_push_unique_access(const LibvigAccess &access) {
   auto it = std::find(accesses.begin(), accesses.end(), access);
 
@@ -337,7 +429,129 @@ void Parser::parse_call_path_info() {
   states.top().content.emplace_back(call_path_info);
 }
 
+// Expressions hold the lines the textual report has between its expression
+// tokens, which are joined the same way.
+std::string Parser::parse_binary_expression(LvaReader &reader) {
+  std::istringstream lines(reader.get_string());
+  std::vector<std::string> fragments;
+  std::string line;
+
+  while (getline(lines, line))
+    fragments.push_back(line);
+
+  return join_expression_fragments(fragments);
+}
+
+std::vector<std::shared_ptr<const Dependency> >
+Parser::parse_binary_packet_dependencies(LvaReader &reader) {
+  std::vector<std::shared_ptr<const Dependency> > dependencies;
+  auto num_chunks = reader.get();
+
+  for (unsigned int i = 0; i < num_chunks; i++) {
+    unsigned int layer = reader.get();
+    bool protocol_known = reader.get();
+    unsigned int protocol_code = reader.get();
+
+    // The textual report always has a protocol line, which reads as 0 when
+    // the protocol is unknown.
+    auto protocol = std::make_pair(true, protocol_known ? protocol_code : 0u);
+
+    auto num_dependencies = reader.get();
+    for (unsigned int j = 0; j < num_dependencies; j++) {
+      PacketDependency dependency(layer, reader.get(), protocol);
+      dependencies.emplace_back(dependency.clone());
+    }
+  }
+
+  return dependencies;
+}
+
+void Parser::parse_binary_access(LvaReader &reader) {
+  unsigned int id = reader.get();
+  unsigned int src_device = reader.get();
+
+  std::pair<bool, unsigned int> dst_device;
+  dst_device.first = reader.get();
+  dst_device.second = reader.get();
+
+  std::pair<bool, bool> success;
+  success.first = reader.get();
+  success.second = reader.get();
+
+  auto operation = LibvigAccess::parse_operation_token(reader.get_string());
+  unsigned int object = reader.get();
+
+  LibvigAccess &access = get_or_push_unique_access(
+      LibvigAccess(id, src_device, dst_device, success, operation, object));
+
+  auto num_arguments = reader.get();
+  for (unsigned int i = 0; i < num_arguments; i++) {
+    auto type =
+        LibvigAccessArgument::parse_argument_type_token(reader.get_string());
+    auto expression = parse_binary_expression(reader);
+
+    LibvigAccessArgument argument(type, expression);
+
+    for (const auto &dependency : parse_binary_packet_dependencies(reader))
+      argument.add_dependency(dependency.get());
+
+    access.add_argument(argument);
+  }
+
+  auto interface = reader.get_string();
+  auto file = reader.get_string();
+
+  access.add_metadata(LibvigAccessMetadata(interface, file));
+}
+
+CallPathInfo Parser::parse_binary_call_path_info(LvaReader &reader) {
+  auto call_path = reader.get_string();
+  auto type = CallPathInfo::parse_call_path_info_type_token(reader.get_string());
+  unsigned int id = reader.get();
+
+  CallPathInfo call_path_info(call_path, type, id);
+
+  for (const auto &dependency : parse_binary_packet_dependencies(reader))
+    call_path_info.add_dependency(dependency.get());
+
+  return call_path_info;
+}
+
+void Parser::parse_binary_call_paths_constraint(LvaReader &reader) {
+  auto expression = parse_binary_expression(reader);
+  auto first_call_path_info = parse_binary_call_path_info(reader);
+  auto second_call_path_info = parse_binary_call_path_info(reader);
+
+  call_paths_constraints.emplace_back(expression, first_call_path_info,
+                                      second_call_path_info);
+}
+
+void Parser::parse_binary(const std::string &filepath) {
+  LvaReader reader(filepath);
+
+  while (!reader.done()) {
+    auto record = reader.get();
+
+    switch (record) {
+      case LVA_ACCESS:
+        parse_binary_access(reader);
+        break;
+      case LVA_CALL_PATHS_CONSTRAINT:
+        parse_binary_call_paths_constraint(reader);
+        break;
+      default:
+        Logger::error() << "Invalid binary LVA record " << record << "\n";
+        exit(1);
+    }
+  }
+}
+
 void Parser::parse(const std::string &filepath) {
+  if (is_binary(filepath)) {
+    parse_binary(filepath);
+    return;
+  }
+
   // TODO: deal with errors
   std::fstream file;
   std::string line;
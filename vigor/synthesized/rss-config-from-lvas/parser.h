@@ -11,6 +11,8 @@
 
 namespace ParallelSynthesizer {
 
+class LvaReader;
+
 class Parser {
 public:
   enum LoadedContentType {
@@ -81,23 +83,9 @@ public:
         : argument{ ARGUMENT, _arg } {}
 
     LoadedContent(const std::vector<std::string> &fragments) {
-      std::string _expression;
-
-      for (auto frag : fragments) {
-        frag.erase(frag.begin(),
-                   std::find_if(frag.begin(), frag.end(),
-                                [](int ch) { return !std::isspace(ch); }));
-
-        frag.erase(std::find_if(frag.rbegin(), frag.rend(), [](int ch) {
-                                  return !std::isspace(ch);
-                                }).base(),
-                   frag.end());
-
-        _expression += frag + " ";
-      }
-
       expression.type = EXPRESSION;
-      new ((void *)(&expression.value)) std::string(_expression);
+      new ((void *)(&expression.value))
+          std::string(join_expression_fragments(fragments));
     }
 
     LoadedContent(
@@ -347,7 +335,38 @@ private:
   void parse_call_paths_constraint();
   void parse_call_path_info();
 
+  std::string parse_binary_expression(LvaReader &reader);
+  std::vector<std::shared_ptr<const Dependency> >
+  parse_binary_packet_dependencies(LvaReader &reader);
+  void parse_binary_access(LvaReader &reader);
+  CallPathInfo parse_binary_call_path_info(LvaReader &reader);
+  void parse_binary_call_paths_constraint(LvaReader &reader);
+  void parse_binary(const std::string &filepath);
+
 public:
+  static std::string
+  join_expression_fragments(const std::vector<std::string> &fragments) {
+    std::string expression;
+
+    for (auto frag : fragments) {
+      frag.erase(frag.begin(),
+                 std::find_if(frag.begin(), frag.end(),
+                              [](int ch) { return !std::isspace(ch); }));
+
+      frag.erase(std::find_if(frag.rbegin(), frag.rend(), [](int ch) {
+                                return !std::isspace(ch);
+                              }).base(),
+                 frag.end());
+
+      expression += frag + " ";
+    }
+
+    return expression;
+  }
+
+  // Binary LVA files are told apart from textual ones by their magic.
+  static bool is_binary(const std::string &filepath);
+
   Parser(const std::string &filepath) : line_counter(0) { parse(filepath); }
 
   const std::vector<LibvigAccess> &get_accesses() const { return accesses; }
@@ -216,6 +216,40 @@ interset_packet_fields(std::vector<R3S::R3S_pf_t> pf1,
   return result;
 }
 
+// Accesses keyed by packet fields alone, or by indexes the same core
+// allocated, stay on one core if RSS is configured for them.
+bool is_constraint_partitionable(const Constraint *constraint) {
+  assert(constraint);
+
+  auto non_packet_dependencies_expression =
+      constraint->get_non_packet_dependencies_expressions();
+  auto packet_dependencies_expression =
+      constraint->get_packet_dependencies_expressions();
+
+  if (non_packet_dependencies_expression.size() &&
+      packet_dependencies_expression.size()) {
+    return false;
+  }
+
+  if (non_packet_dependencies_expression.size() == 0) {
+    return packet_dependencies_expression.size() > 0;
+  }
+
+  for (const auto &npde : non_packet_dependencies_expression) {
+    auto symbol = npde.get_symbol();
+
+    auto is_new_index = symbol.find("new_index");
+    auto is_allocated_index = symbol.find("allocated_index");
+
+    if (is_new_index == std::string::npos &&
+        is_allocated_index == std::string::npos) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool analyse_constraint(Constraint *constraint) {
   assert(constraint);
 
@@ -315,8 +349,19 @@ void RSSConfigBuilder::generate_solver_constraints() {
   }
 
   for (auto libvig_access_constraint : libvig_access_constraints) {
+    auto object = libvig_access_constraint.get_first_access().get_object();
+
+    if (shared_objects.count(object)) {
+      continue;
+    }
+
     libvig_access_constraint.process();
 
+    if (partial && !is_constraint_partitionable(&libvig_access_constraint)) {
+      share_object(object);
+      continue;
+    }
+
     auto devices = std::array<unsigned int, 2>{
       libvig_access_constraint.get_devices().first,
       libvig_access_constraint.get_devices().second
@@ -348,6 +393,11 @@ void RSSConfigBuilder::generate_solver_constraints() {
         packet_fields_per_device[device] = intersection;
       }
 
+      else if (intersection.size() == 0 && partial) {
+        share_object(object);
+        break;
+      }
+
       else if (intersection.size() == 0) {
 
         Logger::error() << "\n";
@@ -398,6 +448,41 @@ void RSSConfigBuilder::generate_solver_constraints() {
       constraints.emplace_back(constraint);
     }
   }
+
+  remove_constraints_from_shared_objects();
+}
+
+void RSSConfigBuilder::share_object(unsigned int obj) {
+  assert(partial);
+
+  Logger::warn() << "Accesses on object " << obj
+                 << " can't be partitioned by RSS, leaving it shared."
+                 << "\n";
+
+  shared_objects.insert(obj);
+}
+
+void RSSConfigBuilder::remove_constraints_from_shared_objects() {
+  for (auto obj : shared_objects) {
+    remove_constraints_from_object(obj);
+  }
+
+  auto constraint_from_shared_object =
+      [&](const std::shared_ptr<Constraint> &constraint) -> bool {
+    auto libvig_access_constraint =
+        dynamic_cast<LibvigAccessConstraint *>(constraint.get());
+
+    if (!libvig_access_constraint) {
+      return false;
+    }
+
+    auto obj = libvig_access_constraint->get_first_access().get_object();
+    return shared_objects.count(obj);
+  };
+
+  constraints.erase(std::remove_if(constraints.begin(), constraints.end(),
+                                   constraint_from_shared_object),
+                    constraints.end());
 }
 
 void RSSConfigBuilder::optimize_constraints() {}
@@ -875,6 +960,12 @@ void RSSConfigBuilder::verify_dchain_correctness(
     return;
   }
 
+  if (partial) {
+    remove_constraints_from_object(dchain_verify.get_object());
+    share_object(dchain_verify.get_object());
+    return;
+  }
+
   Logger::error()
       << "Indexes generated by a dchain are being interpreted as packet fields."
       << "\n";
@@ -901,6 +992,12 @@ void RSSConfigBuilder::analyse_dchain_interpretations(
     // index. This is not parallel correct.
     if (access.get_metadata().get_interface() ==
         "cht_find_preferred_available_backend") {
+      if (partial) {
+        remove_constraints_from_object(access.get_object());
+        share_object(access.get_object());
+        continue;
+      }
+
       Logger::error() << "dchain correctness violated: ";
       Logger::error() << "use of 'cht_find_preferred_available_backend' "
                          "prohibits the existence"
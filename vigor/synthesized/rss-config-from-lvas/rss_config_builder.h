@@ -6,6 +6,7 @@
 
 #include <vector>
 #include <map>
+#include <set>
 
 namespace R3S {
 #include <r3s.h>
@@ -30,6 +31,12 @@ private:
 
   RSSConfig rss_config;
 
+  // Objects whose accesses RSS can't keep on a single core are left shared
+  // instead of failing, for targets that synchronize them.
+  bool partial;
+  std::set<unsigned int> objects;
+  std::set<unsigned int> shared_objects;
+
 private:
   void load_rss_config_options();
   void load_solver_constraints_generators();
@@ -45,6 +52,9 @@ private:
   std::vector<LibvigAccess> filter_reads_without_writes_on_objects(
       const std::vector<LibvigAccess> &accesses);
 
+  void share_object(unsigned int obj);
+  void remove_constraints_from_shared_objects();
+
   void optimize_constraints();
   void remove_constraints_from_object(unsigned int obj);
   void remove_constraints_with_access(unsigned int access_id);
@@ -84,12 +94,17 @@ private:
 public:
   RSSConfigBuilder(
       const std::vector<LibvigAccess> &accesses,
-      const std::vector<CallPathsConstraint> &_call_paths_constraints)
-      : call_paths_constraints(_call_paths_constraints) {
+      const std::vector<CallPathsConstraint> &_call_paths_constraints,
+      bool _partial = false)
+      : call_paths_constraints(_call_paths_constraints), partial(_partial) {
 
     R3S::R3S_cfg_init(&cfg);
     R3S::R3S_cfg_set_skew_analysis(cfg, true);
 
+    for (const auto &access : accesses) {
+      objects.insert(access.get_object());
+    }
+
     fill_unique_devices(accesses);
 
     auto trimmed_accesses = filter_reads_without_writes_on_objects(accesses);
@@ -129,6 +144,11 @@ public:
   }
   RSSConfig &get_generated_rss_cfg() { return rss_config; }
 
+  const std::set<unsigned int> &get_objects() const { return objects; }
+  bool is_object_shared(unsigned int obj) const {
+    return shared_objects.count(obj);
+  }
+
   static R3S::Z3_ast ast_replace(R3S::Z3_context ctx, R3S::Z3_ast root,
                                  R3S::Z3_ast target, R3S::Z3_ast dst);
 
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
@@ -15,6 +16,16 @@
 #include "libvig/verified/vector.h"
 #include "libvig/verified/expirator.h"
 #include "libvig/verified/ether.h"
+#ifdef VIGOR_PERSISTENT_STATE
+#include "libvig/unverified/persistent.h"
+#endif // VIGOR_PERSISTENT_STATE
+#ifdef BRIDGE_FAST_TABLES
+#ifdef KLEE_VERIFICATION
+#error "The fast tables are not verified"
+#endif // KLEE_VERIFICATION
+#include "libvig/unverified/mac-map.h"
+#include "libvig/unverified/perfect-hash.h"
+#endif // BRIDGE_FAST_TABLES
 
 #include "nf.h"
 #include "nf-util.h"
@@ -27,14 +38,36 @@ struct nf_config config;
 
 struct State *mac_tables;
 
+#ifdef BRIDGE_FAST_TABLES
+// Unverified lookup tables: static rules are in a read-only perfect hash
+// table built from st_map at init, and the dynamic table keeps MAC addresses
+// inline instead of in dyn_keys. st_map and dyn_map are then unused while
+// processing packets.
+static struct PerfectHash *static_table;
+static struct MacMap *dynamic_table;
+#endif // BRIDGE_FAST_TABLES
+
 int bridge_expire_entries(vigor_time_t time) {
   assert(time >= 0); // we don't support the past
   assert(sizeof(vigor_time_t) <= sizeof(uint64_t));
   uint64_t time_u = (uint64_t)time; // OK because of the two asserts
   vigor_time_t vigor_time_expiration = (vigor_time_t)config.expiration_time;
   vigor_time_t last_time = time_u - vigor_time_expiration * 1000; // us to ns
+#ifdef BRIDGE_FAST_TABLES
+  int count = 0;
+  int index = -1;
+  while (dchain_expire_one_index(mac_tables->dyn_heap, &index, last_time)) {
+    struct rte_ether_addr *key = 0;
+    vector_borrow(mac_tables->dyn_keys, index, (void **)&key);
+    macmap_erase(dynamic_table, key->addr_bytes);
+    vector_return(mac_tables->dyn_keys, index, key);
+    ++count;
+  }
+  return count;
+#else  // BRIDGE_FAST_TABLES
   return expire_items_single_map(mac_tables->dyn_heap, mac_tables->dyn_keys,
                                  mac_tables->dyn_map, last_time);
+#endif // BRIDGE_FAST_TABLES
 }
 
 int bridge_get_device(struct rte_ether_addr *dst, uint16_t src_device) {
@@ -42,7 +75,11 @@ int bridge_get_device(struct rte_ether_addr *dst, uint16_t src_device) {
   struct StaticKey k;
   memcpy(&k.addr, dst, sizeof(struct rte_ether_addr));
   k.device = src_device;
+#ifdef BRIDGE_FAST_TABLES
+  int present = phash_get(static_table, &k, &device);
+#else  // BRIDGE_FAST_TABLES
   int present = map_get(mac_tables->st_map, &k, &device);
+#endif // BRIDGE_FAST_TABLES
   if (present) {
     return device;
   }
@@ -51,7 +88,11 @@ int bridge_get_device(struct rte_ether_addr *dst, uint16_t src_device) {
 #endif                            // KLEE_VERIFICATION
 
   int index = -1;
+#ifdef BRIDGE_FAST_TABLES
+  present = macmap_get(dynamic_table, dst->addr_bytes, &index);
+#else  // BRIDGE_FAST_TABLES
   present = map_get(mac_tables->dyn_map, dst, &index);
+#endif // BRIDGE_FAST_TABLES
   if (present) {
     struct DynamicValue *value = 0;
     vector_borrow(mac_tables->dyn_vals, index, (void **)&value);
@@ -66,7 +107,11 @@ void bridge_put_update_entry(struct rte_ether_addr *src, uint16_t src_device,
                              vigor_time_t time) {
   int index = -1;
   int hash = rte_ether_addr_hash(src);
+#ifdef BRIDGE_FAST_TABLES
+  int present = macmap_get(dynamic_table, src->addr_bytes, &index);
+#else  // BRIDGE_FAST_TABLES
   int present = map_get(mac_tables->dyn_map, src, &index);
+#endif // BRIDGE_FAST_TABLES
   if (present) {
     dchain_rejuvenate_index(mac_tables->dyn_heap, index, time);
   } else {
@@ -82,7 +127,11 @@ void bridge_put_update_entry(struct rte_ether_addr *src, uint16_t src_device,
     vector_borrow(mac_tables->dyn_vals, index, (void **)&value);
     memcpy(key, src, sizeof(struct rte_ether_addr));
     value->device = src_device;
+#ifdef BRIDGE_FAST_TABLES
+    macmap_put(dynamic_table, key->addr_bytes, index);
+#else  // BRIDGE_FAST_TABLES
     map_put(mac_tables->dyn_map, key, index);
+#endif // BRIDGE_FAST_TABLES
     // the other half of the key is in the map
     vector_return(mac_tables->dyn_keys, index, key);
     vector_return(mac_tables->dyn_vals, index, value);
@@ -249,6 +298,52 @@ static void read_static_ft_from_array(struct Map *stat_map,
 
 #endif // KLEE_VERIFICATION
 
+#ifdef BRIDGE_FAST_TABLES
+static bool build_fast_tables(uint32_t stat_capacity) {
+  // Static rules are in st_map, with keys in st_vec; unused st_vec entries
+  // are either absent from st_map or duplicates, which phash_build drops
+  struct StaticKey *keys = malloc(sizeof(struct StaticKey) * stat_capacity);
+  int *devices = malloc(sizeof(int) * stat_capacity);
+  if (keys == NULL || devices == NULL) {
+    free(keys);
+    free(devices);
+    return false;
+  }
+  unsigned count = 0;
+  for (uint32_t n = 0; n < stat_capacity; n++) {
+    struct StaticKey *key = 0;
+    vector_borrow(mac_tables->st_vec, n, (void **)&key);
+    if (map_get(mac_tables->st_map, key, &devices[count])) {
+      keys[count] = *key;
+      ++count;
+    }
+    vector_return(mac_tables->st_vec, n, key);
+  }
+  int built = phash_build(keys, devices, count, sizeof(struct StaticKey),
+                          &static_table);
+  free(keys);
+  free(devices);
+  if (!built) {
+    return false;
+  }
+  NF_INFO("Built perfect hash table for %u static rules", count);
+
+  if (!macmap_allocate(mac_tables->capacity, &dynamic_table)) {
+    return false;
+  }
+  // Non-empty if the state was restored
+  for (uint32_t n = 0; n < mac_tables->capacity; n++) {
+    if (dchain_is_index_allocated(mac_tables->dyn_heap, n)) {
+      struct rte_ether_addr *key = 0;
+      vector_borrow(mac_tables->dyn_keys, n, (void **)&key);
+      macmap_put(dynamic_table, key->addr_bytes, n);
+      vector_return(mac_tables->dyn_keys, n, key);
+    }
+  }
+  return true;
+}
+#endif // BRIDGE_FAST_TABLES
+
 bool nf_init(void) {
   unsigned stat_capacity = 8192; // Has to be power of 2
   unsigned capacity = config.dyn_capacity;
@@ -258,14 +353,24 @@ bool nf_init(void) {
   if (mac_tables == NULL) {
     return false;
   }
+#ifdef VIGOR_PERSISTENT_STATE
+  // The static rules are part of the restored state
+  if (!persistent_state_restored())
+#endif // VIGOR_PERSISTENT_STATE
+  {
 #ifdef NFOS
-  read_static_ft_from_array(mac_tables->st_map, mac_tables->st_vec,
-                            stat_capacity);
+    read_static_ft_from_array(mac_tables->st_map, mac_tables->st_vec,
+                              stat_capacity);
 #else
-  read_static_ft_from_file(mac_tables->st_map, mac_tables->st_vec,
-                           stat_capacity);
+    read_static_ft_from_file(mac_tables->st_map, mac_tables->st_vec,
+                             stat_capacity);
 #endif
+  }
+#ifdef BRIDGE_FAST_TABLES
+  return build_fast_tables(stat_capacity);
+#else  // BRIDGE_FAST_TABLES
   return true;
+#endif // BRIDGE_FAST_TABLES
 }
 
 int nf_process(uint16_t device, uint8_t **buffer, uint16_t packet_length,
@@ -11,13 +11,136 @@
 #include <string.h>
 #include <stdbool.h>
 
+#ifdef LB_BATCHED_CONTROL
+#ifdef KLEE_VERIFICATION
+#error "The batched control path is not verified"
+#endif // KLEE_VERIFICATION
+
+// Minimum time between two maintenance runs, in ns
+#ifndef LB_MAINTENANCE_PERIOD
+#define LB_MAINTENANCE_PERIOD 100000
+#endif
+
+// Maximum number of flows and backends expired or invalidated per run
+#ifndef LB_MAINTENANCE_BUDGET
+#define LB_MAINTENANCE_BUDGET 64
+#endif
+
+// Maximum number of distinct backends whose heartbeats are coalesced
+#ifndef LB_HEARTBEAT_BATCH
+#define LB_HEARTBEAT_BATCH 32
+#endif
+
+struct PendingHeartbeat {
+  uint32_t ip;
+  struct rte_ether_addr mac;
+  int nic;
+  vigor_time_t time;
+};
+#endif // LB_BATCHED_CONTROL
+
 struct LoadBalancer {
   vigor_time_t flow_expiration_time;
 
   vigor_time_t backend_expiration_time;
   struct State *state;
+
+#ifdef LB_BATCHED_CONTROL
+  // Reverse index from backends to the flows pinned to them: circular
+  // doubly-linked lists over flow indices, with one sentinel node per backend
+  // (flow_capacity + backend index) and one for flows of dead backends, which
+  // are invalidated a few at a time (flow_capacity + backend_capacity).
+  int *flow_next;
+  int *flow_prev;
+  int dead_flows;
+
+  // A flow is only valid if it was pinned to the current generation of its
+  // backend, so that flows waiting to be invalidated are never forwarded to a
+  // new backend that reuses the index of a dead one.
+  uint32_t *flow_generation;
+  uint32_t *backend_generation;
+
+  struct PendingHeartbeat heartbeats[LB_HEARTBEAT_BATCH];
+  unsigned heartbeats_count;
+
+  vigor_time_t next_maintenance;
+#endif // LB_BATCHED_CONTROL
 };
 
+#ifdef LB_BATCHED_CONTROL
+static void flow_list_init(struct LoadBalancer *balancer, int sentinel) {
+  balancer->flow_next[sentinel] = sentinel;
+  balancer->flow_prev[sentinel] = sentinel;
+}
+
+static void flow_list_push(struct LoadBalancer *balancer, int sentinel,
+                           int flow_index) {
+  int first = balancer->flow_next[sentinel];
+  balancer->flow_next[flow_index] = first;
+  balancer->flow_prev[flow_index] = sentinel;
+  balancer->flow_prev[first] = flow_index;
+  balancer->flow_next[sentinel] = flow_index;
+}
+
+static void flow_list_unlink(struct LoadBalancer *balancer, int flow_index) {
+  int next = balancer->flow_next[flow_index];
+  int prev = balancer->flow_prev[flow_index];
+  balancer->flow_next[prev] = next;
+  balancer->flow_prev[next] = prev;
+}
+
+// Moves all flows of the list at 'from' to the end of the list at 'to'
+static void flow_list_splice(struct LoadBalancer *balancer, int from, int to) {
+  int first = balancer->flow_next[from];
+  if (first == from) {
+    return;
+  }
+  int last = balancer->flow_prev[from];
+  int tail = balancer->flow_prev[to];
+  balancer->flow_next[tail] = first;
+  balancer->flow_prev[first] = tail;
+  balancer->flow_next[last] = to;
+  balancer->flow_prev[to] = last;
+  flow_list_init(balancer, from);
+}
+
+static int backend_flows(struct LoadBalancer *balancer, uint32_t backend_index) {
+  return (int)(balancer->state->flow_capacity + backend_index);
+}
+
+static bool lb_allocate_reverse_index(struct LoadBalancer *balancer) {
+  uint32_t flow_capacity = balancer->state->flow_capacity;
+  uint32_t backend_capacity = balancer->state->backend_capacity;
+  // Flows, backend sentinels, dead flows sentinel
+  size_t nodes = (size_t)flow_capacity + backend_capacity + 1;
+  balancer->flow_next = calloc(nodes, sizeof(int));
+  balancer->flow_prev = calloc(nodes, sizeof(int));
+  balancer->flow_generation = calloc(flow_capacity, sizeof(uint32_t));
+  balancer->backend_generation = calloc(backend_capacity, sizeof(uint32_t));
+  if (balancer->flow_next == NULL || balancer->flow_prev == NULL ||
+      balancer->flow_generation == NULL ||
+      balancer->backend_generation == NULL) {
+    return false;
+  }
+
+  for (uint32_t b = 0; b < backend_capacity; b++) {
+    flow_list_init(balancer, backend_flows(balancer, b));
+  }
+  balancer->dead_flows = (int)(flow_capacity + backend_capacity);
+  flow_list_init(balancer, balancer->dead_flows);
+  return true;
+}
+
+// Removes a flow from the flow table; it must be in a reverse index list
+static void lb_forget_flow(struct LoadBalancer *balancer, int flow_index) {
+  struct LoadBalancedFlow *flow_key;
+  vector_borrow(balancer->state->flow_heap, flow_index, (void **)&flow_key);
+  map_erase(balancer->state->flow_to_flow_id, flow_key, (void **)&flow_key);
+  vector_return(balancer->state->flow_heap, flow_index, (void *)flow_key);
+  flow_list_unlink(balancer, flow_index);
+}
+#endif // LB_BATCHED_CONTROL
+
 struct LoadBalancer *lb_allocate_balancer(uint32_t flow_capacity,
                                           uint32_t backend_capacity,
                                           uint32_t cht_height,
@@ -31,6 +154,11 @@ struct LoadBalancer *lb_allocate_balancer(uint32_t flow_capacity,
     // Don't free anything, exiting.
     return NULL;
   }
+#ifdef LB_BATCHED_CONTROL
+  if (!lb_allocate_reverse_index(balancer)) {
+    return NULL;
+  }
+#endif // LB_BATCHED_CONTROL
 
   return balancer;
 }
@@ -60,6 +188,12 @@ struct LoadBalancedBackend lb_get_backend(struct LoadBalancer *balancer,
         *vec_flow_id_to_backend_id = backend_index;
         vector_return(balancer->state->flow_id_to_backend_id, flow_index,
                       (void *)vec_flow_id_to_backend_id);
+#ifdef LB_BATCHED_CONTROL
+        balancer->flow_generation[flow_index] =
+            balancer->backend_generation[backend_index];
+        flow_list_push(balancer, backend_flows(balancer, backend_index),
+                       flow_index);
+#endif // LB_BATCHED_CONTROL
         map_put(balancer->state->flow_to_flow_id, vec_flow, flow_index);
         vector_return(balancer->state->flow_heap, flow_index,
                       vec_flow); // another half is in the map
@@ -83,6 +217,14 @@ struct LoadBalancedBackend lb_get_backend(struct LoadBalancer *balancer,
     uint32_t backend_index = *vec_backend_index;
     vector_return(balancer->state->flow_id_to_backend_id, flow_index,
                   (void *)vec_backend_index);
+#ifdef LB_BATCHED_CONTROL
+    if (balancer->flow_generation[flow_index] !=
+        balancer->backend_generation[backend_index]) {
+      lb_forget_flow(balancer, flow_index);
+      dchain_free_index(balancer->state->flow_chain, flow_index);
+      return lb_get_backend(balancer, flow, now, wan_device);
+    } else
+#endif // LB_BATCHED_CONTROL
     if (0 == dchain_is_index_allocated(balancer->state->active_backends,
                                        backend_index)) {
       struct LoadBalancedFlow *flow_key;
@@ -93,6 +235,9 @@ struct LoadBalancedBackend lb_get_backend(struct LoadBalancer *balancer,
       // current impl of symbex models does not support
       // connecting a map with its keystore.
       map_erase(balancer->state->flow_to_flow_id, flow, (void **)&flow_key);
+#ifdef LB_BATCHED_CONTROL
+      flow_list_unlink(balancer, flow_index);
+#endif // LB_BATCHED_CONTROL
 
       dchain_free_index(balancer->state->flow_chain, flow_index);
       vector_return(balancer->state->flow_heap, flow_index, (void *)flow_key);
@@ -112,10 +257,60 @@ struct LoadBalancedBackend lb_get_backend(struct LoadBalancer *balancer,
   return backend;
 }
 
+#ifdef LB_BATCHED_CONTROL
+static void lb_apply_heartbeat(struct LoadBalancer *balancer,
+                               struct LoadBalancedFlow *flow,
+                               struct rte_ether_addr mac_addr, int nic,
+                               vigor_time_t now);
+
+// Heartbeats are only recorded here, the flow table is updated in
+// lb_maintenance; backends send many of them, so they are coalesced.
+void lb_process_heartbit(struct LoadBalancer *balancer,
+                         struct LoadBalancedFlow *flow,
+                         struct rte_ether_addr mac_addr, int nic,
+                         vigor_time_t now) {
+  for (unsigned n = 0; n < balancer->heartbeats_count; n++) {
+    struct PendingHeartbeat *pending = &balancer->heartbeats[n];
+    if (pending->ip == flow->src_ip) {
+      pending->mac = mac_addr;
+      pending->nic = nic;
+      pending->time = now;
+      return;
+    }
+  }
+
+  if (balancer->heartbeats_count == LB_HEARTBEAT_BATCH) {
+    lb_flush_heartbeats(balancer);
+  }
+  struct PendingHeartbeat *pending =
+      &balancer->heartbeats[balancer->heartbeats_count];
+  pending->ip = flow->src_ip;
+  pending->mac = mac_addr;
+  pending->nic = nic;
+  pending->time = now;
+  balancer->heartbeats_count++;
+}
+
+void lb_flush_heartbeats(struct LoadBalancer *balancer) {
+  for (unsigned n = 0; n < balancer->heartbeats_count; n++) {
+    struct PendingHeartbeat *pending = &balancer->heartbeats[n];
+    struct LoadBalancedFlow flow = { .src_ip = pending->ip };
+    lb_apply_heartbeat(balancer, &flow, pending->mac, pending->nic,
+                       pending->time);
+  }
+  balancer->heartbeats_count = 0;
+}
+
+static void lb_apply_heartbeat(struct LoadBalancer *balancer,
+                               struct LoadBalancedFlow *flow,
+                               struct rte_ether_addr mac_addr, int nic,
+                               vigor_time_t now) {
+#else  // LB_BATCHED_CONTROL
 void lb_process_heartbit(struct LoadBalancer *balancer,
                          struct LoadBalancedFlow *flow,
                          struct rte_ether_addr mac_addr, int nic,
                          vigor_time_t now) {
+#endif // LB_BATCHED_CONTROL
   int backend_index;
   if (map_get(balancer->state->ip_to_backend_id, &flow->src_ip,
               &backend_index) == 0) {
@@ -169,3 +364,86 @@ void lb_expire_backends(struct LoadBalancer *balancer, vigor_time_t time) {
                           balancer->state->backend_ips,
                           balancer->state->ip_to_backend_id, last_time);
 }
+
+#ifdef LB_BATCHED_CONTROL
+static vigor_time_t expiration_threshold(vigor_time_t time,
+                                         vigor_time_t expiration_time) {
+  assert(time >= 0); // we don't support the past
+  return (vigor_time_t)((uint64_t)time - expiration_time * 1000); // us to ns
+}
+
+// Expires at most 'budget' flows, returns how many were expired
+static unsigned lb_expire_flows_budget(struct LoadBalancer *balancer,
+                                       vigor_time_t time, unsigned budget) {
+  vigor_time_t last_time =
+      expiration_threshold(time, balancer->flow_expiration_time);
+  unsigned count = 0;
+  int index = -1;
+  while (count < budget &&
+         dchain_expire_one_index(balancer->state->flow_chain, &index,
+                                 last_time)) {
+    lb_forget_flow(balancer, index);
+    count++;
+  }
+  return count;
+}
+
+// Expires at most 'budget' backends, returns how many were expired.
+// Flows pinned to an expired backend become invalid at once thanks to the
+// generations, and are moved to the dead flows to be reclaimed later.
+static unsigned lb_expire_backends_budget(struct LoadBalancer *balancer,
+                                          vigor_time_t time, unsigned budget) {
+  vigor_time_t last_time =
+      expiration_threshold(time, balancer->backend_expiration_time);
+  unsigned count = 0;
+  int index = -1;
+  while (count < budget &&
+         dchain_expire_one_index(balancer->state->active_backends, &index,
+                                 last_time)) {
+    uint32_t *ip;
+    vector_borrow(balancer->state->backend_ips, index, (void **)&ip);
+    map_erase(balancer->state->ip_to_backend_id, ip, (void **)&ip);
+    vector_return(balancer->state->backend_ips, index, (void *)ip);
+
+    balancer->backend_generation[index]++;
+    flow_list_splice(balancer, backend_flows(balancer, index),
+                     balancer->dead_flows);
+    count++;
+  }
+  return count;
+}
+
+// Reclaims at most 'budget' flows of dead backends, returns how many were
+static unsigned lb_reclaim_dead_flows(struct LoadBalancer *balancer,
+                                      unsigned budget) {
+  unsigned count = 0;
+  while (count < budget &&
+         balancer->flow_next[balancer->dead_flows] != balancer->dead_flows) {
+    int flow_index = balancer->flow_next[balancer->dead_flows];
+    lb_forget_flow(balancer, flow_index);
+    dchain_free_index(balancer->state->flow_chain, flow_index);
+    count++;
+  }
+  return count;
+}
+
+void lb_maintenance(struct LoadBalancer *balancer, vigor_time_t now) {
+  if (now < balancer->next_maintenance) {
+    return;
+  }
+
+  // Heartbeats first, so that live backends are not expired
+  lb_flush_heartbeats(balancer);
+
+  unsigned budget = LB_MAINTENANCE_BUDGET;
+  budget -= lb_expire_backends_budget(balancer, now, budget);
+  budget -= lb_reclaim_dead_flows(balancer, budget);
+  budget -= lb_expire_flows_budget(balancer, now, budget);
+
+  // Keep going on the next packet if there is a backlog, e.g. after a backend
+  // with many flows failed
+  if (budget != 0) {
+    balancer->next_maintenance = now + LB_MAINTENANCE_PERIOD;
+  }
+}
+#endif // LB_BATCHED_CONTROL
@@ -27,4 +27,13 @@ void lb_process_heartbit(struct LoadBalancer *balancer,
                          struct LoadBalancedFlow *flow,
                          struct rte_ether_addr mac_addr, int nic, vigor_time_t now);
 
+#ifdef LB_BATCHED_CONTROL
+// Unverified batched control path: heartbeats are coalesced and applied by
+// lb_maintenance, which replaces lb_expire_flows and lb_expire_backends and
+// only does a bounded amount of work every LB_MAINTENANCE_PERIOD.
+// When a backend fails, only the flows pinned to it are invalidated.
+void lb_flush_heartbeats(struct LoadBalancer *balancer);
+void lb_maintenance(struct LoadBalancer *balancer, vigor_time_t now);
+#endif // LB_BATCHED_CONTROL
+
 #endif // _LB_BALANCER_H_INCLUDED_
@@ -19,8 +19,12 @@ bool nf_init(void) {
 
 int nf_process(uint16_t device, uint8_t **buffer, uint16_t packet_length,
                vigor_time_t now, struct rte_mbuf *mbuf) {
+#ifdef LB_BATCHED_CONTROL
+  lb_maintenance(balancer, now);
+#else  // LB_BATCHED_CONTROL
   lb_expire_flows(balancer, now);
   lb_expire_backends(balancer, now);
+#endif // LB_BATCHED_CONTROL
 
   struct rte_ether_hdr *rte_ether_header = nf_then_get_rte_ether_header(buffer);
   uint8_t *ip_options;
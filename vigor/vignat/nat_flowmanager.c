@@ -15,8 +15,33 @@
 struct FlowManager {
   struct State *state;
   uint32_t expiration_time; /*nanoseconds*/
+#ifdef VIGOR_MULTICORE
+  const uint16_t *ports;
+  const int32_t *port_indices;
+#endif // VIGOR_MULTICORE
 };
 
+static uint16_t index_to_port(struct FlowManager *manager, int index) {
+#ifdef VIGOR_MULTICORE
+  return manager->ports[index];
+#else  // VIGOR_MULTICORE
+  return manager->state->start_port + index;
+#endif // VIGOR_MULTICORE
+}
+
+static bool port_to_index(struct FlowManager *manager, uint16_t port,
+                          int *index) {
+#ifdef VIGOR_MULTICORE
+  // Ports owned by other lcores are as unknown as unallocated ones
+  *index = manager->port_indices[port];
+  return *index >= 0 && *index < manager->state->max_flows &&
+         manager->ports[*index] == port;
+#else  // VIGOR_MULTICORE
+  *index = port - manager->state->start_port;
+  return true;
+#endif // VIGOR_MULTICORE
+}
+
 struct FlowManager *flow_manager_allocate(uint16_t starting_port,
                                           uint32_t nat_ip, uint16_t nat_device,
                                           uint32_t expiration_time,
@@ -36,6 +61,23 @@ struct FlowManager *flow_manager_allocate(uint16_t starting_port,
   return manager;
 }
 
+#ifdef VIGOR_MULTICORE
+struct FlowManager *flow_manager_allocate_ports(
+    const uint16_t *ports, const int32_t *port_indices, uint32_t nat_ip,
+    uint16_t nat_device, uint32_t expiration_time, uint64_t max_flows) {
+  struct FlowManager *manager = flow_manager_allocate(
+      0, nat_ip, nat_device, expiration_time, max_flows);
+  if (manager == NULL) {
+    return NULL;
+  }
+
+  manager->ports = ports;
+  manager->port_indices = port_indices;
+
+  return manager;
+}
+#endif // VIGOR_MULTICORE
+
 bool flow_manager_allocate_flow(struct FlowManager *manager, struct FlowId *id,
                                 uint16_t internal_device, vigor_time_t time,
                                 uint16_t *external_port) {
@@ -44,7 +86,7 @@ bool flow_manager_allocate_flow(struct FlowManager *manager, struct FlowId *id,
     return false;
   }
 
-  *external_port = manager->state->start_port + index;
+  *external_port = index_to_port(manager, index);
 
   struct FlowId *key = 0;
   vector_borrow(manager->state->fv, index, (void **)&key);
@@ -70,7 +112,7 @@ bool flow_manager_get_internal(struct FlowManager *manager, struct FlowId *id,
   if (map_get(manager->state->fm, id, &index) == 0) {
     return false;
   }
-  *external_port = index + manager->state->start_port;
+  *external_port = index_to_port(manager, index);
   dchain_rejuvenate_index(manager->state->heap, index, time);
   return true;
 }
@@ -78,7 +120,10 @@ bool flow_manager_get_internal(struct FlowManager *manager, struct FlowId *id,
 bool flow_manager_get_external(struct FlowManager *manager,
                                uint16_t external_port, vigor_time_t time,
                                struct FlowId *out_flow) {
-  int index = external_port - manager->state->start_port;
+  int index;
+  if (!port_to_index(manager, external_port, &index)) {
+    return false;
+  }
   if (dchain_is_index_allocated(manager->state->heap, index) == 0) {
     return false;
   }
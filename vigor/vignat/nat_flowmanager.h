@@ -17,6 +17,15 @@ flow_manager_allocate(uint16_t starting_port, uint32_t nat_ip,
                                               router + "only NAT" */
                       uint32_t expiration_time, uint64_t max_flows);
 
+#ifdef VIGOR_MULTICORE
+// Same as flow_manager_allocate, but the external port of flow index i is
+// ports[i] instead of starting_port + i, and port_indices is the reverse
+// mapping, see nat_rss.h
+struct FlowManager *flow_manager_allocate_ports(
+    const uint16_t *ports, const int32_t *port_indices, uint32_t nat_ip,
+    uint16_t nat_device, uint32_t expiration_time, uint64_t max_flows);
+#endif // VIGOR_MULTICORE
+
 bool flow_manager_allocate_flow(struct FlowManager *manager, struct FlowId *id,
                                 uint16_t internal_device, vigor_time_t time,
                                 uint16_t *external_port);
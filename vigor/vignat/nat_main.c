@@ -1,20 +1,31 @@
 #include <stdlib.h>
 
+#include <rte_lcore.h>
+
 #include "nf.h"
 #include "flow.h.gen.h"
 #include "nat_flowmanager.h"
 #include "nat_config.h"
+#include "nat_rss.h"
 #include "nf-log.h"
 #include "nf-util.h"
 
 struct nf_config config;
 
-struct FlowManager *flow_manager;
+VIGOR_PER_LCORE struct FlowManager *flow_manager;
 
 bool nf_init(void) {
+#ifdef VIGOR_MULTICORE
+  uint16_t queue = rte_lcore_index(rte_lcore_id());
+  flow_manager = flow_manager_allocate_ports(
+      nat_rss_lcore_ports(queue), nat_rss_port_indices(),
+      config.external_addr, config.wan_device, config.expiration_time,
+      nat_rss_lcore_capacity());
+#else  // VIGOR_MULTICORE
   flow_manager = flow_manager_allocate(
       config.start_port, config.external_addr, config.wan_device,
       config.expiration_time, config.max_flows);
+#endif // VIGOR_MULTICORE
 
   return flow_manager != NULL;
 }
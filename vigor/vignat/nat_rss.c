@@ -0,0 +1,180 @@
+#ifdef VIGOR_MULTICORE
+
+#include "nat_rss.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_thash.h>
+
+#include "nat_config.h"
+#include "nf.h"
+#include "nf-log.h"
+
+#define NAT_PORTS_COUNT 65536
+
+// Toeplitz key for the WAN device, under which the hash of a TCP/UDP IPv4
+// packet only depends on its destination port: all key bits that the source
+// address, destination address and source port are multiplied with are 0.
+// The destination port bits then map to a full-rank triangular matrix over the
+// low hash bits, which spreads the ports evenly over the redirection table.
+// libr3s/examples/nat_port_partition.c finds keys with the same property.
+static uint8_t wan_rss_key[] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x01, 0xff, 0xff, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+  0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d,
+  0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+  0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a
+};
+
+static uint32_t lcore_capacity;
+static uint16_t *lcore_ports[RTE_MAX_LCORE];
+static int32_t port_indices[NAT_PORTS_COUNT];
+
+uint32_t nat_rss_lcore_capacity(void) { return lcore_capacity; }
+
+const uint16_t *nat_rss_lcore_ports(uint16_t queue) {
+  return lcore_ports[queue];
+}
+
+const int32_t *nat_rss_port_indices(void) { return port_indices; }
+
+// Hash the NIC computes for a reply to the given external port,
+// which is stored in network order like in the packet
+static uint32_t wan_hash(uint32_t src_addr, uint16_t src_port,
+                         uint16_t external_port) {
+  struct rte_ipv4_tuple tuple = {
+    .src_addr = rte_be_to_cpu_32(src_addr),
+    .dst_addr = rte_be_to_cpu_32(config.external_addr),
+    .sport = rte_be_to_cpu_16(src_port),
+    .dport = rte_be_to_cpu_16(external_port)
+  };
+  return rte_softrss((uint32_t *)&tuple, RTE_THASH_V4_L4_LEN, wan_rss_key);
+}
+
+static void partition_ports(uint16_t queues, uint16_t *reta,
+                            uint16_t reta_size) {
+  uint32_t ports_count =
+      RTE_MIN(config.max_flows, NAT_PORTS_COUNT - config.start_port);
+
+  // Without a redirection table the NIC can't spread replies among queues,
+  // which a single core can do without: all ports then land in one bucket
+  if (reta_size == 0) {
+    if (queues > 1) {
+      rte_exit(EXIT_FAILURE, "The WAN device has no RSS redirection table, "
+                             "cannot partition ports among %" PRIu16 " cores\n",
+               queues);
+    }
+    reta_size = 1;
+    reta[0] = 0;
+  }
+
+  // Replies must not depend on who sent them, otherwise no partition works
+  for (uint32_t n = 0; n < ports_count; n++) {
+    uint16_t port = (uint16_t)(config.start_port + n);
+    if (wan_hash(0, 0, port) != wan_hash(0xdeadbeef, (uint16_t)(n * 7919), port)) {
+      rte_exit(EXIT_FAILURE, "The WAN RSS key depends on more than the "
+                             "destination port\n");
+    }
+  }
+
+  // Balance the redirection table so that every queue gets as many ports as
+  // possible: greedily give the fullest buckets to the emptiest queues
+  uint32_t bucket_ports[ETH_RSS_RETA_SIZE_512] = { 0 };
+  for (uint32_t n = 0; n < ports_count; n++) {
+    uint16_t port = (uint16_t)(config.start_port + n);
+    bucket_ports[wan_hash(0, 0, port) % reta_size]++;
+  }
+
+  bool bucket_assigned[ETH_RSS_RETA_SIZE_512] = { false };
+  uint32_t queue_ports[RTE_MAX_LCORE] = { 0 };
+  for (uint16_t assigned = 0; assigned < reta_size; assigned++) {
+    uint16_t fullest = 0;
+    while (bucket_assigned[fullest]) {
+      fullest++;
+    }
+    for (uint16_t bucket = fullest + 1; bucket < reta_size; bucket++) {
+      if (!bucket_assigned[bucket] &&
+          bucket_ports[bucket] > bucket_ports[fullest]) {
+        fullest = bucket;
+      }
+    }
+
+    uint16_t emptiest = 0;
+    for (uint16_t queue = 1; queue < queues; queue++) {
+      if (queue_ports[queue] < queue_ports[emptiest]) {
+        emptiest = queue;
+      }
+    }
+
+    reta[fullest] = emptiest;
+    bucket_assigned[fullest] = true;
+    queue_ports[emptiest] += bucket_ports[fullest];
+  }
+
+  // Every lcore gets the same capacity, bounded by the least lucky one
+  lcore_capacity = config.max_flows / queues;
+  for (uint16_t queue = 0; queue < queues; queue++) {
+    lcore_capacity = RTE_MIN(lcore_capacity, queue_ports[queue]);
+  }
+#ifdef CAPACITY_POW2
+  if (lcore_capacity != 0) {
+    lcore_capacity = rte_align32prevpow2(lcore_capacity);
+  }
+#endif // CAPACITY_POW2
+  if (lcore_capacity == 0) {
+    rte_exit(EXIT_FAILURE, "Not enough external ports for %" PRIu16 " cores\n",
+             queues);
+  }
+
+  for (uint16_t queue = 0; queue < queues; queue++) {
+    lcore_ports[queue] = (uint16_t *)calloc(lcore_capacity, sizeof(uint16_t));
+    if (lcore_ports[queue] == NULL) {
+      rte_exit(EXIT_FAILURE, "Out of memory for the port partition\n");
+    }
+    queue_ports[queue] = 0;
+  }
+
+  for (uint32_t port = 0; port < NAT_PORTS_COUNT; port++) {
+    port_indices[port] = -1;
+  }
+  for (uint32_t n = 0; n < ports_count; n++) {
+    uint16_t port = (uint16_t)(config.start_port + n);
+    uint16_t queue = reta[wan_hash(0, 0, port) % reta_size];
+    if (queue_ports[queue] < lcore_capacity) {
+      lcore_ports[queue][queue_ports[queue]] = port;
+      port_indices[port] = queue_ports[queue];
+      queue_ports[queue]++;
+    }
+  }
+
+  NF_INFO("Partitioned external ports among %" PRIu16 " cores, "
+          "%" PRIu32 " flows per core.",
+          queues, lcore_capacity);
+}
+
+void nf_rss_config(uint16_t device, uint16_t queues,
+                   struct rte_eth_rss_conf *rss_conf, uint16_t *reta,
+                   uint16_t reta_size) {
+  struct rte_eth_dev_info dev_info;
+  rte_eth_dev_info_get(device, &dev_info);
+
+  rss_conf->rss_hf = (ETH_RSS_NONFRAG_IPV4_TCP | ETH_RSS_NONFRAG_IPV4_UDP) &
+                     dev_info.flow_type_rss_offloads;
+
+  if (device == config.wan_device) {
+    rss_conf->rss_key = wan_rss_key;
+    rss_conf->rss_key_len =
+        RTE_MIN(dev_info.hash_key_size, sizeof(wan_rss_key));
+    partition_ports(queues, reta, reta_size);
+  } else {
+    // Internal flows may go to any lcore, which then allocates one of its own
+    // external ports; keep the driver's default key
+    rss_conf->rss_key = NULL;
+  }
+}
+
+#endif // VIGOR_MULTICORE
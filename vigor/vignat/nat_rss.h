@@ -0,0 +1,23 @@
+#pragma once
+
+#ifdef VIGOR_MULTICORE
+
+#include <stdint.h>
+
+// Shared-nothing multi-core NAT: every lcore owns a disjoint set of external
+// ports, chosen so that the NIC's RSS brings the replies to a port back to the
+// lcore that allocated it. This is computed by nf_rss_config for the WAN
+// device, which therefore must be called before nf_init.
+
+// Number of flows each lcore can hold, i.e. the number of ports it owns
+uint32_t nat_rss_lcore_capacity(void);
+
+// External ports owned by the lcore polling the given queue,
+// indexed by flow index, nat_rss_lcore_capacity() of them
+const uint16_t *nat_rss_lcore_ports(uint16_t queue);
+
+// Flow index of every external port within the table of the lcore owning it,
+// or -1 if the port is not used
+const int32_t *nat_rss_port_indices(void);
+
+#endif // VIGOR_MULTICORE
@@ -13,6 +13,10 @@
 #include "psd_config.h"
 #include "psd_state.h"
 
+#if defined(PSD_PORT_SETS) && defined(KLEE_VERIFICATION)
+#error "Port sets are not verified"
+#endif
+
 struct nf_config config;
 struct State *state;
 
@@ -39,7 +43,6 @@ void expire_entries(vigor_time_t time) {
 
 int allocate(uint32_t src, uint16_t target_port, vigor_time_t time) {
   int index = -1;
-  int port_index = -1;
 
   int allocated = dchain_allocate_new_index(state->allocator, &index, time);
 
@@ -52,6 +55,17 @@ int allocate(uint32_t src, uint16_t target_port, vigor_time_t time) {
   NF_DEBUG("Allocating %3u.%3u.%3u.%3u", (src >> 0) & 0xff, (src >> 8) & 0xff,
            (src >> 16) & 0xff, (src >> 24) & 0xff);
 
+#ifdef PSD_PORT_SETS
+  uint32_t *src_key = NULL;
+  vector_borrow(state->srcs_key, index, (void **)&src_key);
+  *src_key = src;
+  port_sets_clear(state->port_sets, index);
+  port_sets_add(state->port_sets, index, target_port);
+  map_put(state->srcs, src_key, index);
+  vector_return(state->srcs_key, index, src_key);
+
+  return true;
+#else  // PSD_PORT_SETS
   uint32_t *src_key = NULL;
   uint32_t *counter = NULL;
   struct TouchedPort *touched_port = NULL;
@@ -64,7 +78,7 @@ int allocate(uint32_t src, uint16_t target_port, vigor_time_t time) {
                                       *((int *)counter));
 
   // Now save the source and add the first port.
-  port_index = 0;
+  int port_index = 0;
   vector_borrow(state->ports_key, state->max_ports * index + port_index,
                 (void **)&touched_port);
 
@@ -82,6 +96,7 @@ int allocate(uint32_t src, uint16_t target_port, vigor_time_t time) {
                 touched_port);
 
   return true;
+#endif // PSD_PORT_SETS
 }
 
 // Return true if a port scanning is detected.
@@ -108,6 +123,14 @@ int detect_port_scanning(uint32_t src, uint16_t target_port,
 
   dchain_rejuvenate_index(state->allocator, index, time);
 
+#ifdef PSD_PORT_SETS
+  if (!port_sets_add(state->port_sets, index, target_port)) {
+    NF_DEBUG("Dropping   %3u.%3u.%3u.%3u", (src >> 0) & 0xff, (src >> 8) & 0xff,
+             (src >> 16) & 0xff, (src >> 24) & 0xff);
+    return true;
+  }
+  return false;
+#else  // PSD_PORT_SETS
   uint32_t *counter = NULL;
   vector_borrow(state->touched_ports_counter, index, (void **)&counter);
 
@@ -141,6 +164,7 @@ int detect_port_scanning(uint32_t src, uint16_t target_port,
   vector_return(state->touched_ports_counter, index, counter);
 
   return false;
+#endif // PSD_PORT_SETS
 }
 
 int nf_process(uint16_t device, uint8_t **buffer, uint16_t packet_length,
@@ -43,17 +43,29 @@ struct State *alloc_state(uint32_t capacity, uint64_t max_ports,
     return NULL;
   }
 
+#ifdef PSD_PORT_SETS
+  ret->touched_ports_counter = NULL;
+#else  // PSD_PORT_SETS
   ret->touched_ports_counter = NULL;
   if (vector_allocate(sizeof(struct counter), capacity, counter_allocate,
                       &(ret->touched_ports_counter)) == 0) {
     return NULL;
   }
+#endif // PSD_PORT_SETS
 
   ret->allocator = NULL;
   if (dchain_allocate(capacity, &(ret->allocator)) == 0) {
     return NULL;
   }
 
+#ifdef PSD_PORT_SETS
+  ret->ports = NULL;
+  ret->ports_key = NULL;
+  ret->port_sets = NULL;
+  if (port_sets_allocate(capacity, max_ports, &(ret->port_sets)) == 0) {
+    return NULL;
+  }
+#else  // PSD_PORT_SETS
   if (map_allocate(touched_port_eq, touched_port_hash, capacity * max_ports,
                    &(ret->ports)) == 0) {
     return NULL;
@@ -63,6 +75,7 @@ struct State *alloc_state(uint32_t capacity, uint64_t max_ports,
                       touched_port_allocate, &(ret->ports_key)) == 0) {
     return NULL;
   }
+#endif // PSD_PORT_SETS
 
 #ifdef KLEE_VERIFICATION
   map_set_layout(ret->srcs, ip_addr_descrs,
@@ -3,6 +3,10 @@
 
 #include "psd_loop.h"
 
+#ifdef PSD_PORT_SETS
+#include "libvig/unverified/port-set.h"
+#endif // PSD_PORT_SETS
+
 struct State {
   struct Map *srcs;
   struct Vector *srcs_key;
@@ -12,6 +16,13 @@ struct State {
   struct Map *ports;
   struct Vector *ports_key;
 
+#ifdef PSD_PORT_SETS
+  // Unverified compact replacement for touched_ports_counter, ports and
+  // ports_key, which are then not allocated: the ports touched by the source
+  // at each index.
+  struct PortSets *port_sets;
+#endif // PSD_PORT_SETS
+
   uint32_t capacity;
   uint32_t max_ports;
   uint32_t dev_count;